@@ -1,143 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
-#define MAX_EMAIL_LENGTH 256
-#define MIN_EMAIL_LENGTH 5  // Minimum realistic email: a@b.c
-
-/**
- * Function: is_valid_email
- * Purpose: Validates an email address according to basic RFC standards
- * 
- * Parameters:
- *   email - pointer to the email string to validate
- * 
- * Returns:
- *   true if email is valid, false otherwise
- * 
- * Validation Rules Applied:
- *   1. Must contain exactly one '@' symbol
- *   2. Must have at least one character before '@' (local part)
- *   3. Must have at least one character after '@' (domain part)
- *   4. Domain must contain at least one '.' after the '@'
- *   5. Must end with at least 2 characters after the last '.'
- *   6. No spaces allowed anywhere in the email
- *   7. Local part cannot start or end with '.'
- *   8. Domain part cannot start or end with '.' or '-'
- */
-bool is_valid_email(const char* email) {
-    // Check for NULL pointer - safety first
-    if (email == NULL) {
-        return false;
-    }
-    
-    // Get the length of the email string
-    int len = strlen(email);
-    
-    // Check minimum and maximum length constraints
-    if (len < MIN_EMAIL_LENGTH || len > MAX_EMAIL_LENGTH) {
-        return false;
-    }
-    
-    // Find the position of the '@' symbol
-    // There must be exactly one '@' symbol in a valid email
-    int at_pos = -1;
-    int at_count = 0;
-    
-    for (int i = 0; i < len; i++) {
-        if (email[i] == '@') {
-            at_pos = i;
-            at_count++;
-        }
-        // Check for spaces (not allowed in email addresses)
-        if (isspace(email[i])) {
-            return false;
-        }
-    }
-    
-    // Must have exactly one '@' symbol
-    if (at_count != 1) {
-        return false;
-    }
-    
-    // '@' cannot be at the beginning or end
-    if (at_pos == 0 || at_pos == len - 1) {
-        return false;
-    }
-    
-    // Validate the local part (before '@')
-    // Local part cannot be empty and cannot start/end with '.'
-    if (email[0] == '.' || email[at_pos - 1] == '.') {
-        return false;
-    }
-    
-    // Check for consecutive dots in local part (not allowed)
-    for (int i = 0; i < at_pos - 1; i++) {
-        if (email[i] == '.' && email[i + 1] == '.') {
-            return false;
-        }
-    }
-    
-    // Validate the domain part (after '@')
-    char* domain = (char*)(email + at_pos + 1);
-    int domain_len = len - at_pos - 1;
-    
-    // Domain cannot start or end with '.' or '-'
-    if (domain[0] == '.' || domain[0] == '-' || 
-        domain[domain_len - 1] == '.' || domain[domain_len - 1] == '-') {
-        return false;
-    }
-    
-    // Find the last dot in domain (for TLD validation)
-    int last_dot_pos = -1;
-    int dot_count = 0;
-    
-    for (int i = 0; i < domain_len; i++) {
-        if (domain[i] == '.') {
-            last_dot_pos = i;
-            dot_count++;
-        }
-    }
-    
-    // Domain must have at least one dot (for TLD)
-    if (dot_count == 0) {
-        return false;
-    }
-    
-    // TLD (Top Level Domain) must be at least 2 characters
-    if (domain_len - last_dot_pos - 1 < 2) {
-        return false;
-    }
-    
-    // Check for consecutive dots in domain (not allowed)
-    for (int i = 0; i < domain_len - 1; i++) {
-        if (domain[i] == '.' && domain[i + 1] == '.') {
-            return false;
-        }
-    }
-    
-    // Validate characters in local part
-    // Allow alphanumeric, dots, hyphens, underscores, plus signs
-    for (int i = 0; i < at_pos; i++) {
-        if (!isalnum(email[i]) && email[i] != '.' && 
-            email[i] != '-' && email[i] != '_' && email[i] != '+') {
-            return false;
-        }
-    }
-    
-    // Validate characters in domain part
-    // Allow alphanumeric, dots, and hyphens only
-    for (int i = 0; i < domain_len; i++) {
-        if (!isalnum(domain[i]) && domain[i] != '.' && domain[i] != '-') {
-            return false;
-        }
-    }
-    
-    // If we've made it through all checks, the email is valid
-    return true;
-}
+#include "email_validate.h"
 
 /**
  * Function: get_email_input
@@ -155,6 +28,8 @@ bool is_valid_email(const char* email) {
  *   - Clears input buffer after reading
  *   - Provides user feedback on validation errors
  *   - Allows multiple attempts until valid email is entered
+ *   - Stores the canonical form, domain lowercased (see
+ *     email_normalize()); whitespace is rejected, not stripped
  */
 bool get_email_input(char* email_buffer, int buffer_size) {
     // Safety check for NULL pointer and valid buffer size
@@ -200,43 +75,664 @@ bool get_email_input(char* email_buffer, int buffer_size) {
             continue;
         }
         
-        // Validate the email address
-        if (is_valid_email(input_buffer)) {
-            // Check if the valid email fits in the provided buffer
-            if (input_len >= buffer_size) {
-                printf("Error: Email too long for provided buffer\n");
-                return false;
-            }
-            
-            // Copy the valid email to the output buffer
-            strcpy(email_buffer, input_buffer);
+        // Validate the email address and store its canonical form
+        // (domain lowercased) straight into the caller's buffer
+        email_arena arena;
+        email_normalized result;
+        email_arena_init(&arena, email_buffer, (size_t)buffer_size);
+
+        if (email_normalize(input_buffer, (size_t)input_len, 0, &arena, &result)) {
             printf("✓ Valid email address entered: %s\n", email_buffer);
             return true;
+        } else if (result.reason == EMAIL_VALID) {
+            printf("Error: Email too long for provided buffer\n");
+            return false;
+        } else {
+            // Tell the user which rule failed, and point at the offending
+            // character when there is one
+            printf("✗ Invalid email address: %s\n", email_reason_message(result.reason));
+            if (result.offset < (size_t)input_len) {
+                printf("  %s\n  %*s^\n", input_buffer, (int)result.offset, "");
+            }
+            printf("\n");
+        }
+    }
+}
+
+/*
+ * Non-interactive mode: validate a newline-delimited file or pipe
+ */
+#define CLI_OUTPUT_BUFFER (1 << 20)
+
+typedef struct {
+    bool print_valid;     // print lines that pass (otherwise the ones that fail)
+    bool line_numbers;    // print line numbers instead of the lines
+    bool reasons;         // prefix invalid lines with the reason code
+    bool quiet;           // print nothing but the summary
+    bool profile;         // print the rejection profile after the summary
+    bool metrics;         // print the metrics after the summary
+    bool strict;          // also require a known TLD
+    bool utf8;            // accept internationalized addresses
+    bool rfc;             // RFC 5321 mode (quoted local parts, address literals)
+    bool unique;          // print each address once, at its first line
+    const char* verdicts; // verdict cache file to read and update, may be NULL
+    bool raw;             // flush with write(2), which may find stdout non-blocking
+    size_t used;
+    char buffer[CLI_OUTPUT_BUFFER];
+} cli_output;
+
+// Writes all of p to fd, waiting whenever a non-blocking fd is full
+static void cli_write_fd(int fd, const char* p, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n > 0) {
+            p += n;
+            len -= (size_t)n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+            poll(&pfd, 1, -1);
+        } else if (n < 0 && errno != EINTR) {
+            return;
+        }
+    }
+}
+
+static void cli_flush(cli_output* out) {
+    if (out->raw) {
+        cli_write_fd(STDOUT_FILENO, out->buffer, out->used);
+    } else {
+        fwrite(out->buffer, 1, out->used, stdout);
+    }
+    out->used = 0;
+}
+
+static void cli_write(cli_output* out, const char* p, size_t len) {
+    if (len > CLI_OUTPUT_BUFFER - out->used) {
+        cli_flush(out);
+        if (len > CLI_OUTPUT_BUFFER) {
+            fwrite(p, 1, len, stdout);
+            return;
+        }
+    }
+    memcpy(out->buffer + out->used, p, len);
+    out->used += len;
+}
+
+// The verdict of the selected mode, with the reason of a reject
+static email_reason cli_check(const cli_output* out, const char* line, size_t len,
+                              size_t* offset) {
+    if (out->rfc) {
+        return email_check_rfc(line, len, offset);
+    }
+    if (out->utf8) {
+        return out->strict ? email_check_utf8_strict(line, len, offset)
+                           : email_check_utf8(line, len, offset);
+    }
+    return out->strict ? email_check_strict(line, len, offset) : email_check(line, len, offset);
+}
+
+static int cli_print_line(const char* line, size_t len, uint64_t line_no,
+                          bool valid, void* ctx) {
+    cli_output* out = ctx;
+
+    if (out->quiet || valid != out->print_valid) {
+        return 0;
+    }
+
+    if (out->reasons && !valid) {
+        size_t offset;
+        char prefix[64];
+        email_reason reason = cli_check(out, line, len, &offset);
+        int n = snprintf(prefix, sizeof(prefix), "%s\t%zu\t", email_reason_name(reason), offset);
+        cli_write(out, prefix, (size_t)n);
+    }
+
+    if (out->line_numbers) {
+        char number[24];
+        int n = snprintf(number, sizeof(number), "%llu\n", (unsigned long long)line_no);
+        cli_write(out, number, (size_t)n);
+    } else {
+        cli_write(out, line, len);
+        cli_write(out, "\n", 1);
+    }
+    return 0;
+}
+
+static void cli_usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s                 interactive mode\n"
+            "       %s --file PATH [options]\n"
+            "       %s --listen ADDR [--reactors N] [--strict] [--utf8] [--rfc]\n"
+            "       %s --batch [--strict] [--utf8] [--rfc]\n"
+            "\n"
+            "  -f, --file PATH       validate every line of PATH (\"-\" reads stdin)\n"
+            "      --valid           print the valid lines (default)\n"
+            "      --invalid         print the invalid lines\n"
+            "  -n, --line-numbers    print line numbers instead of lines\n"
+            "  -r, --reasons         with --invalid, prefix each line with the\n"
+            "                        reason code and offset of the bad byte\n"
+            "  -s, --strict          also require a known top-level domain\n"
+            "      --utf8            accept internationalized addresses (UTF-8\n"
+            "                        local parts, IDNA domains)\n"
+            "      --rfc             accept everything RFC 5321 does (quoted local\n"
+            "                        parts, IP address literals); overrides\n"
+            "                        --strict and --utf8\n"
+            "  -u, --unique          print repeated addresses only once (the\n"
+            "                        domain is compared case-insensitively)\n"
+            "      --tld-file PATH   with --strict, read the TLD list from PATH\n"
+            "                        (IANA tlds-alpha-by-domain.txt format)\n"
+            "      --verdict-cache PATH\n"
+            "                        take verdicts from the cache file PATH, and\n"
+            "                        record new ones there (created when missing;\n"
+            "                        processes may share it)\n"
+            "      --pipeline N      validate as a pipeline of threads (read, split,\n"
+            "                        N validators, write) and print how busy each\n"
+            "                        stage was; not with --unique or --verdict-cache\n"
+            "  -q, --quiet           only print the summary\n"
+            "  -p, --profile         print which check rejected how many lines\n"
+            "                        (needs an EMAIL_VALIDATE_PROFILE_REJECTS build)\n"
+            "  -m, --metrics         print the counters and latencies in the\n"
+            "                        Prometheus text format (needs an\n"
+            "                        EMAIL_VALIDATE_METRICS build)\n"
+            "  -l, --listen ADDR     serve the validator on ADDR (host:port, :port\n"
+            "                        or unix:/path): one address per line in,\n"
+            "                        \"OK\" or \"ERR <reason> <offset>\" per line out\n"
+            "      --reactors N      with --listen, event loop threads (default:\n"
+            "                        one per CPU)\n"
+            "  -b, --batch           answer each line of stdin with \"OK\" or\n"
+            "                        \"ERR <reason> <offset>\", as --listen does, as\n"
+            "                        soon as it arrives and without prompts\n"
+            "  -h, --help            show this help\n",
+            prog, prog, prog, prog);
+}
+
+/**
+ * Function: print_reject_profile
+ * Purpose: Prints the rejection counts per precheck stage and per rule
+ */
+static void print_reject_profile(void) {
+    email_reject_profile profile;
+
+    if (!email_reject_profile_snapshot(&profile)) {
+        fprintf(stderr, "Rejection profile not available: "
+                        "rebuild with -DEMAIL_VALIDATE_PROFILE_REJECTS=ON\n");
+        return;
+    }
+
+    fprintf(stderr, "rejected by check:\n");
+    for (int i = EMAIL_STAGE_PASSED + 1; i < EMAIL_STAGE_COUNT; i++) {
+        fprintf(stderr, "  %-20s %llu\n", email_reject_stage_name((email_reject_stage)i),
+                (unsigned long long)profile.by_stage[i]);
+    }
+    fprintf(stderr, "rejected by rule:\n");
+    for (int i = EMAIL_VALID + 1; i < EMAIL_REASON_COUNT; i++) {
+        if (profile.by_reason[i] != 0) {
+            fprintf(stderr, "  %-20s %llu\n", email_reason_name((email_reason)i),
+                    (unsigned long long)profile.by_reason[i]);
+        }
+    }
+}
+
+/**
+ * Function: print_metrics
+ * Purpose: Prints the metrics in the Prometheus text format
+ */
+static void print_metrics(void) {
+    static email_metrics m;
+
+    if (!email_metrics_snapshot(&m)) {
+        fprintf(stderr, "Metrics not available: rebuild with -DEMAIL_VALIDATE_METRICS=ON\n");
+        return;
+    }
+    size_t len = email_metrics_prometheus(&m, NULL, 0);
+    char* text = malloc(len + 1);
+    if (text == NULL) {
+        return;
+    }
+    email_metrics_prometheus(&m, text, len + 1);
+    fputs(text, stderr);
+    free(text);
+}
+
+/**
+ * Function: run_file_mode
+ * Purpose: Validates a file line by line and prints the selected lines
+ *
+ * Returns:
+ *   0 on success, 1 on an I/O error
+ */
+static int run_file_mode(const char* path, cli_output* out) {
+    email_stream_stats stats;
+    email_stream_options opts = { .strict = out->strict, .utf8 = out->utf8,
+                                   .rfc = out->rfc };
+
+    if (out->unique) {
+        opts.dedup = email_dedup_create(0, 0);
+        if (opts.dedup == NULL) {
+            fprintf(stderr, "Error: out of memory\n");
+            return 1;
+        }
+    }
+    if (out->verdicts != NULL) {
+        opts.verdicts = email_verdict_cache_open(out->verdicts, 0);
+        if (opts.verdicts == NULL) {
+            fprintf(stderr, "Error: cannot open verdict cache %s: %s\n", out->verdicts,
+                    strerror(errno));
+            email_dedup_destroy(opts.dedup);
+            return 1;
+        }
+    }
+
+    int rc = validate_email_file_ex(path, &opts, cli_print_line, out, &stats);
+    int saved = errno;
+    email_verdict_cache_stats cached;
+    email_verdict_cache_snapshot(opts.verdicts, &cached);
+    email_verdict_cache_close(opts.verdicts);
+    email_dedup_destroy(opts.dedup);
+    cli_flush(out);
+    fflush(stdout);
+
+    if (rc != 0) {
+        fprintf(stderr, "Error: cannot read %s: %s\n", path, strerror(saved));
+        return 1;
+    }
+
+    fprintf(stderr, "%llu lines, %llu valid, %llu invalid",
+            (unsigned long long)stats.lines, (unsigned long long)stats.valid,
+            (unsigned long long)stats.invalid);
+    if (out->unique) {
+        fprintf(stderr, ", %llu unique, %llu duplicates",
+                (unsigned long long)stats.unique, (unsigned long long)stats.duplicates);
+    }
+    if (out->verdicts != NULL) {
+        fprintf(stderr, ", %llu from the verdict cache", (unsigned long long)cached.hits);
+    }
+    fprintf(stderr, "\n");
+    if (out->profile) {
+        print_reject_profile();
+    }
+    if (out->metrics) {
+        print_metrics();
+    }
+    return 0;
+}
+
+// Write stage of --pipeline: prints the batch as the streaming mode would
+static int cli_print_batch(email_pipe_batch* batch, void* ctx) {
+    for (size_t i = 0; i < batch->count; i++) {
+        bool valid = (batch->valid[i / 8] >> (i % 8)) & 1;
+        cli_print_line(batch->lines[i], batch->lens[i], batch->first_line + i, valid, ctx);
+    }
+    return 0;
+}
+
+/**
+ * Function: run_pipeline_mode
+ * Purpose: Validates a file like run_file_mode(), as a pipeline with
+ *          validators validate threads, and prints what each stage did
+ *
+ * Returns:
+ *   0 on success, 1 on an I/O error
+ */
+static int run_pipeline_mode(const char* path, unsigned validators, cli_output* out) {
+    int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: cannot read %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    email_pipeline_options opts = { .validators = validators, .strict = out->strict,
+                                    .utf8 = out->utf8, .rfc = out->rfc, .domain_cache = true,
+                                    .pin = true, .write = cli_print_batch, .write_ctx = out };
+    email_pipeline_stats stats;
+    email_pipeline* p = email_pipeline_start(fd, &opts);
+    int rc = p != NULL ? email_pipeline_wait(p, &stats) : -1;
+    int saved = errno;
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    cli_flush(out);
+    fflush(stdout);
+
+    if (rc != 0) {
+        fprintf(stderr, "Error: cannot read %s: %s\n", path, strerror(saved));
+        return 1;
+    }
+
+    uint64_t lines = stats.valid + stats.invalid;
+    fprintf(stderr, "%llu lines, %llu valid, %llu invalid\n", (unsigned long long)lines,
+            (unsigned long long)stats.valid, (unsigned long long)stats.invalid);
+    // The bottleneck is the stage that is busy while the others wait on it
+    double elapsed = stats.elapsed_ns > 0 ? (double)stats.elapsed_ns : 1.0;
+    fprintf(stderr, "%-9s %7s %9s %9s %6s %8s %8s %11s\n", "stage", "threads", "batches",
+            "MB/s", "busy", "starved", "blocked", "queue peak");
+    for (int i = 0; i < EMAIL_PIPE_STAGE_COUNT; i++) {
+        const email_pipe_stage_stats* s = &stats.stage[i];
+        double thread_ns = elapsed * (s->threads > 0 ? s->threads : 1);
+        fprintf(stderr, "%-9s %7u %9llu %9.2f %5.1f%% %7.1f%% %7.1f%% %5zu/%zu\n",
+                email_pipeline_stage_name((email_pipe_stage)i), s->threads,
+                (unsigned long long)s->batches, (double)s->bytes * 1e3 / elapsed,
+                100.0 * (double)s->busy_ns / thread_ns, 100.0 * (double)s->starved_ns / thread_ns,
+                100.0 * (double)s->blocked_ns / thread_ns, s->queue_peak, s->queue_capacity);
+    }
+    if (out->profile) {
+        print_reject_profile();
+    }
+    if (out->metrics) {
+        print_metrics();
+    }
+    return 0;
+}
+
+/*
+ * Batch-interactive mode: answers every line of stdin as soon as it has
+ * arrived, but as many answers per write() as there are lines waiting
+ */
+#define CLI_RING_SIZE (1 << 16)   // input ring, a power of two
+
+_Static_assert((CLI_RING_SIZE & (CLI_RING_SIZE - 1)) == 0, "ring size is a power of two");
+_Static_assert(CLI_RING_SIZE > 2 * MAX_EMAIL_LENGTH, "a partial line leaves room to read");
+
+typedef struct {
+    char data[CLI_RING_SIZE];
+    uint64_t head;                  // first byte not yet answered
+    uint64_t tail;                  // end of what was read
+    uint64_t scan;                  // where the search for '\n' resumes
+    bool discarding;                // inside a line too long to answer
+    uint64_t lines;
+    uint64_t valid;
+} cli_ring;
+
+// Appends "OK" or "ERR <reason> <offset>", the --listen protocol, for one line
+static void cli_answer(cli_output* out, cli_ring* ring, email_reason reason, size_t offset) {
+    char reply[64];
+    int n = reason == EMAIL_VALID
+                ? snprintf(reply, sizeof(reply), "OK\n")
+                : snprintf(reply, sizeof(reply), "ERR %s %zu\n", email_reason_name(reason),
+                           offset);
+    cli_write(out, reply, (size_t)n);
+    ring->lines++;
+    ring->valid += reason == EMAIL_VALID;
+}
+
+// Answers a line too long to be kept with the offset cli_check() gives it
+static void cli_answer_too_long(cli_output* out, cli_ring* ring) {
+    cli_answer(out, ring, EMAIL_TOO_LONG, out->rfc ? EMAIL_RFC_MAX_LENGTH : MAX_EMAIL_LENGTH);
+}
+
+// Answers the line from ring->head to end (exclusive); copies it out of
+// the ring first when it wraps around the end
+static void cli_answer_line(cli_output* out, cli_ring* ring, uint64_t end) {
+    char line[MAX_EMAIL_LENGTH + 1];
+    size_t len = (size_t)(end - ring->head);
+
+    // A whole line can arrive in one read however long it is; one too long
+    // to be an address even without its '\r' would not fit in line[]
+    if (len > MAX_EMAIL_LENGTH + 1) {
+        cli_answer_too_long(out, ring);
+        return;
+    }
+    size_t at = (size_t)(ring->head & (CLI_RING_SIZE - 1));
+    const char* p = ring->data + at;
+    if (at + len > CLI_RING_SIZE) {
+        size_t first = CLI_RING_SIZE - at;
+        memcpy(line, p, first);
+        memcpy(line + first, ring->data, len - first);
+        p = line;
+    }
+    if (len > 0 && p[len - 1] == '\r') {
+        len--;
+    }
+    size_t offset;
+    email_reason reason = cli_check(out, p, len, &offset);
+    cli_answer(out, ring, reason, offset);
+}
+
+// Answers every complete line in the ring; at_eof also the last, unterminated one
+static void cli_answer_lines(cli_output* out, cli_ring* ring, bool at_eof) {
+    while (ring->scan < ring->tail) {
+        size_t at = (size_t)(ring->scan & (CLI_RING_SIZE - 1));
+        size_t span = CLI_RING_SIZE - at;
+        if (span > ring->tail - ring->scan) {
+            span = (size_t)(ring->tail - ring->scan);
+        }
+        const char* nl = memchr(ring->data + at, '\n', span);
+        if (nl == NULL) {
+            ring->scan += span;
+            continue;
+        }
+        uint64_t end = ring->scan + (uint64_t)(nl - (ring->data + at));
+        if (ring->discarding) {
+            cli_answer_too_long(out, ring);
+            ring->discarding = false;
         } else {
-            // Provide specific feedback about why the email is invalid
-            printf("✗ Invalid email address. Please check the following:\n");
-            printf("  - Must contain exactly one '@' symbol\n");
-            printf("  - Must have text before and after '@'\n");
-            printf("  - Domain must contain at least one '.' (dot)\n");
-            printf("  - Must end with valid domain extension (at least 2 characters)\n");
-            printf("  - No spaces allowed\n");
-            printf("  - Cannot start or end with '.' or '-'\n");
-            printf("  - Length must be between %d and %d characters\n\n", 
-                   MIN_EMAIL_LENGTH, MAX_EMAIL_LENGTH - 1);
+            cli_answer_line(out, ring, end);
         }
+        ring->head = ring->scan = end + 1;
+    }
+
+    // A partial line can only grow; past the longest address it is dropped
+    // and answered once its end arrives
+    if (ring->tail - ring->head > MAX_EMAIL_LENGTH + 1) {
+        ring->discarding = true;
+        ring->head = ring->tail;
+    }
+    // What follows the dropped part is the end of the same line, not one of its own
+    if (at_eof && ring->discarding) {
+        cli_answer_too_long(out, ring);
+        ring->discarding = false;
+        ring->head = ring->scan = ring->tail;
+    } else if (at_eof && ring->tail > ring->head) {
+        cli_answer_line(out, ring, ring->tail);
+        ring->head = ring->scan = ring->tail;
     }
 }
 
+/**
+ * Function: run_batch_mode
+ * Purpose: Answers each line of stdin with "OK" or "ERR <reason> <offset>"
+ *
+ * stdin is made non-blocking and read with one readv() into whatever
+ * room the input ring has; reading goes on while input is waiting, and
+ * the answers collected so far go out in one write() when it runs dry,
+ * so a pipe is answered in large blocks. A terminal is left blocking, as
+ * its flags are shared with the shell and would outlive a killed process:
+ * it delivers a line per read() anyway, and the answers go out before each.
+ *
+ * Returns:
+ *   0 at the end of the input, 1 on a read error
+ */
+static int run_batch_mode(cli_output* out) {
+    static cli_ring ring;
+    bool tty = isatty(STDIN_FILENO);
+    int flags = tty ? -1 : fcntl(STDIN_FILENO, F_GETFL);
+    if (flags >= 0) {
+        fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+    }
+    out->raw = true;
+
+    int rc = 0;
+    for (;;) {
+        // The free part of the ring, in up to two pieces
+        size_t at = (size_t)(ring.tail & (CLI_RING_SIZE - 1));
+        size_t room = CLI_RING_SIZE - (size_t)(ring.tail - ring.head);
+        struct iovec iov[2] = {
+            { ring.data + at, room < CLI_RING_SIZE - at ? room : CLI_RING_SIZE - at },
+            { ring.data, 0 },
+        };
+        iov[1].iov_len = room - iov[0].iov_len;
+        if (tty) {
+            cli_flush(out);
+        }
+
+        ssize_t n = readv(STDIN_FILENO, iov, iov[1].iov_len > 0 ? 2 : 1);
+        if (n > 0) {
+            ring.tail += (uint64_t)n;
+            cli_answer_lines(out, &ring, false);
+        } else if (n == 0) {
+            cli_answer_lines(out, &ring, true);
+            break;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            cli_flush(out);
+            struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+            poll(&pfd, 1, -1);
+        } else if (errno != EINTR) {
+            fprintf(stderr, "Error: cannot read stdin: %s\n", strerror(errno));
+            rc = 1;
+            break;
+        }
+    }
+    cli_flush(out);
+
+    if (flags >= 0) {
+        fcntl(STDIN_FILENO, F_SETFL, flags);
+    }
+    if (rc == 0 && !out->quiet) {
+        fprintf(stderr, "%llu lines, %llu valid, %llu invalid\n",
+                (unsigned long long)ring.lines, (unsigned long long)ring.valid,
+                (unsigned long long)(ring.lines - ring.valid));
+    }
+    return rc;
+}
+
+/**
+ * Function: run_server_mode
+ * Purpose: Serves the validator on addr until SIGINT or SIGTERM
+ *
+ * Returns:
+ *   0 after a signal, 1 when the server cannot be started
+ */
+static int run_server_mode(const char* addr, unsigned reactors, const cli_output* out) {
+    // Blocked before the reactors start, so they inherit the mask and the
+    // signals wait for sigwait() below
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    email_server_options opts = { .listen = addr, .reactors = reactors, .strict = out->strict,
+                                  .utf8 = out->utf8, .rfc = out->rfc, .pin = reactors == 0 };
+    email_server* server = email_server_start(&opts);
+    if (server == NULL) {
+        fprintf(stderr, "Error: cannot listen on %s: %s\n", addr, strerror(errno));
+        return 1;
+    }
+
+    email_server_stats stats;
+    email_server_snapshot(server, &stats);
+    if (email_server_port(server) != 0) {
+        fprintf(stderr, "listening on port %u, %u reactors\n", email_server_port(server),
+                stats.reactors);
+    } else {
+        fprintf(stderr, "listening on %s, %u reactors\n", addr, stats.reactors);
+    }
+
+    int sig;
+    sigwait(&signals, &sig);
+    email_server_snapshot(server, &stats);
+    email_server_stop(server);
+
+    fprintf(stderr, "%llu connections, %llu requests, %llu valid, %llu invalid\n",
+            (unsigned long long)stats.connections, (unsigned long long)stats.requests,
+            (unsigned long long)stats.valid, (unsigned long long)stats.invalid);
+    return 0;
+}
+
 /**
  * Function: main
  * Purpose: Demonstrates the email validation functionality
  * 
  * This example function shows how to use the email input and validation
- * functions in a complete program.
+ * functions in a complete program. With --file it validates a whole file
+ * or pipe instead of prompting, with --listen it runs as a validation
+ * service, and with --batch it answers stdin line by line without prompts
+ * (see cli_usage()).
  */
-int main() {
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        static cli_output out = { .print_valid = true };
+        const char* path = NULL;
+        const char* tld_file = NULL;
+        const char* listen_addr = NULL;
+        unsigned reactors = 0;
+        unsigned validators = 0;   // --pipeline
+        bool batch = false;
+
+        for (int i = 1; i < argc; i++) {
+            if ((strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--file") == 0) && i + 1 < argc) {
+                path = argv[++i];
+            } else if (strcmp(argv[i], "--valid") == 0) {
+                out.print_valid = true;
+            } else if (strcmp(argv[i], "--invalid") == 0) {
+                out.print_valid = false;
+            } else if (strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--line-numbers") == 0) {
+                out.line_numbers = true;
+            } else if (strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--reasons") == 0) {
+                out.reasons = true;
+            } else if (strcmp(argv[i], "-q") == 0 || strcmp(argv[i], "--quiet") == 0) {
+                out.quiet = true;
+            } else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--strict") == 0) {
+                out.strict = true;
+            } else if (strcmp(argv[i], "--utf8") == 0) {
+                out.utf8 = true;
+            } else if (strcmp(argv[i], "--rfc") == 0) {
+                out.rfc = true;
+            } else if (strcmp(argv[i], "-u") == 0 || strcmp(argv[i], "--unique") == 0) {
+                out.unique = true;
+            } else if (strcmp(argv[i], "--tld-file") == 0 && i + 1 < argc) {
+                tld_file = argv[++i];
+            } else if (strcmp(argv[i], "--verdict-cache") == 0 && i + 1 < argc) {
+                out.verdicts = argv[++i];
+            } else if (strcmp(argv[i], "--pipeline") == 0 && i + 1 < argc) {
+                validators = (unsigned)strtoul(argv[++i], NULL, 10);
+                validators = validators != 0 ? validators : 1;
+            } else if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--profile") == 0) {
+                out.profile = true;
+            } else if (strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--metrics") == 0) {
+                out.metrics = true;
+            } else if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--batch") == 0) {
+                batch = true;
+            } else if ((strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--listen") == 0) &&
+                       i + 1 < argc) {
+                listen_addr = argv[++i];
+            } else if (strcmp(argv[i], "--reactors") == 0 && i + 1 < argc) {
+                reactors = (unsigned)strtoul(argv[++i], NULL, 10);
+            } else {
+                cli_usage(argv[0]);
+                return strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0 ? 0 : 2;
+            }
+        }
+
+        if ((path != NULL) + (listen_addr != NULL) + batch != 1 ||
+            (validators != 0 && (path == NULL || out.unique || out.verdicts != NULL))) {
+            cli_usage(argv[0]);
+            return 2;
+        }
+        if (tld_file != NULL && email_tld_load_file(tld_file) != 0) {
+            fprintf(stderr, "Error: cannot load TLD list %s: %s\n", tld_file, strerror(errno));
+            return 1;
+        }
+        if (listen_addr != NULL) {
+            return run_server_mode(listen_addr, reactors, &out);
+        }
+        if (batch) {
+            return run_batch_mode(&out);
+        }
+        if (validators != 0) {
+            return run_pipeline_mode(path, validators, &out);
+        }
+        return run_file_mode(path, &out);
+    }
+
     // Buffer to store the validated email address
     char user_email[MAX_EMAIL_LENGTH];
+
+    // Fully buffered even on a terminal: the prompt's fflush() then writes
+    // the previous answer and the prompt as one write() instead of one
+    // per line
+    static char stdout_buffer[BUFSIZ];
+    setvbuf(stdout, stdout_buffer, _IOFBF, sizeof(stdout_buffer));
     
     printf("=== Email Address Validation Program ===\n");
     printf("This program will validate your email address format.\n\n");
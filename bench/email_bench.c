@@ -0,0 +1,714 @@
+/*
+ * Microbenchmark for the email validators
+ *
+ * Generates several synthetic corpora and runs every validator over each
+ * of them, reporting nanoseconds per address, addresses per second and
+ * input bytes per second. No dependencies beyond libc and pthreads.
+ *
+ * Build: the email_bench target of the CMake build
+ *
+ * Usage:
+ *   email_bench [--count N] [--min-time SECONDS] [--repeat N]
+ *               [--corpus NAME] [--engine NAME] [--csv]
+ *               [--baseline FILE [--max-regression PERCENT]]
+ *
+ * With --baseline every result is compared with the one for the same
+ * corpus and engine in FILE, the --csv output of an earlier run with the
+ * same --count. The exit status is 1 when an engine got slower by more
+ * than PERCENT (default 10) in addresses/s or gave a different number of
+ * valid addresses. A result that falls short is measured up to
+ * BASELINE_RETRIES more times first and the best one counts. The
+ * perf-gate target of the CMake build runs this against
+ * bench/baseline.csv.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "email_validate.h"
+#include "email_arrow.h"
+
+#define DEFAULT_COUNT 100000
+#define DEFAULT_MIN_TIME 0.2   // seconds per measurement
+#define DEFAULT_REPEAT 5       // measurements per result, best one is kept
+#define DEFAULT_MAX_REGRESSION 10.0   // percent, for --baseline
+#define BASELINE_RETRIES 3     // extra measurements before a regression counts
+
+/*
+ * A corpus is stored three ways so that every engine can read it in its
+ * native form: NUL-terminated strings for is_valid_email() and the
+ * reference, pointer/length pairs, and one blob with Arrow-style offsets.
+ */
+typedef struct {
+    const char* name;
+    size_t count;
+    size_t bytes;          // total address bytes, terminators excluded
+    char* blob;            // addresses back to back, each followed by '\0'
+    const char** ptrs;
+    size_t* lens;
+    int32_t* offsets;      // count + 1 offsets into packed
+    char* packed;          // addresses back to back, no terminators
+} corpus;
+
+/* ---- Deterministic generator ------------------------------------------ */
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static uint64_t rng_next(void) {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+static size_t rng_range(size_t lo, size_t hi) {
+    return lo + (size_t)(rng_next() % (hi - lo + 1));
+}
+
+static const char ALNUM[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+
+static const char* const FIRST_NAMES[] = {
+    "john", "mary", "wei", "olga", "raj", "ana", "mohammed", "li", "sophie", "kenji"
+};
+static const char* const LAST_NAMES[] = {
+    "smith", "garcia", "chen", "ivanova", "patel", "silva", "ali", "wang", "martin", "sato"
+};
+static const char* const DOMAINS[] = {
+    "gmail.com", "outlook.com", "yahoo.com", "hotmail.com", "icloud.com",
+    "mail.ru", "qq.com", "web.de", "example.co.uk", "corp-mail.example.org"
+};
+
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+static size_t put_str(char* out, const char* s) {
+    size_t n = strlen(s);
+    memcpy(out, s, n);
+    return n;
+}
+
+static size_t put_alnum(char* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = ALNUM[rng_next() % (sizeof(ALNUM) - 1)];
+    }
+    return n;
+}
+
+// Short valid: "ab12@xy.com" style, 10-25 bytes
+static size_t gen_short_valid(char* out) {
+    size_t n = put_alnum(out, rng_range(2, 8));
+    out[n++] = '@';
+    n += put_alnum(out + n, rng_range(2, 8));
+    out[n++] = '.';
+    n += put_alnum(out + n, rng_range(2, 3));
+    return n;
+}
+
+// Long valid, close to MAX_EMAIL_LENGTH: long local part, many labels
+static size_t gen_long_valid(char* out) {
+    size_t target = rng_range(MAX_EMAIL_LENGTH - 16, MAX_EMAIL_LENGTH);
+    size_t n = put_alnum(out, 20);
+    out[n++] = '.';
+    n += put_alnum(out + n, 20);
+    out[n++] = '+';
+    n += put_alnum(out + n, 20);
+    out[n++] = '@';
+    while (n + 16 < target) {
+        n += put_alnum(out + n, 10);
+        out[n++] = rng_next() % 4 == 0 ? '-' : '.';
+        n += put_alnum(out + n, 1);
+    }
+    out[n++] = '.';
+    n += put_alnum(out + n, target - n);
+    return n;
+}
+
+// Early reject: junk that fails within the first few bytes
+static size_t gen_early_reject(char* out) {
+    static const char* const prefixes[] = { ".", " ", "@", "\t", "\"", "<", "(" };
+    size_t n = put_str(out, prefixes[rng_next() % COUNT_OF(prefixes)]);
+    n += put_alnum(out + n, rng_range(8, 30));
+    if (rng_next() % 2) {
+        n += put_str(out + n, "@example.com");
+    }
+    return n;
+}
+
+// Late reject: looks fine until a one-character TLD at the very end
+static size_t gen_late_reject(char* out) {
+    size_t n = put_str(out, FIRST_NAMES[rng_next() % COUNT_OF(FIRST_NAMES)]);
+    out[n++] = '.';
+    n += put_str(out + n, LAST_NAMES[rng_next() % COUNT_OF(LAST_NAMES)]);
+    out[n++] = '@';
+    n += put_alnum(out + n, rng_range(6, 20));
+    out[n++] = '.';
+    n += put_alnum(out + n, 1);
+    return n;
+}
+
+// Realistic valid address: first.last+tag@provider
+static size_t gen_real_valid(char* out) {
+    size_t n = put_str(out, FIRST_NAMES[rng_next() % COUNT_OF(FIRST_NAMES)]);
+    switch (rng_next() % 4) {
+    case 0:
+        out[n++] = '.';
+        n += put_str(out + n, LAST_NAMES[rng_next() % COUNT_OF(LAST_NAMES)]);
+        break;
+    case 1:
+        out[n++] = '_';
+        n += put_alnum(out + n, rng_range(2, 4));
+        break;
+    case 2:
+        n += put_alnum(out + n, rng_range(1, 4));
+        break;
+    default:
+        out[n++] = '+';
+        n += put_str(out + n, "news");
+        break;
+    }
+    out[n++] = '@';
+    n += put_str(out + n, DOMAINS[rng_next() % COUNT_OF(DOMAINS)]);
+    return n;
+}
+
+// Mixed: mostly realistic valid addresses with a tail of everything else
+static size_t gen_mixed(char* out) {
+    unsigned r = (unsigned)(rng_next() % 100);
+    if (r < 70) {
+        return gen_real_valid(out);
+    } else if (r < 80) {
+        return gen_late_reject(out);
+    } else if (r < 90) {
+        return gen_early_reject(out);
+    } else if (r < 95) {
+        return gen_short_valid(out);
+    }
+    return gen_long_valid(out);
+}
+
+static void corpus_build(corpus* c, const char* name, size_t count,
+                         size_t (*gen)(char* out)) {
+    char tmp[MAX_EMAIL_LENGTH * 2];
+    size_t cap = count * 32;
+
+    c->name = name;
+    c->count = count;
+    c->bytes = 0;
+    c->blob = malloc(cap);
+    c->packed = malloc(cap);
+    c->ptrs = malloc(count * sizeof(*c->ptrs));
+    c->lens = malloc(count * sizeof(*c->lens));
+    c->offsets = malloc((count + 1) * sizeof(*c->offsets));
+
+    // The blob can move while it grows, so remember offsets and fix up
+    // the pointers at the end
+    size_t* starts = malloc(count * sizeof(*starts));
+    size_t used = 0;       // bytes in packed
+    size_t blob_used = 0;  // bytes in blob, terminators included
+    c->offsets[0] = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t n = gen(tmp);
+        if (blob_used + n + 1 > cap) {
+            cap = cap * 2 + n + 1;
+            c->blob = realloc(c->blob, cap);
+            c->packed = realloc(c->packed, cap);
+        }
+        memcpy(c->blob + blob_used, tmp, n);
+        c->blob[blob_used + n] = '\0';
+        memcpy(c->packed + used, tmp, n);
+        starts[i] = blob_used;
+        c->lens[i] = n;
+        blob_used += n + 1;
+        used += n;
+        c->offsets[i + 1] = (int32_t)used;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        c->ptrs[i] = c->blob + starts[i];
+    }
+    c->bytes = used;
+    free(starts);
+}
+
+static void corpus_free(corpus* c) {
+    free(c->blob);
+    free(c->packed);
+    free(c->ptrs);
+    free(c->lens);
+    free(c->offsets);
+}
+
+/* ---- Engines ------------------------------------------------------------ */
+
+// Each engine validates the whole corpus once and returns the valid count
+typedef size_t (*engine_fn)(const corpus* c, uint8_t* bitmap);
+
+static size_t run_reference(const corpus* c, uint8_t* bitmap) {
+    (void)bitmap;
+    size_t valid = 0;
+    for (size_t i = 0; i < c->count; i++) {
+        valid += is_valid_email_reference(c->ptrs[i]);
+    }
+    return valid;
+}
+
+static size_t run_nul_terminated(const corpus* c, uint8_t* bitmap) {
+    (void)bitmap;
+    size_t valid = 0;
+    for (size_t i = 0; i < c->count; i++) {
+        valid += is_valid_email(c->ptrs[i]);
+    }
+    return valid;
+}
+
+static size_t run_length_aware(const corpus* c, uint8_t* bitmap) {
+    (void)bitmap;
+    size_t valid = 0;
+    for (size_t i = 0; i < c->count; i++) {
+        valid += is_valid_email_n(c->ptrs[i], c->lens[i]);
+    }
+    return valid;
+}
+
+static size_t run_check(const corpus* c, uint8_t* bitmap) {
+    (void)bitmap;
+    size_t valid = 0;
+    for (size_t i = 0; i < c->count; i++) {
+        size_t offset;
+        valid += email_check(c->ptrs[i], c->lens[i], &offset) == EMAIL_VALID;
+    }
+    return valid;
+}
+
+static size_t run_simd(const corpus* c, uint8_t* bitmap) {
+    (void)bitmap;
+    size_t valid = 0;
+    for (size_t i = 0; i < c->count; i++) {
+        valid += is_valid_email_simd(c->ptrs[i], c->lens[i]);
+    }
+    return valid;
+}
+
+// The ASCII corpora take the fast path: one email_is_ascii() pass, then
+// the SIMD kernel
+static size_t run_utf8(const corpus* c, uint8_t* bitmap) {
+    (void)bitmap;
+    size_t valid = 0;
+    for (size_t i = 0; i < c->count; i++) {
+        valid += is_valid_email_utf8(c->ptrs[i], c->lens[i]);
+    }
+    return valid;
+}
+
+// One DFA transition per byte, whatever the byte
+static size_t run_rfc(const corpus* c, uint8_t* bitmap) {
+    (void)bitmap;
+    size_t valid = 0;
+    for (size_t i = 0; i < c->count; i++) {
+        valid += is_valid_email_rfc(c->ptrs[i], c->lens[i]);
+    }
+    return valid;
+}
+
+static size_t run_strict(const corpus* c, uint8_t* bitmap) {
+    (void)bitmap;
+    size_t valid = 0;
+    for (size_t i = 0; i < c->count; i++) {
+        valid += is_valid_email_strict(c->ptrs[i], c->lens[i]);
+    }
+    return valid;
+}
+
+// One domain cache for the whole run; after the first pass it is warm
+static email_domain_cache* bench_cache(void) {
+    static email_domain_cache* cache;
+    if (cache == NULL) {
+        cache = email_domain_cache_create();
+        if (cache == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    return cache;
+}
+
+static size_t run_cached(const corpus* c, uint8_t* bitmap) {
+    (void)bitmap;
+    email_domain_cache* cache = bench_cache();
+    size_t valid = 0;
+    for (size_t i = 0; i < c->count; i++) {
+        valid += is_valid_email_cached(cache, c->ptrs[i], c->lens[i]);
+    }
+    return valid;
+}
+
+static size_t run_batch(const corpus* c, uint8_t* bitmap) {
+    return validate_emails_batch(c->ptrs, c->lens, c->count, bitmap);
+}
+
+static size_t run_batch_offsets(const corpus* c, uint8_t* bitmap) {
+    return validate_emails_batch_offsets(c->packed, c->offsets, c->count, bitmap);
+}
+
+static size_t run_batch_cached(const corpus* c, uint8_t* bitmap) {
+    return validate_emails_batch_cached(c->ptrs, c->lens, c->count, bitmap, bench_cache());
+}
+
+// The canonical forms of the whole corpus, into one arena reused per pass
+static size_t run_normalize(const corpus* c, uint8_t* bitmap) {
+    static char* buf;
+    static const char** outs;
+    static size_t* out_lens;
+    static size_t cap;
+    (void)bitmap;
+
+    if (cap < c->bytes + c->count) {
+        free(buf);
+        free(outs);
+        free(out_lens);
+        cap = c->bytes + c->count;
+        buf = malloc(cap);
+        outs = malloc(c->count * sizeof(*outs));
+        out_lens = malloc(c->count * sizeof(*out_lens));
+        if (buf == NULL || outs == NULL || out_lens == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+
+    email_arena arena;
+    email_arena_init(&arena, buf, cap);
+    normalize_emails_batch(c->ptrs, c->lens, c->count, 0, &arena, outs, out_lens);
+
+    size_t valid = 0;
+    for (size_t i = 0; i < c->count; i++) {
+        valid += outs[i] != NULL;
+    }
+    return valid;
+}
+
+static void bench_release(struct ArrowArray* array) {
+    array->release = NULL;
+}
+
+// The corpus as an Arrow utf8 column, results as Arrow arrays
+static size_t run_arrow(const corpus* c, uint8_t* bitmap) {
+    const void* buffers[3] = { NULL, c->offsets, c->packed };
+    struct ArrowArray column = { .length = (int64_t)c->count, .n_buffers = 3,
+                                 .buffers = buffers, .release = bench_release };
+    struct ArrowSchema schema = { .format = "u" };
+    struct ArrowArray out;
+    (void)bitmap;
+
+    if (email_arrow_validate(&schema, &column, NULL, &out, NULL) != 0) {
+        fprintf(stderr, "email_arrow_validate failed\n");
+        exit(1);
+    }
+    const uint8_t* bits = out.children[0]->buffers[1];
+    size_t valid = 0;
+    for (size_t k = 0; k < c->count / 8; k++) {
+        valid += (size_t)__builtin_popcount(bits[k]);
+    }
+    if (c->count % 8 != 0) {
+        valid += (size_t)__builtin_popcount(bits[c->count / 8] & ((1u << (c->count % 8)) - 1));
+    }
+    out.release(&out);
+    return valid;
+}
+
+static size_t run_parallel(const corpus* c, uint8_t* bitmap) {
+    return validate_emails_parallel(c->ptrs, c->lens, c->count, bitmap, NULL, NULL);
+}
+
+typedef struct {
+    const char* name;
+    engine_fn run;
+} engine;
+
+static const engine ENGINES[] = {
+    { "reference",      run_reference },
+    { "is_valid_email", run_nul_terminated },
+    { "n",              run_length_aware },
+    { "check",          run_check },
+    { "simd",           run_simd },
+    { "utf8",           run_utf8 },
+    { "rfc",            run_rfc },
+    { "strict",         run_strict },
+    { "cached",         run_cached },
+    { "batch",          run_batch },
+    { "batch_cached",   run_batch_cached },
+    { "batch_offsets",  run_batch_offsets },
+    { "arrow",          run_arrow },
+    { "normalize",      run_normalize },
+    { "parallel",       run_parallel },
+};
+
+typedef struct {
+    const char* name;
+    size_t (*gen)(char* out);
+} corpus_spec;
+
+static const corpus_spec CORPORA[] = {
+    { "short_valid",  gen_short_valid },
+    { "long_valid",   gen_long_valid },
+    { "early_reject", gen_early_reject },
+    { "late_reject",  gen_late_reject },
+    { "real_valid",   gen_real_valid },
+    { "mixed",        gen_mixed },
+};
+
+/* ---- Measurement -------------------------------------------------------- */
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static volatile size_t sink;  // keeps the results alive
+
+/**
+ * Function: measure
+ * Purpose: Returns the best time for one pass of engine e over corpus c
+ *
+ * Each measurement runs as many passes as fit in min_time; the fastest
+ * of repeat measurements is reported, which filters out most noise from
+ * other processes.
+ */
+static double measure(const engine* e, const corpus* c, uint8_t* bitmap,
+                      double min_time, int repeat) {
+    double best = 1e300;
+
+    sink += e->run(c, bitmap);  // warm caches and branch predictors
+
+    for (int r = 0; r < repeat; r++) {
+        size_t passes = 0;
+        double start = now_seconds();
+        double elapsed;
+        do {
+            sink += e->run(c, bitmap);
+            passes++;
+            elapsed = now_seconds() - start;
+        } while (elapsed < min_time);
+
+        double per_pass = elapsed / (double)passes;
+        if (per_pass < best) {
+            best = per_pass;
+        }
+    }
+    return best;
+}
+
+/* ---- Baseline ----------------------------------------------------------- */
+
+typedef struct {
+    char corpus[32];
+    char engine[32];
+    double per_s;
+    size_t valid;
+    bool seen;             // measured in this run
+} baseline_entry;
+
+typedef struct {
+    baseline_entry* entries;
+    size_t count;
+} baseline;
+
+/**
+ * Function: baseline_load
+ * Purpose: Reads the rows of a --csv run from path
+ *
+ * Returns:
+ *   0 on success, -1 when the file cannot be read or is not --csv output
+ */
+static int baseline_load(baseline* b, const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+
+    char line[256];
+    size_t cap = 0;
+    b->entries = NULL;
+    b->count = 0;
+    bool header = true;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (header) {
+            header = false;
+            if (strncmp(line, "corpus,engine,", 14) != 0) {
+                break;
+            }
+            continue;
+        }
+        if (b->count == cap) {
+            cap = cap == 0 ? 64 : cap * 2;
+            baseline_entry* grown = realloc(b->entries, cap * sizeof(*grown));
+            if (grown == NULL) {
+                break;
+            }
+            b->entries = grown;
+        }
+        baseline_entry* e = &b->entries[b->count];
+        double ns, gbs;
+        if (sscanf(line, "%31[^,],%31[^,],%lf,%lf,%lf,%zu", e->corpus, e->engine, &ns,
+                   &e->per_s, &gbs, &e->valid) == 6) {
+            e->seen = false;
+            b->count++;
+        }
+    }
+    fclose(f);
+    if (b->count == 0) {
+        free(b->entries);
+        return -1;
+    }
+    return 0;
+}
+
+static baseline_entry* baseline_find(const baseline* b, const char* corpus, const char* engine) {
+    for (size_t i = 0; i < b->count; i++) {
+        if (strcmp(b->entries[i].corpus, corpus) == 0 && strcmp(b->entries[i].engine, engine) == 0) {
+            return &b->entries[i];
+        }
+    }
+    return NULL;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [--count N] [--min-time SECONDS] [--repeat N]\n"
+            "          [--corpus NAME] [--engine NAME] [--csv]\n"
+            "          [--baseline FILE [--max-regression PERCENT]]\n",
+            prog);
+}
+
+int main(int argc, char** argv) {
+    size_t count = DEFAULT_COUNT;
+    double min_time = DEFAULT_MIN_TIME;
+    int repeat = DEFAULT_REPEAT;
+    const char* only_corpus = NULL;
+    const char* only_engine = NULL;
+    const char* baseline_path = NULL;
+    double max_regression = DEFAULT_MAX_REGRESSION;
+    bool csv = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            count = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            min_time = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc) {
+            only_corpus = argv[++i];
+        } else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            only_engine = argv[++i];
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            csv = true;
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "--max-regression") == 0 && i + 1 < argc) {
+            max_regression = strtod(argv[++i], NULL);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (count == 0 || repeat <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    baseline base = { NULL, 0 };
+    if (baseline_path != NULL && baseline_load(&base, baseline_path) != 0) {
+        fprintf(stderr, "Error: cannot read a baseline from %s\n", baseline_path);
+        return 2;
+    }
+    size_t regressions = 0;
+
+    uint8_t* bitmap = malloc((count + 7) / 8);
+
+    if (csv) {
+        printf("corpus,engine,ns_per_addr,addr_per_s,gb_per_s,valid\n");
+    } else {
+        printf("%-13s %-15s %10s %12s %9s %8s\n",
+               "corpus", "engine", "ns/addr", "addr/s", "GB/s", "valid%");
+    }
+
+    for (size_t k = 0; k < COUNT_OF(CORPORA); k++) {
+        if (only_corpus != NULL && strcmp(only_corpus, CORPORA[k].name) != 0) {
+            continue;
+        }
+
+        corpus c;
+        rng_state = 0x9E3779B97F4A7C15ull + k;  // same corpus on every run
+        corpus_build(&c, CORPORA[k].name, count, CORPORA[k].gen);
+
+        for (size_t e = 0; e < COUNT_OF(ENGINES); e++) {
+            if (only_engine != NULL && strcmp(only_engine, ENGINES[e].name) != 0) {
+                continue;
+            }
+
+            size_t valid = ENGINES[e].run(&c, bitmap);
+            double t = measure(&ENGINES[e], &c, bitmap, min_time, repeat);
+
+            // A result below the baseline is measured again before it
+            // counts, so a burst of noise does not fail the gate
+            baseline_entry* was = baseline_find(&base, c.name, ENGINES[e].name);
+            for (int retry = 0; retry < BASELINE_RETRIES && was != NULL &&
+                                (double)c.count / t < was->per_s * (1.0 - max_regression / 100.0);
+                 retry++) {
+                double again = measure(&ENGINES[e], &c, bitmap, min_time, repeat);
+                t = again < t ? again : t;
+            }
+            double ns = t * 1e9 / (double)c.count;
+            double per_s = (double)c.count / t;
+            double gbs = (double)c.bytes / t / 1e9;
+            double pct = 100.0 * (double)valid / (double)c.count;
+
+            if (csv) {
+                printf("%s,%s,%.3f,%.0f,%.4f,%zu\n",
+                       c.name, ENGINES[e].name, ns, per_s, gbs, valid);
+            } else {
+                printf("%-13s %-15s %10.2f %12.4g %9.3f %7.1f%%\n",
+                       c.name, ENGINES[e].name, ns, per_s, gbs, pct);
+            }
+            fflush(stdout);
+
+            if (was != NULL) {
+                double change = 100.0 * (per_s - was->per_s) / was->per_s;
+                was->seen = true;
+                if (valid != was->valid) {
+                    fprintf(stderr, "FAIL %s/%s: %zu valid, baseline %zu\n",
+                            c.name, ENGINES[e].name, valid, was->valid);
+                    regressions++;
+                } else if (change < -max_regression) {
+                    fprintf(stderr, "FAIL %s/%s: %.4g addr/s, %.1f%% below the baseline %.4g\n",
+                            c.name, ENGINES[e].name, per_s, -change, was->per_s);
+                    regressions++;
+                }
+            } else if (baseline_path != NULL) {
+                fprintf(stderr, "note %s/%s: not in the baseline\n", c.name, ENGINES[e].name);
+            }
+        }
+
+        corpus_free(&c);
+    }
+
+    free(bitmap);
+
+    if (baseline_path != NULL) {
+        size_t compared = 0;
+        for (size_t i = 0; i < base.count; i++) {
+            compared += base.entries[i].seen;
+        }
+        fprintf(stderr, "%zu results compared with %s: %zu regression(s) beyond %.1f%%\n",
+                compared, baseline_path, regressions, max_regression);
+        free(base.entries);
+        return regressions != 0 ? 1 : 0;
+    }
+    return 0;
+}
@@ -0,0 +1,301 @@
+/*
+ * Differential fuzz target for the email validators
+ *
+ * Every input is split into lines and each line is run through every
+ * engine: the rule-by-rule is_valid_email_reference(), is_valid_email(),
+ * the single-pass scan, email_check(), the SIMD kernel, the domain cache,
+ * the C++ policy DFA, normalization, strict mode, the UTF-8 validators,
+ * RFC 5321 mode and the batch validators. Any two that disagree abort the process with both verdicts
+ * and the offending line, which is what libFuzzer and AFL look for.
+ *
+ * The reference works on NUL-terminated strings, so it is compared on
+ * the line up to its first NUL; the length-aware engines are compared
+ * with is_valid_email_n() on the whole line, embedded NULs included.
+ *
+ * Build:
+ *   libFuzzer - configure with Clang and -DEMAIL_VALIDATE_FUZZ=ON, then
+ *               email_fuzz [libFuzzer options] fuzz/corpus
+ *   AFL       - configure with CC=afl-clang-fast CXX=afl-clang-fast++,
+ *               then afl-fuzz -i fuzz/corpus -o findings -- email_fuzz @@
+ *   otherwise - email_fuzz FILE|DIR... replays inputs (the email_fuzz_corpus
+ *               test runs it over fuzz/corpus)
+ */
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "email_validate.h"
+#include "email_validate.hpp"
+
+#define FUZZ_MAX_LINES 64
+
+static void fuzz_mismatch(const char* what, bool got, bool expected, const char* p, size_t len) {
+    std::fprintf(stderr, "email_fuzz: %s says %s, expected %s, for \"", what,
+                 got ? "valid" : "invalid", expected ? "valid" : "invalid");
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = static_cast<unsigned char>(p[i]);
+        if (c >= 0x20 && c < 0x7F && c != '"' && c != '\\') {
+            std::fputc(c, stderr);
+        } else {
+            std::fprintf(stderr, "\\x%02x", c);
+        }
+    }
+    std::fprintf(stderr, "\" (%zu bytes)\n", len);
+    std::abort();
+}
+
+#define FUZZ_AGREE(what, got, expected, p, len)                     \
+    do {                                                            \
+        bool fuzz_got_ = (got);                                     \
+        bool fuzz_expected_ = (expected);                           \
+        if (fuzz_got_ != fuzz_expected_) {                          \
+            fuzz_mismatch((what), fuzz_got_, fuzz_expected_, (p), (len)); \
+        }                                                           \
+    } while (0)
+
+// The domain cache lives across inputs, so stale or colliding entries
+// show up as disagreements too
+static email_domain_cache* fuzz_cache() {
+    static email_domain_cache* cache = email_domain_cache_create();
+    if (cache == nullptr) {
+        std::fprintf(stderr, "email_fuzz: out of memory\n");
+        std::abort();
+    }
+    return cache;
+}
+
+// The single-address engines on one line; returns is_valid_email_n()
+static bool fuzz_line(const char* p, size_t len) {
+    // NUL-terminated engines against the reference
+    std::vector<char> c_str(p, p + len);
+    c_str.push_back('\0');
+    size_t c_len = std::strlen(c_str.data());
+    bool ref = is_valid_email_reference(c_str.data());
+
+    FUZZ_AGREE("is_valid_email", is_valid_email(c_str.data()), ref, p, c_len);
+    FUZZ_AGREE("is_valid_email_n", is_valid_email_n(c_str.data(), c_len), ref, p, c_len);
+    FUZZ_AGREE("email_check", email_check(c_str.data(), c_len, nullptr) == EMAIL_VALID, ref,
+               p, c_len);
+    FUZZ_AGREE("email::valid", email::valid(std::string_view(c_str.data(), c_len)), ref, p, c_len);
+
+    // Length-aware engines on the whole line
+    bool valid = is_valid_email_n(p, len);
+    size_t offset = len + 1;
+    email_reason reason = email_check(p, len, &offset);
+    FUZZ_AGREE("email_check", reason == EMAIL_VALID, valid, p, len);
+    FUZZ_AGREE("email_check offset", reason == EMAIL_VALID || offset <= len, true, p, len);
+    FUZZ_AGREE("is_valid_email_simd", is_valid_email_simd(p, len), valid, p, len);
+    FUZZ_AGREE("is_valid_email_cached", is_valid_email_cached(fuzz_cache(), p, len), valid, p, len);
+    FUZZ_AGREE("email::validate", email::validate(std::string_view(p, len)), valid, p, len);
+    if (std::memchr(p, '+', len) == nullptr) {
+        FUZZ_AGREE("email::validate<no_plus_policy>",
+                   email::validate<email::no_plus_policy>(std::string_view(p, len)), valid, p, len);
+    }
+
+    // The UTF-8 validators keep the ASCII verdicts and agree with each other
+    size_t utf8_offset = len + 1;
+    email_reason utf8_reason = email_check_utf8(p, len, &utf8_offset);
+    bool utf8 = utf8_reason == EMAIL_VALID;
+    FUZZ_AGREE("is_valid_email_utf8", is_valid_email_utf8(p, len), utf8, p, len);
+    FUZZ_AGREE("email_check_utf8 offset", utf8 || utf8_offset <= len, true, p, len);
+    if (std::none_of(p, p + len, [](char c) { return static_cast<unsigned char>(c) >= 0x80; })) {
+        FUZZ_AGREE("email_check_utf8(ASCII)", utf8, valid, p, len);
+    }
+
+    // RFC 5321 mode accepts every valid address within its limits whose
+    // labels neither start nor end with '-'
+    size_t rfc_offset = len + 1;
+    email_reason rfc_reason = email_check_rfc(p, len, &rfc_offset);
+    bool rfc = rfc_reason == EMAIL_VALID;
+    FUZZ_AGREE("is_valid_email_rfc", is_valid_email_rfc(p, len), rfc, p, len);
+    FUZZ_AGREE("email_check_rfc offset", rfc || rfc_offset <= len, true, p, len);
+    if (valid && len <= EMAIL_RFC_MAX_LENGTH) {
+        std::string_view address(p, len);
+        size_t at = address.find('@');
+        bool hyphen_edge = address.find("-.") != address.npos ||
+                           address.find(".-") != address.npos || address[at + 1] == '-' ||
+                           address.back() == '-';
+        size_t label = 0;
+        bool long_label = false;
+        for (size_t i = at + 1; i < len; i++) {
+            label = p[i] == '.' ? 0 : label + 1;
+            long_label |= label > EMAIL_RFC_MAX_LABEL;
+        }
+        if (at <= EMAIL_RFC_MAX_LOCAL && !hyphen_edge && !long_label) {
+            FUZZ_AGREE("is_valid_email_rfc(valid)", rfc, true, p, len);
+        }
+    }
+
+    // Strict mode is the same verdict plus a known TLD after the last '.'
+    bool strict = valid;
+    if (valid) {
+        const char* dot = static_cast<const char*>(std::memchr(p, '@', len));
+        for (const char* q = p + len; q-- > dot;) {
+            if (*q == '.') {
+                dot = q;
+                break;
+            }
+        }
+        strict = email_tld_is_known(dot + 1, static_cast<size_t>(p + len - dot - 1));
+    }
+    FUZZ_AGREE("is_valid_email_strict", is_valid_email_strict(p, len), strict, p, len);
+    FUZZ_AGREE("email_check_strict", email_check_strict(p, len, nullptr) == EMAIL_VALID, strict,
+               p, len);
+
+    // The canonical form is valid, as long as the input and a fixed point
+    char buf[2 * MAX_EMAIL_LENGTH + 2];
+    email_arena arena;
+    email_arena_init(&arena, buf, sizeof(buf));
+    email_normalized first;
+    FUZZ_AGREE("email_normalize", email_normalize(p, len, 0, &arena, &first), valid, p, len);
+    if (valid) {
+        FUZZ_AGREE("email_normalize length", first.len == len, true, p, len);
+        FUZZ_AGREE("is_valid_email_n(canonical)", is_valid_email_n(first.p, first.len), true,
+                   p, len);
+        email_normalized second;
+        FUZZ_AGREE("email_normalize(canonical)",
+                   email_normalize(first.p, first.len, 0, &arena, &second) &&
+                       second.len == first.len && std::memcmp(first.p, second.p, first.len) == 0,
+                   true, p, len);
+    }
+    email_arena_reset(&arena);
+    email_normalized strict_form;
+    FUZZ_AGREE("email_normalize(STRICT)",
+               email_normalize(p, len, EMAIL_NORMALIZE_STRICT, &arena, &strict_form), strict,
+               p, len);
+
+    return valid;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    const char* text = size > 0 ? reinterpret_cast<const char*>(data) : "";
+    const char* ptrs[FUZZ_MAX_LINES];
+    size_t lens[FUZZ_MAX_LINES];
+    int32_t offsets[FUZZ_MAX_LINES + 1];
+    bool expected[FUZZ_MAX_LINES];
+    size_t n = 0;
+
+    for (size_t pos = 0; n < FUZZ_MAX_LINES && pos <= size;) {
+        const char* nl = static_cast<const char*>(std::memchr(text + pos, '\n', size - pos));
+        size_t len = nl != nullptr ? static_cast<size_t>(nl - text - pos) : size - pos;
+        ptrs[n] = text + pos;
+        lens[n] = len;
+        expected[n] = fuzz_line(text + pos, len);
+        n++;
+        if (nl == nullptr) {
+            break;
+        }
+        pos += len + 1;
+    }
+
+    // The batch validators over all lines at once; for the offsets form
+    // the lines have to be back to back, so they are packed first
+    std::vector<char> packed;
+    for (size_t i = 0; i < n; i++) {
+        offsets[i] = static_cast<int32_t>(packed.size());
+        packed.insert(packed.end(), ptrs[i], ptrs[i] + lens[i]);
+    }
+    offsets[n] = static_cast<int32_t>(packed.size());
+    packed.push_back('\0');
+
+    uint8_t batch[FUZZ_MAX_LINES / 8];
+    uint8_t cached[FUZZ_MAX_LINES / 8];
+    uint8_t by_offsets[FUZZ_MAX_LINES / 8];
+    validate_emails_batch(ptrs, lens, n, batch);
+    validate_emails_batch_cached(ptrs, lens, n, cached, fuzz_cache());
+    validate_emails_batch_offsets(packed.data(), offsets, n, by_offsets);
+
+    static char arena_buf[FUZZ_MAX_LINES * (MAX_EMAIL_LENGTH + 1)];
+    email_arena arena;
+    email_arena_init(&arena, arena_buf, sizeof(arena_buf));
+    const char* canonical[FUZZ_MAX_LINES];
+    size_t canonical_lens[FUZZ_MAX_LINES];
+    size_t done = normalize_emails_batch(ptrs, lens, n, 0, &arena, canonical, canonical_lens);
+    FUZZ_AGREE("normalize_emails_batch done", done == n, true, text, size);
+
+    for (size_t i = 0; i < n; i++) {
+        bool bit = (batch[i / 8] >> (i % 8)) & 1;
+        FUZZ_AGREE("validate_emails_batch", bit, expected[i], ptrs[i], lens[i]);
+        bit = (cached[i / 8] >> (i % 8)) & 1;
+        FUZZ_AGREE("validate_emails_batch_cached", bit, expected[i], ptrs[i], lens[i]);
+        bit = (by_offsets[i / 8] >> (i % 8)) & 1;
+        FUZZ_AGREE("validate_emails_batch_offsets", bit, expected[i], ptrs[i], lens[i]);
+        FUZZ_AGREE("normalize_emails_batch", canonical[i] != nullptr, expected[i], ptrs[i], lens[i]);
+    }
+    return 0;
+}
+
+#ifndef EMAIL_FUZZ_LIBFUZZER
+
+/*
+ * Standalone driver: runs the target once per file, recursing into
+ * directories, or once over stdin when there are no arguments. This is
+ * all AFL needs, and it replays crashes found by either fuzzer.
+ */
+static size_t fuzz_path(const char* path);
+
+static size_t fuzz_file(const char* path) {
+    std::FILE* f = path != nullptr ? std::fopen(path, "rb") : stdin;
+    if (f == nullptr) {
+        std::perror(path);
+        std::exit(2);
+    }
+    std::vector<uint8_t> data;
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = std::fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    if (f != stdin) {
+        std::fclose(f);
+    }
+    LLVMFuzzerTestOneInput(data.data(), data.size());
+    return 1;
+}
+
+static size_t fuzz_path(const char* path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return fuzz_file(path);
+    }
+    DIR* dir = opendir(path);
+    if (dir == nullptr) {
+        std::perror(path);
+        std::exit(2);
+    }
+    size_t runs = 0;
+    while (struct dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        std::string_view name(entry->d_name);
+        std::vector<char> child(path, path + std::strlen(path));
+        child.push_back('/');
+        child.insert(child.end(), name.begin(), name.end());
+        child.push_back('\0');
+        runs += fuzz_path(child.data());
+    }
+    closedir(dir);
+    return runs;
+}
+
+int main(int argc, char** argv) {
+    size_t runs = 0;
+    if (argc < 2) {
+        runs = fuzz_file(nullptr);
+    }
+    for (int i = 1; i < argc; i++) {
+        runs += fuzz_path(argv[i]);
+    }
+    std::fprintf(stderr, "email_fuzz: %zu inputs, no mismatch\n", runs);
+    return 0;
+}
+
+#endif  // EMAIL_FUZZ_LIBFUZZER
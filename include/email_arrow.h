@@ -0,0 +1,127 @@
+#ifndef EMAIL_ARROW_H
+#define EMAIL_ARROW_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "email_validate.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Columnar bulk validation over the Arrow C data interface
+ *
+ * Arrow, Parquet readers (Arrow C++, pyarrow, DuckDB, Polars, nanoarrow)
+ * and most data lake engines hand out columns as ArrowArray /
+ * ArrowSchema pairs and tables as an ArrowArrayStream of record batches,
+ * one per row group. The structures below are the ABI-stable definitions
+ * from the Arrow specification, so no Arrow library is needed to build
+ * or use this; when one is included first its identical definitions are
+ * used instead.
+ *
+ * A utf8 string column ("u") is validated in place: its offsets and data
+ * buffers go straight into validate_emails_batch_offsets(), nothing is
+ * copied or converted. The result is a struct array of a boolean "valid"
+ * column, whose values buffer is the batch validator's bitmap, and
+ * optionally an int8 "reason" column holding the email_reason of every
+ * row. Null input rows give null results.
+ */
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+    void (*release)(struct ArrowSchema*);
+    void* private_data;
+};
+
+struct ArrowArray {
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+    void (*release)(struct ArrowArray*);
+    void* private_data;
+};
+
+#endif  // ARROW_C_DATA_INTERFACE
+
+#ifndef ARROW_C_STREAM_INTERFACE
+#define ARROW_C_STREAM_INTERFACE
+
+struct ArrowArrayStream {
+    int (*get_schema)(struct ArrowArrayStream*, struct ArrowSchema* out);
+    int (*get_next)(struct ArrowArrayStream*, struct ArrowArray* out);
+    const char* (*get_last_error)(struct ArrowArrayStream*);
+    void (*release)(struct ArrowArrayStream*);
+    void* private_data;
+};
+
+#endif  // ARROW_C_STREAM_INTERFACE
+
+typedef struct {
+    int64_t column;       // for a struct (record batch) input, the child to validate
+    bool reasons;         // add the "reason" column
+    bool strict;          // also require a known TLD
+} email_arrow_options;
+
+/**
+ * Function: email_arrow_validate
+ * Purpose: Validates every row of a string column
+ *
+ * Parameters:
+ *   schema, array - the column: utf8 ("u"), large utf8 ("U"), binary
+ *                   ("z") or large binary ("Z"), or a struct ("+s") whose
+ *                   child opts->column is one; array->offset is honoured
+ *   opts          - NULL for the defaults (column 0, no reasons, not strict)
+ *   out, out_schema - receive the struct array of results, one row per
+ *                   input row, and its schema (out_schema may be NULL);
+ *                   the caller releases both
+ *
+ * Returns:
+ *   0, EINVAL for a malformed array or a column out of range, ENOTSUP for
+ *   another type, or ENOMEM. The input is neither modified nor released.
+ */
+int email_arrow_validate(const struct ArrowSchema* schema, const struct ArrowArray* array,
+                         const email_arrow_options* opts, struct ArrowArray* out,
+                         struct ArrowSchema* out_schema);
+
+/**
+ * Function: email_arrow_validate_stream
+ * Purpose: Validates a stream of record batches, one batch at a time
+ *
+ * out becomes a stream of result arrays, as email_arrow_validate() makes
+ * them, one per batch of in. Each get_next() on out reads the next batch
+ * of in, validates it and releases it, so no more than one row group is
+ * held at a time whatever the size of the table. out takes ownership of
+ * in, which is released with it.
+ *
+ * Returns:
+ *   0, EINVAL when in is NULL or released, or ENOMEM; in is left alone
+ *   unless 0 is returned. Errors of a batch come back from get_next(),
+ *   with a message from get_last_error().
+ */
+int email_arrow_validate_stream(struct ArrowArrayStream* in, const email_arrow_options* opts,
+                                struct ArrowArrayStream* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // EMAIL_ARROW_H
@@ -0,0 +1,59 @@
+#ifndef EMAIL_RULES_H
+#define EMAIL_RULES_H
+
+/*
+ * The validation rules as constants and constant expressions
+ *
+ * Everything here is plain C that is also a constant expression in C++,
+ * so the C library (its class table and every kernel) and the constexpr
+ * C++ validator in email_validate.hpp are built from the same
+ * definitions. Change a rule here and both follow.
+ */
+
+#define MAX_EMAIL_LENGTH 256
+#define MIN_EMAIL_LENGTH 5      // Minimum realistic email: a@b.c
+#define EMAIL_MIN_TLD_LENGTH 2  // characters after the last '.' of the domain
+
+/*
+ * Character classes
+ *
+ * Every byte value maps to a set of the bits below. EMAIL_CHAR_CLASS(c)
+ * computes that set using the ASCII ("C" locale) definitions of letters,
+ * digits and whitespace, so results never depend on setlocale(). Every
+ * byte >= 0x80 has no bits set.
+ */
+#define EMAIL_CHAR_ALNUM   0x01  // 'A'-'Z', 'a'-'z', '0'-'9'
+#define EMAIL_CHAR_LOCAL   0x02  // allowed in the local part: alnum . - _ +
+#define EMAIL_CHAR_DOMAIN  0x04  // allowed in the domain: alnum . -
+#define EMAIL_CHAR_DOT     0x08  // '.'
+#define EMAIL_CHAR_HYPHEN  0x10  // '-'
+#define EMAIL_CHAR_SPACE   0x20  // ' ', '\t', '\n', '\v', '\f', '\r'
+
+#define EMAIL_IS_ALNUM(c) \
+    (((c) >= 'A' && (c) <= 'Z') || ((c) >= 'a' && (c) <= 'z') || \
+     ((c) >= '0' && (c) <= '9'))
+
+#define EMAIL_CHAR_CLASS(c) ( \
+    (EMAIL_IS_ALNUM(c) ? EMAIL_CHAR_ALNUM | EMAIL_CHAR_LOCAL | EMAIL_CHAR_DOMAIN : 0) | \
+    ((c) == '.' ? EMAIL_CHAR_DOT | EMAIL_CHAR_LOCAL | EMAIL_CHAR_DOMAIN : 0) | \
+    ((c) == '-' ? EMAIL_CHAR_HYPHEN | EMAIL_CHAR_LOCAL | EMAIL_CHAR_DOMAIN : 0) | \
+    ((c) == '_' || (c) == '+' ? EMAIL_CHAR_LOCAL : 0) | \
+    ((c) == ' ' || ((c) >= '\t' && (c) <= '\r') ? EMAIL_CHAR_SPACE : 0))
+
+/*
+ * RFC 5321 mode (is_valid_email_rfc())
+ *
+ * The limits of RFC 5321 section 4.5.3.1 and the atext characters of an
+ * unquoted local part (RFC 5322 section 3.2.3). The grammar built on them
+ * is compiled into a DFA at build time by src/email_rfc_gen.c.
+ */
+#define EMAIL_RFC_MAX_LENGTH 254  // a 256-octet path minus its '<' and '>'
+#define EMAIL_RFC_MAX_LOCAL 64
+#define EMAIL_RFC_MAX_LABEL 63
+
+#define EMAIL_IS_ATEXT(c) (EMAIL_IS_ALNUM(c) || \
+    (c) == '!' || ((c) >= '#' && (c) <= '\'') || (c) == '*' || (c) == '+' || \
+    (c) == '-' || (c) == '/' || (c) == '=' || (c) == '?' || ((c) >= '^' && (c) <= '`') || \
+    ((c) >= '{' && (c) <= '~'))
+
+#endif  // EMAIL_RULES_H
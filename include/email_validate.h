@@ -0,0 +1,1306 @@
+#ifndef EMAIL_VALIDATE_H
+#define EMAIL_VALIDATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "email_rules.h"  // MAX_EMAIL_LENGTH, MIN_EMAIL_LENGTH, character classes
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Why an address was rejected. EMAIL_VALID (zero) means it was not.
+ */
+typedef enum {
+    EMAIL_VALID = 0,
+    EMAIL_NULL_INPUT,          // NULL pointer
+    EMAIL_TOO_SHORT,           // fewer than MIN_EMAIL_LENGTH bytes
+    EMAIL_TOO_LONG,            // more than MAX_EMAIL_LENGTH bytes
+    EMAIL_WHITESPACE,          // space, tab or line break
+    EMAIL_MISSING_AT,          // no '@' at all
+    EMAIL_MULTIPLE_AT,         // a second '@'
+    EMAIL_EMPTY_LOCAL,         // nothing before the '@'
+    EMAIL_LOCAL_LEADING_DOT,   // local part starts with '.'
+    EMAIL_LOCAL_TRAILING_DOT,  // '.' right before the '@'
+    EMAIL_LOCAL_DOUBLE_DOT,    // '..' in the local part
+    EMAIL_BAD_LOCAL_CHAR,      // not a letter, digit, '.', '-', '_' or '+'
+    EMAIL_EMPTY_DOMAIN,        // nothing after the '@'
+    EMAIL_DOMAIN_BAD_START,    // domain starts with '.' or '-'
+    EMAIL_DOMAIN_BAD_END,      // domain ends with '.' or '-'
+    EMAIL_DOMAIN_DOUBLE_DOT,   // '..' in the domain
+    EMAIL_BAD_DOMAIN_CHAR,     // not a letter, digit, '.' or '-'
+    EMAIL_DOMAIN_NO_DOT,       // domain has no '.'
+    EMAIL_TLD_TOO_SHORT,       // fewer than EMAIL_MIN_TLD_LENGTH characters after the last '.'
+    EMAIL_UNKNOWN_TLD,         // strict mode only: TLD not in the known-TLD list
+    EMAIL_BAD_UTF8,            // UTF-8 mode only: malformed UTF-8 sequence
+    EMAIL_BAD_IDN,             // UTF-8 mode only: character not allowed in a domain label
+    EMAIL_LOCAL_TOO_LONG,      // RFC mode only: more than EMAIL_RFC_MAX_LOCAL bytes before the '@'
+    EMAIL_LABEL_TOO_LONG,      // RFC mode only: a domain label of more than EMAIL_RFC_MAX_LABEL bytes
+    EMAIL_BAD_QUOTED_LOCAL,    // RFC mode only: malformed or unterminated quoted local part
+    EMAIL_BAD_ADDRESS_LITERAL, // RFC mode only: malformed [IPv4] or [IPv6:...] domain
+    EMAIL_REASON_COUNT
+} email_reason;
+
+/**
+ * Function: is_valid_email
+ * Purpose: Validates a NUL-terminated email address
+ *
+ * Thin wrapper around is_valid_email_n(); the terminator is searched for
+ * at most MAX_EMAIL_LENGTH + 1 bytes, so overlong input is not walked
+ * to the end.
+ */
+bool is_valid_email(const char* email);
+
+/**
+ * Function: is_valid_email_n
+ * Purpose: Validates the email address held in p[0..len)
+ *
+ * Parameters:
+ *   p   - pointer to the first byte of the address (need not be
+ *         NUL-terminated, may be NULL when len is 0)
+ *   len - number of bytes in the address
+ *
+ * Returns:
+ *   true if email is valid, false otherwise
+ *
+ * The buffer is validated in place in a single pass, so fields can be
+ * checked straight out of a CSV/JSON parse buffer. A NUL byte inside the
+ * range is an invalid character like any other.
+ */
+bool is_valid_email_n(const char* p, size_t len);
+
+/**
+ * Function: email_check
+ * Purpose: Validates p[0..len) and reports the first rule it breaks
+ *
+ * Parameters:
+ *   p      - pointer to the first byte of the address
+ *   len    - number of bytes in the address
+ *   offset - receives the position of the offending byte, may be NULL
+ *
+ * Returns:
+ *   EMAIL_VALID or the reason for the rejection
+ *
+ * Runs the same single scan as is_valid_email_n(); the reason and offset
+ * come out of the branch that rejects, so they cost nothing extra.
+ */
+email_reason email_check(const char* p, size_t len, size_t* offset);
+
+/**
+ * Function: email_reason_name / email_reason_message
+ * Purpose: Reason code as a name ("TLD_TOO_SHORT") or a sentence for users
+ */
+const char* email_reason_name(email_reason reason);
+const char* email_reason_message(email_reason reason);
+
+/**
+ * Function: is_valid_email_strict / email_check_strict
+ * Purpose: Strict mode: the usual rules, plus the TLD must be a known
+ *          top-level domain (see email_tld_is_known())
+ *
+ * email_check_strict() returns EMAIL_UNKNOWN_TLD, with the offset of the
+ * TLD, for an address that is fine apart from its TLD.
+ */
+bool is_valid_email_strict(const char* p, size_t len);
+email_reason email_check_strict(const char* p, size_t len, size_t* offset);
+
+/**
+ * Internationalized addresses (RFC 6531 SMTPUTF8, IDNA2008 domains)
+ *
+ * The UTF-8 validators accept everything the ASCII ones do, plus non-ASCII
+ * letters in the local part and internationalized domain labels. An
+ * all-ASCII address, the usual case, is recognized with one vectorized
+ * pass and goes to the ASCII kernel unchanged. Otherwise the UTF-8 is
+ * decoded strictly (no overlong forms, surrogates or code points above
+ * U+10FFFF), every domain label is mapped (lowercased, fullwidth forms
+ * folded) and converted to its punycode A-label, and the address is
+ * checked by the usual rules in that form. Offsets point into the
+ * original bytes. The yes/no forms run the ASCII validator first and
+ * only look at the UTF-8 of an address it rejects; profiling and metrics
+ * builds count that first verdict.
+ */
+bool is_valid_email_utf8(const char* p, size_t len);
+bool is_valid_email_utf8_strict(const char* p, size_t len);
+email_reason email_check_utf8(const char* p, size_t len, size_t* offset);
+email_reason email_check_utf8_strict(const char* p, size_t len, size_t* offset);
+
+/**
+ * Function: email_domain_to_ascii
+ * Purpose: Converts the domain p[0..len) to its ASCII (A-label) form
+ *
+ * Non-ASCII labels become "xn--" plus their punycode; ASCII labels are
+ * lowercased and copied; "。", "．" and "｡" count as dots. The result is
+ * not otherwise checked: validate the address for that.
+ *
+ * Returns:
+ *   the length written to out, NUL-terminated, or 0 when the domain is
+ *   not valid UTF-8, has a character no label may contain, or does not
+ *   fit in out[0..cap)
+ */
+size_t email_domain_to_ascii(const char* p, size_t len, char* out, size_t cap);
+
+/**
+ * Function: is_valid_email_rfc / email_check_rfc
+ * Purpose: RFC 5321 mode: the full SMTP Mailbox grammar instead of the
+ *          conservative rules above
+ *
+ * Accepts every local part character of RFC 5322 atext
+ * (!#$%&'*+-/=?^_`{|}~ besides letters and digits), quoted local parts
+ * ("john doe"@example.com, "a\"b"@example.com), single-label domains and
+ * address literals: [192.0.2.1], [IPv6:2001:db8::1] and
+ * [IPv6:::ffff:192.0.2.1]. The limits are those of RFC 5321 section
+ * 4.5.3.1 (EMAIL_RFC_MAX_LOCAL, EMAIL_RFC_MAX_LABEL,
+ * EMAIL_RFC_MAX_LENGTH). Not accepted: comments, folding whitespace and
+ * the obsolete forms of RFC 5322, and literals of any tag but IPv6, the
+ * only one registered.
+ *
+ * The grammar is compiled into a DFA when the library is built, so the
+ * check is one pass with one table lookup per byte. Reasons and offsets
+ * are those of email_check() where the rule is the same; the four
+ * "RFC mode only" reasons cover the rest.
+ */
+bool is_valid_email_rfc(const char* p, size_t len);
+email_reason email_check_rfc(const char* p, size_t len, size_t* offset);
+
+/**
+ * A bump allocator over caller memory, for email_normalize(). Nothing is
+ * ever freed on its own: email_arena_reset() releases everything at once.
+ */
+typedef struct {
+    char* base;
+    size_t size;
+    size_t used;
+} email_arena;
+
+/**
+ * Function: email_arena_init / email_arena_reset
+ * Purpose: Makes buf[0..size) an empty arena / empties it again
+ */
+void email_arena_init(email_arena* arena, void* buf, size_t size);
+void email_arena_reset(email_arena* arena);
+
+#define EMAIL_NORMALIZE_LENIENT 0x1u  // strip whitespace around the address
+#define EMAIL_NORMALIZE_STRICT  0x2u  // also require a known TLD
+#define EMAIL_NORMALIZE_UTF8    0x4u  // accept internationalized addresses; the
+                                      // domain is written as A-labels
+
+typedef struct {
+    const char* p;        // canonical form in the arena, NUL-terminated, or NULL
+    size_t len;           // its length
+    email_reason reason;  // EMAIL_VALID, or why the address was rejected
+    size_t offset;        // position of the offending byte in the input
+} email_normalized;
+
+/**
+ * Function: email_normalize
+ * Purpose: Validates p[0..len) and writes its canonical form, with the
+ *          domain lowercased, to arena
+ *
+ * Returns true when it was written. False means the address is invalid
+ * (see out->reason) or, with out->reason == EMAIL_VALID, that the arena
+ * has no room left for it. No heap memory is used.
+ */
+bool email_normalize(const char* p, size_t len, unsigned flags, email_arena* arena,
+                     email_normalized* out);
+
+/**
+ * Function: normalize_emails_batch
+ * Purpose: email_normalize() over n addresses
+ *
+ * out_ptrs[i] / out_lens[i] receive the canonical form of address i, or
+ * NULL / 0 when it is invalid. Returns how many addresses were done,
+ * fewer than n when the arena filled up.
+ */
+size_t normalize_emails_batch(const char* const* ptrs, const size_t* lens, size_t n,
+                              unsigned flags, email_arena* arena,
+                              const char** out_ptrs, size_t* out_lens);
+
+/**
+ * Function: email_tld_is_known
+ * Purpose: Looks up tld[0..len) (no leading '.'), ignoring case
+ *
+ * The list is a minimal perfect hash table: one hash, two loads and a
+ * compare per lookup, no locks and no allocation. It starts out as the
+ * list compiled into the library (data/tlds-alpha-by-domain.txt).
+ */
+bool email_tld_is_known(const char* tld, size_t len);
+
+/**
+ * Function: email_tld_count
+ * Purpose: Number of TLDs in the current list
+ */
+size_t email_tld_count(void);
+
+/**
+ * Function: email_tld_load_file / email_tld_load_list / email_tld_load_builtin
+ * Purpose: Replace the TLD list without a rebuild
+ *
+ * The file (or text[0..len)) lists one TLD per line, as IANA's
+ * tlds-alpha-by-domain.txt does: '#' lines and blank lines are skipped,
+ * case does not matter, IDNs are given in punycode. The new list is
+ * swapped in atomically, so lookups running in other threads are safe.
+ * Returns 0, or -1 with errno set (EINVAL for a line that is not a TLD);
+ * on failure the old list stays in use.
+ */
+int email_tld_load_file(const char* path);
+int email_tld_load_list(const char* text, size_t len);
+int email_tld_load_builtin(void);
+
+/**
+ * The check that rejected an address in the yes/no validators. Before
+ * any loop over the address they look at the length, the first byte, the
+ * last two bytes and the bytes around the first '@', in this order; only
+ * what passes all of them gets the full scan.
+ */
+typedef enum {
+    EMAIL_STAGE_PASSED = 0,    // not rejected
+    EMAIL_STAGE_LENGTH,        // NULL, or outside MIN/MAX_EMAIL_LENGTH
+    EMAIL_STAGE_FIRST_BYTE,    // cannot start a local part
+    EMAIL_STAGE_LAST_BYTES,    // cannot end a TLD of 2+ characters
+    EMAIL_STAGE_AT_POSITION,   // no '@' with room around it
+    EMAIL_STAGE_FULL_SCAN,     // passed the prechecks, rejected by the scan
+    EMAIL_STAGE_COUNT
+} email_reject_stage;
+
+/**
+ * Rejection counts of a profiling build (EMAIL_VALIDATE_PROFILE_REJECTS).
+ */
+typedef struct {
+    uint64_t calls;                          // addresses validated
+    uint64_t valid;                          // addresses accepted
+    uint64_t by_stage[EMAIL_STAGE_COUNT];    // rejections per check
+    uint64_t by_reason[EMAIL_REASON_COUNT];  // rejections per rule, as email_check() reports it
+} email_reject_profile;
+
+/**
+ * Function: email_reject_profile_snapshot / email_reject_profile_reset
+ * Purpose: Read or clear the rejection counts
+ *
+ * Counted are is_valid_email(), is_valid_email_n(), is_valid_email_simd()
+ * and everything built on them (batch, parallel, streaming). The snapshot
+ * returns false, with all counts zero, unless the library was built with
+ * EMAIL_VALIDATE_PROFILE_REJECTS.
+ */
+bool email_reject_profile_snapshot(email_reject_profile* out);
+void email_reject_profile_reset(void);
+
+/**
+ * Function: email_reject_stage_name
+ * Purpose: Returns the stage as a short constant-style name ("FIRST_BYTE")
+ */
+const char* email_reject_stage_name(email_reject_stage stage);
+
+/**
+ * Instrumentation of an EMAIL_VALIDATE_METRICS build
+ *
+ * Every verdict of the validators (is_valid_email() and everything built
+ * on it: batch, parallel, streaming, the service) is counted by outcome,
+ * by rejection reason and in bytes, and the time per call goes into a
+ * latency histogram per path. Other builds contain none of it.
+ */
+typedef enum {
+    EMAIL_METRICS_SINGLE,   // is_valid_email(), per call
+    EMAIL_METRICS_BATCH,    // validate_emails_batch*(), per call; parallel, per chunk
+    EMAIL_METRICS_SERVER,   // email_server_start(), per batch of replies
+    EMAIL_METRICS_PATH_COUNT
+} email_metrics_path;
+
+// Buckets of the latency histograms: 16 per power of two of nanoseconds,
+// exact below 32 ns, up to 2^36 ns
+#define EMAIL_METRICS_BUCKETS 528
+
+typedef struct {
+    uint64_t valid;                              // addresses accepted
+    uint64_t invalid;                            // addresses rejected
+    uint64_t by_reason[EMAIL_REASON_COUNT];      // rejections per rule
+    uint64_t bytes;                              // address bytes validated
+    uint64_t calls[EMAIL_METRICS_PATH_COUNT];    // timed calls per path
+    uint64_t latency_ns[EMAIL_METRICS_PATH_COUNT];  // their total time
+    uint64_t latency[EMAIL_METRICS_PATH_COUNT][EMAIL_METRICS_BUCKETS];
+} email_metrics;
+
+/**
+ * Function: email_metrics_snapshot / email_metrics_reset
+ * Purpose: Read or clear the counters of all threads
+ *
+ * The snapshot returns false, with everything zero, unless the library was
+ * built with EMAIL_VALIDATE_METRICS. Counts being added while the reset
+ * runs may survive it.
+ */
+bool email_metrics_snapshot(email_metrics* out);
+void email_metrics_reset(void);
+
+/**
+ * Function: email_metrics_bucket_floor
+ * Purpose: Returns the lowest latency, in ns, that lands in a bucket
+ */
+uint64_t email_metrics_bucket_floor(size_t bucket);
+
+/**
+ * Function: email_metrics_percentile
+ * Purpose: Returns the latency in ns below which a fraction q (0..1) of
+ *          the calls on a path fall, to within a bucket; 0 without calls
+ */
+uint64_t email_metrics_percentile(const email_metrics* m, email_metrics_path path, double q);
+
+/**
+ * Function: email_metrics_prometheus
+ * Purpose: Writes m in the Prometheus text format into buf[0..cap)
+ *
+ * Returns the length of the whole text, as snprintf() does; it was cut
+ * short when that is cap or more.
+ */
+size_t email_metrics_prometheus(const email_metrics* m, char* buf, size_t cap);
+
+/**
+ * Function: is_valid_email_simd
+ * Purpose: Validates p[0..len) with vectorized kernels
+ *
+ * Same verdicts as is_valid_email_n(). The address is classified 16 or 32
+ * bytes at a time into '@', '.', '-' and illegal-byte bitmasks; the kernel
+ * (AVX2, SSE2, NEON or the scalar fallback) is picked at run time.
+ */
+bool is_valid_email_simd(const char* p, size_t len);
+
+/**
+ * Function: validate_emails_batch
+ * Purpose: Validates n addresses given as (pointer, length) pairs
+ *
+ * Bit i of out_bitmap (least significant bit first, (n + 7) / 8 bytes)
+ * is set when address i is valid. Returns the number of valid addresses.
+ */
+size_t validate_emails_batch(const char* const* ptrs, const size_t* lens,
+                             size_t n, uint8_t* out_bitmap);
+
+/**
+ * Function: validate_emails_batch_offsets
+ * Purpose: Validates n addresses stored back to back in one buffer
+ *
+ * Address i is data[offsets[i] .. offsets[i + 1]), the layout of an Arrow
+ * string column; offsets has n + 1 entries. Output as for
+ * validate_emails_batch().
+ */
+size_t validate_emails_batch_offsets(const char* data, const int32_t* offsets,
+                                     size_t n, uint8_t* out_bitmap);
+
+/**
+ * A cache of domain verdicts for bulk validation.
+ *
+ * When most addresses share a few domains, the domain half of the rules
+ * only needs checking once per domain. The cache is a fixed table of
+ * cache-line slots indexed by a hash of the domain; lookups and updates
+ * are lock-free, so one cache can be shared by any number of threads.
+ */
+typedef struct email_domain_cache email_domain_cache;
+
+/**
+ * Function: email_domain_cache_create / email_domain_cache_destroy
+ * Purpose: Allocates an empty cache (NULL when out of memory) / frees it
+ */
+email_domain_cache* email_domain_cache_create(void);
+void email_domain_cache_destroy(email_domain_cache* cache);
+
+/**
+ * Function: is_valid_email_cached
+ * Purpose: is_valid_email_n() with the domain verdict taken from cache
+ *
+ * Same verdicts as is_valid_email_n(). The local part is always scanned;
+ * the domain is only scanned when it is not in the cache yet.
+ */
+bool is_valid_email_cached(email_domain_cache* cache, const char* p, size_t len);
+
+/**
+ * Function: validate_emails_batch_cached
+ * Purpose: validate_emails_batch() using is_valid_email_cached()
+ */
+size_t validate_emails_batch_cached(const char* const* ptrs, const size_t* lens,
+                                    size_t n, uint8_t* out_bitmap,
+                                    email_domain_cache* cache);
+
+/**
+ * A set of the addresses seen so far, for skipping exact duplicates.
+ *
+ * Addresses are compared with their domain (everything after the last
+ * '@') lowercased, so "Ann@Example.COM" and "Ann@example.com" are the
+ * same address, while the local part is compared as is. The set is an
+ * open-addressing hash table over an arena of address bytes, both sized
+ * once when it is created, and any number of threads can add to it at
+ * the same time.
+ */
+typedef struct email_dedup email_dedup;
+
+typedef enum {
+    EMAIL_DEDUP_NEW,         // first time the address is added
+    EMAIL_DEDUP_DUPLICATE,   // the address is already in the set
+    EMAIL_DEDUP_UNTRACKED    // not kept: the set is full, or the address is
+                             // longer than MAX_EMAIL_LENGTH
+} email_dedup_result;
+
+typedef struct {
+    uint64_t unique;         // distinct addresses in the set
+    uint64_t duplicates;     // additions of an address already in the set
+    uint64_t untracked;      // additions that were not kept
+    size_t arena_used;       // arena bytes in use
+    size_t arena_size;       // arena bytes in all
+} email_dedup_stats;
+
+/**
+ * Function: email_dedup_create / email_dedup_destroy
+ * Purpose: Allocates an empty set for up to max_addresses distinct
+ *          addresses in arena_bytes of storage (0 = 1 Mi addresses and
+ *          64 MiB), NULL when out of memory / frees it
+ */
+email_dedup* email_dedup_create(size_t max_addresses, size_t arena_bytes);
+void email_dedup_destroy(email_dedup* set);
+
+/**
+ * Function: email_dedup_add
+ * Purpose: Adds p[0..len), seen on line line_no, to the set
+ *
+ * *first_line (may be NULL) receives the lowest line the address has been
+ * added with so far. Returns EMAIL_DEDUP_NEW, EMAIL_DEDUP_DUPLICATE or
+ * EMAIL_DEDUP_UNTRACKED.
+ */
+email_dedup_result email_dedup_add(email_dedup* set, const char* p, size_t len,
+                                   uint64_t line_no, uint64_t* first_line);
+
+/**
+ * Function: email_dedup_find
+ * Purpose: Returns true, with its first line in *first_line (may be
+ *          NULL), when p[0..len) is in the set
+ */
+bool email_dedup_find(email_dedup* set, const char* p, size_t len, uint64_t* first_line);
+
+/**
+ * Function: email_dedup_snapshot
+ * Purpose: Copies the counters of the set into *out
+ */
+void email_dedup_snapshot(email_dedup* set, email_dedup_stats* out);
+
+/**
+ * A compact store of validated addresses, for suppression lists and other
+ * in-memory indexes of hundreds of millions of addresses.
+ *
+ * Each address is split at its '@': the domain is interned in a
+ * dictionary and known by a 32-bit id, and the local part is appended,
+ * length-prefixed, to one arena. An address then costs its local part
+ * plus one byte, 12 bytes of offset and domain id, and 11 to 22 bytes of
+ * hash table (kept between 3/8 and 3/4 full); every address gets a dense
+ * 32-bit id in insertion order.
+ * Domains are kept lowercased and local parts as they are, the
+ * comparison email_dedup makes. Lookups are one probe sequence in a flat
+ * open-addressing table of the domain, then one of the address.
+ *
+ * email_store_save() writes the store as a single file that
+ * email_store_open() maps read-only without parsing or copying, so a
+ * service starts with its whole index in one mmap(). A store is built by
+ * one thread at a time; any number may look up in it while none adds.
+ */
+typedef struct email_store email_store;
+
+typedef enum {
+    EMAIL_STORE_ADDED,       // new address, now stored
+    EMAIL_STORE_PRESENT,     // already in the store
+    EMAIL_STORE_INVALID,     // rejected by email_check(), not stored
+    EMAIL_STORE_FULL         // out of memory, 2^32 - 1 addresses or domains,
+                             // or a store opened from a file
+} email_store_result;
+
+typedef struct {
+    uint64_t addresses;
+    uint64_t domains;
+    size_t local_bytes;      // local part arena in use, length bytes included
+    size_t domain_bytes;     // domain dictionary text in use
+    size_t memory;           // bytes allocated or mapped in all
+} email_store_stats;
+
+/**
+ * Function: email_store_create / email_store_destroy
+ * Purpose: Makes an empty store sized for expected_addresses (0 for a
+ *          small start; it grows as needed), NULL when out of memory /
+ *          frees it, or unmaps a store from email_store_open(); NULL is
+ *          ignored
+ */
+email_store* email_store_create(size_t expected_addresses);
+void email_store_destroy(email_store* store);
+
+/**
+ * Function: email_store_add
+ * Purpose: Validates p[0..len) and stores it unless it is there already
+ *
+ * *id (may be NULL) receives the id of the address when the result is
+ * EMAIL_STORE_ADDED or EMAIL_STORE_PRESENT. The address is split at the
+ * '@' found by the validation scan, so nothing is scanned twice.
+ */
+email_store_result email_store_add(email_store* store, const char* p, size_t len,
+                                   uint32_t* id);
+
+/**
+ * Function: email_store_find
+ * Purpose: Returns true, with its id in *id (may be NULL), when
+ *          p[0..len) is in the store; the domain is matched
+ *          case-insensitively
+ */
+bool email_store_find(const email_store* store, const char* p, size_t len, uint32_t* id);
+
+/**
+ * Function: email_store_get
+ * Purpose: Writes the address with the given id to out[0..cap),
+ *          NUL-terminated, domain lowercased
+ *
+ * Returns:
+ *   its length, or 0 when there is no such id or it does not fit
+ */
+size_t email_store_get(const email_store* store, uint32_t id, char* out, size_t cap);
+
+/**
+ * Function: email_store_domain_of / email_store_domain
+ * Purpose: The domain id of address id / the text of a domain id, with
+ *          its length in *len (NULL when there is no such domain)
+ */
+uint32_t email_store_domain_of(const email_store* store, uint32_t id);
+const char* email_store_domain(const email_store* store, uint32_t domain, size_t* len);
+
+/**
+ * Function: email_store_save / email_store_open
+ * Purpose: Writes the store to path / maps a file written that way
+ *
+ * The file is written beside path and renamed over it, so readers never
+ * see half of it. It holds the tables as they are in memory, in the byte
+ * order of the machine that wrote it; email_store_open() checks the
+ * header and sizes (EINVAL when they are wrong) and trusts the rest, so
+ * only open files written by email_store_save(). A mapped store answers
+ * lookups; adding to it gives EMAIL_STORE_FULL.
+ *
+ * Returns:
+ *   0 / the store, or -1 / NULL with errno set
+ */
+int email_store_save(const email_store* store, const char* path);
+email_store* email_store_open(const char* path);
+
+/**
+ * Function: email_store_snapshot
+ * Purpose: Copies the sizes of the store into *out
+ */
+void email_store_snapshot(const email_store* store, email_store_stats* out);
+
+/**
+ * A persistent verdict cache, shared by every process that opens the
+ * same file.
+ *
+ * The file is a fixed-size open-addressing table mapped read-write into
+ * each process, so a worker that restarts starts with every verdict its
+ * predecessors recorded, without reading anything. Entries are keyed by
+ * a 64-bit hash of the address with its domain lowercased (the
+ * comparison email_dedup makes) and of the mode the verdict was reached
+ * in, and hold the reason, the DNS status when the domain was checked
+ * and the time of the check. Slots are claimed and updated with
+ * compare-and-swap, so threads and processes read and write it at the
+ * same time with no lock; when the few slots an address may go to are
+ * all taken, the oldest entry among them is replaced.
+ */
+typedef struct email_verdict_cache email_verdict_cache;
+
+// Modes, for the mode argument; verdicts of different modes are different entries
+#define EMAIL_VERDICT_STRICT 1u  // email_check_strict() / email_check_utf8_strict()
+#define EMAIL_VERDICT_UTF8   2u  // email_check_utf8() / email_check_utf8_strict()
+#define EMAIL_VERDICT_RFC    4u  // email_check_rfc(), alone
+
+typedef struct {
+    email_reason reason;     // EMAIL_VALID, or why the address is not
+    int dns;                 // an email_dns_status for the domain, -1 when not checked
+    uint32_t checked_at;     // seconds since the epoch; 0 in a put means now
+} email_verdict;
+
+typedef struct {
+    uint64_t slots;          // entries the file holds
+    uint64_t used;           // slots ever filled, by any process
+    uint64_t hits;           // lookups answered, by this handle
+    uint64_t misses;         // lookups not answered: absent, or older than asked
+    uint64_t stores;         // verdicts written
+    uint64_t evictions;      // of those, the ones that replaced another address
+} email_verdict_cache_stats;
+
+/**
+ * Function: email_verdict_cache_open / email_verdict_cache_close
+ * Purpose: Maps the cache at path, creating it with room for slots
+ *          entries (0 = 1 Mi, 16 MiB; rounded up to a power of two) when
+ *          it does not exist / unmaps it; NULL is ignored
+ *
+ * An existing cache keeps the size it was created with. Opening is
+ * serialized with flock(), so processes racing to create the file agree
+ * on one. The entries live in the shared mapping: they outlast every
+ * process, and reach the disk whenever the kernel writes the pages back.
+ *
+ * Returns:
+ *   the cache, or NULL with errno set (EINVAL: path is not a verdict
+ *   cache of this build's format and byte order)
+ */
+email_verdict_cache* email_verdict_cache_open(const char* path, size_t slots);
+void email_verdict_cache_close(email_verdict_cache* cache);
+
+/**
+ * Function: email_verdict_cache_get
+ * Purpose: Looks up the verdict of p[0..len) in mode (EMAIL_VERDICT_*
+ *          flags, 0 for email_check())
+ *
+ * A verdict checked more than max_age seconds ago counts as absent;
+ * max_age 0 accepts any age.
+ *
+ * Returns:
+ *   true with the verdict in *out, or false
+ */
+bool email_verdict_cache_get(email_verdict_cache* cache, unsigned mode,
+                             const char* p, size_t len, uint32_t max_age,
+                             email_verdict* out);
+
+/**
+ * Function: email_verdict_cache_put
+ * Purpose: Records the verdict of p[0..len) in mode, replacing the one
+ *          there was
+ *
+ * Addresses longer than MAX_EMAIL_LENGTH are not kept. A put that races
+ * with another for the same address keeps one of the two.
+ */
+void email_verdict_cache_put(email_verdict_cache* cache, unsigned mode,
+                             const char* p, size_t len, const email_verdict* verdict);
+
+/**
+ * Function: email_verdict_cache_snapshot
+ * Purpose: Copies the size and counters of the cache into *out
+ */
+void email_verdict_cache_snapshot(email_verdict_cache* cache,
+                                  email_verdict_cache_stats* out);
+
+/**
+ * A blocked Bloom filter of addresses, to screen validated addresses
+ * against a blocklist or suppression list too large to keep in memory, so
+ * that only the likely members are looked up in the store that has it.
+ *
+ * The filter is an array of 64-byte blocks, one cache line each; an
+ * address sets one bit in each of the eight 64-bit words of the one block
+ * its hash picks, so a probe is a single cache miss and, with AVX2, one
+ * vector compare. Addresses compare as email_dedup does (domain
+ * lowercased). The false positive rate at 16 bits per address is about
+ * 0.09%, at 12 about 0.4%, at 8 about 3%; there are no false negatives.
+ *
+ * email_bloom_save() writes the blocks as one file that email_bloom_open()
+ * maps read-only, as email_store does. A filter is built by one thread at
+ * a time; any number may probe it while none adds.
+ */
+typedef struct email_bloom email_bloom;
+
+typedef struct {
+    uint64_t blocks;         // 64-byte blocks
+    uint64_t addresses;      // addresses added
+    size_t memory;           // bytes allocated or mapped
+} email_bloom_stats;
+
+/**
+ * Function: email_bloom_create / email_bloom_destroy
+ * Purpose: Makes an empty filter for expected_addresses (0 = 1 Mi) at
+ *          bits_per_address bits each (0 = 16), NULL when out of memory /
+ *          frees or unmaps it; NULL is ignored
+ *
+ * The memory is mapped lazily, so pages no address touches stay unused.
+ */
+email_bloom* email_bloom_create(uint64_t expected_addresses, unsigned bits_per_address);
+void email_bloom_destroy(email_bloom* bloom);
+
+/**
+ * Function: email_bloom_add
+ * Purpose: Adds p[0..len) to the filter
+ *
+ * Returns:
+ *   false, with nothing added, for NULL, an address longer than
+ *   MAX_EMAIL_LENGTH, or a filter opened from a file
+ */
+bool email_bloom_add(email_bloom* bloom, const char* p, size_t len);
+
+/**
+ * Function: email_bloom_maybe_contains
+ * Purpose: false when p[0..len) was never added; true when it was, or,
+ *          rarely, when it was not
+ */
+bool email_bloom_maybe_contains(const email_bloom* bloom, const char* p, size_t len);
+
+/**
+ * Function: email_bloom_screen_batch
+ * Purpose: The stage after validate_emails_batch(): probes the filter for
+ *          every address whose bit is set in valid_bitmap
+ *
+ * Parameters:
+ *   ptrs, lens   - the addresses, as for validate_emails_batch()
+ *   valid_bitmap - the bitmap it wrote, or NULL to probe every address
+ *   out_bitmap   - receives (n + 7) / 8 bytes; bit i is set when address i
+ *                  was probed and may be in the filter
+ *
+ * The hashes of a group of addresses are computed and their blocks
+ * prefetched before any is probed, so the cache misses overlap.
+ *
+ * Returns:
+ *   the number of bits set in out_bitmap
+ */
+size_t email_bloom_screen_batch(const email_bloom* bloom, const char* const* ptrs,
+                                const size_t* lens, size_t n,
+                                const uint8_t* valid_bitmap, uint8_t* out_bitmap);
+
+/**
+ * Function: email_bloom_save / email_bloom_open
+ * Purpose: Writes the filter to path, through a temporary file renamed
+ *          over it / maps a file written that way
+ *
+ * The file is in the byte order of the machine that wrote it;
+ * email_bloom_open() checks the header and the size (EINVAL when they are
+ * wrong).
+ *
+ * Returns:
+ *   0 / the filter, or -1 / NULL with errno set
+ */
+int email_bloom_save(const email_bloom* bloom, const char* path);
+email_bloom* email_bloom_open(const char* path);
+
+/**
+ * Function: email_bloom_snapshot
+ * Purpose: Copies the size of the filter into *out
+ */
+void email_bloom_snapshot(const email_bloom* bloom, email_bloom_stats* out);
+
+/**
+ * Classification of valid addresses: disposable-mail domains and role
+ * accounts, for signup forms that turn them away.
+ *
+ * Domains are kept in a trie of labels read from the right, so a listed
+ * "mailinator.com" also matches "x.mailinator.com"; role local parts
+ * ("admin", "noreply") in a hash set, matched up to a "+tag". Both
+ * compare case-insensitively. A query costs one hash lookup per domain
+ * label plus one for the local part, and allocates nothing. A classifier
+ * is built by one thread; any number may query it while none adds.
+ */
+typedef struct email_classifier email_classifier;
+
+#define EMAIL_CLASS_DISPOSABLE 1u  // the domain, or one it is under, is listed disposable
+#define EMAIL_CLASS_ROLE       2u  // the local part, up to a '+', is a listed role
+
+typedef struct {
+    uint64_t domains;        // disposable domains listed
+    uint64_t roles;          // role local parts listed
+    uint64_t nodes;          // trie nodes, the root included
+    size_t memory;           // bytes allocated in all
+} email_classifier_stats;
+
+/**
+ * Function: email_classifier_create / email_classifier_destroy
+ * Purpose: Makes a classifier with empty lists, NULL when out of memory /
+ *          frees it; NULL is ignored
+ */
+email_classifier* email_classifier_create(void);
+void email_classifier_destroy(email_classifier* c);
+
+/**
+ * Function: email_classifier_add
+ * Purpose: Lists p[0..len) as a disposable domain (kind
+ *          EMAIL_CLASS_DISPOSABLE) or a role local part (EMAIL_CLASS_ROLE)
+ *
+ * Returns:
+ *   0, or -1 with errno set: EINVAL for another kind or an entry that is
+ *   not a domain / a local part without '+', ENOMEM
+ */
+int email_classifier_add(email_classifier* c, unsigned kind, const char* p, size_t len);
+
+/**
+ * Function: email_classifier_load_list / email_classifier_load_file
+ * Purpose: Lists every line of text[0..len) / of the file at path as kind
+ *
+ * One entry per line; '#' starts a comment line, blank lines and
+ * surrounding spaces are ignored, as in a TLD list. Returns as
+ * email_classifier_add() for the first line that fails, with the lines
+ * before it listed, or with errno from the failed call on an I/O error.
+ */
+int email_classifier_load_list(email_classifier* c, unsigned kind, const char* text,
+                               size_t len);
+int email_classifier_load_file(email_classifier* c, unsigned kind, const char* path);
+
+/**
+ * Function: email_classify
+ * Purpose: The EMAIL_CLASS_* flags of p[0..len), split at its last '@'
+ *
+ * The address is not validated; 0 for NULL or no '@'.
+ */
+unsigned email_classify(const email_classifier* c, const char* p, size_t len);
+
+/**
+ * Function: email_check_classified
+ * Purpose: email_check(), with the EMAIL_CLASS_* flags of a valid address
+ *          in *flags (0 for an invalid one; may be NULL)
+ *
+ * The address is split at the '@' the validation scan found, so nothing
+ * is scanned twice.
+ */
+email_reason email_check_classified(const email_classifier* c, const char* p, size_t len,
+                                    size_t* offset, unsigned* flags);
+
+/**
+ * Function: email_classify_batch
+ * Purpose: The stage after validate_emails_batch(): out_flags[i] receives
+ *          the flags of address i when its bit is set in valid_bitmap
+ *          (NULL: every address), and 0 otherwise
+ *
+ * Returns:
+ *   the number of addresses with a flag
+ */
+size_t email_classify_batch(const email_classifier* c, const char* const* ptrs,
+                            const size_t* lens, size_t n, const uint8_t* valid_bitmap,
+                            uint8_t* out_flags);
+
+/**
+ * Function: email_classifier_snapshot
+ * Purpose: Copies the sizes of the classifier into *out
+ */
+void email_classifier_snapshot(const email_classifier* c, email_classifier_stats* out);
+
+#define EMAIL_MAX_THREADS 256
+
+/**
+ * Options for validate_emails_parallel(); zero fields take the default.
+ */
+typedef struct {
+    unsigned threads;     // worker threads, 0 = one per online CPU
+    size_t chunk_size;    // addresses per work item, rounded up to 512
+    bool domain_cache;    // share one email_domain_cache between the workers
+    email_dedup* dedup;   // validate each distinct address once, may be NULL;
+                          // address i is added as line i + 1
+} email_parallel_options;
+
+/**
+ * Counters kept by each worker thread while it validates.
+ */
+typedef struct {
+    uint64_t valid;       // addresses accepted
+    uint64_t invalid;     // addresses rejected
+    uint64_t bytes;       // address bytes validated
+    uint64_t chunks;      // chunks validated
+    uint64_t steals;      // times this thread stole work from another
+    uint64_t duplicates;  // addresses found in opts->dedup, not validated again
+} email_thread_stats;
+
+typedef struct {
+    unsigned threads;                                // workers actually used
+    email_thread_stats total;                        // sum over all workers
+    email_thread_stats per_thread[EMAIL_MAX_THREADS];
+} email_parallel_stats;
+
+/**
+ * Function: validate_emails_parallel
+ * Purpose: Validates a large array of addresses on a work-stealing pool
+ *
+ * Same inputs and output bitmap as validate_emails_batch(); the bitmap is
+ * in input order. opts and stats may be NULL. Returns the number of valid
+ * addresses.
+ */
+size_t validate_emails_parallel(const char* const* ptrs, const size_t* lens,
+                                size_t n, uint8_t* out_bitmap,
+                                const email_parallel_options* opts,
+                                email_parallel_stats* stats);
+
+/**
+ * Called by the streaming validators for every line, in input order.
+ * line is a view into the input (without the line ending) that is only
+ * valid during the call; line_no counts from 1. A non-zero return value
+ * stops the scan.
+ */
+typedef int (*email_line_fn)(const char* line, size_t len, uint64_t line_no,
+                             bool valid, void* ctx);
+
+typedef struct {
+    uint64_t lines;       // lines seen
+    uint64_t valid;       // lines that are valid addresses
+    uint64_t invalid;     // lines that are not
+    uint64_t bytes;       // bytes in the lines, line endings excluded
+    uint64_t unique;      // with opts->dedup: lines not seen before
+    uint64_t duplicates;  // with opts->dedup: lines seen before
+} email_stream_stats;
+
+/**
+ * Function: validate_email_stream_fd
+ * Purpose: Validates every newline-delimited line read from fd
+ *
+ * Regular files are memory-mapped; pipes and terminals are read in large
+ * blocks of bounded memory (a line too long to be an address reaches fn
+ * cut short, still invalid). fn and stats may be NULL. Returns 0 at end
+ * of input, -1 with errno set on an I/O error, or the non-zero value
+ * returned by fn.
+ */
+int validate_email_stream_fd(int fd, email_line_fn fn, void* ctx,
+                             email_stream_stats* stats);
+
+/**
+ * Function: validate_email_file
+ * Purpose: Same as validate_email_stream_fd() for the file at path;
+ *          "-" means standard input
+ */
+int validate_email_file(const char* path, email_line_fn fn, void* ctx,
+                        email_stream_stats* stats);
+
+/**
+ * Called instead of the line callback for a line that is a duplicate of
+ * line first_line (see email_stream_options.dedup).
+ */
+typedef int (*email_duplicate_fn)(const char* line, size_t len, uint64_t line_no,
+                                  uint64_t first_line, bool valid, void* ctx);
+
+/**
+ * Options for validate_email_stream_fd_ex(); zero means the default.
+ */
+typedef struct {
+    bool strict;          // also require a known TLD (is_valid_email_strict())
+    bool utf8;            // accept internationalized addresses
+                          // (is_valid_email_utf8()); no domain cache then
+    bool rfc;             // RFC 5321 mode (is_valid_email_rfc()), instead of
+                          // strict and utf8; no domain cache then
+    bool domain_cache;    // cache domain verdicts (see email_domain_cache)
+    email_dedup* dedup;   // skip lines already in this set, may be NULL: they
+                          // keep the verdict of their first occurrence and go
+                          // to on_duplicate instead of the line callback
+    email_duplicate_fn on_duplicate;  // may be NULL; gets the same ctx
+    email_verdict_cache* verdicts;    // take verdicts from this cache and
+                                      // record new ones there, may be NULL
+} email_stream_options;
+
+/**
+ * Function: validate_email_stream_fd_ex / validate_email_file_ex
+ * Purpose: validate_email_stream_fd() / validate_email_file() with
+ *          options; opts may be NULL
+ */
+int validate_email_stream_fd_ex(int fd, const email_stream_options* opts,
+                                email_line_fn fn, void* ctx,
+                                email_stream_stats* stats);
+int validate_email_file_ex(const char* path, const email_stream_options* opts,
+                           email_line_fn fn, void* ctx,
+                           email_stream_stats* stats);
+
+/**
+ * Pipelined validation
+ *
+ * An email_pipeline runs the streaming validator as five stages on
+ * threads of their own, so reading, splitting, validating, enriching and
+ * writing overlap instead of taking turns:
+ *
+ *   read      read() blocks of input, whole lines each
+ *   split     cut a block into batches of up to batch_size lines
+ *   validate  one or more threads, each validating whole batches
+ *   enrich    the caller's per-batch stage (DNS, classification, ...)
+ *   write     the caller's output stage, given the batches in input order
+ *
+ * Stages hand each other batch descriptors, never single lines, through
+ * bounded lock-free single-producer single-consumer rings; with several
+ * validators the split stage deals batches to them in turn and the enrich
+ * stage collects them in the same turn, which keeps the input order. A
+ * full ring stops the stage that feeds it, and a fixed pool of blocks and
+ * batches bounds the memory, so a slow stage holds up the ones before it
+ * rather than letting work pile up. Every stage counts its work, its time
+ * busy, starved (waiting for input) and blocked (waiting for room), and
+ * the depth of its input ring, readable while the pipeline runs: the
+ * bottleneck is the stage that is busy while its neighbours wait on it.
+ */
+typedef struct email_pipeline email_pipeline;
+
+typedef enum {
+    EMAIL_PIPE_READ,
+    EMAIL_PIPE_SPLIT,
+    EMAIL_PIPE_VALIDATE,
+    EMAIL_PIPE_ENRICH,
+    EMAIL_PIPE_WRITE,
+    EMAIL_PIPE_STAGE_COUNT
+} email_pipe_stage;
+
+/**
+ * A batch as the enrich and write stages see it: count lines of the input
+ * (line endings dropped) from line first_line on, views into the block
+ * they were read into and valid only during the call.
+ */
+typedef struct {
+    uint64_t first_line;     // line number of lines[0], counting from 1
+    size_t count;
+    const char* const* lines;
+    const size_t* lens;
+    const uint8_t* valid;    // bitmap, bit i for line i
+    uint8_t* flags;          // count bytes, zeroed, for the enrich stage to fill
+                             // (EMAIL_CLASS_* or anything else) and write to read
+} email_pipe_batch;
+
+/**
+ * Called for every batch on the enrich / write stage thread. A non-zero
+ * return value stops the pipeline.
+ */
+typedef int (*email_pipe_fn)(email_pipe_batch* batch, void* ctx);
+
+/**
+ * Options for email_pipeline_start(); zero fields take the default.
+ */
+typedef struct {
+    unsigned validators;     // validate stage threads, default 1
+    size_t batch_size;       // lines per batch, default 4096
+    size_t block_size;       // bytes per read(), default 1 MiB, at least 1 KiB; a line
+                             // longer than any address reaches the callbacks cut short
+    unsigned blocks;         // blocks in flight, default 8 (1 also means 8)
+    unsigned queue_depth;    // batches per ring, default 64; rounded up to a power of two
+    bool strict;             // as in email_stream_options
+    bool utf8;
+    bool rfc;
+    bool domain_cache;       // one email_domain_cache shared by the validators
+    bool pin;                // pin each stage thread to a CPU of its own, in stage order
+    email_pipe_fn enrich;    // may be NULL
+    void* enrich_ctx;
+    email_pipe_fn write;     // may be NULL
+    void* write_ctx;
+} email_pipeline_options;
+
+typedef struct {
+    unsigned threads;
+    uint64_t batches;        // batches that left the stage (blocks, for read)
+    uint64_t lines;
+    uint64_t bytes;
+    uint64_t busy_ns;        // working
+    uint64_t starved_ns;     // waiting for input
+    uint64_t blocked_ns;     // waiting for room downstream, or for a free block / batch
+    size_t queue_depth;      // batches waiting in the stage's input ring(s) now
+    size_t queue_peak;       // most ever waiting
+    size_t queue_capacity;   // room in the input ring(s)
+} email_pipe_stage_stats;
+
+typedef struct {
+    email_pipe_stage_stats stage[EMAIL_PIPE_STAGE_COUNT];
+    uint64_t valid;          // lines written that are valid addresses
+    uint64_t invalid;
+    uint64_t elapsed_ns;     // since the start
+} email_pipeline_stats;
+
+/**
+ * Function: email_pipeline_start / email_pipeline_wait
+ * Purpose: Starts the stage threads on fd (which stays open and the
+ *          caller's) / waits for the end of the input, or for a stage to
+ *          stop it, joins the threads and frees the pipeline
+ *
+ * stats (may be NULL) receives the final counters.
+ *
+ * Returns:
+ *   the pipeline, or NULL with errno set / 0, -1 with errno set on a read
+ *   error, or the non-zero value returned by a callback
+ */
+email_pipeline* email_pipeline_start(int fd, const email_pipeline_options* opts);
+int email_pipeline_wait(email_pipeline* p, email_pipeline_stats* stats);
+
+/**
+ * Function: email_pipeline_snapshot
+ * Purpose: Copies the counters of a running pipeline into *out; any
+ *          thread may call it while the stages run
+ */
+void email_pipeline_snapshot(email_pipeline* p, email_pipeline_stats* out);
+
+/**
+ * Function: email_pipeline_stage_name
+ * Purpose: The stage as a lowercase word ("validate")
+ */
+const char* email_pipeline_stage_name(email_pipe_stage stage);
+
+/**
+ * Asynchronous MX verification
+ *
+ * An email_dns resolver checks that the domains of valid addresses can
+ * receive mail: an MX record, or failing that an A record (RFC 5321
+ * section 5.1). It runs its own thread around a c-ares channel, so the
+ * thread that validates only hands domains over and never waits on the
+ * network. Without c-ares at build time email_dns_create() fails with
+ * ENOTSUP.
+ */
+typedef struct email_dns email_dns;
+
+typedef enum {
+    EMAIL_DNS_MX,         // the domain has MX records
+    EMAIL_DNS_A,          // no MX record, but an A record (the implicit MX)
+    EMAIL_DNS_NO_MAIL,    // the domain exists without either, or has a null MX
+    EMAIL_DNS_NXDOMAIN,   // the domain does not exist
+    EMAIL_DNS_TIMEOUT,    // no answer within the timeout
+    EMAIL_DNS_FAILED,     // server failure, refused, ...
+    EMAIL_DNS_CANCELLED   // the resolver was destroyed first
+} email_dns_status;
+
+/**
+ * Options for email_dns_create(); zero fields take the default.
+ */
+typedef struct {
+    unsigned max_in_flight;  // domains being resolved at once, default 64
+    unsigned max_pending;    // requests accepted and not yet answered, default 4096
+    unsigned timeout_ms;     // per try, default 2000
+    unsigned tries;          // default 2
+    unsigned cache_size;     // domains whose answer is remembered, default 4096
+    unsigned max_ttl;        // cap on the record TTL, in seconds, default 3600
+    unsigned negative_ttl;   // cap on how long NXDOMAIN/NO_MAIL is kept, default 300
+    const char* servers;     // "host[:port],..." instead of /etc/resolv.conf, may be NULL
+} email_dns_options;
+
+typedef struct {
+    uint64_t submitted;      // requests accepted
+    uint64_t cache_hits;     // answered from the cache
+    uint64_t joined;         // attached to a query already running for the domain
+    uint64_t queries;        // DNS queries sent (MX, and A after an empty MX answer)
+    uint64_t timeouts;       // domains that timed out
+    uint64_t in_flight;      // domains being resolved now
+    uint64_t in_flight_peak; // most domains ever resolved at once
+} email_dns_stats;
+
+/**
+ * Called once per request on the resolver thread, with the domain in
+ * lowercase. It must not block for long, and must not destroy the resolver.
+ */
+typedef void (*email_dns_fn)(const char* domain, size_t len,
+                             email_dns_status status, void* ctx);
+
+/**
+ * Function: email_dns_create / email_dns_destroy
+ * Purpose: Starts a resolver; opts may be NULL. Destroying it cancels what
+ *          is still pending (EMAIL_DNS_CANCELLED) and joins its thread.
+ *          create returns NULL with errno set on failure.
+ */
+email_dns* email_dns_create(const email_dns_options* opts);
+void email_dns_destroy(email_dns* dns);
+
+/**
+ * Function: email_dns_submit
+ * Purpose: Queues domain[0..len) for verification; fn(ctx) gets the answer
+ *
+ * Never blocks and may be called from any thread. Only one query runs per
+ * domain: requests for a domain already being resolved wait for its answer.
+ * Returns 0, or -1 with errno EAGAIN when max_pending requests are
+ * outstanding, or EINVAL for an empty or over-long domain.
+ */
+int email_dns_submit(email_dns* dns, const char* domain, size_t len,
+                     email_dns_fn fn, void* ctx);
+
+/**
+ * Function: email_dns_submit_address
+ * Purpose: email_dns_submit() for the domain of the valid address p[0..len),
+ *          everything after its last '@'
+ */
+int email_dns_submit_address(email_dns* dns, const char* p, size_t len,
+                             email_dns_fn fn, void* ctx);
+
+/**
+ * Function: email_dns_wait
+ * Purpose: Waits until every submitted request has been answered, or for
+ *          at most timeout_ms (negative: no limit); returns 0, or -1 with
+ *          errno ETIMEDOUT
+ */
+int email_dns_wait(email_dns* dns, int timeout_ms);
+
+/**
+ * Function: email_dns_snapshot
+ * Purpose: Copies the counters of the resolver into *out
+ */
+void email_dns_snapshot(email_dns* dns, email_dns_stats* out);
+
+/**
+ * Function: email_dns_status_name
+ * Purpose: Returns the name of a status ("MX", "NXDOMAIN", ...)
+ */
+const char* email_dns_status_name(email_dns_status status);
+
+/**
+ * Validation service
+ *
+ * email_server_start() serves the validator over TCP or a Unix socket.
+ * The protocol is line based: a client sends addresses one per line
+ * ("\n" or "\r\n") and receives one reply line per address, in order:
+ *
+ *   OK
+ *   ERR <reason> <offset>      e.g. "ERR TLD_TOO_SHORT 9" (see email_check())
+ *
+ * Requests can be pipelined: whatever has arrived is validated as one
+ * batch and answered with one write. Every reactor thread runs its own
+ * edge-triggered epoll loop; for TCP each one listens on its own
+ * SO_REUSEPORT socket, so the kernel spreads connections over them.
+ *
+ * A connection that starts with "GET " is answered with one HTTP response
+ * instead: the server counters and, in an EMAIL_VALIDATE_METRICS build,
+ * email_metrics_prometheus(), so a Prometheus server can scrape
+ * http://host:port/metrics directly.
+ */
+typedef struct email_server email_server;
+
+typedef struct {
+    const char* listen;   // "host:port", ":port" (any address) or "unix:/path";
+                          // port 0 picks a free port, see email_server_port()
+    unsigned reactors;    // event loop threads, 0 = one per online CPU
+    bool pin;             // pin reactor i to CPU i
+    bool strict;          // also require a known TLD
+    bool utf8;            // accept internationalized addresses; no domain cache then
+    bool rfc;             // RFC 5321 mode instead of strict and utf8; no domain cache then
+    bool domain_cache;    // share one email_domain_cache between the reactors
+} email_server_options;
+
+typedef struct {
+    unsigned reactors;
+    uint64_t connections;   // accepted so far
+    uint64_t requests;      // lines answered
+    uint64_t valid;
+    uint64_t invalid;
+    uint64_t bytes;         // bytes received
+} email_server_stats;
+
+/**
+ * Function: email_server_start
+ * Purpose: Binds the listening socket(s) and starts the reactor threads
+ *
+ * Returns:
+ *   the running server, or NULL with errno set (EINVAL for an address
+ *   that cannot be parsed, or what socket(), bind() or listen() failed with)
+ */
+email_server* email_server_start(const email_server_options* opts);
+
+/**
+ * Function: email_server_stop
+ * Purpose: Stops the reactors, closes every connection and frees the
+ *          server (a Unix socket is unlinked); NULL is ignored
+ */
+void email_server_stop(email_server* server);
+
+/**
+ * Function: email_server_port
+ * Purpose: Returns the TCP port the server listens on, 0 for a Unix socket
+ */
+unsigned email_server_port(const email_server* server);
+
+/**
+ * Function: email_server_snapshot
+ * Purpose: Copies the counters summed over all reactors into *out
+ */
+void email_server_snapshot(email_server* server, email_server_stats* out);
+
+/**
+ * Function: is_valid_email_reference
+ * Purpose: The original rule-by-rule implementation of the validator
+ *
+ * Kept as the reference the single-pass validator is diffed against;
+ * it always accepts and rejects exactly the same addresses.
+ */
+bool is_valid_email_reference(const char* email);
+
+#ifdef __cplusplus
+}
+
+#include <string_view>
+
+/**
+ * Function: is_valid_email (C++)
+ * Purpose: Validates a std::string_view in place, without copying it
+ */
+inline bool is_valid_email(std::string_view email) {
+    return is_valid_email_n(email.data(), email.size());
+}
+#endif
+
+#endif  // EMAIL_VALIDATE_H
@@ -0,0 +1,253 @@
+#ifndef EMAIL_VALIDATE_HPP
+#define EMAIL_VALIDATE_HPP
+
+/*
+ * Compile-time configurable validation for C++17
+ *
+ * email::validate<Policy>(s) applies the rules of is_valid_email_n(), with
+ * the length limits, the TLD minimum and the extra local-part characters
+ * taken from Policy, a struct of constexpr members. Each policy gets its
+ * own transition table built at compile time, so validating is one table
+ * load per byte with no branches; a rule a policy does not use is simply
+ * not in its table and costs nothing.
+ *
+ * Everything is constexpr: email::valid("noreply@example.com") can be used
+ * in static_assert() and in constant tables. The character classes and
+ * limits come from email_rules.h, the same definitions the C library is
+ * built from, so the compile-time and run-time answers cannot drift apart.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "email_rules.h"
+#include "email_validate.h"
+
+namespace email {
+
+/**
+ * The rules of is_valid_email(). New policies derive from it and
+ * override the members they change.
+ */
+struct default_policy {
+    static constexpr std::size_t min_length = MIN_EMAIL_LENGTH;
+    static constexpr std::size_t max_length = MAX_EMAIL_LENGTH;
+    static constexpr std::size_t min_tld_length = EMAIL_MIN_TLD_LENGTH;  // after the last '.'
+    static constexpr bool allow_plus = true;          // '+' in the local part
+    static constexpr bool allow_underscore = true;    // '_' in the local part
+};
+
+/**
+ * No plus-addressing ("user+tag@example.com"), e.g. for billing contacts.
+ */
+struct no_plus_policy : default_policy {
+    static constexpr bool allow_plus = false;
+};
+
+namespace detail {
+
+/*
+ * What a byte can be, as far as the rules care
+ */
+enum byte_kind : std::uint8_t {
+    KIND_ALNUM,       // letter or digit
+    KIND_DOT,         // '.'
+    KIND_HYPHEN,      // '-'
+    KIND_AT,          // '@'
+    KIND_LOCAL_ONLY,  // allowed in the local part only ('+', '_')
+    KIND_OTHER        // never allowed
+};
+
+// Built from EMAIL_CHAR_CLASS() (email_rules.h), like the C class table
+template <class Policy>
+constexpr byte_kind kind_of(unsigned c) {
+    unsigned cls = EMAIL_CHAR_CLASS(c);
+
+    if (cls & EMAIL_CHAR_ALNUM) {
+        return KIND_ALNUM;
+    }
+    if (cls & EMAIL_CHAR_DOT) {
+        return KIND_DOT;
+    }
+    if (cls & EMAIL_CHAR_HYPHEN) {
+        return KIND_HYPHEN;
+    }
+    if (c == '@') {
+        return KIND_AT;
+    }
+    if (cls & EMAIL_CHAR_LOCAL) {
+        if ((c == '+' && !Policy::allow_plus) || (c == '_' && !Policy::allow_underscore)) {
+            return KIND_OTHER;
+        }
+        return KIND_LOCAL_ONLY;
+    }
+    return KIND_OTHER;
+}
+
+/*
+ * States of the scan. They are the states of email_scan() with the domain
+ * split further, so that "has a '.'" and "length of the TLD so far" are
+ * part of the state instead of variables checked at the end:
+ *
+ *   REJECT        - a rule is broken; every byte keeps it here
+ *   LOCAL_START   - nothing read yet
+ *   LOCAL         - last byte was a local-part character other than '.'
+ *   LOCAL_DOT     - last byte was a '.' in the local part
+ *   DOMAIN_START  - last byte was the '@'
+ *   LABEL         - in the first domain label, last byte a letter or digit
+ *   LABEL_HYPHEN  - in the first domain label, last byte a '-'
+ *   DOMAIN_DOT    - last byte was a '.' in the domain
+ *   TLD + 2 * (k - 1) + h
+ *                 - k bytes after the last '.' (counting stops at
+ *                   min_tld_length), h = 1 when the last one was a '-'
+ *
+ * The address is valid when the scan ends in the TLD state with
+ * k = min_tld_length and h = 0.
+ */
+enum : std::uint8_t {
+    REJECT,
+    LOCAL_START,
+    LOCAL,
+    LOCAL_DOT,
+    DOMAIN_START,
+    LABEL,
+    LABEL_HYPHEN,
+    DOMAIN_DOT,
+    TLD
+};
+
+template <class Policy>
+struct dfa {
+    static_assert(Policy::min_tld_length >= 1 && Policy::min_tld_length <= 63,
+                  "min_tld_length must be between 1 and 63");
+    static_assert(Policy::min_length <= Policy::max_length,
+                  "min_length must not exceed max_length");
+
+    static constexpr std::size_t tld_states = Policy::min_tld_length;
+    static constexpr std::size_t state_count = TLD + 2 * tld_states;
+    static constexpr std::uint8_t accept = TLD + 2 * (tld_states - 1);
+
+    std::uint8_t next[state_count][256] = {};
+};
+
+// The TLD state after k bytes past the last '.'
+template <class Policy>
+constexpr std::uint8_t tld_state(std::size_t k, bool hyphen) {
+    if (k > Policy::min_tld_length) {
+        k = Policy::min_tld_length;
+    }
+    return static_cast<std::uint8_t>(TLD + 2 * (k - 1) + (hyphen ? 1 : 0));
+}
+
+template <class Policy>
+constexpr std::uint8_t next_state(std::uint8_t state, byte_kind kind) {
+    switch (state) {
+    case LOCAL_START:
+    case LOCAL:
+    case LOCAL_DOT:
+        if (kind == KIND_ALNUM || kind == KIND_HYPHEN || kind == KIND_LOCAL_ONLY) {
+            return LOCAL;
+        }
+        // Leading, trailing and consecutive dots are rejected here
+        if (kind == KIND_DOT && state == LOCAL) {
+            return LOCAL_DOT;
+        }
+        if (kind == KIND_AT && state == LOCAL) {
+            return DOMAIN_START;
+        }
+        return REJECT;
+
+    case DOMAIN_START:
+        // The domain cannot start with '.' or '-'
+        return kind == KIND_ALNUM ? LABEL : REJECT;
+
+    case LABEL:
+    case LABEL_HYPHEN:
+        switch (kind) {
+        case KIND_ALNUM:  return LABEL;
+        case KIND_HYPHEN: return LABEL_HYPHEN;
+        case KIND_DOT:    return DOMAIN_DOT;
+        default:          return REJECT;
+        }
+
+    case DOMAIN_DOT:
+        // No '..' in the domain
+        switch (kind) {
+        case KIND_ALNUM:  return tld_state<Policy>(1, false);
+        case KIND_HYPHEN: return tld_state<Policy>(1, true);
+        default:          return REJECT;
+        }
+
+    case REJECT:
+        return REJECT;
+
+    default: {
+        std::size_t k = (state - TLD) / 2 + 1;
+        switch (kind) {
+        case KIND_ALNUM:  return tld_state<Policy>(k + 1, false);
+        case KIND_HYPHEN: return tld_state<Policy>(k + 1, true);
+        case KIND_DOT:    return DOMAIN_DOT;
+        default:          return REJECT;
+        }
+    }
+    }
+}
+
+template <class Policy>
+constexpr dfa<Policy> build_dfa() {
+    dfa<Policy> d;
+    for (std::size_t s = 0; s < dfa<Policy>::state_count; s++) {
+        for (unsigned c = 0; c < 256; c++) {
+            d.next[s][c] = next_state<Policy>(static_cast<std::uint8_t>(s), kind_of<Policy>(c));
+        }
+    }
+    return d;
+}
+
+// One table per policy, built by the compiler
+template <class Policy>
+inline constexpr dfa<Policy> dfa_table = build_dfa<Policy>();
+
+}  // namespace detail
+
+/**
+ * Function: validate
+ * Purpose: Validates s with the rules of Policy
+ *
+ * Returns:
+ *   true if s is a valid address under Policy, false otherwise
+ *
+ * The length is checked up front; after that every byte is one load from
+ * the policy's transition table, whatever it contains, so the time taken
+ * depends only on the length.
+ */
+template <class Policy = default_policy>
+constexpr bool validate(std::string_view s) noexcept {
+    if (s.size() < Policy::min_length || s.size() > Policy::max_length) {
+        return false;
+    }
+
+    const auto& d = detail::dfa_table<Policy>;
+    std::uint8_t state = detail::LOCAL_START;
+    for (char c : s) {
+        state = d.next[state][static_cast<unsigned char>(c)];
+    }
+    return state == detail::dfa<Policy>::accept;
+}
+
+/**
+ * Function: valid
+ * Purpose: The is_valid_email() rules, usable in constant expressions
+ *
+ *   static_assert(email::valid("noreply@example.com"));
+ *
+ * At run time it gives the same answers as is_valid_email_n().
+ */
+constexpr bool valid(std::string_view s) noexcept {
+    return validate<default_policy>(s);
+}
+
+}  // namespace email
+
+#endif  // EMAIL_VALIDATE_HPP
@@ -0,0 +1,447 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "email_arrow.h"
+#include "email_internal.h"
+
+/*
+ * Arrow columns
+ *
+ * The input is only read: a string column is a validity bitmap, an
+ * offsets buffer and a data buffer, and the batch validator takes the
+ * last two as they are. What is allocated is the result, laid out as the
+ * Arrow specification asks of a producer: every result column is one
+ * 64-byte aligned block holding its buffer pointers and the buffers, and
+ * the struct array around them owns the columns and frees them from its
+ * release callback.
+ */
+#define EMAIL_ARROW_COLUMNS 2
+#define EMAIL_ARROW_ALIGN 64
+
+#define EMAIL_ARROW_ROUND(n) (((n) + EMAIL_ARROW_ALIGN - 1) / EMAIL_ARROW_ALIGN * EMAIL_ARROW_ALIGN)
+
+// The string column being validated, wherever it came from
+typedef struct {
+    int64_t length;
+    int64_t offset;                 // of the first row, in the offsets buffer
+    bool large;                     // int64 offsets
+    const void* offsets;
+    const char* data;
+    const uint8_t* validity;        // NULL when no row is null
+    int64_t validity_offset;
+    const uint8_t* outer_validity;  // that of an enclosing struct, or NULL
+    int64_t outer_offset;
+} email_arrow_strings;
+
+typedef struct {
+    const void* buffers[2];         // validity, values
+} email_arrow_column;
+
+typedef struct {
+    const void* buffers[1];         // the struct itself has no nulls
+    struct ArrowArray* children[EMAIL_ARROW_COLUMNS];
+    struct ArrowArray child[EMAIL_ARROW_COLUMNS];
+} email_arrow_result;
+
+typedef struct {
+    struct ArrowSchema* children[EMAIL_ARROW_COLUMNS];
+    struct ArrowSchema child[EMAIL_ARROW_COLUMNS];
+} email_arrow_result_schema;
+
+static inline bool email_arrow_bit(const uint8_t* bits, int64_t i) {
+    return (bits[i >> 3] >> (i & 7)) & 1;
+}
+
+// ---- Input ---------------------------------------------------------------------
+
+static int email_arrow_string_column(const struct ArrowSchema* schema,
+                                     const struct ArrowArray* array, email_arrow_strings* s) {
+    const char* format = schema->format;
+    if (format == NULL || array->release == NULL || array->length < 0 || array->offset < 0) {
+        return EINVAL;
+    }
+    if (strcmp(format, "u") == 0 || strcmp(format, "z") == 0) {
+        s->large = false;
+    } else if (strcmp(format, "U") == 0 || strcmp(format, "Z") == 0) {
+        s->large = true;
+    } else {
+        return ENOTSUP;
+    }
+    if (array->n_buffers != 3 || array->buffers == NULL ||
+        (array->length > 0 && (array->buffers[1] == NULL || array->buffers[2] == NULL))) {
+        return EINVAL;
+    }
+    if (!s->large && array->offset + array->length > INT32_MAX) {
+        return EINVAL;
+    }
+
+    s->length = array->length;
+    s->offset = array->offset;
+    s->offsets = array->buffers[1];
+    s->data = array->buffers[2];
+    s->validity = array->null_count != 0 ? array->buffers[0] : NULL;
+    s->validity_offset = array->offset;
+    return 0;
+}
+
+// The column to validate: the array itself, or a child of a record batch
+static int email_arrow_find_column(const struct ArrowSchema* schema,
+                                   const struct ArrowArray* array, int64_t column,
+                                   email_arrow_strings* s) {
+    if (schema == NULL || array == NULL || schema->format == NULL) {
+        return EINVAL;
+    }
+    s->outer_validity = NULL;
+    s->outer_offset = 0;
+    if (strcmp(schema->format, "+s") != 0) {
+        return email_arrow_string_column(schema, array, s);
+    }
+
+    if (column < 0 || column >= schema->n_children || column >= array->n_children ||
+        array->release == NULL || array->offset < 0) {
+        return EINVAL;
+    }
+    const struct ArrowArray* child = array->children[column];
+    int rc = email_arrow_string_column(schema->children[column], child, s);
+    if (rc != 0) {
+        return rc;
+    }
+    // The struct's offset and length select from its children
+    if (array->length < 0 || child->length < array->offset + array->length) {
+        return EINVAL;
+    }
+    s->offset += array->offset;
+    s->validity_offset += array->offset;
+    s->length = array->length;
+    if (!s->large && s->offset + s->length > INT32_MAX) {
+        return EINVAL;
+    }
+    if (array->null_count != 0 && array->n_buffers >= 1 && array->buffers[0] != NULL) {
+        s->outer_validity = array->buffers[0];
+        s->outer_offset = array->offset;
+    }
+    return 0;
+}
+
+static inline size_t email_arrow_row(const email_arrow_strings* s, int64_t i, const char** p) {
+    int64_t start, end;
+    if (s->large) {
+        const int64_t* offsets = (const int64_t*)s->offsets + s->offset;
+        start = offsets[i];
+        end = offsets[i + 1];
+    } else {
+        const int32_t* offsets = (const int32_t*)s->offsets + s->offset;
+        start = offsets[i];
+        end = offsets[i + 1];
+    }
+    *p = s->data + start;
+    return end > start ? (size_t)(end - start) : 0;
+}
+
+// ---- Output --------------------------------------------------------------------
+
+static void email_arrow_release_column(struct ArrowArray* array) {
+    free(array->private_data);
+    array->release = NULL;
+}
+
+static void email_arrow_release_result(struct ArrowArray* array) {
+    email_arrow_result* r = array->private_data;
+    for (int64_t i = 0; i < array->n_children; i++) {
+        if (r->child[i].release != NULL) {
+            r->child[i].release(&r->child[i]);
+        }
+    }
+    free(r);
+    array->release = NULL;
+}
+
+static void email_arrow_release_leaf_schema(struct ArrowSchema* schema) {
+    schema->release = NULL;
+}
+
+static void email_arrow_release_result_schema(struct ArrowSchema* schema) {
+    email_arrow_result_schema* r = schema->private_data;
+    for (int64_t i = 0; i < schema->n_children; i++) {
+        if (r->child[i].release != NULL) {
+            r->child[i].release(&r->child[i]);
+        }
+    }
+    free(r);
+    schema->release = NULL;
+}
+
+static int email_arrow_result_schema_make(bool reasons, struct ArrowSchema* out) {
+    email_arrow_result_schema* r = calloc(1, sizeof(*r));
+    if (r == NULL) {
+        return ENOMEM;
+    }
+    static const char* const formats[EMAIL_ARROW_COLUMNS] = { "b", "c" };
+    static const char* const names[EMAIL_ARROW_COLUMNS] = { "valid", "reason" };
+    int64_t columns = reasons ? 2 : 1;
+    for (int64_t i = 0; i < columns; i++) {
+        r->child[i] = (struct ArrowSchema){
+            .format = formats[i], .name = names[i], .flags = ARROW_FLAG_NULLABLE,
+            .release = email_arrow_release_leaf_schema
+        };
+        r->children[i] = &r->child[i];
+    }
+    *out = (struct ArrowSchema){
+        .format = "+s", .n_children = columns, .children = r->children,
+        .release = email_arrow_release_result_schema, .private_data = r
+    };
+    return 0;
+}
+
+/*
+ * Allocates a result column of length rows whose values take value_bytes;
+ * validity is copied in when given. Returns the values buffer.
+ */
+static void* email_arrow_column_make(struct ArrowArray* out, int64_t length, size_t value_bytes,
+                                     const uint8_t* validity, int64_t null_count) {
+    size_t bitmap_bytes = ((size_t)length + 7) / 8;
+    size_t header = EMAIL_ARROW_ROUND(sizeof(email_arrow_column));
+    size_t validity_bytes = validity != NULL ? EMAIL_ARROW_ROUND(bitmap_bytes) : 0;
+    size_t size = header + validity_bytes + EMAIL_ARROW_ROUND(value_bytes + 1);
+
+    char* block = aligned_alloc(EMAIL_ARROW_ALIGN, size);
+    if (block == NULL) {
+        return NULL;
+    }
+    email_arrow_column* column = (email_arrow_column*)block;
+    char* values = block + header + validity_bytes;
+    column->buffers[0] = NULL;
+    if (validity != NULL) {
+        memcpy(block + header, validity, bitmap_bytes);
+        column->buffers[0] = block + header;
+    }
+    column->buffers[1] = values;
+
+    *out = (struct ArrowArray){
+        .length = length, .null_count = validity != NULL ? null_count : 0, .n_buffers = 2,
+        .buffers = column->buffers, .release = email_arrow_release_column, .private_data = block
+    };
+    return values;
+}
+
+// The validity of the result: both the column's and its struct's, from bit 0
+static int64_t email_arrow_validity(const email_arrow_strings* s, uint8_t* out) {
+    int64_t nulls = 0;
+    memset(out, 0, ((size_t)s->length + 7) / 8);
+    for (int64_t i = 0; i < s->length; i++) {
+        bool present = (s->validity == NULL || email_arrow_bit(s->validity, s->validity_offset + i)) &&
+                       (s->outer_validity == NULL ||
+                        email_arrow_bit(s->outer_validity, s->outer_offset + i));
+        out[i >> 3] |= (uint8_t)((unsigned)present << (i & 7));
+        nulls += !present;
+    }
+    return nulls;
+}
+
+/**
+ * Function: email_arrow_validate
+ * Purpose: Validates every row of a string column into a struct array of
+ *          "valid" (boolean) and, with opts->reasons, "reason" (int8)
+ *
+ * A utf8 or binary column with int32 offsets in non-strict mode is handed
+ * to validate_emails_batch_offsets() as it is; large offsets and strict
+ * mode take one call per row. out_schema may be NULL.
+ *
+ * Returns:
+ *   0, EINVAL, ENOTSUP or ENOMEM (see email_arrow.h)
+ */
+int email_arrow_validate(const struct ArrowSchema* schema, const struct ArrowArray* array,
+                         const email_arrow_options* opts, struct ArrowArray* out,
+                         struct ArrowSchema* out_schema) {
+    static const email_arrow_options defaults = { 0, false, false };
+    if (opts == NULL) {
+        opts = &defaults;
+    }
+
+    email_arrow_strings s;
+    int rc = email_arrow_find_column(schema, array, opts->column, &s);
+    if (rc != 0) {
+        return rc;
+    }
+
+    size_t bitmap_bytes = ((size_t)s.length + 7) / 8;
+    uint8_t* validity = NULL;
+    int64_t nulls = 0;
+    if (s.validity != NULL || s.outer_validity != NULL) {
+        validity = malloc(bitmap_bytes + 1);
+        if (validity == NULL) {
+            return ENOMEM;
+        }
+        nulls = email_arrow_validity(&s, validity);
+    }
+
+    email_arrow_result* r = calloc(1, sizeof(*r));
+    if (r == NULL) {
+        free(validity);
+        return ENOMEM;
+    }
+    int64_t columns = opts->reasons ? 2 : 1;
+    uint8_t* bits = email_arrow_column_make(&r->child[0], s.length, bitmap_bytes, validity, nulls);
+    int8_t* reasons = NULL;
+    if (bits != NULL && opts->reasons) {
+        reasons = email_arrow_column_make(&r->child[1], s.length, (size_t)s.length, validity, nulls);
+    }
+    if (bits == NULL || (opts->reasons && reasons == NULL)) {
+        if (r->child[0].release != NULL) {
+            r->child[0].release(&r->child[0]);
+        }
+        free(r);
+        free(validity);
+        return ENOMEM;
+    }
+
+    // The verdicts
+    if (!s.large && !opts->strict && s.length > 0) {
+        validate_emails_batch_offsets(s.data, (const int32_t*)s.offsets + s.offset,
+                                      (size_t)s.length, bits);
+    } else {
+        email_kernel_fn validate = opts->strict ? is_valid_email_strict : email_select_kernel();
+        memset(bits, 0, bitmap_bytes);
+        for (int64_t i = 0; i < s.length; i++) {
+            const char* p;
+            size_t len = email_arrow_row(&s, i, &p);
+            bits[i >> 3] |= (uint8_t)((unsigned)validate(p, len) << (i & 7));
+        }
+    }
+    // Null rows are not valid, whatever their slot holds
+    if (validity != NULL) {
+        for (size_t k = 0; k < bitmap_bytes; k++) {
+            bits[k] &= validity[k];
+        }
+    }
+
+    // The reasons, asked for only where the verdict was no
+    if (reasons != NULL) {
+        for (int64_t i = 0; i < s.length; i++) {
+            email_reason reason = EMAIL_VALID;
+            if (!email_arrow_bit(bits, i) && (validity == NULL || email_arrow_bit(validity, i))) {
+                const char* p;
+                size_t len = email_arrow_row(&s, i, &p);
+                reason = opts->strict ? email_check_strict(p, len, NULL) : email_check(p, len, NULL);
+            }
+            reasons[i] = (int8_t)reason;
+        }
+    }
+    free(validity);
+
+    for (int64_t i = 0; i < columns; i++) {
+        r->children[i] = &r->child[i];
+    }
+    *out = (struct ArrowArray){
+        .length = s.length, .n_buffers = 1, .n_children = columns, .buffers = r->buffers,
+        .children = r->children, .release = email_arrow_release_result, .private_data = r
+    };
+
+    if (out_schema != NULL && (rc = email_arrow_result_schema_make(opts->reasons, out_schema)) != 0) {
+        out->release(out);
+        return rc;
+    }
+    return 0;
+}
+
+// ---- Streams -------------------------------------------------------------------
+
+typedef struct {
+    struct ArrowArrayStream in;
+    struct ArrowSchema in_schema;   // released until the first batch
+    email_arrow_options opts;
+    uint64_t batches;
+    char error[256];
+} email_arrow_stream;
+
+static int email_arrow_stream_schema(struct ArrowArrayStream* stream, struct ArrowSchema* out) {
+    email_arrow_stream* st = stream->private_data;
+    return email_arrow_result_schema_make(st->opts.reasons, out);
+}
+
+static int email_arrow_stream_next(struct ArrowArrayStream* stream, struct ArrowArray* out) {
+    email_arrow_stream* st = stream->private_data;
+    st->error[0] = '\0';
+
+    int rc;
+    if (st->in_schema.release == NULL && (rc = st->in.get_schema(&st->in, &st->in_schema)) != 0) {
+        const char* why = st->in.get_last_error != NULL ? st->in.get_last_error(&st->in) : NULL;
+        snprintf(st->error, sizeof(st->error), "input schema: %s", why != NULL ? why : strerror(rc));
+        return rc;
+    }
+
+    struct ArrowArray batch;
+    if ((rc = st->in.get_next(&st->in, &batch)) != 0) {
+        const char* why = st->in.get_last_error != NULL ? st->in.get_last_error(&st->in) : NULL;
+        snprintf(st->error, sizeof(st->error), "input batch %llu: %s",
+                 (unsigned long long)st->batches, why != NULL ? why : strerror(rc));
+        return rc;
+    }
+    if (batch.release == NULL) {
+        out->release = NULL;   // end of stream
+        return 0;
+    }
+
+    rc = email_arrow_validate(&st->in_schema, &batch, &st->opts, out, NULL);
+    batch.release(&batch);
+    if (rc != 0) {
+        snprintf(st->error, sizeof(st->error), "batch %llu: %s", (unsigned long long)st->batches,
+                 rc == ENOTSUP ? "the column is not a string or binary column" : strerror(rc));
+        return rc;
+    }
+    st->batches++;
+    return 0;
+}
+
+static const char* email_arrow_stream_error(struct ArrowArrayStream* stream) {
+    email_arrow_stream* st = stream->private_data;
+    return st->error[0] != '\0' ? st->error : NULL;
+}
+
+static void email_arrow_stream_release(struct ArrowArrayStream* stream) {
+    email_arrow_stream* st = stream->private_data;
+    if (st->in_schema.release != NULL) {
+        st->in_schema.release(&st->in_schema);
+    }
+    if (st->in.release != NULL) {
+        st->in.release(&st->in);
+    }
+    free(st);
+    stream->release = NULL;
+}
+
+/**
+ * Function: email_arrow_validate_stream
+ * Purpose: Wraps in into a stream of email_arrow_validate() results
+ *
+ * Returns:
+ *   0, EINVAL for a NULL or released input, or ENOMEM
+ */
+int email_arrow_validate_stream(struct ArrowArrayStream* in, const email_arrow_options* opts,
+                                struct ArrowArrayStream* out) {
+    if (in == NULL || in->release == NULL || out == NULL) {
+        return EINVAL;
+    }
+    email_arrow_stream* st = calloc(1, sizeof(*st));
+    if (st == NULL) {
+        return ENOMEM;
+    }
+    if (opts != NULL) {
+        st->opts = *opts;
+    }
+
+    // The stream moves: the caller's copy is marked released
+    st->in = *in;
+    in->release = NULL;
+
+    *out = (struct ArrowArrayStream){
+        .get_schema = email_arrow_stream_schema, .get_next = email_arrow_stream_next,
+        .get_last_error = email_arrow_stream_error, .release = email_arrow_stream_release,
+        .private_data = st
+    };
+    return 0;
+}
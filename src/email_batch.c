@@ -0,0 +1,421 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "email_internal.h"
+
+/*
+ * Batch validation
+ *
+ * Results are packed into a bitmap, least significant bit first, the same
+ * layout as an Arrow validity bitmap: address i is bit (i % 8) of byte
+ * i / 8. The kernel is selected once per batch, and each group of eight
+ * addresses is folded into its output byte without branching on the
+ * verdicts, so the only unpredictable branches left are inside the kernel.
+ */
+#define EMAIL_BATCH_PREFETCH 8  // addresses ahead of the one being validated
+
+// The batch loop. With a duplicate set, address i counts as line
+// first_line + i, and *duplicates receives how many were found in the set
+static inline size_t email_batch_run(const char* const* ptrs, const size_t* lens,
+                                     size_t n, uint8_t* out_bitmap,
+                                     const email_validator* v, email_dedup* dedup,
+                                     uint64_t first_line, uint64_t* duplicates) {
+    size_t valid = 0;
+
+    for (size_t base = 0; base < n; base += 8) {
+        size_t group = n - base < 8 ? n - base : 8;
+        unsigned bits = 0;
+
+        for (size_t j = 0; j < group; j++) {
+            size_t i = base + j;
+            if (i + EMAIL_BATCH_PREFETCH < n) {
+                __builtin_prefetch(ptrs[i + EMAIL_BATCH_PREFETCH]);
+            }
+            bool ok;
+            if (dedup != NULL && ptrs[i] != NULL) {
+                bool dup;
+                uint64_t first;
+                ok = email_dedup_validate(dedup, ptrs[i], lens[i], first_line + i, v,
+                                          &dup, &first);
+                *duplicates += dup;
+            } else {
+                ok = email_validator_run(v, ptrs[i], lens[i]);
+            }
+            bits |= (unsigned)ok << j;
+        }
+
+        out_bitmap[base / 8] = (uint8_t)bits;
+        valid += (size_t)__builtin_popcount(bits);
+    }
+
+    return valid;
+}
+
+void email_validator_select(email_validator* v, bool strict, bool utf8, bool rfc) {
+    v->strict = strict && !rfc;
+    v->max_length = rfc ? EMAIL_RFC_MAX_LENGTH : MAX_EMAIL_LENGTH;
+    if (rfc) {
+        v->validate = is_valid_email_rfc;
+        v->check = email_check_rfc;
+        v->verdict_mode = EMAIL_VERDICT_RFC;
+    } else if (utf8) {
+        v->validate = v->strict ? is_valid_email_utf8_strict : is_valid_email_utf8;
+        v->check = v->strict ? email_check_utf8_strict : email_check_utf8;
+        v->verdict_mode = EMAIL_VERDICT_UTF8 | (v->strict ? EMAIL_VERDICT_STRICT : 0);
+    } else {
+        v->validate = v->strict ? is_valid_email_strict : email_select_kernel();
+        v->check = v->strict ? email_check_strict : email_check;
+        v->verdict_mode = v->strict ? EMAIL_VERDICT_STRICT : 0;
+    }
+}
+
+/**
+ * Function: validate_emails_batch
+ * Purpose: Validates n addresses given as (pointer, length) pairs
+ *
+ * Parameters:
+ *   ptrs       - ptrs[i] points at address i (NULL counts as invalid)
+ *   lens       - lens[i] is the length of address i
+ *   n          - number of addresses
+ *   out_bitmap - receives (n + 7) / 8 bytes; bit i is set when address i
+ *                is valid, unused bits of the last byte are cleared
+ *
+ * Returns:
+ *   the number of valid addresses
+ */
+size_t validate_emails_batch(const char* const* ptrs, const size_t* lens,
+                             size_t n, uint8_t* out_bitmap) {
+    email_validator v = { .validate = email_select_kernel() };
+    EMAIL_METRICS_START(start);
+    size_t valid = email_batch_run(ptrs, lens, n, out_bitmap, &v, NULL, 0, NULL);
+    EMAIL_METRICS_STOP(EMAIL_METRICS_BATCH, start);
+    return valid;
+}
+
+/**
+ * Function: validate_emails_batch_cached
+ * Purpose: validate_emails_batch() with domain verdicts taken from cache
+ *
+ * Parameters:
+ *   ptrs, lens, n, out_bitmap - as for validate_emails_batch()
+ *   cache - a cache from email_domain_cache_create(); it keeps its contents
+ *           between calls, so later batches start warm
+ *
+ * Returns:
+ *   the number of valid addresses
+ */
+size_t validate_emails_batch_cached(const char* const* ptrs, const size_t* lens,
+                                    size_t n, uint8_t* out_bitmap,
+                                    email_domain_cache* cache) {
+    email_validator v = { .validate = email_select_kernel(), .cache = cache };
+    EMAIL_METRICS_START(start);
+    size_t valid = email_batch_run(ptrs, lens, n, out_bitmap, &v, NULL, 0, NULL);
+    EMAIL_METRICS_STOP(EMAIL_METRICS_BATCH, start);
+    return valid;
+}
+
+size_t email_batch_validate(const char* const* ptrs, const size_t* lens, size_t n,
+                            uint8_t* out_bitmap, const email_validator* v) {
+    return email_batch_run(ptrs, lens, n, out_bitmap, v, NULL, 0, NULL);
+}
+
+/**
+ * Function: validate_emails_batch_offsets
+ * Purpose: Validates n addresses stored back to back in one buffer
+ *
+ * Parameters:
+ *   data       - contiguous bytes of all addresses
+ *   offsets    - n + 1 offsets into data; address i is
+ *                data[offsets[i] .. offsets[i + 1]) (Arrow string layout)
+ *   n          - number of addresses
+ *   out_bitmap - receives (n + 7) / 8 bytes, as for validate_emails_batch()
+ *
+ * Returns:
+ *   the number of valid addresses
+ */
+size_t validate_emails_batch_offsets(const char* data, const int32_t* offsets,
+                                     size_t n, uint8_t* out_bitmap) {
+    email_kernel_fn validate = email_select_kernel();
+    size_t valid = 0;
+    EMAIL_METRICS_START(start);
+
+    for (size_t base = 0; base < n; base += 8) {
+        size_t group = n - base < 8 ? n - base : 8;
+        unsigned bits = 0;
+
+        // The data is contiguous, so one prefetch covers the next group
+        __builtin_prefetch(data + offsets[base + group]);
+
+        for (size_t j = 0; j < group; j++) {
+            size_t i = base + j;
+            bits |= (unsigned)validate(data + offsets[i],
+                                       (size_t)(offsets[i + 1] - offsets[i])) << j;
+        }
+
+        out_bitmap[base / 8] = (uint8_t)bits;
+        valid += (size_t)__builtin_popcount(bits);
+    }
+
+    EMAIL_METRICS_STOP(EMAIL_METRICS_BATCH, start);
+    return valid;
+}
+
+/*
+ * Parallel validation
+ *
+ * The input is cut into chunks of chunk_size addresses. Chunks are a
+ * multiple of 512 addresses, so every chunk writes whole 64-byte runs of
+ * the output bitmap and threads never share an output byte. Each worker
+ * starts out owning a contiguous range of chunks and takes them from the
+ * front; a worker that runs dry steals the back half of another worker's
+ * range. A range is one 64-bit word (first chunk in the high half, end in
+ * the low half), so both taking and stealing are a single compare-and-swap.
+ * Results land at their own index in the bitmap, which keeps them in input
+ * order no matter which thread validated them.
+ */
+#define EMAIL_CHUNK_ALIGN 512       // addresses per 64 bytes of bitmap
+#define EMAIL_DEFAULT_CHUNK 4096    // ~64 KiB of pointers and lengths
+
+typedef struct {
+    _Alignas(64) _Atomic uint64_t range;  // (begin << 32) | end, in chunks
+    email_thread_stats stats;             // only written by its own thread
+} email_worker;
+
+typedef struct {
+    const char* const* ptrs;
+    const size_t* lens;
+    size_t n;
+    uint8_t* out_bitmap;
+    size_t chunk_size;
+    email_validator validator;  // its domain cache is shared by all workers
+    email_dedup* dedup;         // may be NULL
+    email_worker* workers;
+    unsigned worker_count;
+} email_parallel_job;
+
+typedef struct {
+    email_parallel_job* job;
+    unsigned index;
+    pthread_t thread;
+    bool started;
+} email_worker_arg;
+
+// Takes the first chunk of a range; returns false when it is empty
+static bool email_range_pop_front(_Atomic uint64_t* range, uint32_t* chunk) {
+    uint64_t r = atomic_load_explicit(range, memory_order_acquire);
+    for (;;) {
+        uint32_t begin = (uint32_t)(r >> 32), end = (uint32_t)r;
+        if (begin >= end) {
+            return false;
+        }
+        uint64_t next = ((uint64_t)(begin + 1) << 32) | end;
+        if (atomic_compare_exchange_weak_explicit(range, &r, next,
+                                                  memory_order_acq_rel,
+                                                  memory_order_acquire)) {
+            *chunk = begin;
+            return true;
+        }
+    }
+}
+
+// Takes the back half of a range; returns false when it is empty
+static bool email_range_steal_half(_Atomic uint64_t* range,
+                                   uint32_t* first, uint32_t* last) {
+    uint64_t r = atomic_load_explicit(range, memory_order_acquire);
+    for (;;) {
+        uint32_t begin = (uint32_t)(r >> 32), end = (uint32_t)r;
+        if (begin >= end) {
+            return false;
+        }
+        uint32_t mid = begin + (end - begin) / 2;
+        uint64_t next = ((uint64_t)begin << 32) | mid;
+        if (atomic_compare_exchange_weak_explicit(range, &r, next,
+                                                  memory_order_acq_rel,
+                                                  memory_order_acquire)) {
+            *first = mid;
+            *last = end;
+            return true;
+        }
+    }
+}
+
+static void email_validate_chunk(email_parallel_job* job, email_worker* self,
+                                 uint32_t chunk) {
+    size_t start = (size_t)chunk * job->chunk_size;
+    size_t count = job->n - start < job->chunk_size ? job->n - start : job->chunk_size;
+
+    uint64_t duplicates = 0;
+    EMAIL_METRICS_START(started);
+    size_t valid = email_batch_run(job->ptrs + start, job->lens + start, count,
+                                   job->out_bitmap + start / 8, &job->validator,
+                                   job->dedup, start + 1, &duplicates);
+    EMAIL_METRICS_STOP(EMAIL_METRICS_BATCH, started);
+
+    uint64_t bytes = 0;
+    for (size_t i = start; i < start + count; i++) {
+        bytes += job->ptrs[i] != NULL ? job->lens[i] : 0;
+    }
+
+    self->stats.valid += valid;
+    self->stats.invalid += count - valid;
+    self->stats.bytes += bytes;
+    self->stats.chunks++;
+    self->stats.duplicates += duplicates;
+}
+
+static void* email_worker_main(void* arg) {
+    email_parallel_job* job = ((email_worker_arg*)arg)->job;
+    unsigned index = ((email_worker_arg*)arg)->index;
+    email_worker* self = &job->workers[index];
+    uint32_t chunk;
+
+    for (;;) {
+        // Drain our own range first
+        while (email_range_pop_front(&self->range, &chunk)) {
+            email_validate_chunk(job, self, chunk);
+        }
+
+        // Then look for a victim, starting with our right-hand neighbour
+        bool stole = false;
+        for (unsigned k = 1; k < job->worker_count && !stole; k++) {
+            email_worker* victim = &job->workers[(index + k) % job->worker_count];
+            uint32_t first, last;
+            if (email_range_steal_half(&victim->range, &first, &last)) {
+                // Our range is empty and nobody else writes to an empty range
+                atomic_store_explicit(&self->range,
+                                      ((uint64_t)first << 32) | last,
+                                      memory_order_release);
+                self->stats.steals++;
+                stole = true;
+            }
+        }
+
+        // Chunks never come back once taken: if nothing was left to steal,
+        // every remaining chunk is already owned by a running worker
+        if (!stole) {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * Function: validate_emails_parallel
+ * Purpose: Validates a large array of addresses on a pool of threads
+ *
+ * Parameters:
+ *   ptrs, lens, n, out_bitmap - as for validate_emails_batch()
+ *   opts  - thread count, chunk size, domain cache and duplicate set,
+ *           NULL for the defaults
+ *   stats - receives per-thread and total counters, may be NULL
+ *
+ * Returns:
+ *   the number of valid addresses
+ *
+ * The calling thread works as one of the workers. If a thread cannot be
+ * started the remaining workers simply steal its share. With
+ * opts->domain_cache the workers share one email_domain_cache for the
+ * call; if it cannot be allocated they validate without it. With
+ * opts->dedup every address is added to the set as line index + 1, and
+ * addresses already in it take the verdict stored there instead of being
+ * validated again.
+ */
+size_t validate_emails_parallel(const char* const* ptrs, const size_t* lens,
+                                size_t n, uint8_t* out_bitmap,
+                                const email_parallel_options* opts,
+                                email_parallel_stats* stats) {
+    unsigned threads = opts != NULL ? opts->threads : 0;
+    size_t chunk_size = opts != NULL && opts->chunk_size != 0
+                            ? opts->chunk_size : EMAIL_DEFAULT_CHUNK;
+
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned)cpus : 1;
+    }
+    if (threads > EMAIL_MAX_THREADS) {
+        threads = EMAIL_MAX_THREADS;
+    }
+
+    // Round the chunk up to whole cache lines of bitmap, and grow it if
+    // the chunk count would not fit in the 32-bit halves of a range
+    chunk_size = (chunk_size + EMAIL_CHUNK_ALIGN - 1) / EMAIL_CHUNK_ALIGN * EMAIL_CHUNK_ALIGN;
+    while ((n + chunk_size - 1) / chunk_size > UINT32_MAX) {
+        chunk_size *= 2;
+    }
+
+    size_t chunks = (n + chunk_size - 1) / chunk_size;
+    if (threads > chunks) {
+        threads = chunks > 0 ? (unsigned)chunks : 1;
+    }
+
+    email_worker* workers = aligned_alloc(64, sizeof(email_worker) * threads);
+    email_worker_arg* args = malloc(sizeof(email_worker_arg) * threads);
+
+    // Out of memory: run as a single worker on this thread
+    email_worker local_worker;
+    email_worker_arg local_arg;
+    bool on_heap = workers != NULL && args != NULL;
+    if (!on_heap) {
+        free(workers);
+        free(args);
+        workers = &local_worker;
+        args = &local_arg;
+        threads = 1;
+    }
+
+    email_domain_cache* cache = opts != NULL && opts->domain_cache
+                                    ? email_domain_cache_create() : NULL;
+    email_parallel_job job = {
+        ptrs, lens, n, out_bitmap, chunk_size, { .validate = email_select_kernel(), .cache = cache },
+        opts != NULL ? opts->dedup : NULL, workers, threads
+    };
+
+    // Hand out the chunks in equal contiguous ranges
+    for (unsigned t = 0; t < threads; t++) {
+        uint64_t begin = chunks * t / threads;
+        uint64_t end = chunks * (t + 1) / threads;
+        atomic_init(&workers[t].range, (begin << 32) | end);
+        memset(&workers[t].stats, 0, sizeof(workers[t].stats));
+        args[t].job = &job;
+        args[t].index = t;
+        args[t].started = false;
+    }
+
+    for (unsigned t = 1; t < threads; t++) {
+        args[t].started = pthread_create(&args[t].thread, NULL,
+                                         email_worker_main, &args[t]) == 0;
+    }
+    email_worker_main(&args[0]);
+
+    size_t valid = 0;
+    if (stats != NULL) {
+        memset(stats, 0, sizeof(*stats));
+        stats->threads = threads;
+    }
+    for (unsigned t = 0; t < threads; t++) {
+        if (args[t].started) {
+            pthread_join(args[t].thread, NULL);
+        }
+        valid += workers[t].stats.valid;
+        if (stats != NULL) {
+            stats->per_thread[t] = workers[t].stats;
+            stats->total.valid += workers[t].stats.valid;
+            stats->total.invalid += workers[t].stats.invalid;
+            stats->total.bytes += workers[t].stats.bytes;
+            stats->total.chunks += workers[t].stats.chunks;
+            stats->total.steals += workers[t].stats.steals;
+            stats->total.duplicates += workers[t].stats.duplicates;
+        }
+    }
+
+    if (on_heap) {
+        free(workers);
+        free(args);
+    }
+    email_domain_cache_destroy(cache);
+    return valid;
+}
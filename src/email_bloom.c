@@ -0,0 +1,354 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define EMAIL_HAVE_AVX2 1
+#endif
+
+#include "email_internal.h"
+
+/*
+ * Blocked Bloom filter
+ *
+ * The top bits of the address hash pick a block (a multiply-shift, so the
+ * block count need not be a power of two) and the low 32 bits, multiplied
+ * by eight odd constants, give one bit position per 64-bit word of it:
+ * the "split block" layout, where the eight bits of an address never
+ * collide with each other. An address is in the filter when all eight are
+ * set. The AVX2 probe does the eight multiplies, the variable shifts and
+ * the test in two 256-bit halves; the scalar one loops over the words.
+ * Both compute the same bits, so a filter built on one machine is probed
+ * the same way on any other of its byte order.
+ *
+ * Created filters live in an anonymous mapping, so a filter sized for
+ * 500 million addresses costs only the pages its addresses reach;
+ * email_bloom_open() maps the saved blocks read-only instead.
+ */
+#define EMAIL_BLOOM_MAGIC "EMBLOOM"
+#define EMAIL_BLOOM_VERSION 1
+#define EMAIL_BLOOM_BYTE_ORDER 0x01020304u
+#define EMAIL_BLOOM_DEFAULT_ADDRESSES ((uint64_t)1 << 20)
+#define EMAIL_BLOOM_DEFAULT_BITS 16
+#define EMAIL_BLOOM_GROUP 16    // addresses hashed and prefetched before probing
+
+typedef struct {
+    _Alignas(64) uint64_t words[8];
+} email_bloom_block;
+
+// The file header; the blocks follow
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t blocks;
+    uint64_t addresses;
+    char reserved[32];
+} email_bloom_header;
+
+_Static_assert(sizeof(email_bloom_header) == sizeof(email_bloom_block),
+               "the blocks of a mapped file stay 64-byte aligned");
+
+typedef bool (*email_bloom_probe_fn)(const email_bloom_block* b, uint32_t x);
+
+struct email_bloom {
+    email_bloom_block* blocks;
+    uint64_t count;             // blocks
+    uint64_t addresses;
+    email_bloom_probe_fn probe;
+    void* map;                  // the whole mapping, header included when opened
+    size_t map_size;
+    bool read_only;
+};
+
+static const uint32_t email_bloom_salt[8] = {
+    0x47B6137Bu, 0x44974D91u, 0x8824AD5Bu, 0xA2B7289Du,
+    0x705495C7u, 0x2DF1424Bu, 0x9EFC4947u, 0x5C6BFB31u,
+};
+
+static inline const email_bloom_block* email_bloom_block_of(const email_bloom* b, uint64_t h) {
+    return &b->blocks[(uint64_t)(((unsigned __int128)h * b->count) >> 64)];
+}
+
+static bool email_bloom_probe_scalar(const email_bloom_block* b, uint32_t x) {
+    for (int i = 0; i < 8; i++) {
+        if (!((b->words[i] >> ((x * email_bloom_salt[i]) >> 26)) & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#if defined(EMAIL_HAVE_AVX2)
+__attribute__((target("avx2")))
+static bool email_bloom_probe_avx2(const email_bloom_block* b, uint32_t x) {
+    const __m256i salt = _mm256_loadu_si256((const __m256i*)email_bloom_salt);
+    __m256i bit = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32((int)x), salt), 26);
+    __m256i one = _mm256_set1_epi64x(1);
+    __m256i lo = _mm256_sllv_epi64(one, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(bit)));
+    __m256i hi = _mm256_sllv_epi64(one, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(bit, 1)));
+    // testc: every bit of the mask is set in the block
+    return _mm256_testc_si256(_mm256_load_si256((const __m256i*)&b->words[0]), lo) &
+           _mm256_testc_si256(_mm256_load_si256((const __m256i*)&b->words[4]), hi);
+}
+#endif
+
+static email_bloom_probe_fn email_bloom_select_probe(void) {
+#if defined(EMAIL_HAVE_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        return email_bloom_probe_avx2;
+    }
+#endif
+    return email_bloom_probe_scalar;
+}
+
+/**
+ * Function: email_bloom_create
+ * Purpose: Maps zeroed blocks for expected_addresses at bits_per_address
+ *
+ * Returns:
+ *   the filter, or NULL when out of memory or the size overflows
+ */
+email_bloom* email_bloom_create(uint64_t expected_addresses, unsigned bits_per_address) {
+    if (expected_addresses == 0) {
+        expected_addresses = EMAIL_BLOOM_DEFAULT_ADDRESSES;
+    }
+    if (bits_per_address == 0) {
+        bits_per_address = EMAIL_BLOOM_DEFAULT_BITS;
+    }
+    if (expected_addresses > SIZE_MAX / bits_per_address) {
+        return NULL;
+    }
+    uint64_t count = (expected_addresses * bits_per_address + 511) / 512;
+    if (count > SIZE_MAX / sizeof(email_bloom_block)) {
+        return NULL;
+    }
+
+    email_bloom* b = calloc(1, sizeof(*b));
+    if (b == NULL) {
+        return NULL;
+    }
+    b->map_size = (size_t)count * sizeof(email_bloom_block);
+    b->map = mmap(NULL, b->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b->map == MAP_FAILED) {
+        free(b);
+        return NULL;
+    }
+    b->blocks = b->map;
+    b->count = count;
+    b->probe = email_bloom_select_probe();
+    return b;
+}
+
+void email_bloom_destroy(email_bloom* bloom) {
+    if (bloom == NULL) {
+        return;
+    }
+    munmap(bloom->map, bloom->map_size);
+    free(bloom);
+}
+
+bool email_bloom_add(email_bloom* bloom, const char* p, size_t len) {
+    if (bloom == NULL || bloom->read_only || p == NULL || len > MAX_EMAIL_LENGTH) {
+        return false;
+    }
+    uint64_t h = email_address_hash(p, len, 0);
+    email_bloom_block* b = (email_bloom_block*)email_bloom_block_of(bloom, h);
+    uint32_t x = (uint32_t)h;
+    for (int i = 0; i < 8; i++) {
+        b->words[i] |= (uint64_t)1 << ((x * email_bloom_salt[i]) >> 26);
+    }
+    bloom->addresses++;
+    return true;
+}
+
+bool email_bloom_maybe_contains(const email_bloom* bloom, const char* p, size_t len) {
+    if (bloom == NULL || p == NULL || len > MAX_EMAIL_LENGTH) {
+        return false;
+    }
+    uint64_t h = email_address_hash(p, len, 0);
+    return bloom->probe(email_bloom_block_of(bloom, h), (uint32_t)h);
+}
+
+size_t email_bloom_screen_batch(const email_bloom* bloom, const char* const* ptrs,
+                                const size_t* lens, size_t n,
+                                const uint8_t* valid_bitmap, uint8_t* out_bitmap) {
+    size_t hits = 0;
+    memset(out_bitmap, 0, (n + 7) / 8);
+
+    for (size_t base = 0; base < n; base += EMAIL_BLOOM_GROUP) {
+        size_t group = n - base < EMAIL_BLOOM_GROUP ? n - base : EMAIL_BLOOM_GROUP;
+        const email_bloom_block* block[EMAIL_BLOOM_GROUP];
+        uint32_t x[EMAIL_BLOOM_GROUP];
+
+        // Hash the group and start every block load, then probe
+        for (size_t j = 0; j < group; j++) {
+            size_t i = base + j;
+            block[j] = NULL;
+            if ((valid_bitmap != NULL && !((valid_bitmap[i / 8] >> (i % 8)) & 1)) ||
+                ptrs[i] == NULL || lens[i] > MAX_EMAIL_LENGTH) {
+                continue;
+            }
+            uint64_t h = email_address_hash(ptrs[i], lens[i], 0);
+            block[j] = email_bloom_block_of(bloom, h);
+            x[j] = (uint32_t)h;
+            __builtin_prefetch(block[j]);
+        }
+        for (size_t j = 0; j < group; j++) {
+            if (block[j] != NULL && bloom->probe(block[j], x[j])) {
+                size_t i = base + j;
+                out_bitmap[i / 8] |= (uint8_t)(1u << (i % 8));
+                hits++;
+            }
+        }
+    }
+    return hits;
+}
+
+// Writes p[0..len) in full
+static bool email_bloom_write_all(int fd, const void* p, size_t len) {
+    const char* q = p;
+    while (len > 0) {
+        ssize_t n = write(fd, q, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        q += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+/**
+ * Function: email_bloom_save
+ * Purpose: Writes the filter to path, through a temporary file beside it
+ *          that is renamed over path once complete
+ *
+ * Returns:
+ *   0, or -1 with errno set
+ */
+int email_bloom_save(const email_bloom* bloom, const char* path) {
+    email_bloom_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, EMAIL_BLOOM_MAGIC, sizeof(h.magic));
+    h.version = EMAIL_BLOOM_VERSION;
+    h.byte_order = EMAIL_BLOOM_BYTE_ORDER;
+    h.blocks = bloom->count;
+    h.addresses = bloom->addresses;
+
+    size_t tmp_len = strlen(path) + sizeof(".tmp");
+    char* tmp = malloc(tmp_len);
+    if (tmp == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    snprintf(tmp, tmp_len, "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        int saved = errno;
+        free(tmp);
+        errno = saved;
+        return -1;
+    }
+
+    bool ok = email_bloom_write_all(fd, &h, sizeof(h)) &&
+              email_bloom_write_all(fd, bloom->blocks,
+                                    (size_t)bloom->count * sizeof(email_bloom_block)) &&
+              fsync(fd) == 0;
+    int saved = errno;
+    if (close(fd) != 0 && ok) {
+        ok = false;
+        saved = errno;
+    }
+    if (ok && rename(tmp, path) != 0) {
+        ok = false;
+        saved = errno;
+    }
+    if (!ok) {
+        unlink(tmp);
+    }
+    free(tmp);
+    errno = saved;
+    return ok ? 0 : -1;
+}
+
+/**
+ * Function: email_bloom_open
+ * Purpose: Maps a file written by email_bloom_save() as a read-only filter
+ *
+ * Returns:
+ *   the filter, or NULL with errno set: EINVAL when the file is not a
+ *   filter of this version and byte order, or its size does not match
+ */
+email_bloom* email_bloom_open(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return NULL;
+    }
+    if (st.st_size < (off_t)(sizeof(email_bloom_header) + sizeof(email_bloom_block))) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    int saved = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        errno = saved;
+        return NULL;
+    }
+
+    const email_bloom_header* h = map;
+    email_bloom* b = NULL;
+    if (memcmp(h->magic, EMAIL_BLOOM_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != EMAIL_BLOOM_VERSION || h->byte_order != EMAIL_BLOOM_BYTE_ORDER ||
+        h->blocks == 0 || h->blocks > (size - sizeof(*h)) / sizeof(email_bloom_block) ||
+        sizeof(*h) + h->blocks * sizeof(email_bloom_block) != size) {
+        saved = EINVAL;
+    } else if ((b = calloc(1, sizeof(*b))) == NULL) {
+        saved = ENOMEM;
+    }
+    if (b == NULL) {
+        munmap(map, size);
+        errno = saved;
+        return NULL;
+    }
+
+    b->blocks = (email_bloom_block*)((char*)map + sizeof(*h));
+    b->count = h->blocks;
+    b->addresses = h->addresses;
+    b->probe = email_bloom_select_probe();
+    b->map = map;
+    b->map_size = size;
+    b->read_only = true;
+    return b;
+}
+
+void email_bloom_snapshot(const email_bloom* bloom, email_bloom_stats* out) {
+    memset(out, 0, sizeof(*out));
+    if (bloom == NULL) {
+        return;
+    }
+    out->blocks = bloom->count;
+    out->addresses = bloom->addresses;
+    out->memory = sizeof(*bloom) + bloom->map_size;
+}
@@ -0,0 +1,536 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "email_internal.h"
+
+/*
+ * Disposable domains and role accounts
+ *
+ * Disposable domains go into a trie whose edges are whole labels, read
+ * from the right: "mail.example.com" is the path "com", "example",
+ * "mail", and the node it ends at is marked. A lookup walks the labels of
+ * the address's domain the same way and stops at the first marked node,
+ * so every subdomain of a listed domain matches too, after one hash
+ * lookup per label. The edges of every node share one open-addressing
+ * table keyed by the parent node and the label.
+ *
+ * Role local parts ("admin", "noreply") are a hash set of their own. An
+ * address matches on its local part up to the first '+', so subaddresses
+ * ("noreply+bounces") count as their role.
+ *
+ * Both tables are linear probing over 64-bit slots, the top 32 bits of
+ * the hash and the id plus one, as email_store's; entries are kept
+ * lowercased and the text looked up is lowercased into a stack buffer,
+ * so queries never allocate. Tables double when three quarters full.
+ */
+#define EMAIL_CLASS_MIN_SLOTS 64
+#define EMAIL_CLASS_MAX_LABEL 63
+#define EMAIL_CLASS_MAX_ROLE (MAX_EMAIL_LENGTH - 2)
+#define EMAIL_CLASS_MAX_IDS (UINT32_MAX - 1)
+
+// A trie node, the end of the edge from parent with its label
+typedef struct {
+    uint32_t parent;
+    uint32_t label_at;          // offset of the label in text
+    uint8_t label_len;
+    bool disposable;            // a listed domain ends here
+} email_class_node;
+
+struct email_classifier {
+    email_class_node* nodes;    // nodes[0] is the root
+    size_t node_count;
+    size_t node_cap;
+    uint64_t* edges;
+    size_t edge_mask;
+
+    size_t* role_at;            // offset of each role in text, length first
+    size_t role_count;
+    size_t role_cap;
+    uint64_t* roles;
+    size_t role_mask;
+
+    char* text;                 // labels, and length-prefixed roles
+    size_t text_used;
+    size_t text_cap;
+};
+
+static uint64_t email_class_hash(const char* p, size_t len, uint64_t seed) {
+    uint64_t h = (seed << 8 | len) * 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < len; i += 8) {
+        h = (h ^ email_load_word(p + i, len - i)) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 29;
+    }
+    return h * 0xBF58476D1CE4E5B9ull;
+}
+
+static inline uint64_t email_class_slot(uint64_t h, size_t id) {
+    return (h >> 32 << 32) | (uint64_t)(id + 1);
+}
+
+static inline bool email_class_crowded(size_t count, size_t mask) {
+    return (count + 1) * 4 > (mask + 1) * 3;
+}
+
+static void email_class_lower(const char* p, size_t len, char* out) {
+    for (size_t i = 0; i < len; i++) {
+        char c = p[i];
+        out[i] = c >= 'A' && c <= 'Z' ? (char)(c | 0x20) : c;
+    }
+}
+
+// The hash of node id's edge / of role id, for rebuilding the tables
+static uint64_t email_class_edge_hash(const email_classifier* c, size_t id) {
+    const email_class_node* n = &c->nodes[id];
+    return email_class_hash(c->text + n->label_at, n->label_len, n->parent);
+}
+
+static uint64_t email_class_role_hash(const email_classifier* c, size_t id) {
+    const char* role = c->text + c->role_at[id];
+    return email_class_hash(role + 1, (unsigned char)role[0], 0);
+}
+
+// ---- Lookup ----
+
+/*
+ * Finds the child of parent along label[0..len) (lowercased) with hash
+ * h: returns true with its id in *id, or false with the empty slot it
+ * would go in in *slot
+ */
+static bool email_class_find_edge(const email_classifier* c, uint32_t parent,
+                                  const char* label, size_t len, uint64_t h,
+                                  uint32_t* id, size_t* slot) {
+    uint64_t tag = h >> 32;
+    for (size_t i = (size_t)h & c->edge_mask;; i = (i + 1) & c->edge_mask) {
+        uint64_t v = c->edges[i];
+        if (v == 0) {
+            *slot = i;
+            return false;
+        }
+        if (v >> 32 == tag) {
+            uint32_t n = (uint32_t)v - 1;
+            const email_class_node* node = &c->nodes[n];
+            if (node->parent == parent && node->label_len == len &&
+                memcmp(c->text + node->label_at, label, len) == 0) {
+                *id = n;
+                return true;
+            }
+        }
+    }
+}
+
+// The same for the role role[0..len)
+static bool email_class_find_role(const email_classifier* c, const char* role, size_t len,
+                                  uint64_t h, size_t* slot) {
+    uint64_t tag = h >> 32;
+    for (size_t i = (size_t)h & c->role_mask;; i = (i + 1) & c->role_mask) {
+        uint64_t v = c->roles[i];
+        if (v == 0) {
+            *slot = i;
+            return false;
+        }
+        if (v >> 32 == tag) {
+            const char* entry = c->text + c->role_at[(uint32_t)v - 1];
+            if ((unsigned char)entry[0] == len && memcmp(entry + 1, role, len) == 0) {
+                return true;
+            }
+        }
+    }
+}
+
+// True when domain[0..len), or a domain it is under, is listed
+static bool email_class_disposable(const email_classifier* c, const char* domain, size_t len) {
+    if (c->node_count == 1) {
+        return false;
+    }
+    uint32_t node = 0;
+    size_t end = len;
+    while (end > 0) {
+        size_t start = end;
+        while (start > 0 && domain[start - 1] != '.') {
+            start--;
+        }
+        size_t n = end - start;
+        if (n == 0 || n > EMAIL_CLASS_MAX_LABEL) {
+            return false;
+        }
+        char label[EMAIL_CLASS_MAX_LABEL];
+        email_class_lower(domain + start, n, label);
+        uint32_t child;
+        size_t slot;
+        if (!email_class_find_edge(c, node, label, n, email_class_hash(label, n, node),
+                                   &child, &slot)) {
+            return false;
+        }
+        if (c->nodes[child].disposable) {
+            return true;
+        }
+        node = child;
+        end = start > 0 ? start - 1 : 0;
+    }
+    return false;
+}
+
+// True when local[0..len), up to a '+', is a listed role
+static bool email_class_role(const email_classifier* c, const char* local, size_t len) {
+    if (c->role_count == 0) {
+        return false;
+    }
+    const char* plus = memchr(local, '+', len);
+    if (plus != NULL) {
+        len = (size_t)(plus - local);
+    }
+    if (len == 0 || len > EMAIL_CLASS_MAX_ROLE) {
+        return false;
+    }
+    char role[EMAIL_CLASS_MAX_ROLE];
+    email_class_lower(local, len, role);
+    size_t slot;
+    return email_class_find_role(c, role, len, email_class_hash(role, len, 0), &slot);
+}
+
+// The flags of an address whose '@' is at p[at]
+static unsigned email_class_split(const email_classifier* c, const char* p, size_t len,
+                                  size_t at) {
+    unsigned flags = 0;
+    if (email_class_disposable(c, p + at + 1, len - at - 1)) {
+        flags |= EMAIL_CLASS_DISPOSABLE;
+    }
+    if (email_class_role(c, p, at)) {
+        flags |= EMAIL_CLASS_ROLE;
+    }
+    return flags;
+}
+
+unsigned email_classify(const email_classifier* c, const char* p, size_t len) {
+    if (c == NULL || p == NULL) {
+        return 0;
+    }
+    const char* at = email_domain_at(p, len);
+    return at != NULL ? email_class_split(c, p, len, (size_t)(at - p)) : 0;
+}
+
+email_reason email_check_classified(const email_classifier* c, const char* p, size_t len,
+                                    size_t* offset, unsigned* flags) {
+    size_t at = 0;
+    email_reason r = email_check_split(p, len, offset, &at);
+    if (flags != NULL) {
+        *flags = r == EMAIL_VALID && c != NULL ? email_class_split(c, p, len, at) : 0;
+    }
+    return r;
+}
+
+size_t email_classify_batch(const email_classifier* c, const char* const* ptrs,
+                            const size_t* lens, size_t n, const uint8_t* valid_bitmap,
+                            uint8_t* out_flags) {
+    size_t flagged = 0;
+    for (size_t i = 0; i < n; i++) {
+        out_flags[i] = 0;
+        if (valid_bitmap != NULL && !((valid_bitmap[i / 8] >> (i % 8)) & 1)) {
+            continue;
+        }
+        out_flags[i] = (uint8_t)email_classify(c, ptrs[i], lens[i]);
+        flagged += out_flags[i] != 0;
+    }
+    return flagged;
+}
+
+// ---- Building ----
+
+// Makes *buf hold at least need elements of size bytes, doubling from *cap
+static bool email_class_reserve(void** buf, size_t* cap, size_t need, size_t size) {
+    if (need <= *cap) {
+        return true;
+    }
+    size_t n = *cap != 0 ? *cap : 64;
+    while (n < need) {
+        n *= 2;
+    }
+    void* p = realloc(*buf, n * size);
+    if (p == NULL) {
+        return false;
+    }
+    *buf = p;
+    *cap = n;
+    return true;
+}
+
+// Rebuilds a table of count entries, numbered from first, with twice the slots
+static bool email_class_rehash(email_classifier* c, uint64_t** slots, size_t* mask,
+                               size_t first, size_t count,
+                               uint64_t (*hash)(const email_classifier*, size_t)) {
+    size_t n = (*mask + 1) * 2;
+    uint64_t* table = calloc(n, sizeof(*table));
+    if (table == NULL) {
+        return false;
+    }
+    for (size_t id = first; id < count; id++) {
+        uint64_t h = hash(c, id);
+        size_t i = (size_t)h & (n - 1);
+        while (table[i] != 0) {
+            i = (i + 1) & (n - 1);
+        }
+        table[i] = email_class_slot(h, id);
+    }
+    free(*slots);
+    *slots = table;
+    *mask = n - 1;
+    return true;
+}
+
+email_classifier* email_classifier_create(void) {
+    email_classifier* c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        return NULL;
+    }
+    c->edges = calloc(EMAIL_CLASS_MIN_SLOTS, sizeof(*c->edges));
+    c->roles = calloc(EMAIL_CLASS_MIN_SLOTS, sizeof(*c->roles));
+    c->edge_mask = c->role_mask = EMAIL_CLASS_MIN_SLOTS - 1;
+    if (c->edges == NULL || c->roles == NULL ||
+        !email_class_reserve((void**)&c->nodes, &c->node_cap, 1, sizeof(*c->nodes))) {
+        email_classifier_destroy(c);
+        return NULL;
+    }
+    memset(&c->nodes[0], 0, sizeof(c->nodes[0]));
+    c->node_count = 1;
+    return c;
+}
+
+void email_classifier_destroy(email_classifier* c) {
+    if (c == NULL) {
+        return;
+    }
+    free(c->nodes);
+    free(c->edges);
+    free(c->role_at);
+    free(c->roles);
+    free(c->text);
+    free(c);
+}
+
+// Adds the domain p[0..len), lowercased and checked
+static int email_class_add_domain(email_classifier* c, const char* p, size_t len) {
+    if (len > 0 && p[len - 1] == '.') {
+        len--;  // the root label of a fully qualified name
+    }
+    if (len == 0 || len > MAX_EMAIL_LENGTH) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (!(EMAIL_CLASS_OF(p[i]) & EMAIL_CHAR_DOMAIN)) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    uint32_t node = 0;
+    size_t end = len;
+    while (end > 0) {
+        size_t start = end;
+        while (start > 0 && p[start - 1] != '.') {
+            start--;
+        }
+        size_t n = end - start;
+        if (n == 0 || n > EMAIL_CLASS_MAX_LABEL) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (c->nodes[node].disposable) {
+            return 0;  // a parent domain is listed already
+        }
+
+        char label[EMAIL_CLASS_MAX_LABEL];
+        email_class_lower(p + start, n, label);
+        uint64_t h = email_class_hash(label, n, node);
+        uint32_t child;
+        size_t slot;
+        if (!email_class_find_edge(c, node, label, n, h, &child, &slot)) {
+            if (c->node_count > EMAIL_CLASS_MAX_IDS || c->text_used + n > UINT32_MAX ||
+                !email_class_reserve((void**)&c->nodes, &c->node_cap, c->node_count + 1,
+                                     sizeof(*c->nodes)) ||
+                !email_class_reserve((void**)&c->text, &c->text_cap, c->text_used + n, 1)) {
+                errno = ENOMEM;
+                return -1;
+            }
+            child = (uint32_t)c->node_count++;
+            email_class_node* created = &c->nodes[child];
+            created->parent = node;
+            created->label_at = (uint32_t)c->text_used;
+            created->label_len = (uint8_t)n;
+            created->disposable = false;
+            memcpy(c->text + c->text_used, label, n);
+            c->text_used += n;
+            c->edges[slot] = email_class_slot(h, child);
+            if (email_class_crowded(c->node_count - 1, c->edge_mask) &&
+                !email_class_rehash(c, &c->edges, &c->edge_mask, 1, c->node_count,
+                                    email_class_edge_hash)) {
+                errno = ENOMEM;
+                return -1;
+            }
+        }
+        node = child;
+        end = start > 0 ? start - 1 : 0;
+    }
+    // Subdomains of it listed before stay in the trie, unreachable
+    c->nodes[node].disposable = true;
+    return 0;
+}
+
+// Adds the role local part p[0..len), lowercased and checked
+static int email_class_add_role(email_classifier* c, const char* p, size_t len) {
+    if (len == 0 || len > EMAIL_CLASS_MAX_ROLE || memchr(p, '@', len) != NULL ||
+        memchr(p, '+', len) != NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        unsigned char b = (unsigned char)p[i];
+        if (b <= ' ' || b == 0x7F) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    char role[EMAIL_CLASS_MAX_ROLE];
+    email_class_lower(p, len, role);
+    uint64_t h = email_class_hash(role, len, 0);
+    size_t slot;
+    if (email_class_find_role(c, role, len, h, &slot)) {
+        return 0;
+    }
+    if (c->role_count > EMAIL_CLASS_MAX_IDS ||
+        !email_class_reserve((void**)&c->role_at, &c->role_cap, c->role_count + 1,
+                             sizeof(*c->role_at)) ||
+        !email_class_reserve((void**)&c->text, &c->text_cap, c->text_used + 1 + len, 1)) {
+        errno = ENOMEM;
+        return -1;
+    }
+    c->role_at[c->role_count] = c->text_used;
+    c->text[c->text_used] = (char)len;
+    memcpy(c->text + c->text_used + 1, role, len);
+    c->text_used += 1 + len;
+    c->roles[slot] = email_class_slot(h, c->role_count++);
+    if (email_class_crowded(c->role_count, c->role_mask) &&
+        !email_class_rehash(c, &c->roles, &c->role_mask, 0, c->role_count,
+                            email_class_role_hash)) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function: email_classifier_add
+ * Purpose: Lists the domain (EMAIL_CLASS_DISPOSABLE) or role local part
+ *          (EMAIL_CLASS_ROLE) p[0..len)
+ *
+ * Returns:
+ *   0, or -1 with errno set: EINVAL for another kind, or an entry that is
+ *   not a domain / local part, ENOMEM
+ */
+int email_classifier_add(email_classifier* c, unsigned kind, const char* p, size_t len) {
+    if (c == NULL || p == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    switch (kind) {
+    case EMAIL_CLASS_DISPOSABLE:
+        return email_class_add_domain(c, p, len);
+    case EMAIL_CLASS_ROLE:
+        return email_class_add_role(c, p, len);
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+/**
+ * Function: email_classifier_load_list
+ * Purpose: Adds every entry of text[0..len), one per line, as kind
+ *
+ * '#' starts a comment line; blank lines and surrounding spaces are
+ * ignored, as in a TLD list. Stops at the first bad line, with the lines
+ * before it added.
+ */
+int email_classifier_load_list(email_classifier* c, unsigned kind, const char* text,
+                               size_t len) {
+    const char* p = text;
+    const char* end = text + len;
+    while (p < end) {
+        const char* nl = memchr(p, '\n', (size_t)(end - p));
+        const char* b = p;
+        const char* e = nl != NULL ? nl : end;
+        p = nl != NULL ? nl + 1 : end;
+
+        while (b < e && (EMAIL_CLASS_OF(*b) & EMAIL_CHAR_SPACE)) {
+            b++;
+        }
+        while (e > b && (EMAIL_CLASS_OF(e[-1]) & EMAIL_CHAR_SPACE)) {
+            e--;
+        }
+        if (b == e || *b == '#') {
+            continue;
+        }
+        if (email_classifier_add(c, kind, b, (size_t)(e - b)) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Function: email_classifier_load_file
+ * Purpose: email_classifier_load_list() on the file at path
+ */
+int email_classifier_load_file(email_classifier* c, unsigned kind, const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return -1;
+    }
+
+    size_t cap = 1 << 16;
+    size_t used = 0;
+    char* buf = malloc(cap);
+    int rc = -1;
+
+    while (buf != NULL) {
+        used += fread(buf + used, 1, cap - used, f);
+        if (used < cap) {
+            if (!ferror(f)) {
+                rc = email_classifier_load_list(c, kind, buf, used);
+            }
+            break;
+        }
+        char* bigger = realloc(buf, cap * 2);
+        if (bigger == NULL) {
+            break;
+        }
+        buf = bigger;
+        cap *= 2;
+    }
+
+    int saved = buf == NULL ? ENOMEM : errno;
+    free(buf);
+    fclose(f);
+    errno = saved;
+    return rc;
+}
+
+void email_classifier_snapshot(const email_classifier* c, email_classifier_stats* out) {
+    memset(out, 0, sizeof(*out));
+    if (c == NULL) {
+        return;
+    }
+    for (size_t i = 1; i < c->node_count; i++) {
+        out->domains += c->nodes[i].disposable;
+    }
+    out->roles = c->role_count;
+    out->nodes = c->node_count;
+    out->memory = sizeof(*c) + c->node_cap * sizeof(*c->nodes) +
+                  (c->edge_mask + 1 + c->role_mask + 1) * sizeof(uint64_t) +
+                  c->role_cap * sizeof(*c->role_at) + c->text_cap;
+}
@@ -0,0 +1,344 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "email_internal.h"
+
+/*
+ * Duplicate detection
+ *
+ * The set is an open-addressing table of 64-bit slots with linear
+ * probing, over an arena that holds the addresses themselves. Both are
+ * allocated once, by email_dedup_create(): the table has at least twice
+ * as many slots as the set may hold addresses, so probe runs stay short,
+ * and nothing is allocated after that.
+ *
+ * A slot is 0 while empty; otherwise its top 16 bits are a tag taken from
+ * the hash and the rest is the arena offset of the entry, in 8-byte
+ * units, plus one. Entries are written in full before the slot that points
+ * at them is published with a compare-and-swap, so a thread that loads a
+ * slot can read its entry without any lock. Two threads adding the same
+ * new address race for the same empty slot; the loser finds the winner's
+ * entry there and reports a duplicate. Its own arena space is lost, which
+ * only ever happens in such a race.
+ *
+ * The line number kept in an entry only goes down, so after all threads
+ * are done it is the first line of the address, whichever thread stored it.
+ */
+#define EMAIL_DEDUP_DEFAULT_ADDRESSES (1u << 20)
+#define EMAIL_DEDUP_DEFAULT_ARENA (64u << 20)
+#define EMAIL_DEDUP_TAG_SHIFT 48
+
+struct email_dedup {
+    _Atomic uint64_t* slots;
+    size_t mask;                  // slot count - 1
+    size_t max_addresses;
+    char* arena;
+    size_t arena_size;
+    _Alignas(64) _Atomic size_t arena_used;
+    _Atomic uint64_t unique;
+    _Atomic uint64_t duplicates;
+    _Atomic uint64_t untracked;
+};
+
+/*
+ * Copies p[0..len) to out with the domain, everything after the last
+ * '@', lowercased; returns the hash of the copy
+ */
+static uint64_t email_dedup_normalize(const char* p, size_t len, char* out) {
+    const char* at = email_domain_at(p, len);
+    size_t local = at != NULL ? (size_t)(at - p) : len;
+
+    memcpy(out, p, local);
+    for (size_t i = local; i < len; i++) {
+        char c = p[i];
+        out[i] = c >= 'A' && c <= 'Z' ? (char)(c | 0x20) : c;
+    }
+
+    uint64_t h = len;
+    for (size_t i = 0; i < len; i += 8) {
+        h = (h ^ email_load_word(out + i, len - i)) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 29;
+    }
+    return h * 0xBF58476D1CE4E5B9ull;
+}
+
+static inline email_dedup_entry* email_dedup_entry_at(const email_dedup* set, uint64_t slot) {
+    size_t units = (size_t)(slot & (((uint64_t)1 << EMAIL_DEDUP_TAG_SHIFT) - 1)) - 1;
+    return (email_dedup_entry*)(set->arena + units * 8);
+}
+
+// Lowers *line to line_no unless it is already lower
+static void email_dedup_lower_line(_Atomic uint64_t* line, uint64_t line_no) {
+    uint64_t seen = atomic_load_explicit(line, memory_order_relaxed);
+    while (line_no < seen &&
+           !atomic_compare_exchange_weak_explicit(line, &seen, line_no,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+}
+
+/**
+ * Function: email_dedup_create
+ * Purpose: Allocates an empty duplicate set
+ *
+ * Parameters:
+ *   max_addresses - most distinct addresses to keep, 0 for 1 Mi
+ *   arena_bytes   - bytes for the addresses and their bookkeeping
+ *                   (about 16 bytes each plus the address), 0 for 64 MiB
+ *
+ * Returns:
+ *   the set, or NULL when out of memory
+ *
+ * The table takes 16 bytes per address on top of the arena. Once either
+ * limit is reached, new addresses are reported as EMAIL_DEDUP_UNTRACKED.
+ */
+email_dedup* email_dedup_create(size_t max_addresses, size_t arena_bytes) {
+    if (max_addresses == 0) {
+        max_addresses = EMAIL_DEDUP_DEFAULT_ADDRESSES;
+    }
+    if (arena_bytes == 0) {
+        arena_bytes = EMAIL_DEDUP_DEFAULT_ARENA;
+    }
+    // Offsets are stored in 8-byte units below the tag
+    if (arena_bytes / 8 >= ((uint64_t)1 << EMAIL_DEDUP_TAG_SHIFT) - 1) {
+        arena_bytes = (((uint64_t)1 << EMAIL_DEDUP_TAG_SHIFT) - 2) * 8;
+    }
+
+    size_t slots = 16;
+    while (slots < max_addresses * 2 && slots <= SIZE_MAX / 4) {
+        slots *= 2;
+    }
+
+    email_dedup* set = aligned_alloc(64, sizeof(*set));
+    if (set == NULL) {
+        return NULL;
+    }
+    set->slots = calloc(slots, sizeof(*set->slots));
+    set->arena = malloc(arena_bytes);
+    if (set->slots == NULL || set->arena == NULL) {
+        free(set->slots);
+        free(set->arena);
+        free(set);
+        return NULL;
+    }
+
+    set->mask = slots - 1;
+    set->max_addresses = max_addresses;
+    set->arena_size = arena_bytes;
+    atomic_init(&set->arena_used, 0);
+    atomic_init(&set->unique, 0);
+    atomic_init(&set->duplicates, 0);
+    atomic_init(&set->untracked, 0);
+    return set;
+}
+
+/**
+ * Function: email_dedup_destroy
+ * Purpose: Frees a set made by email_dedup_create(); NULL is ignored
+ */
+void email_dedup_destroy(email_dedup* set) {
+    if (set != NULL) {
+        free((void*)set->slots);
+        free(set->arena);
+        free(set);
+    }
+}
+
+/**
+ * Function: email_dedup_insert
+ * Purpose: Adds p[0..len), seen on line line_no, to the set
+ *
+ * Parameters:
+ *   set     - the set
+ *   p, len  - the address
+ *   line_no - where the address was seen
+ *   entry   - receives the address's entry, or NULL when untracked
+ *
+ * Returns:
+ *   EMAIL_DEDUP_NEW, EMAIL_DEDUP_DUPLICATE or EMAIL_DEDUP_UNTRACKED
+ */
+email_dedup_result email_dedup_insert(email_dedup* set, const char* p, size_t len,
+                                      uint64_t line_no, email_dedup_entry** entry) {
+    char key[MAX_EMAIL_LENGTH];
+
+    *entry = NULL;
+    // Longer lines cannot be valid, and are not worth the space
+    if (p == NULL || len > MAX_EMAIL_LENGTH) {
+        atomic_fetch_add_explicit(&set->untracked, 1, memory_order_relaxed);
+        return EMAIL_DEDUP_UNTRACKED;
+    }
+
+    uint64_t h = email_dedup_normalize(p, len, key);
+    uint64_t tag = h >> EMAIL_DEDUP_TAG_SHIFT << EMAIL_DEDUP_TAG_SHIFT;
+    uint64_t mine = 0;  // our entry once written, as a slot value
+
+    for (size_t i = (size_t)h & set->mask, probes = 0; probes <= set->mask;
+         i = (i + 1) & set->mask, probes++) {
+        uint64_t slot = atomic_load_explicit(&set->slots[i], memory_order_acquire);
+
+        while (slot == 0) {
+            // An empty slot: the address is new. Write the entry once,
+            // then try to publish it here
+            if (mine == 0) {
+                size_t need = (offsetof(email_dedup_entry, bytes) + len + 7) & ~(size_t)7;
+                size_t at = atomic_fetch_add_explicit(&set->arena_used, need,
+                                                      memory_order_relaxed);
+                if (at + need > set->arena_size ||
+                    atomic_load_explicit(&set->unique, memory_order_relaxed) >= set->max_addresses) {
+                    atomic_fetch_add_explicit(&set->untracked, 1, memory_order_relaxed);
+                    return EMAIL_DEDUP_UNTRACKED;
+                }
+                email_dedup_entry* e = (email_dedup_entry*)(set->arena + at);
+                atomic_init(&e->first_line, line_no);
+                atomic_init(&e->verdict, EMAIL_DEDUP_UNKNOWN);
+                e->len = (uint16_t)len;
+                memcpy(e->bytes, key, len);
+                mine = tag | (uint64_t)(at / 8 + 1);
+            }
+            if (atomic_compare_exchange_strong_explicit(&set->slots[i], &slot, mine,
+                                                        memory_order_release,
+                                                        memory_order_acquire)) {
+                atomic_fetch_add_explicit(&set->unique, 1, memory_order_relaxed);
+                *entry = email_dedup_entry_at(set, mine);
+                return EMAIL_DEDUP_NEW;
+            }
+            // Another thread took the slot first; slot now holds its entry
+        }
+
+        if ((slot & ~(((uint64_t)1 << EMAIL_DEDUP_TAG_SHIFT) - 1)) == tag) {
+            email_dedup_entry* e = email_dedup_entry_at(set, slot);
+            if (e->len == len && memcmp(e->bytes, key, len) == 0) {
+                email_dedup_lower_line(&e->first_line, line_no);
+                atomic_fetch_add_explicit(&set->duplicates, 1, memory_order_relaxed);
+                *entry = e;
+                return EMAIL_DEDUP_DUPLICATE;
+            }
+        }
+    }
+
+    // max_addresses keeps the table half empty, so this is not reached
+    atomic_fetch_add_explicit(&set->untracked, 1, memory_order_relaxed);
+    return EMAIL_DEDUP_UNTRACKED;
+}
+
+/**
+ * Function: email_dedup_add
+ * Purpose: Adds an address to the set
+ *
+ * Parameters:
+ *   set        - the set
+ *   p, len     - the address
+ *   line_no    - where it was seen (line number, or index + 1 for arrays)
+ *   first_line - receives the lowest line the address has been added
+ *                with so far, may be NULL; line_no when untracked
+ *
+ * Returns:
+ *   EMAIL_DEDUP_NEW, EMAIL_DEDUP_DUPLICATE or EMAIL_DEDUP_UNTRACKED
+ */
+email_dedup_result email_dedup_add(email_dedup* set, const char* p, size_t len,
+                                   uint64_t line_no, uint64_t* first_line) {
+    email_dedup_entry* e;
+    email_dedup_result r = email_dedup_insert(set, p, len, line_no, &e);
+
+    if (first_line != NULL) {
+        *first_line = e != NULL ? atomic_load_explicit(&e->first_line, memory_order_relaxed)
+                                : line_no;
+    }
+    return r;
+}
+
+/**
+ * Function: email_dedup_find
+ * Purpose: Looks an address up without adding it
+ *
+ * Returns:
+ *   true with *first_line (may be NULL) set when the address is in the set
+ */
+bool email_dedup_find(email_dedup* set, const char* p, size_t len, uint64_t* first_line) {
+    char key[MAX_EMAIL_LENGTH];
+
+    if (p == NULL || len > MAX_EMAIL_LENGTH) {
+        return false;
+    }
+
+    uint64_t h = email_dedup_normalize(p, len, key);
+    uint64_t tag = h >> EMAIL_DEDUP_TAG_SHIFT << EMAIL_DEDUP_TAG_SHIFT;
+
+    for (size_t i = (size_t)h & set->mask, probes = 0; probes <= set->mask;
+         i = (i + 1) & set->mask, probes++) {
+        uint64_t slot = atomic_load_explicit(&set->slots[i], memory_order_acquire);
+        if (slot == 0) {
+            return false;
+        }
+        if ((slot & ~(((uint64_t)1 << EMAIL_DEDUP_TAG_SHIFT) - 1)) == tag) {
+            email_dedup_entry* e = email_dedup_entry_at(set, slot);
+            if (e->len == len && memcmp(e->bytes, key, len) == 0) {
+                if (first_line != NULL) {
+                    *first_line = atomic_load_explicit(&e->first_line, memory_order_relaxed);
+                }
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Function: email_dedup_snapshot
+ * Purpose: Copies the counters of the set into *out
+ */
+void email_dedup_snapshot(email_dedup* set, email_dedup_stats* out) {
+    size_t used = atomic_load_explicit(&set->arena_used, memory_order_relaxed);
+
+    out->unique = atomic_load_explicit(&set->unique, memory_order_relaxed);
+    out->duplicates = atomic_load_explicit(&set->duplicates, memory_order_relaxed);
+    out->untracked = atomic_load_explicit(&set->untracked, memory_order_relaxed);
+    out->arena_used = used < set->arena_size ? used : set->arena_size;
+    out->arena_size = set->arena_size;
+}
+
+/**
+ * Function: email_dedup_validate
+ * Purpose: The verdict of p[0..len), validated only the first time the
+ *          set sees the address
+ *
+ * Parameters:
+ *   set        - the set
+ *   p, len     - the address
+ *   line_no    - where it was seen
+ *   check      - how to validate it the first time
+ *   first_line - receives the first line of the address so far
+ *
+ * Returns:
+ *   the verdict; *duplicate says whether it was remembered from before
+ *
+ * A duplicate whose first occurrence is still being validated by another
+ * thread is simply validated again.
+ */
+bool email_dedup_validate(email_dedup* set, const char* p, size_t len, uint64_t line_no,
+                          const email_validator* check, bool* duplicate,
+                          uint64_t* first_line) {
+    email_dedup_entry* e;
+    email_dedup_result r = email_dedup_insert(set, p, len, line_no, &e);
+
+    *duplicate = r == EMAIL_DEDUP_DUPLICATE;
+    *first_line = e != NULL ? atomic_load_explicit(&e->first_line, memory_order_relaxed)
+                            : line_no;
+
+    if (e != NULL) {
+        uint8_t verdict = atomic_load_explicit(&e->verdict, memory_order_relaxed);
+        if (verdict != EMAIL_DEDUP_UNKNOWN) {
+            return verdict == EMAIL_DEDUP_VALID;
+        }
+    }
+
+    bool valid = email_validator_run(check, p, len);
+    if (e != NULL) {
+        atomic_store_explicit(&e->verdict, valid ? EMAIL_DEDUP_VALID : EMAIL_DEDUP_INVALID,
+                              memory_order_relaxed);
+    }
+    return valid;
+}
@@ -0,0 +1,822 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef EMAIL_VALIDATE_HAVE_CARES
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+// ares_query() with the raw answer is what every c-ares since 1.10 has;
+// releases from 1.28 on flag it in favour of ares_query_dnsrec()
+#define CARES_NO_DEPRECATED
+#include <ares.h>
+#endif
+
+#include "email_internal.h"
+
+/*
+ * Asynchronous MX verification
+ *
+ * One resolver thread owns a c-ares channel and everything the lookups
+ * need; the threads that submit domains only touch a mutex-protected
+ * queue of requests, so a submission costs a lock and a copy of the
+ * domain and never waits on the network.
+ *
+ * On the resolver thread a request is answered from the cache when its
+ * domain was resolved recently, attached to the query already running for
+ * its domain when there is one, or else starts a query of its own. At
+ * most max_in_flight domains are resolved at once; requests beyond that
+ * wait in a FIFO backlog. A domain is first asked for MX records and, when
+ * it has none, for A records. Answers are cached for the TTL of the
+ * records (capped at max_ttl) and negative answers for the TTL the SOA
+ * record asks for (RFC 2308, capped at negative_ttl); timeouts and
+ * failures are not cached.
+ *
+ * Requests come from a pool of max_pending slots allocated up front, so a
+ * burst of submissions fails fast with EAGAIN instead of growing memory.
+ */
+#define EMAIL_DNS_NAME_MAX 253
+
+/**
+ * Function: email_dns_status_name
+ * Purpose: Returns the name of a status ("MX", "NXDOMAIN", ...)
+ */
+const char* email_dns_status_name(email_dns_status status) {
+    switch (status) {
+    case EMAIL_DNS_MX:        return "MX";
+    case EMAIL_DNS_A:         return "A";
+    case EMAIL_DNS_NO_MAIL:   return "NO_MAIL";
+    case EMAIL_DNS_NXDOMAIN:  return "NXDOMAIN";
+    case EMAIL_DNS_TIMEOUT:   return "TIMEOUT";
+    case EMAIL_DNS_FAILED:    return "FAILED";
+    case EMAIL_DNS_CANCELLED: return "CANCELLED";
+    }
+    return "UNKNOWN";
+}
+
+/**
+ * Function: email_dns_submit_address
+ * Purpose: email_dns_submit() for the domain of the valid address p[0..len)
+ */
+int email_dns_submit_address(email_dns* dns, const char* p, size_t len,
+                             email_dns_fn fn, void* ctx) {
+    const char* at = p != NULL ? email_domain_at(p, len) : NULL;
+    if (at == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t local = (size_t)(at - p);
+    return email_dns_submit(dns, at + 1, len - local - 1, fn, ctx);
+}
+
+#ifdef EMAIL_VALIDATE_HAVE_CARES
+
+#define EMAIL_DNS_CLASS_IN 1
+#define EMAIL_DNS_TYPE_A 1
+#define EMAIL_DNS_TYPE_SOA 6
+#define EMAIL_DNS_TYPE_MX 15
+
+typedef struct email_dns_request {
+    struct email_dns_request* next;
+    email_dns_fn fn;
+    void* ctx;
+    uint64_t hash;
+    size_t len;
+    char domain[EMAIL_DNS_NAME_MAX + 1];   // lowercase, NUL-terminated
+} email_dns_request;
+
+typedef struct email_dns_query {
+    email_dns* dns;
+    struct email_dns_query* next_free;
+    const email_dns_request* key;   // the request that started the query
+    email_dns_request* waiters;     // every request for the domain, key included
+    bool fallback;                  // the MX answer was empty, asking for A
+    bool active;
+} email_dns_query;
+
+typedef struct {
+    uint64_t hash;
+    uint64_t expires_ms;            // 0 while the entry is empty
+    email_dns_status status;
+    size_t len;
+    char domain[EMAIL_DNS_NAME_MAX + 1];
+} email_dns_cache_entry;
+
+struct email_dns {
+    ares_channel channel;
+    bool channel_ready;
+    pthread_t thread;
+    bool thread_started;
+    int wake[2];                    // written to when the queue goes non-empty
+    unsigned max_ttl;
+    unsigned negative_ttl;
+
+    // Shared with the submitting threads, under lock
+    pthread_mutex_t lock;
+    pthread_cond_t idle;            // signalled when outstanding drops to 0
+    email_dns_request* pool;
+    email_dns_request* free_requests;
+    email_dns_request* incoming;
+    email_dns_request** incoming_tail;
+    size_t outstanding;
+    bool stop;
+
+    // Resolver thread only
+    email_dns_request* backlog;
+    email_dns_request** backlog_tail;
+    email_dns_query* queries;
+    email_dns_query* free_queries;
+    unsigned max_in_flight;
+    unsigned in_flight;
+    email_dns_cache_entry* cache;
+    size_t cache_mask;
+
+    _Atomic uint64_t submitted;
+    _Atomic uint64_t cache_hits;
+    _Atomic uint64_t joined;
+    _Atomic uint64_t queries_sent;
+    _Atomic uint64_t timeouts;
+    _Atomic uint64_t in_flight_now;
+    _Atomic uint64_t in_flight_peak;
+};
+
+static uint64_t email_dns_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static inline void email_dns_count(_Atomic uint64_t* counter) {
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+static inline bool email_dns_same(const email_dns_request* r, uint64_t hash, size_t len,
+                                  const char* domain) {
+    return r->hash == hash && r->len == len && memcmp(r->domain, domain, len) == 0;
+}
+
+// ---- Answers -------------------------------------------------------------------
+
+typedef struct {
+    unsigned records;               // answer records of the type asked for
+    bool null_mx;                   // one of them is "MX 0 ." (RFC 7505)
+    uint32_t ttl;                   // lowest TTL among them
+    uint32_t negative_ttl;          // from the SOA record, UINT32_MAX without one
+} email_dns_answer;
+
+static inline uint32_t email_dns_be16(const unsigned char* p) {
+    return (uint32_t)p[0] << 8 | p[1];
+}
+
+static inline uint32_t email_dns_be32(const unsigned char* p) {
+    return email_dns_be16(p) << 16 | email_dns_be16(p + 2);
+}
+
+// Offset just past the name at buf[pos], or -1 when it runs off the end
+static int email_dns_skip_name(const unsigned char* buf, int len, int pos) {
+    while (pos < len) {
+        unsigned label = buf[pos];
+        if (label == 0) {
+            return pos + 1;
+        }
+        if ((label & 0xC0) == 0xC0) {
+            return pos + 2 <= len ? pos + 2 : -1;
+        }
+        pos += 1 + (int)label;
+    }
+    return -1;
+}
+
+/*
+ * Reads the records of the given type in the answer section, and the SOA
+ * record of the authority section, out of a raw response. c-ares parses
+ * MX records without their TTL, so the response is walked here instead.
+ */
+static bool email_dns_parse(const unsigned char* buf, int len, unsigned type,
+                            email_dns_answer* out) {
+    out->records = 0;
+    out->null_mx = false;
+    out->ttl = UINT32_MAX;
+    out->negative_ttl = UINT32_MAX;
+    if (buf == NULL || len < 12) {
+        return false;
+    }
+
+    uint32_t questions = email_dns_be16(buf + 4);
+    uint32_t answers = email_dns_be16(buf + 6);
+    uint32_t records = answers + email_dns_be16(buf + 8);
+    int pos = 12;
+
+    for (uint32_t i = 0; i < questions; i++) {
+        pos = email_dns_skip_name(buf, len, pos);
+        if (pos < 0 || pos + 4 > len) {
+            return false;
+        }
+        pos += 4;
+    }
+
+    for (uint32_t i = 0; i < records; i++) {
+        pos = email_dns_skip_name(buf, len, pos);
+        if (pos < 0 || pos + 10 > len) {
+            return false;
+        }
+        uint32_t rtype = email_dns_be16(buf + pos);
+        uint32_t ttl = email_dns_be32(buf + pos + 4);
+        int rdlen = (int)email_dns_be16(buf + pos + 8);
+        pos += 10;
+        if (pos + rdlen > len) {
+            return false;
+        }
+
+        if (i < answers && rtype == type) {
+            out->records++;
+            out->ttl = ttl < out->ttl ? ttl : out->ttl;
+            // Preference, then the root name as the exchange
+            if (type == EMAIL_DNS_TYPE_MX && rdlen == 3 && buf[pos + 2] == 0) {
+                out->null_mx = true;
+            }
+        } else if (i >= answers && rtype == EMAIL_DNS_TYPE_SOA && rdlen >= 4) {
+            // A negative answer lives for min(SOA TTL, SOA MINIMUM)
+            uint32_t minimum = email_dns_be32(buf + pos + rdlen - 4);
+            out->negative_ttl = minimum < ttl ? minimum : ttl;
+        }
+        pos += rdlen;
+    }
+
+    if (out->records == 0) {
+        out->ttl = 0;
+    }
+    return true;
+}
+
+// ---- Requests ------------------------------------------------------------------
+
+// Hands the answer to the caller and gives the request slot back
+static void email_dns_complete(email_dns* dns, email_dns_request* r, email_dns_status status) {
+    r->fn(r->domain, r->len, status, r->ctx);
+
+    pthread_mutex_lock(&dns->lock);
+    r->next = dns->free_requests;
+    dns->free_requests = r;
+    if (--dns->outstanding == 0) {
+        pthread_cond_broadcast(&dns->idle);
+    }
+    pthread_mutex_unlock(&dns->lock);
+}
+
+static void email_dns_cache_store(email_dns* dns, const email_dns_request* key,
+                                  email_dns_status status, uint32_t ttl) {
+    if (ttl == 0) {
+        return;
+    }
+    email_dns_cache_entry* e = &dns->cache[key->hash & dns->cache_mask];
+    e->hash = key->hash;
+    e->len = key->len;
+    e->status = status;
+    memcpy(e->domain, key->domain, key->len + 1);
+    e->expires_ms = email_dns_now_ms() + (uint64_t)ttl * 1000;
+}
+
+// Answers every request waiting for q and frees it for the next domain
+static void email_dns_finish(email_dns* dns, email_dns_query* q, email_dns_status status,
+                             uint32_t ttl) {
+    if (status <= EMAIL_DNS_NXDOMAIN) {
+        email_dns_cache_store(dns, q->key, status, ttl);
+    } else if (status == EMAIL_DNS_TIMEOUT) {
+        email_dns_count(&dns->timeouts);
+    }
+
+    email_dns_request* r = q->waiters;
+    q->waiters = NULL;
+    q->key = NULL;
+    q->active = false;
+    q->next_free = dns->free_queries;
+    dns->free_queries = q;
+    dns->in_flight--;
+    atomic_store_explicit(&dns->in_flight_now, dns->in_flight, memory_order_relaxed);
+
+    while (r != NULL) {
+        email_dns_request* next = r->next;
+        email_dns_complete(dns, r, status);
+        r = next;
+    }
+}
+
+static void email_dns_answered(void* arg, int status, int timeouts, unsigned char* abuf,
+                               int alen);
+
+static void email_dns_send(email_dns* dns, email_dns_query* q) {
+    email_dns_count(&dns->queries_sent);
+    ares_query(dns->channel, q->key->domain, EMAIL_DNS_CLASS_IN,
+               q->fallback ? EMAIL_DNS_TYPE_A : EMAIL_DNS_TYPE_MX, email_dns_answered, q);
+}
+
+// c-ares callback for the MX query of a domain, then for its A query
+static void email_dns_answered(void* arg, int status, int timeouts, unsigned char* abuf,
+                               int alen) {
+    email_dns_query* q = arg;
+    email_dns* dns = q->dns;
+    email_dns_answer answer;
+    bool parsed = email_dns_parse(abuf, alen,
+                                  q->fallback ? EMAIL_DNS_TYPE_A : EMAIL_DNS_TYPE_MX, &answer);
+    uint32_t ttl = answer.ttl < dns->max_ttl ? answer.ttl : dns->max_ttl;
+    uint32_t negative = answer.negative_ttl < dns->negative_ttl ? answer.negative_ttl
+                                                                : dns->negative_ttl;
+    (void)timeouts;
+
+    if (status == ARES_SUCCESS && parsed && answer.records > 0) {
+        if (q->fallback) {
+            email_dns_finish(dns, q, EMAIL_DNS_A, ttl);
+        } else if (answer.null_mx && answer.records == 1) {
+            email_dns_finish(dns, q, EMAIL_DNS_NO_MAIL, ttl);
+        } else {
+            email_dns_finish(dns, q, EMAIL_DNS_MX, ttl);
+        }
+    } else if (status == ARES_SUCCESS || status == ARES_ENODATA) {
+        // No records of the type asked for (only a CNAME, or nothing at all)
+        if (!q->fallback) {
+            q->fallback = true;
+            email_dns_send(dns, q);
+        } else {
+            email_dns_finish(dns, q, EMAIL_DNS_NO_MAIL, negative);
+        }
+    } else if (status == ARES_ENOTFOUND) {
+        email_dns_finish(dns, q, EMAIL_DNS_NXDOMAIN, negative);
+    } else if (status == ARES_ETIMEOUT) {
+        email_dns_finish(dns, q, EMAIL_DNS_TIMEOUT, 0);
+    } else if (status == ARES_ECANCELLED || status == ARES_EDESTRUCTION) {
+        email_dns_finish(dns, q, EMAIL_DNS_CANCELLED, 0);
+    } else {
+        email_dns_finish(dns, q, EMAIL_DNS_FAILED, 0);
+    }
+}
+
+/*
+ * Answers r from the cache, joins it to the query running for its domain,
+ * or, when may_start is set and a query slot is free, starts one. Returns
+ * false when r has to wait in the backlog.
+ */
+static bool email_dns_dispatch(email_dns* dns, email_dns_request* r, uint64_t now,
+                               bool may_start) {
+    email_dns_cache_entry* e = &dns->cache[r->hash & dns->cache_mask];
+    if (e->expires_ms > now && e->hash == r->hash && e->len == r->len &&
+        memcmp(e->domain, r->domain, r->len) == 0) {
+        email_dns_count(&dns->cache_hits);
+        email_dns_complete(dns, r, e->status);
+        return true;
+    }
+
+    for (unsigned i = 0; i < dns->max_in_flight; i++) {
+        email_dns_query* q = &dns->queries[i];
+        if (q->active && email_dns_same(q->key, r->hash, r->len, r->domain)) {
+            r->next = q->waiters;
+            q->waiters = r;
+            email_dns_count(&dns->joined);
+            return true;
+        }
+    }
+
+    if (!may_start || dns->free_queries == NULL) {
+        return false;
+    }
+
+    email_dns_query* q = dns->free_queries;
+    dns->free_queries = q->next_free;
+    q->key = r;
+    r->next = NULL;
+    q->waiters = r;
+    q->fallback = false;
+    q->active = true;
+    dns->in_flight++;
+    atomic_store_explicit(&dns->in_flight_now, dns->in_flight, memory_order_relaxed);
+    if (dns->in_flight > atomic_load_explicit(&dns->in_flight_peak, memory_order_relaxed)) {
+        atomic_store_explicit(&dns->in_flight_peak, dns->in_flight, memory_order_relaxed);
+    }
+    email_dns_send(dns, q);
+    return true;
+}
+
+static void email_dns_defer(email_dns* dns, email_dns_request* r) {
+    r->next = NULL;
+    *dns->backlog_tail = r;
+    dns->backlog_tail = &r->next;
+}
+
+// Starts what the backlog holds, oldest first, while query slots are free
+static void email_dns_drain_backlog(email_dns* dns, uint64_t now) {
+    while (dns->backlog != NULL) {
+        email_dns_request* r = dns->backlog;
+        email_dns_request* next = r->next;
+        if (!email_dns_dispatch(dns, r, now, true)) {
+            break;
+        }
+        dns->backlog = next;
+        if (next == NULL) {
+            dns->backlog_tail = &dns->backlog;
+        }
+    }
+}
+
+// ---- Resolver thread -----------------------------------------------------------
+
+// Waits for the channel's sockets, the wake-up pipe or the next timeout
+static void email_dns_poll(email_dns* dns) {
+    ares_socket_t socks[ARES_GETSOCK_MAXNUM];
+    struct pollfd fds[1 + ARES_GETSOCK_MAXNUM];
+    nfds_t nfds = 1;
+    int bits = ares_getsock(dns->channel, socks, ARES_GETSOCK_MAXNUM);
+
+    fds[0].fd = dns->wake[0];
+    fds[0].events = POLLIN;
+    for (int i = 0; i < ARES_GETSOCK_MAXNUM; i++) {
+        short events = 0;
+        if (ARES_GETSOCK_READABLE(bits, i)) {
+            events |= POLLIN;
+        }
+        if (ARES_GETSOCK_WRITABLE(bits, i)) {
+            events |= POLLOUT;
+        }
+        if (events != 0) {
+            fds[nfds].fd = socks[i];
+            fds[nfds].events = events;
+            nfds++;
+        }
+    }
+
+    struct timeval tv;
+    struct timeval* next = ares_timeout(dns->channel, NULL, &tv);
+    int timeout_ms = next != NULL ? (int)(tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000) : -1;
+    if (poll(fds, nfds, timeout_ms) < 0) {
+        return;   // EINTR: the caller loops
+    }
+
+    if (fds[0].revents != 0) {
+        char drain[64];
+        while (read(dns->wake[0], drain, sizeof(drain)) > 0) {
+        }
+    }
+    for (nfds_t k = 1; k < nfds; k++) {
+        short ready = fds[k].revents;
+        if (ready != 0) {
+            ares_process_fd(dns->channel,
+                            ready & (POLLIN | POLLERR | POLLHUP) ? fds[k].fd : ARES_SOCKET_BAD,
+                            ready & POLLOUT ? fds[k].fd : ARES_SOCKET_BAD);
+        }
+    }
+    // Expires queries whose timeout has passed
+    ares_process_fd(dns->channel, ARES_SOCKET_BAD, ARES_SOCKET_BAD);
+}
+
+static void* email_dns_run(void* arg) {
+    email_dns* dns = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&dns->lock);
+        email_dns_request* r = dns->incoming;
+        dns->incoming = NULL;
+        dns->incoming_tail = &dns->incoming;
+        bool stop = dns->stop;
+        pthread_mutex_unlock(&dns->lock);
+
+        if (stop) {
+            while (r != NULL) {
+                email_dns_request* next = r->next;
+                email_dns_defer(dns, r);
+                r = next;
+            }
+            break;
+        }
+
+        uint64_t now = email_dns_now_ms();
+        email_dns_drain_backlog(dns, now);
+        while (r != NULL) {
+            email_dns_request* next = r->next;
+            if (!email_dns_dispatch(dns, r, now, dns->backlog == NULL)) {
+                email_dns_defer(dns, r);
+            }
+            r = next;
+        }
+
+        email_dns_poll(dns);
+    }
+
+    // Running queries call back with ARES_ECANCELLED
+    ares_cancel(dns->channel);
+    while (dns->backlog != NULL) {
+        email_dns_request* r = dns->backlog;
+        dns->backlog = r->next;
+        email_dns_complete(dns, r, EMAIL_DNS_CANCELLED);
+    }
+    dns->backlog_tail = &dns->backlog;
+    return NULL;
+}
+
+// ---- Public interface ----------------------------------------------------------
+
+static pthread_once_t email_dns_library_once = PTHREAD_ONCE_INIT;
+static int email_dns_library_status = ARES_SUCCESS;
+
+static void email_dns_library_init(void) {
+    email_dns_library_status = ares_library_init(ARES_LIB_INIT_ALL);
+}
+
+static void email_dns_free(email_dns* dns) {
+    if (dns->channel_ready) {
+        ares_destroy(dns->channel);
+    }
+    if (dns->wake[0] >= 0) {
+        close(dns->wake[0]);
+        close(dns->wake[1]);
+    }
+    pthread_cond_destroy(&dns->idle);
+    pthread_mutex_destroy(&dns->lock);
+    free(dns->cache);
+    free(dns->queries);
+    free(dns->pool);
+    free(dns);
+}
+
+/**
+ * Function: email_dns_create
+ * Purpose: Starts a resolver thread with its own c-ares channel
+ *
+ * Parameters:
+ *   opts - limits, timeouts and servers; NULL takes the defaults
+ *
+ * Returns:
+ *   the resolver, or NULL with errno set (ENOMEM, EINVAL for a bad
+ *   servers list, or what pipe() or pthread_create() failed with)
+ */
+email_dns* email_dns_create(const email_dns_options* opts) {
+    email_dns_options o = {0};
+    if (opts != NULL) {
+        o = *opts;
+    }
+    o.max_in_flight = o.max_in_flight != 0 ? o.max_in_flight : 64;
+    o.max_pending = o.max_pending != 0 ? o.max_pending : 4096;
+    o.timeout_ms = o.timeout_ms != 0 ? o.timeout_ms : 2000;
+    o.tries = o.tries != 0 ? o.tries : 2;
+    o.cache_size = o.cache_size != 0 ? o.cache_size : 4096;
+    o.max_ttl = o.max_ttl != 0 ? o.max_ttl : 3600;
+    o.negative_ttl = o.negative_ttl != 0 ? o.negative_ttl : 300;
+
+    pthread_once(&email_dns_library_once, email_dns_library_init);
+    if (email_dns_library_status != ARES_SUCCESS) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    email_dns* dns = calloc(1, sizeof(*dns));
+    if (dns == NULL) {
+        return NULL;
+    }
+    dns->wake[0] = dns->wake[1] = -1;
+    pthread_mutex_init(&dns->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&dns->idle, &attr);
+    pthread_condattr_destroy(&attr);
+
+    size_t slots = 1;
+    while (slots < o.cache_size) {
+        slots <<= 1;
+    }
+    dns->cache = calloc(slots, sizeof(*dns->cache));
+    dns->cache_mask = slots - 1;
+    dns->queries = calloc(o.max_in_flight, sizeof(*dns->queries));
+    dns->pool = calloc(o.max_pending, sizeof(*dns->pool));
+    if (dns->cache == NULL || dns->queries == NULL || dns->pool == NULL) {
+        email_dns_free(dns);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    dns->max_in_flight = o.max_in_flight;
+    dns->max_ttl = o.max_ttl;
+    dns->negative_ttl = o.negative_ttl;
+    for (unsigned i = o.max_in_flight; i-- > 0;) {
+        dns->queries[i].dns = dns;
+        dns->queries[i].next_free = dns->free_queries;
+        dns->free_queries = &dns->queries[i];
+    }
+    for (unsigned i = o.max_pending; i-- > 0;) {
+        dns->pool[i].next = dns->free_requests;
+        dns->free_requests = &dns->pool[i];
+    }
+    dns->incoming_tail = &dns->incoming;
+    dns->backlog_tail = &dns->backlog;
+
+    if (pipe(dns->wake) != 0) {
+        int saved = errno;
+        dns->wake[0] = dns->wake[1] = -1;
+        email_dns_free(dns);
+        errno = saved;
+        return NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(dns->wake[i], F_SETFL, fcntl(dns->wake[i], F_GETFL) | O_NONBLOCK);
+        fcntl(dns->wake[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    struct ares_options ao;
+    memset(&ao, 0, sizeof(ao));
+    ao.timeout = (int)o.timeout_ms;
+    ao.tries = (int)o.tries;
+    int rc = ares_init_options(&dns->channel, &ao, ARES_OPT_TIMEOUTMS | ARES_OPT_TRIES);
+    dns->channel_ready = rc == ARES_SUCCESS;
+    if (rc == ARES_SUCCESS && o.servers != NULL) {
+        rc = ares_set_servers_ports_csv(dns->channel, o.servers);
+    }
+    if (rc != ARES_SUCCESS) {
+        email_dns_free(dns);
+        errno = rc == ARES_ENOMEM ? ENOMEM : EINVAL;
+        return NULL;
+    }
+
+    rc = pthread_create(&dns->thread, NULL, email_dns_run, dns);
+    if (rc != 0) {
+        email_dns_free(dns);
+        errno = rc;
+        return NULL;
+    }
+    dns->thread_started = true;
+    return dns;
+}
+
+/**
+ * Function: email_dns_destroy
+ * Purpose: Cancels what is still pending, stops the resolver thread and
+ *          frees the resolver; NULL is ignored
+ */
+void email_dns_destroy(email_dns* dns) {
+    if (dns == NULL) {
+        return;
+    }
+    if (dns->thread_started) {
+        pthread_mutex_lock(&dns->lock);
+        dns->stop = true;
+        pthread_mutex_unlock(&dns->lock);
+        (void)!write(dns->wake[1], "", 1);
+        pthread_join(dns->thread, NULL);
+    }
+    email_dns_free(dns);
+}
+
+/**
+ * Function: email_dns_submit
+ * Purpose: Queues domain[0..len) for the resolver thread
+ *
+ * Parameters:
+ *   dns    - the resolver
+ *   domain - the domain, in any case; it is copied
+ *   len    - number of bytes in the domain
+ *   fn     - called with the answer, on the resolver thread
+ *   ctx    - passed to fn
+ *
+ * Returns:
+ *   0, or -1 with errno EAGAIN when max_pending requests are outstanding,
+ *   EINVAL for an empty or over-long domain
+ */
+int email_dns_submit(email_dns* dns, const char* domain, size_t len,
+                     email_dns_fn fn, void* ctx) {
+    if (domain == NULL || fn == NULL || len == 0 || len > EMAIL_DNS_NAME_MAX ||
+        memchr(domain, '\0', len) != NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&dns->lock);
+    email_dns_request* r = dns->free_requests;
+    if (r != NULL) {
+        dns->free_requests = r->next;
+        dns->outstanding++;
+    }
+    pthread_mutex_unlock(&dns->lock);
+    if (r == NULL) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        char c = domain[i];
+        r->domain[i] = c >= 'A' && c <= 'Z' ? (char)(c | 0x20) : c;
+    }
+    r->domain[len] = '\0';
+    uint64_t h = len;
+    for (size_t i = 0; i < len; i += 8) {
+        h = (h ^ email_load_word(r->domain + i, len - i)) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 29;
+    }
+    r->hash = h * 0xBF58476D1CE4E5B9ull;
+    r->len = len;
+    r->fn = fn;
+    r->ctx = ctx;
+    r->next = NULL;
+    email_dns_count(&dns->submitted);
+
+    pthread_mutex_lock(&dns->lock);
+    bool was_empty = dns->incoming == NULL;
+    *dns->incoming_tail = r;
+    dns->incoming_tail = &r->next;
+    pthread_mutex_unlock(&dns->lock);
+    if (was_empty) {
+        // A full pipe already has a wake-up in it
+        (void)!write(dns->wake[1], "", 1);
+    }
+    return 0;
+}
+
+/**
+ * Function: email_dns_wait
+ * Purpose: Waits until every submitted request has been answered
+ *
+ * Parameters:
+ *   dns        - the resolver
+ *   timeout_ms - longest wait; negative waits as long as it takes
+ *
+ * Returns:
+ *   0, or -1 with errno ETIMEDOUT. Must not be called from a callback.
+ */
+int email_dns_wait(email_dns* dns, int timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    if (timeout_ms >= 0) {
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    pthread_mutex_lock(&dns->lock);
+    while (dns->outstanding > 0) {
+        if (timeout_ms < 0) {
+            pthread_cond_wait(&dns->idle, &dns->lock);
+        } else if (pthread_cond_timedwait(&dns->idle, &dns->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    bool idle = dns->outstanding == 0;
+    pthread_mutex_unlock(&dns->lock);
+
+    if (!idle) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function: email_dns_snapshot
+ * Purpose: Copies the counters of the resolver into *out
+ */
+void email_dns_snapshot(email_dns* dns, email_dns_stats* out) {
+    out->submitted = atomic_load_explicit(&dns->submitted, memory_order_relaxed);
+    out->cache_hits = atomic_load_explicit(&dns->cache_hits, memory_order_relaxed);
+    out->joined = atomic_load_explicit(&dns->joined, memory_order_relaxed);
+    out->queries = atomic_load_explicit(&dns->queries_sent, memory_order_relaxed);
+    out->timeouts = atomic_load_explicit(&dns->timeouts, memory_order_relaxed);
+    out->in_flight = atomic_load_explicit(&dns->in_flight_now, memory_order_relaxed);
+    out->in_flight_peak = atomic_load_explicit(&dns->in_flight_peak, memory_order_relaxed);
+}
+
+#else  // !EMAIL_VALIDATE_HAVE_CARES
+
+// Built without c-ares: the resolver cannot be created
+
+email_dns* email_dns_create(const email_dns_options* opts) {
+    (void)opts;
+    errno = ENOTSUP;
+    return NULL;
+}
+
+void email_dns_destroy(email_dns* dns) {
+    (void)dns;
+}
+
+int email_dns_submit(email_dns* dns, const char* domain, size_t len,
+                     email_dns_fn fn, void* ctx) {
+    (void)dns, (void)domain, (void)len, (void)fn, (void)ctx;
+    errno = ENOTSUP;
+    return -1;
+}
+
+int email_dns_wait(email_dns* dns, int timeout_ms) {
+    (void)dns, (void)timeout_ms;
+    return 0;
+}
+
+void email_dns_snapshot(email_dns* dns, email_dns_stats* out) {
+    (void)dns;
+    memset(out, 0, sizeof(*out));
+}
+
+#endif  // EMAIL_VALIDATE_HAVE_CARES
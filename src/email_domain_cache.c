@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "email_internal.h"
+
+/*
+ * Domain verdict cache
+ *
+ * A direct-mapped table of EMAIL_DOMAIN_CACHE_SLOTS slots, one cache line
+ * each. A slot holds a domain of up to EMAIL_DOMAIN_CACHE_KEY bytes, as
+ * seven words, and a header word with its length, its verdict and a
+ * sequence number:
+ *
+ *   bits  0..31  sequence, odd while a writer is filling the slot
+ *   bits 32..39  domain length, 0 for an empty slot
+ *   bits 40..55  verdict (see email_internal.h)
+ *
+ * Slots are seqlocks: a reader loads the header, compares the words and
+ * loads the header again, and only trusts a match when the header did not
+ * change in between. A writer claims the slot by making the sequence odd
+ * with a compare-and-swap, and skips the update if another writer holds
+ * it. Every field is an atomic, so readers never see a torn key as a
+ * match, and nobody ever waits. A domain that collides with another one
+ * simply takes over the slot; the cache only has to be right, not full.
+ */
+#define EMAIL_DOMAIN_CACHE_SLOTS 1024   // 64 KiB, a power of two
+#define EMAIL_DOMAIN_CACHE_WORDS (EMAIL_DOMAIN_CACHE_KEY / 8)
+
+_Static_assert(EMAIL_DOMAIN_CACHE_WORDS == 7, "a slot is one 64-byte line");
+_Static_assert(MAX_EMAIL_LENGTH < (1 << 16), "the TLD position fits the verdict field");
+
+typedef struct {
+    _Alignas(64) _Atomic uint64_t header;
+    _Atomic uint64_t words[EMAIL_DOMAIN_CACHE_WORDS];
+} email_domain_slot;
+
+struct email_domain_cache {
+    email_domain_slot slots[EMAIL_DOMAIN_CACHE_SLOTS];
+};
+
+#define EMAIL_SLOT_SEQ(h) ((uint32_t)(h))
+#define EMAIL_SLOT_LEN(h) ((size_t)((h) >> 32) & 0xFF)
+#define EMAIL_SLOT_VERDICT(h) ((unsigned)((h) >> 40) & 0xFFFF)
+
+static inline email_domain_slot* email_domain_slot_of(email_domain_cache* cache,
+                                                      uint64_t hash) {
+    return &cache->slots[hash >> (64 - 10)];
+}
+_Static_assert(EMAIL_DOMAIN_CACHE_SLOTS == 1 << 10, "slot index is the top 10 hash bits");
+
+/**
+ * Function: email_domain_cache_create
+ * Purpose: Allocates an empty domain cache
+ *
+ * Returns:
+ *   the cache, or NULL when out of memory
+ */
+email_domain_cache* email_domain_cache_create(void) {
+    email_domain_cache* cache = aligned_alloc(64, sizeof(*cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < EMAIL_DOMAIN_CACHE_SLOTS; i++) {
+        atomic_init(&cache->slots[i].header, 0);
+        for (size_t k = 0; k < EMAIL_DOMAIN_CACHE_WORDS; k++) {
+            atomic_init(&cache->slots[i].words[k], 0);
+        }
+    }
+    return cache;
+}
+
+/**
+ * Function: email_domain_cache_destroy
+ * Purpose: Frees a cache made by email_domain_cache_create(); NULL is ignored
+ */
+void email_domain_cache_destroy(email_domain_cache* cache) {
+    free(cache);
+}
+
+/**
+ * Function: email_domain_cache_lookup
+ * Purpose: Looks up the verdict of domain[0..len)
+ *
+ * Parameters:
+ *   cache   - the cache
+ *   domain  - first byte after the '@'
+ *   len     - number of domain bytes
+ *   key     - receives the domain and its hash, to hand to
+ *             email_domain_cache_store() after a miss
+ *   verdict - receives the cached verdict on a hit
+ *
+ * Returns:
+ *   true on a hit; false on a miss or for a domain too long to cache
+ */
+bool email_domain_cache_lookup(email_domain_cache* cache, const char* domain,
+                               size_t len, email_domain_key* key, unsigned* verdict) {
+    key->domain = domain;
+    key->len = len;
+    if (len == 0 || len > EMAIL_DOMAIN_CACHE_KEY) {
+        return false;
+    }
+
+    // The hash only takes the first and the last eight bytes, so there is
+    // no loop over the domain before the slot is known
+    uint64_t first = email_load_word(domain, len);
+    uint64_t last = len > 8 ? email_load_word(domain + len - 8, 8) : first;
+    uint64_t h = (first ^ len) * 0x9E3779B97F4A7C15ull;
+    h = (h ^ (h >> 29) ^ last) * 0xBF58476D1CE4E5B9ull;
+    key->hash = h ^ (h >> 31);
+
+    email_domain_slot* slot = email_domain_slot_of(cache, key->hash);
+    uint64_t before = atomic_load_explicit(&slot->header, memory_order_acquire);
+    if ((EMAIL_SLOT_SEQ(before) & 1) != 0 || EMAIL_SLOT_LEN(before) != len) {
+        return false;
+    }
+
+    uint64_t diff = atomic_load_explicit(&slot->words[0], memory_order_relaxed) ^ first;
+    for (size_t k = 1; k < (len + 7) / 8; k++) {
+        diff |= atomic_load_explicit(&slot->words[k], memory_order_relaxed) ^
+                email_load_word(domain + 8 * k, len - 8 * k);
+    }
+
+    // The words must have been read while the header stayed the same
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t after = atomic_load_explicit(&slot->header, memory_order_relaxed);
+    if (diff != 0 || after != before) {
+        return false;
+    }
+
+    *verdict = EMAIL_SLOT_VERDICT(before);
+    return true;
+}
+
+/**
+ * Function: email_domain_cache_store
+ * Purpose: Records the verdict of the domain a lookup has just missed
+ *
+ * Parameters:
+ *   cache   - the cache
+ *   key     - as filled in by email_domain_cache_lookup()
+ *   verdict - the verdict to remember
+ *
+ * Does nothing for domains that cannot be cached, or when another thread
+ * is writing the same slot.
+ */
+void email_domain_cache_store(email_domain_cache* cache, const email_domain_key* key,
+                              unsigned verdict) {
+    if (key->len == 0 || key->len > EMAIL_DOMAIN_CACHE_KEY) {
+        return;
+    }
+
+    email_domain_slot* slot = email_domain_slot_of(cache, key->hash);
+    uint64_t header = atomic_load_explicit(&slot->header, memory_order_relaxed);
+    uint32_t seq = EMAIL_SLOT_SEQ(header);
+    if ((seq & 1) != 0 ||
+        !atomic_compare_exchange_strong_explicit(&slot->header, &header,
+                                                 (header & ~(uint64_t)UINT32_MAX) | (seq + 1),
+                                                 memory_order_acquire,
+                                                 memory_order_relaxed)) {
+        return;
+    }
+
+    // Readers that see any of the new words also see the odd sequence
+    atomic_thread_fence(memory_order_release);
+
+    size_t words = (key->len + 7) / 8;
+    for (size_t k = 0; k < EMAIL_DOMAIN_CACHE_WORDS; k++) {
+        uint64_t w = k < words ? email_load_word(key->domain + 8 * k, key->len - 8 * k) : 0;
+        atomic_store_explicit(&slot->words[k], w, memory_order_relaxed);
+    }
+
+    uint64_t next = (uint64_t)(seq + 2) | (uint64_t)key->len << 32 |
+                    (uint64_t)(verdict & 0xFFFF) << 40;
+    atomic_store_explicit(&slot->header, next, memory_order_release);
+}
@@ -0,0 +1,534 @@
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "email_internal.h"
+
+/*
+ * Internationalized addresses
+ *
+ * RFC 6531 (SMTPUTF8) lets the local part hold any UTF-8 beyond ASCII,
+ * and IDNA2008 (RFC 5890-5893) lets a domain label hold the letters and
+ * digits of any script, carried on the wire as an A-label: "xn--" and the
+ * punycode (RFC 3492) of the label. Rather than a second copy of the
+ * rules, a non-ASCII address is checked through its ASCII shadow: every
+ * permitted non-ASCII character of the local part stands in as 'a', every
+ * non-ASCII domain label as its A-label, and email_check() runs on that.
+ * For each shadow byte the position of the input byte it stands for is
+ * kept, which turns the offset email_check() reports back into one into
+ * the input.
+ *
+ * The character rules are a compact approximation of the IDNA2008 and
+ * UTS #46 tables, not the tables themselves: labels are lowercased for
+ * Latin-1, Latin Extended-A, Greek and Cyrillic, fullwidth ASCII is
+ * folded to ASCII, and controls, spaces, punctuation and symbol blocks,
+ * private use, noncharacters and emoji are refused, as is a label that
+ * starts with a combining mark. There is no NFC normalization and no
+ * contextual or bidi rule.
+ */
+
+#define EMAIL_FAIL(reason, pos)   \
+    do {                          \
+        if (offset != NULL) {     \
+            *offset = (pos);      \
+        }                         \
+        return (reason);          \
+    } while (0)
+
+// Longest A-label, "xn--" included (RFC 1035)
+#define EMAIL_LABEL_MAX 63
+#define EMAIL_ACE_PREFIX "xn--"
+#define EMAIL_ACE_PREFIX_LEN 4
+
+_Static_assert(MAX_EMAIL_LENGTH <= UINT16_MAX, "shadow positions are 16 bits");
+
+// ---- UTF-8 ----
+
+// Decodes the code point at s[0..len) into *cp; returns its length in
+// bytes, or 0 for a malformed or overlong sequence, a surrogate, or a
+// value above U+10FFFF
+static size_t email_utf8_decode(const char* s, size_t len, uint32_t* cp) {
+    const unsigned char* p = (const unsigned char*)s;
+    unsigned char c = p[0];
+    unsigned char lo = 0x80, hi = 0xBF;  // range of the second byte
+    size_t n;
+    uint32_t v;
+
+    if (c < 0x80) {
+        *cp = c;
+        return 1;
+    }
+    if (c >= 0xC2 && c <= 0xDF) {
+        n = 2;
+        v = c & 0x1F;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        n = 3;
+        v = c & 0x0F;
+        lo = c == 0xE0 ? 0xA0 : 0x80;  // overlong below U+0800
+        hi = c == 0xED ? 0x9F : 0xBF;  // surrogates U+D800..U+DFFF
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        n = 4;
+        v = c & 0x07;
+        lo = c == 0xF0 ? 0x90 : 0x80;  // overlong below U+10000
+        hi = c == 0xF4 ? 0x8F : 0xBF;  // above U+10FFFF
+    } else {
+        return 0;
+    }
+    if (len < n || p[1] < lo || p[1] > hi) {
+        return 0;
+    }
+    v = (v << 6) | (p[1] & 0x3F);
+    for (size_t k = 2; k < n; k++) {
+        if ((p[k] & 0xC0) != 0x80) {
+            return 0;
+        }
+        v = (v << 6) | (p[k] & 0x3F);
+    }
+    *cp = v;
+    return n;
+}
+
+// ---- Character rules ----
+
+// Non-ASCII spaces, rejected as EMAIL_WHITESPACE
+static bool email_is_unicode_space(uint32_t cp) {
+    return cp == 0x85 || cp == 0xA0 || cp == 0x1680 || (cp >= 0x2000 && cp <= 0x200A) ||
+           cp == 0x2028 || cp == 0x2029 || cp == 0x202F || cp == 0x205F || cp == 0x3000;
+}
+
+// Non-ASCII code points no part of an address may hold: C1 controls,
+// invisible format characters, private use, tags and noncharacters
+static bool email_is_unicode_forbidden(uint32_t cp) {
+    return cp < 0xA0 || (cp >= 0x200B && cp <= 0x200F) || (cp >= 0x202A && cp <= 0x202E) ||
+           (cp >= 0x2060 && cp <= 0x206F) || cp == 0xFEFF || (cp >= 0xE000 && cp <= 0xF8FF) ||
+           (cp >= 0xFDD0 && cp <= 0xFDEF) || (cp & 0xFFFE) == 0xFFFE || cp >= 0xE0000;
+}
+
+// Combining marks, which cannot start a label (RFC 5891 section 5.4)
+static bool email_is_combining(uint32_t cp) {
+    return (cp >= 0x300 && cp <= 0x36F) || (cp >= 0x1AB0 && cp <= 0x1AFF) ||
+           (cp >= 0x1DC0 && cp <= 0x1DFF) || (cp >= 0x20D0 && cp <= 0x20FF) ||
+           (cp >= 0xFE20 && cp <= 0xFE2F);
+}
+
+// The label separators of IDNA: '.' and the ideographic, fullwidth and
+// halfwidth full stops
+static bool email_is_label_dot(uint32_t cp) {
+    return cp == '.' || cp == 0x3002 || cp == 0xFF0E || cp == 0xFF61;
+}
+
+// A non-ASCII code point of a domain label as IDNA maps it: lowercased,
+// with fullwidth ASCII folded to ASCII; 0 when no label may contain it
+static uint32_t email_idna_map(uint32_t cp) {
+    if (email_is_unicode_space(cp) || email_is_unicode_forbidden(cp)) {
+        return 0;
+    }
+    if (cp >= 0xFF01 && cp <= 0xFF5E) {
+        cp -= 0xFEE0;
+        return cp >= 'A' && cp <= 'Z' ? cp | 0x20 : cp;
+    }
+
+    // Latin-1 signs, general punctuation up to the end of the arrow and
+    // symbol blocks, CJK punctuation, small and vertical forms, fullwidth
+    // signs and emoji
+    if (cp <= 0xBF || cp == 0xD7 || cp == 0xF7 || (cp >= 0x2000 && cp <= 0x2BFF) ||
+        (cp >= 0x2E00 && cp <= 0x2E7F) || (cp >= 0x3000 && cp <= 0x3004) ||
+        (cp >= 0x3008 && cp <= 0x3020) || (cp >= 0xFE10 && cp <= 0xFE6F) ||
+        (cp >= 0xFFE0 && cp <= 0xFFEF) || (cp >= 0x1F000 && cp <= 0x1FAFF)) {
+        return 0;
+    }
+
+    // Capital letters, whose lowercase is one code point away
+    if ((cp >= 0xC0 && cp <= 0xDE) || (cp >= 0x391 && cp <= 0x3AB && cp != 0x3A2) ||
+        (cp >= 0x410 && cp <= 0x42F)) {
+        return cp + 0x20;
+    }
+    if (cp >= 0x400 && cp <= 0x40F) {
+        return cp + 0x50;
+    }
+    if (cp == 0x130) {
+        return 0;  // capital dotted I lowercases to two code points
+    }
+    if (cp == 0x178) {
+        return 0xFF;
+    }
+    if ((cp >= 0x100 && cp <= 0x137) || (cp >= 0x14A && cp <= 0x177)) {
+        return cp | 1;  // pairs with the capital first
+    }
+    if ((cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17E)) {
+        return cp & 1 ? cp + 1 : cp;
+    }
+    return cp;
+}
+
+// ---- Punycode (RFC 3492) ----
+
+#define PUNY_BASE 36
+#define PUNY_TMIN 1
+#define PUNY_TMAX 26
+#define PUNY_SKEW 38
+#define PUNY_DAMP 700
+#define PUNY_INITIAL_BIAS 72
+#define PUNY_INITIAL_N 0x80
+
+static uint32_t email_puny_adapt(uint32_t delta, uint32_t points, bool first) {
+    uint32_t k = 0;
+
+    delta = first ? delta / PUNY_DAMP : delta / 2;
+    delta += delta / points;
+    while (delta > ((PUNY_BASE - PUNY_TMIN) * PUNY_TMAX) / 2) {
+        delta /= PUNY_BASE - PUNY_TMIN;
+        k += PUNY_BASE;
+    }
+    return k + (PUNY_BASE - PUNY_TMIN + 1) * delta / (delta + PUNY_SKEW);
+}
+
+static char email_puny_digit(uint32_t d) {
+    return (char)(d < 26 ? 'a' + d : '0' + (d - 26));
+}
+
+/*
+ * Writes the punycode of cps[0..n) to out[0..cap); returns its length,
+ * or 0 when it does not fit. n is at most MAX_EMAIL_LENGTH, which keeps
+ * delta far from overflowing.
+ */
+static size_t email_punycode(const uint32_t* cps, size_t n, char* out, size_t cap) {
+    size_t len = 0;
+
+    for (size_t j = 0; j < n; j++) {
+        if (cps[j] < 0x80) {
+            if (len == cap) {
+                return 0;
+            }
+            out[len++] = (char)cps[j];
+        }
+    }
+    size_t basic = len, done = len;
+    if (basic > 0) {
+        if (len == cap) {
+            return 0;
+        }
+        out[len++] = '-';
+    }
+
+    uint32_t next = PUNY_INITIAL_N, delta = 0, bias = PUNY_INITIAL_BIAS;
+    while (done < n) {
+        uint32_t m = UINT32_MAX;
+        for (size_t j = 0; j < n; j++) {
+            if (cps[j] >= next && cps[j] < m) {
+                m = cps[j];
+            }
+        }
+        delta += (m - next) * (uint32_t)(done + 1);
+        next = m;
+
+        for (size_t j = 0; j < n; j++) {
+            if (cps[j] < next) {
+                delta++;
+            } else if (cps[j] == next) {
+                uint32_t q = delta;
+                for (uint32_t k = PUNY_BASE;; k += PUNY_BASE) {
+                    uint32_t t = k <= bias ? PUNY_TMIN : k >= bias + PUNY_TMAX ? PUNY_TMAX : k - bias;
+                    if (q < t) {
+                        break;
+                    }
+                    if (len == cap) {
+                        return 0;
+                    }
+                    out[len++] = email_puny_digit(t + (q - t) % (PUNY_BASE - t));
+                    q = (q - t) / (PUNY_BASE - t);
+                }
+                if (len == cap) {
+                    return 0;
+                }
+                out[len++] = email_puny_digit(q);
+                bias = email_puny_adapt(delta, (uint32_t)(done + 1), done == basic);
+                delta = 0;
+                done++;
+            }
+        }
+        delta++;
+        next++;
+    }
+    return len;
+}
+
+// ---- Domains ----
+
+// Appends one byte to the converted domain, with the input position it
+// stands for
+#define EMAIL_EMIT(c, pos, at_fault)                   \
+    do {                                               \
+        if (n == cap) {                                \
+            EMAIL_FAIL(EMAIL_TOO_LONG, (at_fault));    \
+        }                                              \
+        if (from != NULL) {                            \
+            from[n] = (uint16_t)(pos);                 \
+        }                                              \
+        out[n++] = (char)(c);                          \
+    } while (0)
+
+/*
+ * Converts one label, cps[0..count) decoded from the input positions
+ * at[0..count), and appends it to out[*len..cap). A label with non-ASCII
+ * characters is mapped, checked and written as an A-label; an ASCII one
+ * is copied lowercased and left for email_check() to judge.
+ */
+static email_reason email_idna_label(uint32_t* cps, const uint16_t* at, size_t count,
+                                     bool ascii, char* out, size_t cap, uint16_t* from,
+                                     size_t* len, size_t* offset) {
+    size_t n = *len;
+
+    for (size_t j = 0; !ascii && j < count; j++) {
+        uint32_t cp = cps[j];
+        uint32_t m = cp < 0x80 ? cp : email_idna_map(cp);
+        if (m >= 'A' && m <= 'Z') {
+            m |= 0x20;
+        }
+        if (m == 0 || (m < 0x80 && m != '-' && !(EMAIL_CLASS_OF(m) & EMAIL_CHAR_ALNUM))) {
+            // ASCII a label cannot hold fails as it would in an ASCII domain
+            if (cp == '@') {
+                EMAIL_FAIL(EMAIL_MULTIPLE_AT, at[j]);
+            }
+            if (cp < 0x80) {
+                EMAIL_FAIL(EMAIL_CLASS_OF(cp) & EMAIL_CHAR_SPACE ? EMAIL_WHITESPACE
+                                                                 : EMAIL_BAD_DOMAIN_CHAR, at[j]);
+            }
+            EMAIL_FAIL(email_is_unicode_space(cp) ? EMAIL_WHITESPACE : EMAIL_BAD_IDN, at[j]);
+        }
+        cps[j] = m;
+    }
+
+    // Fullwidth ASCII folds to a plain ASCII label
+    bool all_ascii = true;
+    for (size_t j = 0; j < count; j++) {
+        all_ascii &= cps[j] < 0x80;
+    }
+    if (all_ascii) {
+        for (size_t j = 0; j < count; j++) {
+            uint32_t c = cps[j];
+            EMAIL_EMIT(c >= 'A' && c <= 'Z' ? c | 0x20 : c, at[j], at[j]);
+        }
+        *len = n;
+        return EMAIL_VALID;
+    }
+
+    // A U-label neither starts nor ends with '-', has no "--" in the
+    // places of an ACE prefix and does not start with a combining mark
+    if (cps[0] == '-' || email_is_combining(cps[0])) {
+        EMAIL_FAIL(EMAIL_BAD_IDN, at[0]);
+    }
+    if (cps[count - 1] == '-') {
+        EMAIL_FAIL(EMAIL_BAD_IDN, at[count - 1]);
+    }
+    if (count >= 4 && cps[2] == '-' && cps[3] == '-') {
+        EMAIL_FAIL(EMAIL_BAD_IDN, at[2]);
+    }
+
+    char label[EMAIL_LABEL_MAX - EMAIL_ACE_PREFIX_LEN];
+    size_t label_len = email_punycode(cps, count, label, sizeof(label));
+    if (label_len == 0) {
+        EMAIL_FAIL(EMAIL_BAD_IDN, at[0]);  // A-label longer than 63 bytes
+    }
+    for (size_t j = 0; j < EMAIL_ACE_PREFIX_LEN; j++) {
+        EMAIL_EMIT(EMAIL_ACE_PREFIX[j], at[0], at[0]);
+    }
+    for (size_t j = 0; j < label_len; j++) {
+        EMAIL_EMIT(label[j], at[0], at[0]);
+    }
+    *len = n;
+    return EMAIL_VALID;
+}
+
+/*
+ * Converts the domain p[start..len) label by label into out[0..cap), from
+ * receiving the input position of every byte written when it is not
+ * NULL. *out_len receives the length.
+ *
+ * Returns:
+ *   EMAIL_VALID; EMAIL_BAD_UTF8, EMAIL_BAD_IDN or the ASCII reason for a
+ *   character of a non-ASCII label; EMAIL_TOO_LONG when out is full
+ */
+static email_reason email_idna_domain(const char* p, size_t start, size_t len, char* out,
+                                      size_t cap, uint16_t* from, size_t* out_len,
+                                      size_t* offset) {
+    uint32_t cps[MAX_EMAIL_LENGTH];
+    uint16_t at[MAX_EMAIL_LENGTH];
+    size_t n = 0;
+
+    for (size_t i = start;;) {
+        size_t count = 0, end = i, step = 0;
+        bool ascii = true;
+        while (end < len) {
+            uint32_t cp;
+            step = email_utf8_decode(p + end, len - end, &cp);
+            if (step == 0) {
+                EMAIL_FAIL(EMAIL_BAD_UTF8, end);
+            }
+            if (email_is_label_dot(cp)) {
+                break;
+            }
+            ascii &= cp < 0x80;
+            cps[count] = cp;
+            at[count] = (uint16_t)end;
+            count++;
+            end += step;
+        }
+
+        email_reason reason = email_idna_label(cps, at, count, ascii, out, cap, from, &n, offset);
+        if (reason != EMAIL_VALID) {
+            return reason;
+        }
+        if (end >= len) {
+            break;
+        }
+        EMAIL_EMIT('.', end, end);
+        i = end + step;
+    }
+    *out_len = n;
+    return EMAIL_VALID;
+}
+
+#undef EMAIL_EMIT
+
+/**
+ * Function: email_domain_to_ascii
+ * Purpose: Converts the domain p[0..len) to its ASCII (A-label) form
+ *
+ * Parameters:
+ *   p, len - the domain, UTF-8, without the '@'
+ *   out    - receives the ASCII form, NUL-terminated
+ *   cap    - size of out
+ *
+ * Returns:
+ *   the length of the ASCII form, or 0 when the domain is empty, is not
+ *   valid UTF-8, has a character no label may contain, or does not fit
+ */
+size_t email_domain_to_ascii(const char* p, size_t len, char* out, size_t cap) {
+    size_t n;
+
+    if (p == NULL || out == NULL || cap == 0 || len > MAX_EMAIL_LENGTH ||
+        email_idna_domain(p, 0, len, out, cap - 1, NULL, &n, NULL) != EMAIL_VALID) {
+        return 0;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+// ---- Addresses ----
+
+/*
+ * The check of a non-ASCII address p[0..len): builds the ASCII shadow and
+ * runs email_check() or email_check_strict() on it.
+ */
+static email_reason email_check_shadow(const char* p, size_t len, bool strict, size_t* offset) {
+    if (len > MAX_EMAIL_LENGTH) {
+        EMAIL_FAIL(EMAIL_TOO_LONG, MAX_EMAIL_LENGTH);
+    }
+
+    char shadow[MAX_EMAIL_LENGTH];
+    uint16_t from[MAX_EMAIL_LENGTH];
+    size_t n = 0, i = 0;
+
+    // The local part: ASCII as it is and 'a' for any other character an
+    // RFC 6531 local part may hold. The shadow is never longer than it.
+    while (i < len && p[i] != '@') {
+        if ((unsigned char)p[i] < 0x80) {
+            from[n] = (uint16_t)i;
+            shadow[n++] = p[i++];
+            continue;
+        }
+        uint32_t cp;
+        size_t step = email_utf8_decode(p + i, len - i, &cp);
+        if (step == 0) {
+            EMAIL_FAIL(EMAIL_BAD_UTF8, i);
+        }
+        if (email_is_unicode_space(cp)) {
+            EMAIL_FAIL(EMAIL_WHITESPACE, i);
+        }
+        if (email_is_unicode_forbidden(cp)) {
+            EMAIL_FAIL(EMAIL_BAD_LOCAL_CHAR, i);
+        }
+        from[n] = (uint16_t)i;
+        shadow[n++] = 'a';
+        i += step;
+    }
+
+    if (i < len) {
+        from[n] = (uint16_t)i;
+        shadow[n++] = '@';
+        size_t domain_len;
+        email_reason reason = email_idna_domain(p, i + 1, len, shadow + n, sizeof(shadow) - n,
+                                                from + n, &domain_len, offset);
+        if (reason != EMAIL_VALID) {
+            return reason;
+        }
+        n += domain_len;
+    }
+
+    size_t at_fault = 0;
+    email_reason reason = strict ? email_check_strict(shadow, n, &at_fault)
+                                 : email_check(shadow, n, &at_fault);
+    if (reason != EMAIL_VALID && offset != NULL) {
+        *offset = at_fault < n ? from[at_fault] : len;
+    }
+    return reason;
+}
+
+/**
+ * Function: email_check_utf8 / email_check_utf8_strict
+ * Purpose: email_check() / email_check_strict() for internationalized
+ *          addresses
+ *
+ * Parameters:
+ *   p      - pointer to the first byte of the address, UTF-8
+ *   len    - number of bytes in the address
+ *   offset - receives the position of the offending byte in p, may be NULL
+ *
+ * Returns:
+ *   EMAIL_VALID, or the first rule the address breaks; EMAIL_BAD_UTF8 for
+ *   a malformed sequence and EMAIL_BAD_IDN for a character or label that
+ *   IDNA does not allow
+ */
+email_reason email_check_utf8(const char* p, size_t len, size_t* offset) {
+    if (p == NULL || email_is_ascii(p, len)) {
+        return email_check(p, len, offset);
+    }
+    return email_check_shadow(p, len, false, offset);
+}
+
+email_reason email_check_utf8_strict(const char* p, size_t len, size_t* offset) {
+    if (p == NULL || email_is_ascii(p, len)) {
+        return email_check_strict(p, len, offset);
+    }
+    return email_check_shadow(p, len, true, offset);
+}
+
+/**
+ * Function: is_valid_email_utf8 / is_valid_email_utf8_strict
+ * Purpose: is_valid_email_n() / is_valid_email_strict() for
+ *          internationalized addresses
+ *
+ * The ASCII validator runs first: an address it accepts is ASCII, so a
+ * valid ASCII address costs nothing extra. Only a rejected one is tested
+ * with email_is_ascii() and, when it is not ASCII, checked again through
+ * its shadow. The ASCII verdict is not counted on its own; the metrics
+ * count the final one.
+ */
+bool is_valid_email_utf8(const char* p, size_t len) {
+    bool valid = email_select_uncounted_kernel()(p, len) ||
+                 (p != NULL && !email_is_ascii(p, len) &&
+                  email_check_shadow(p, len, false, NULL) == EMAIL_VALID);
+
+    EMAIL_METRICS_VERDICT(valid, p, len, email_check_utf8);
+    return valid;
+}
+
+bool is_valid_email_utf8_strict(const char* p, size_t len) {
+    bool valid = email_valid_strict_uncounted(p, len) ||
+                 (p != NULL && !email_is_ascii(p, len) &&
+                  email_check_shadow(p, len, true, NULL) == EMAIL_VALID);
+
+    EMAIL_METRICS_VERDICT(valid, p, len, email_check_utf8_strict);
+    return valid;
+}
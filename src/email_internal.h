@@ -0,0 +1,307 @@
+#ifndef EMAIL_INTERNAL_H
+#define EMAIL_INTERNAL_H
+
+/*
+ * Declarations shared by the library sources; not part of the public API.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "email_validate.h"
+
+/*
+ * The class table: EMAIL_CHAR_CLASS() (email_rules.h) of every byte value,
+ * built at compile time so classifying a byte is a single load and mask.
+ */
+#define EMAIL_CHAR_CLASS_ROW(b) \
+    EMAIL_CHAR_CLASS((b) + 0x0), EMAIL_CHAR_CLASS((b) + 0x1), \
+    EMAIL_CHAR_CLASS((b) + 0x2), EMAIL_CHAR_CLASS((b) + 0x3), \
+    EMAIL_CHAR_CLASS((b) + 0x4), EMAIL_CHAR_CLASS((b) + 0x5), \
+    EMAIL_CHAR_CLASS((b) + 0x6), EMAIL_CHAR_CLASS((b) + 0x7), \
+    EMAIL_CHAR_CLASS((b) + 0x8), EMAIL_CHAR_CLASS((b) + 0x9), \
+    EMAIL_CHAR_CLASS((b) + 0xA), EMAIL_CHAR_CLASS((b) + 0xB), \
+    EMAIL_CHAR_CLASS((b) + 0xC), EMAIL_CHAR_CLASS((b) + 0xD), \
+    EMAIL_CHAR_CLASS((b) + 0xE), EMAIL_CHAR_CLASS((b) + 0xF)
+
+// Defined in email_validate.c
+extern const unsigned char email_char_class[256];
+
+// Class bits of a (possibly signed) char
+#define EMAIL_CLASS_OF(c) (email_char_class[(unsigned char)(c)])
+
+/*
+ * O(1) prechecks of the yes/no validators
+ *
+ * Real rejects are mostly junk that is obvious from a few bytes, so these
+ * run before any full-length loop. Every check is implied by the rules of
+ * email_scan(), so an address that fails one is invalid, and one that
+ * passes them all still gets the full scan. The order follows the
+ * by_stage counts of a profiling build and can be tuned from those.
+ */
+_Static_assert(EMAIL_MIN_TLD_LENGTH >= 2, "email_precheck() looks at two TLD bytes");
+
+static inline email_reject_stage email_precheck(const char* p, size_t len) {
+    if (p == NULL || len < MIN_EMAIL_LENGTH || len > MAX_EMAIL_LENGTH) {
+        return EMAIL_STAGE_LENGTH;
+    }
+
+    // A local part starts with a letter, digit, '-', '_' or '+'
+    if ((EMAIL_CLASS_OF(p[0]) & (EMAIL_CHAR_LOCAL | EMAIL_CHAR_DOT)) != EMAIL_CHAR_LOCAL) {
+        return EMAIL_STAGE_FIRST_BYTE;
+    }
+
+    // The domain ends with a letter or digit, and a TLD of at least
+    // EMAIL_MIN_TLD_LENGTH (>= 2) bytes means the byte before it is a
+    // letter, digit or '-'
+    if (!(EMAIL_CLASS_OF(p[len - 1]) & EMAIL_CHAR_ALNUM) ||
+        (EMAIL_CLASS_OF(p[len - 2]) & (EMAIL_CHAR_DOMAIN | EMAIL_CHAR_DOT)) != EMAIL_CHAR_DOMAIN) {
+        return EMAIL_STAGE_LAST_BYTES;
+    }
+
+    // The '@' leaves room for "x.yz" after it, follows a local-part byte
+    // other than '.' and is followed by a letter or digit
+    const char* at = memchr(p + 1, '@', len - MIN_EMAIL_LENGTH);
+    if (at == NULL ||
+        (EMAIL_CLASS_OF(at[-1]) & (EMAIL_CHAR_LOCAL | EMAIL_CHAR_DOT)) != EMAIL_CHAR_LOCAL ||
+        !(EMAIL_CLASS_OF(at[1]) & EMAIL_CHAR_ALNUM)) {
+        return EMAIL_STAGE_AT_POSITION;
+    }
+
+    return EMAIL_STAGE_PASSED;
+}
+
+/*
+ * The '@' that starts the domain of p[0..len), or NULL: the last one, since
+ * a quoted local part (RFC mode) may hold others and a domain never does
+ */
+static inline const char* email_domain_at(const char* p, size_t len) {
+    for (size_t i = len; i > 0; i--) {
+        if (p[i - 1] == '@') {
+            return p + i - 1;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Profiling builds count every verdict of the yes/no validators by the
+ * stage that rejected it and by its email_check() reason (email_validate.c).
+ * In normal builds EMAIL_PROFILE_VERDICT() compiles to nothing.
+ */
+#ifdef EMAIL_VALIDATE_PROFILE_REJECTS
+void email_profile_record(email_reject_stage stage, bool valid, const char* p, size_t len);
+#define EMAIL_PROFILE_VERDICT(stage, valid, p, len) email_profile_record((stage), (valid), (p), (len))
+#else
+#define EMAIL_PROFILE_VERDICT(stage, valid, p, len) ((void)0)
+#endif
+
+/*
+ * Metrics builds count every verdict and time the calls of each path
+ * (email_metrics.c); EMAIL_METRICS_START() declares the variable holding
+ * the start time. A reject is counted under the reason check (the
+ * email_check() of the validator's mode) gives for it. In normal builds
+ * all three compile to nothing.
+ */
+#ifdef EMAIL_VALIDATE_METRICS
+void email_metrics_verdict(bool valid, const char* p, size_t len,
+                           email_reason (*check)(const char*, size_t, size_t*));
+uint64_t email_metrics_now(void);
+void email_metrics_latency(email_metrics_path path, uint64_t start_ns);
+#define EMAIL_METRICS_VERDICT(valid, p, len, check) email_metrics_verdict((valid), (p), (len), (check))
+#define EMAIL_METRICS_START(var) uint64_t var = email_metrics_now()
+#define EMAIL_METRICS_STOP(path, var) email_metrics_latency((path), (var))
+#else
+#define EMAIL_METRICS_VERDICT(valid, p, len, check) ((void)0)
+#define EMAIL_METRICS_START(var) ((void)0)
+#define EMAIL_METRICS_STOP(path, var) ((void)0)
+#endif
+
+/*
+ * Reading past the end of a buffer
+ *
+ * A load that starts inside the buffer and stays inside the page the buffer
+ * ends in cannot fault: memory protection works on whole pages. The SIMD
+ * kernels and the word hashes of the TLD table and the domain cache use this to load whole vectors or words at the
+ * end of an address and mask off the extra bytes; only when the load would
+ * cross into the next page do they copy the tail instead. The over-read is
+ * invisible to the program but not to AddressSanitizer, hence the attribute
+ * on the functions that do it.
+ */
+#define EMAIL_PAGE_SIZE 4096
+
+static inline bool email_block_in_page(const char* p, size_t block) {
+    return ((uintptr_t)p % EMAIL_PAGE_SIZE) <= EMAIL_PAGE_SIZE - block;
+}
+
+#if defined(__GNUC__)
+#define EMAIL_NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define EMAIL_NO_SANITIZE_ADDRESS
+#endif
+
+/*
+ * Loads the next min(n, 8) bytes of p as a little-endian word, zero
+ * padded. A whole word is loaded when that stays inside the page.
+ */
+EMAIL_NO_SANITIZE_ADDRESS
+static inline uint64_t email_load_word(const char* p, size_t n) {
+    uint64_t w = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (n >= 8 || email_block_in_page(p, 8)) {
+        memcpy(&w, p, 8);
+        return n >= 8 ? w : w & ~(~(uint64_t)0 << (8 * n));
+    }
+#endif
+    for (size_t k = 0; k < n && k < 8; k++) {
+        w |= (uint64_t)(unsigned char)p[k] << (8 * k);
+    }
+    return w;
+}
+
+// Lowercases the ASCII letters of eight bytes at once; other bytes,
+// including those >= 0x80, are left alone
+static inline uint64_t email_lower_word(uint64_t w) {
+    const uint64_t high = 0x8080808080808080ull;
+    uint64_t low7 = w & ~high;
+    uint64_t ge_a = low7 + 0x3F3F3F3F3F3F3F3Full;   // bit 7 set from 'A' up
+    uint64_t gt_z = low7 + 0x2525252525252525ull;   // bit 7 set above 'Z'
+    uint64_t upper = (ge_a ^ gt_z) & ~w & high;
+    return w | (upper >> 2);
+}
+
+// Turns a numeric macro into a string literal
+#define EMAIL_STR_(x) #x
+#define EMAIL_STR(x) EMAIL_STR_(x)
+
+/*
+ * Validators for one address, all with the signature of is_valid_email_n(),
+ * so callers that validate many addresses can pick one up front with
+ * email_select_kernel() (email_simd.c).
+ */
+typedef bool (*email_kernel_fn)(const char* p, size_t len);
+
+email_kernel_fn email_select_kernel(void);
+
+/*
+ * The same verdicts as email_select_kernel()'s kernel and as
+ * is_valid_email_strict(), counted in neither the rejection profile nor
+ * the metrics: for validators built on them that count their own verdict
+ */
+email_kernel_fn email_select_uncounted_kernel(void);
+bool email_valid_uncounted(const char* p, size_t len);
+bool email_valid_strict_uncounted(const char* p, size_t len);
+
+// email_check() that also gives the position of the '@' of a valid
+// address (email_validate.c)
+email_reason email_check_split(const char* p, size_t len, size_t* offset, size_t* at);
+
+// True when every byte of p[0..len) is below 0x80, 16 or 32 bytes at a
+// time (email_simd.c); the UTF-8 validators take their ASCII path on it
+bool email_is_ascii(const char* p, size_t len);
+
+/*
+ * Domain verdict cache (email_domain_cache.c)
+ *
+ * A verdict packs the outcome of email_scan_domain() for one domain:
+ * EMAIL_DOMAIN_OK when it is valid, and the position of its TLD relative
+ * to the first domain byte in the bits above EMAIL_DOMAIN_TLD_SHIFT.
+ * Domains longer than EMAIL_DOMAIN_CACHE_KEY bytes are never cached.
+ */
+#define EMAIL_DOMAIN_CACHE_KEY 56
+#define EMAIL_DOMAIN_OK 1u
+#define EMAIL_DOMAIN_TLD_SHIFT 8
+
+// A domain as it is looked up, and its hash
+typedef struct {
+    const char* domain;
+    size_t len;
+    uint64_t hash;
+} email_domain_key;
+
+bool email_domain_cache_lookup(email_domain_cache* cache, const char* domain,
+                               size_t len, email_domain_key* key, unsigned* verdict);
+void email_domain_cache_store(email_domain_cache* cache, const email_domain_key* key,
+                              unsigned verdict);
+
+// is_valid_email_cached(), and is_valid_email_strict() when strict is set
+bool email_validate_cached(email_domain_cache* cache, const char* p, size_t len,
+                           bool strict);
+
+typedef email_reason (*email_check_fn)(const char* p, size_t len, size_t* offset);
+
+/*
+ * How the bulk validators check one address: the kernel, or the domain
+ * cache (with or without strict mode) when there is one, behind the
+ * verdict cache when there is one of those
+ */
+typedef struct {
+    email_kernel_fn validate;
+    email_domain_cache* cache;      // may be NULL
+    bool strict;                    // with cache: also require a known TLD
+    email_verdict_cache* verdicts;  // may be NULL
+    unsigned verdict_mode;          // with verdicts: EMAIL_VERDICT_* of validate
+    email_check_fn check;           // with verdicts: the reason of a rejected address
+    size_t max_length;              // the offset check gives a line too long
+} email_validator;
+
+// The verdict of an address from v->verdicts, validated and recorded on a
+// miss (email_verdict_cache.c)
+bool email_validate_remembered(const email_validator* v, const char* p, size_t len);
+
+static inline bool email_validator_check(const email_validator* v, const char* p, size_t len) {
+    return v->cache != NULL ? email_validate_cached(v->cache, p, len, v->strict)
+                            : v->validate(p, len);
+}
+
+static inline bool email_validator_run(const email_validator* v, const char* p, size_t len) {
+    return v->verdicts != NULL ? email_validate_remembered(v, p, len)
+                               : email_validator_check(v, p, len);
+}
+
+// Fills in the kernel, reason check and verdict mode of a mode; rfc
+// overrides the other two (email_batch.c)
+void email_validator_select(email_validator* v, bool strict, bool utf8, bool rfc);
+
+// The loop of validate_emails_batch() with any validator (email_batch.c)
+size_t email_batch_validate(const char* const* ptrs, const size_t* lens, size_t n,
+                            uint8_t* out_bitmap, const email_validator* v);
+
+/*
+ * Duplicate sets (email_dedup.c)
+ *
+ * An entry is an address as the set stores it, with its domain lowercased,
+ * and the verdict of its first occurrence once that is known.
+ */
+enum {
+    EMAIL_DEDUP_UNKNOWN,
+    EMAIL_DEDUP_INVALID,
+    EMAIL_DEDUP_VALID
+};
+
+typedef struct {
+    _Atomic uint64_t first_line;   // lowest line the address was added with
+    _Atomic uint8_t verdict;       // EMAIL_DEDUP_UNKNOWN until validated
+    uint16_t len;
+    char bytes[];
+} email_dedup_entry;
+
+email_dedup_result email_dedup_insert(email_dedup* set, const char* p, size_t len,
+                                      uint64_t line_no, email_dedup_entry** entry);
+
+// The verdict of an address, from the set when it has been seen before
+bool email_dedup_validate(email_dedup* set, const char* p, size_t len, uint64_t line_no,
+                          const email_validator* check, bool* duplicate,
+                          uint64_t* first_line);
+
+/*
+ * The hash of an address with its domain lowercased, which the verdict
+ * cache and the Bloom filter key their files with: changing it changes
+ * both formats (email_verdict_cache.c). len is at most MAX_EMAIL_LENGTH.
+ */
+uint64_t email_address_hash(const char* p, size_t len, uint64_t seed);
+
+#endif  // EMAIL_INTERNAL_H
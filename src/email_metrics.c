@@ -0,0 +1,338 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "email_internal.h"
+
+/*
+ * Instrumentation
+ *
+ * The counters only exist in EMAIL_VALIDATE_METRICS builds; in every other
+ * build the hooks in email_internal.h expand to nothing and only the
+ * reporting functions below are compiled, reporting zeros.
+ *
+ * Each thread counts into a slot of its own, padded to whole cache lines
+ * that no other thread writes, so recording is a few plain loads and
+ * stores: no lock prefix and no line moving between cores. A thread claims
+ * a free slot the first time it records something and gives it back when
+ * it exits; the counts stay in the slot and the next owner adds to them.
+ * When all EMAIL_METRICS_SLOTS are taken the remaining threads share an
+ * overflow slot, with atomic adds. A snapshot sums all slots.
+ *
+ * Latencies go into a log-linear histogram in the style of HdrHistogram:
+ * nanosecond values below 32 have a bucket each, and every power of two
+ * above is split into 16 buckets, so a value is known to within 1/16.
+ */
+#define EMAIL_METRICS_SUB_BITS 4
+#define EMAIL_METRICS_MAX_NS ((1ull << 36) - 1)
+
+_Static_assert(EMAIL_METRICS_BUCKETS ==
+                   ((35 - EMAIL_METRICS_SUB_BITS) << EMAIL_METRICS_SUB_BITS) + 32,
+               "one bucket per 16th of each power of two up to 2^36 ns");
+
+// The bucket a latency of ns nanoseconds is counted in
+static inline size_t email_metrics_bucket(uint64_t ns) {
+    if (ns > EMAIL_METRICS_MAX_NS) {
+        ns = EMAIL_METRICS_MAX_NS;
+    }
+    unsigned msb = 63u - (unsigned)__builtin_clzll(ns | 1);
+    unsigned shift = msb <= EMAIL_METRICS_SUB_BITS ? 0 : msb - EMAIL_METRICS_SUB_BITS;
+    return ((size_t)shift << EMAIL_METRICS_SUB_BITS) + (size_t)(ns >> shift);
+}
+
+/**
+ * Function: email_metrics_bucket_floor
+ * Purpose: Returns the lowest latency, in ns, that lands in a bucket
+ */
+uint64_t email_metrics_bucket_floor(size_t bucket) {
+    if (bucket < 2u << EMAIL_METRICS_SUB_BITS) {
+        return bucket;
+    }
+    unsigned shift = (unsigned)(bucket >> EMAIL_METRICS_SUB_BITS) - 1;
+    return (uint64_t)(bucket - ((size_t)shift << EMAIL_METRICS_SUB_BITS)) << shift;
+}
+
+#ifdef EMAIL_VALIDATE_METRICS
+
+#define EMAIL_METRICS_SLOTS 256
+
+typedef struct {
+    _Alignas(64) _Atomic bool in_use;
+    bool shared;                                // the overflow slot
+    _Atomic uint64_t valid;
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t by_reason[EMAIL_REASON_COUNT];
+    _Atomic uint64_t calls[EMAIL_METRICS_PATH_COUNT];
+    _Atomic uint64_t latency_ns[EMAIL_METRICS_PATH_COUNT];
+    _Atomic uint64_t latency[EMAIL_METRICS_PATH_COUNT][EMAIL_METRICS_BUCKETS];
+} email_metrics_slot;
+
+static email_metrics_slot email_metrics_slots[EMAIL_METRICS_SLOTS + 1] = {
+    [EMAIL_METRICS_SLOTS] = { .shared = true }
+};
+static _Thread_local email_metrics_slot* email_metrics_mine;
+static pthread_once_t email_metrics_once = PTHREAD_ONCE_INIT;
+static pthread_key_t email_metrics_key;
+
+// Thread exit: the slot, and the counts in it, go to the next thread
+static void email_metrics_release(void* arg) {
+    email_metrics_slot* slot = arg;
+    atomic_store_explicit(&slot->in_use, false, memory_order_release);
+}
+
+static void email_metrics_init(void) {
+    pthread_key_create(&email_metrics_key, email_metrics_release);
+}
+
+static email_metrics_slot* email_metrics_claim(void) {
+    pthread_once(&email_metrics_once, email_metrics_init);
+
+    email_metrics_slot* slot = &email_metrics_slots[EMAIL_METRICS_SLOTS];
+    for (size_t i = 0; i < EMAIL_METRICS_SLOTS; i++) {
+        bool free_slot = false;
+        if (!atomic_load_explicit(&email_metrics_slots[i].in_use, memory_order_relaxed) &&
+            atomic_compare_exchange_strong_explicit(&email_metrics_slots[i].in_use, &free_slot,
+                                                    true, memory_order_acquire,
+                                                    memory_order_relaxed)) {
+            slot = &email_metrics_slots[i];
+            pthread_setspecific(email_metrics_key, slot);
+            break;
+        }
+    }
+    email_metrics_mine = slot;
+    return slot;
+}
+
+static inline email_metrics_slot* email_metrics_slot_of_thread(void) {
+    email_metrics_slot* slot = email_metrics_mine;
+    return slot != NULL ? slot : email_metrics_claim();
+}
+
+// A plain add on the thread's own slot, an atomic one on the shared slot
+static inline void email_metrics_add(const email_metrics_slot* slot, _Atomic uint64_t* counter,
+                                     uint64_t n) {
+    if (slot->shared) {
+        atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+    } else {
+        atomic_store_explicit(counter,
+                              atomic_load_explicit(counter, memory_order_relaxed) + n,
+                              memory_order_relaxed);
+    }
+}
+
+void email_metrics_verdict(bool valid, const char* p, size_t len,
+                           email_reason (*check)(const char*, size_t, size_t*)) {
+    email_metrics_slot* slot = email_metrics_slot_of_thread();
+
+    if (valid) {
+        email_metrics_add(slot, &slot->valid, 1);
+    } else {
+        // The yes/no validators do not say why; rejections are rare
+        // enough in real traffic to ask again
+        email_reason reason = check(p, len, NULL);
+        email_metrics_add(slot, &slot->by_reason[reason], 1);
+    }
+    email_metrics_add(slot, &slot->bytes, p != NULL ? len : 0);
+}
+
+uint64_t email_metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void email_metrics_latency(email_metrics_path path, uint64_t start_ns) {
+    uint64_t ns = email_metrics_now() - start_ns;
+    email_metrics_slot* slot = email_metrics_slot_of_thread();
+
+    email_metrics_add(slot, &slot->calls[path], 1);
+    email_metrics_add(slot, &slot->latency_ns[path], ns);
+    email_metrics_add(slot, &slot->latency[path][email_metrics_bucket(ns)], 1);
+}
+
+#endif  // EMAIL_VALIDATE_METRICS
+
+/**
+ * Function: email_metrics_snapshot
+ * Purpose: Sums the counters of every thread into *out
+ *
+ * Returns:
+ *   true in an EMAIL_VALIDATE_METRICS build, false (and all zeros) otherwise
+ */
+bool email_metrics_snapshot(email_metrics* out) {
+    memset(out, 0, sizeof(*out));
+#ifdef EMAIL_VALIDATE_METRICS
+    for (size_t i = 0; i <= EMAIL_METRICS_SLOTS; i++) {
+        email_metrics_slot* slot = &email_metrics_slots[i];
+        out->valid += atomic_load_explicit(&slot->valid, memory_order_relaxed);
+        out->bytes += atomic_load_explicit(&slot->bytes, memory_order_relaxed);
+        for (int r = 0; r < EMAIL_REASON_COUNT; r++) {
+            out->by_reason[r] += atomic_load_explicit(&slot->by_reason[r], memory_order_relaxed);
+        }
+        for (int p = 0; p < EMAIL_METRICS_PATH_COUNT; p++) {
+            out->calls[p] += atomic_load_explicit(&slot->calls[p], memory_order_relaxed);
+            out->latency_ns[p] += atomic_load_explicit(&slot->latency_ns[p], memory_order_relaxed);
+            for (size_t b = 0; b < EMAIL_METRICS_BUCKETS; b++) {
+                out->latency[p][b] += atomic_load_explicit(&slot->latency[p][b],
+                                                           memory_order_relaxed);
+            }
+        }
+    }
+    for (int r = 0; r < EMAIL_REASON_COUNT; r++) {
+        out->invalid += out->by_reason[r];
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Function: email_metrics_reset
+ * Purpose: Sets every counter of every thread back to zero
+ */
+void email_metrics_reset(void) {
+#ifdef EMAIL_VALIDATE_METRICS
+    for (size_t i = 0; i <= EMAIL_METRICS_SLOTS; i++) {
+        email_metrics_slot* slot = &email_metrics_slots[i];
+        atomic_store_explicit(&slot->valid, 0, memory_order_relaxed);
+        atomic_store_explicit(&slot->bytes, 0, memory_order_relaxed);
+        for (int r = 0; r < EMAIL_REASON_COUNT; r++) {
+            atomic_store_explicit(&slot->by_reason[r], 0, memory_order_relaxed);
+        }
+        for (int p = 0; p < EMAIL_METRICS_PATH_COUNT; p++) {
+            atomic_store_explicit(&slot->calls[p], 0, memory_order_relaxed);
+            atomic_store_explicit(&slot->latency_ns[p], 0, memory_order_relaxed);
+            for (size_t b = 0; b < EMAIL_METRICS_BUCKETS; b++) {
+                atomic_store_explicit(&slot->latency[p][b], 0, memory_order_relaxed);
+            }
+        }
+    }
+#endif
+}
+
+/**
+ * Function: email_metrics_percentile
+ * Purpose: Returns the latency in ns below which a fraction q of the calls
+ *          on path fall: the upper end of the bucket the q-th call is in
+ */
+uint64_t email_metrics_percentile(const email_metrics* m, email_metrics_path path, double q) {
+    uint64_t calls = m->calls[path];
+    if (calls == 0) {
+        return 0;
+    }
+    q = q < 0 ? 0 : q > 1 ? 1 : q;
+    uint64_t rank = (uint64_t)(q * (double)calls + 0.5);
+    rank = rank == 0 ? 1 : rank;
+
+    uint64_t seen = 0;
+    for (size_t b = 0; b < EMAIL_METRICS_BUCKETS; b++) {
+        seen += m->latency[path][b];
+        if (seen >= rank) {
+            return b + 1 < EMAIL_METRICS_BUCKETS ? email_metrics_bucket_floor(b + 1) - 1
+                                                 : EMAIL_METRICS_MAX_NS;
+        }
+    }
+    return EMAIL_METRICS_MAX_NS;
+}
+
+// ---- Prometheus text format ----------------------------------------------------
+
+typedef struct {
+    char* buf;
+    size_t cap;
+    size_t len;     // of the whole text, even past cap
+} email_text;
+
+static void email_text_printf(email_text* t, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    size_t room = t->len < t->cap ? t->cap - t->len : 0;
+    int n = vsnprintf(room > 0 ? t->buf + t->len : NULL, room, fmt, args);
+    va_end(args);
+    if (n > 0) {
+        t->len += (size_t)n;
+    }
+}
+
+static const char* const email_metrics_path_names[EMAIL_METRICS_PATH_COUNT] = {
+    "single", "batch", "server"
+};
+
+// Histogram edges exported to Prometheus, in nanoseconds
+static const uint64_t email_metrics_edges[] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+    250000, 500000, 1000000, 10000000, 100000000, 1000000000
+};
+
+/**
+ * Function: email_metrics_prometheus
+ * Purpose: Writes m in the Prometheus text exposition format
+ *
+ * Parameters:
+ *   m   - a snapshot from email_metrics_snapshot()
+ *   buf - receives the text, NUL-terminated when cap > 0
+ *   cap - bytes available at buf
+ *
+ * Returns:
+ *   the length of the whole text (without the NUL); the text was cut
+ *   short when that is cap or more
+ */
+size_t email_metrics_prometheus(const email_metrics* m, char* buf, size_t cap) {
+    email_text t = { buf, cap, 0 };
+
+    email_text_printf(&t, "# HELP email_validations_total Addresses validated, by verdict\n"
+                          "# TYPE email_validations_total counter\n"
+                          "email_validations_total{verdict=\"valid\"} %llu\n"
+                          "email_validations_total{verdict=\"invalid\"} %llu\n",
+                      (unsigned long long)m->valid, (unsigned long long)m->invalid);
+
+    email_text_printf(&t, "# HELP email_rejections_total Addresses rejected, by rule\n"
+                          "# TYPE email_rejections_total counter\n");
+    for (int r = EMAIL_VALID + 1; r < EMAIL_REASON_COUNT; r++) {
+        email_text_printf(&t, "email_rejections_total{reason=\"%s\"} %llu\n",
+                          email_reason_name((email_reason)r),
+                          (unsigned long long)m->by_reason[r]);
+    }
+
+    email_text_printf(&t, "# HELP email_validated_bytes_total Address bytes validated\n"
+                          "# TYPE email_validated_bytes_total counter\n"
+                          "email_validated_bytes_total %llu\n",
+                      (unsigned long long)m->bytes);
+
+    email_text_printf(&t, "# HELP email_validation_latency_seconds Time per call, by path\n"
+                          "# TYPE email_validation_latency_seconds histogram\n");
+    for (int p = 0; p < EMAIL_METRICS_PATH_COUNT; p++) {
+        const char* path = email_metrics_path_names[p];
+        uint64_t below = 0;
+        size_t b = 0;
+
+        for (size_t e = 0; e < sizeof(email_metrics_edges) / sizeof(email_metrics_edges[0]); e++) {
+            // Buckets that end at or below the edge
+            while (b + 1 < EMAIL_METRICS_BUCKETS &&
+                   email_metrics_bucket_floor(b + 1) <= email_metrics_edges[e] + 1) {
+                below += m->latency[p][b++];
+            }
+            email_text_printf(&t, "email_validation_latency_seconds_bucket{path=\"%s\",le=\"%g\"} %llu\n",
+                              path, (double)email_metrics_edges[e] / 1e9,
+                              (unsigned long long)below);
+        }
+        email_text_printf(&t, "email_validation_latency_seconds_bucket{path=\"%s\",le=\"+Inf\"} %llu\n"
+                              "email_validation_latency_seconds_sum{path=\"%s\"} %.9f\n"
+                              "email_validation_latency_seconds_count{path=\"%s\"} %llu\n",
+                          path, (unsigned long long)m->calls[p],
+                          path, (double)m->latency_ns[p] / 1e9,
+                          path, (unsigned long long)m->calls[p]);
+    }
+
+    if (cap > 0 && t.len >= cap) {
+        buf[cap - 1] = '\0';
+    }
+    return t.len;
+}
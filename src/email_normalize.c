@@ -0,0 +1,176 @@
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "email_internal.h"
+
+/*
+ * Normalization
+ *
+ * The canonical form of a valid address is the address with its domain
+ * lowercased (the local part is case-sensitive in principle and is left
+ * alone). It is written into an email_arena, a caller-owned block of
+ * memory handed out front to back: nothing here allocates, and a whole
+ * batch is released by resetting the arena. With EMAIL_NORMALIZE_UTF8 an
+ * internationalized domain is written in its ASCII form, the one DNS and
+ * SMTP use, so "josé@Bücher.de" and "josé@xn--bcher-kva.de" compare equal.
+ */
+
+/**
+ * Function: email_arena_init
+ * Purpose: Makes buf[0..size) an empty arena
+ */
+void email_arena_init(email_arena* arena, void* buf, size_t size) {
+    arena->base = buf;
+    arena->size = size;
+    arena->used = 0;
+}
+
+/**
+ * Function: email_arena_reset
+ * Purpose: Empties the arena; everything written to it is released at once
+ */
+void email_arena_reset(email_arena* arena) {
+    arena->used = 0;
+}
+
+// Bytes p[0..len) with the domain lowercased, eight at a time
+static void email_copy_canonical(char* dst, const char* p, size_t len, size_t at_pos) {
+    size_t i = at_pos + 1;
+
+    memcpy(dst, p, i);
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        w = email_lower_word(w);
+        memcpy(dst + i, &w, 8);
+    }
+    for (; i < len; i++) {
+        char c = p[i];
+        dst[i] = c >= 'A' && c <= 'Z' ? (char)(c | 0x20) : c;
+    }
+    dst[len] = '\0';
+}
+
+// A valid internationalized address: the local part as it is and the
+// domain as A-labels
+static bool email_normalize_utf8(const char* p, size_t len, email_arena* arena,
+                                 email_normalized* out) {
+    const char* at = memchr(p, '@', len);
+    size_t local = (size_t)(at - p) + 1;
+    char domain[MAX_EMAIL_LENGTH + 1];
+    size_t domain_len = email_domain_to_ascii(at + 1, len - local, domain, sizeof(domain));
+
+    if (arena->size - arena->used < local + domain_len + 1) {
+        return false;
+    }
+    char* dst = arena->base + arena->used;
+    memcpy(dst, p, local);
+    memcpy(dst + local, domain, domain_len + 1);
+    arena->used += local + domain_len + 1;
+
+    out->p = dst;
+    out->len = local + domain_len;
+    return true;
+}
+
+/**
+ * Function: email_normalize
+ * Purpose: Validates p[0..len) and writes its canonical form to arena
+ *
+ * Parameters:
+ *   p     - pointer to the first byte of the address
+ *   len   - number of bytes in the address
+ *   flags - EMAIL_NORMALIZE_LENIENT: strip whitespace around the address
+ *           first; EMAIL_NORMALIZE_STRICT: also require a known TLD;
+ *           EMAIL_NORMALIZE_UTF8: accept internationalized addresses,
+ *           whose domain is written as A-labels (so the canonical form
+ *           can be longer than the input)
+ *   arena - receives the canonical form, NUL-terminated
+ *   out   - receives the result
+ *
+ * Returns:
+ *   true when the address is valid and its canonical form was written;
+ *   false when it is invalid (out->reason and out->offset say why, with
+ *   the offset into p[0..len)) or when the arena has no room for it
+ *   (out->reason is EMAIL_VALID and out->p is NULL)
+ */
+bool email_normalize(const char* p, size_t len, unsigned flags, email_arena* arena,
+                     email_normalized* out) {
+    size_t skipped = 0;
+
+    if ((flags & EMAIL_NORMALIZE_LENIENT) && p != NULL) {
+        while (skipped < len && (EMAIL_CLASS_OF(p[skipped]) & EMAIL_CHAR_SPACE)) {
+            skipped++;
+        }
+        while (len > skipped && (EMAIL_CLASS_OF(p[len - 1]) & EMAIL_CHAR_SPACE)) {
+            len--;
+        }
+        p += skipped;
+        len -= skipped;
+    }
+
+    size_t offset = 0;
+    bool utf8 = (flags & EMAIL_NORMALIZE_UTF8) && p != NULL && !email_is_ascii(p, len);
+    out->p = NULL;
+    out->len = 0;
+    if (utf8) {
+        out->reason = flags & EMAIL_NORMALIZE_STRICT ? email_check_utf8_strict(p, len, &offset)
+                                                     : email_check_utf8(p, len, &offset);
+    } else {
+        out->reason = flags & EMAIL_NORMALIZE_STRICT ? email_check_strict(p, len, &offset)
+                                                     : email_check(p, len, &offset);
+    }
+    out->offset = out->reason == EMAIL_VALID ? 0 : skipped + offset;
+    if (out->reason != EMAIL_VALID) {
+        return false;
+    }
+    if (utf8) {
+        return email_normalize_utf8(p, len, arena, out);
+    }
+
+    if (arena->size - arena->used < len + 1) {
+        return false;
+    }
+
+    char* dst = arena->base + arena->used;
+    const char* at = memchr(p, '@', len);
+    email_copy_canonical(dst, p, len, (size_t)(at - p));
+    arena->used += len + 1;
+
+    out->p = dst;
+    out->len = len;
+    return true;
+}
+
+/**
+ * Function: normalize_emails_batch
+ * Purpose: email_normalize() over n addresses, into one arena
+ *
+ * Parameters:
+ *   ptrs, lens - the addresses, as for validate_emails_batch()
+ *   n          - number of addresses
+ *   flags      - as for email_normalize()
+ *   arena      - receives the canonical forms
+ *   out_ptrs   - out_ptrs[i] receives the canonical form of address i,
+ *                NULL when it is invalid
+ *   out_lens   - out_lens[i] receives its length, 0 when invalid
+ *
+ * Returns:
+ *   the number of addresses done. It is less than n only when the arena
+ *   filled up: reset it (after using the results) and call again with
+ *   the rest.
+ */
+size_t normalize_emails_batch(const char* const* ptrs, const size_t* lens, size_t n,
+                              unsigned flags, email_arena* arena,
+                              const char** out_ptrs, size_t* out_lens) {
+    for (size_t i = 0; i < n; i++) {
+        email_normalized r;
+        if (!email_normalize(ptrs[i], lens[i], flags, arena, &r) && r.reason == EMAIL_VALID) {
+            return i;
+        }
+        out_ptrs[i] = r.p;
+        out_lens[i] = r.len;
+    }
+    return n;
+}
@@ -0,0 +1,755 @@
+#define _GNU_SOURCE   // pthread_setaffinity_np()
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "email_internal.h"
+
+/*
+ * Pipelined validation
+ *
+ * Five kinds of stage thread pass pointers through single-producer
+ * single-consumer rings:
+ *
+ *   read --blocks--> split --batches--> validate[w] --> enrich --> write
+ *     ^                ^                                            |
+ *     +-- free blocks -+------------- free batches -----------------+
+ *
+ * A block holds whole lines only: the reader moves the partial line at
+ * the end of what it read into the next block before handing a block
+ * on. Batches are cut from one block each, and the last batch of a block
+ * carries it, so the write stage hands the block back once that batch is
+ * written: batches are written in order, so by then every batch of the
+ * block has been. The blocks and batches are allocated once, when the
+ * pipeline starts; a stage that finds no free one waits, which is the
+ * backpressure. Batch k goes to validator k % validators and is collected
+ * from there in the same turn, so no ring ever has two producers or two
+ * consumers. A NULL pointer marks the end of the input.
+ *
+ * Waiting is a short spin, then sched_yield(), then short sleeps, so an
+ * idle stage costs little and a busy one picks work up within a few
+ * microseconds. Counters belong to one thread each and are plain
+ * relaxed stores; email_pipeline_snapshot() adds them up.
+ */
+#define EMAIL_PIPE_DEFAULT_BATCH 4096
+#define EMAIL_PIPE_DEFAULT_BLOCK ((size_t)1 << 20)
+#define EMAIL_PIPE_MIN_BLOCK ((size_t)1024)
+#define EMAIL_PIPE_LINE_KEEP (MAX_EMAIL_LENGTH + 2)   // of a longer line; still too long
+#define EMAIL_PIPE_DEFAULT_BLOCKS 8
+#define EMAIL_PIPE_DEFAULT_DEPTH 64
+#define EMAIL_PIPE_MAX_VALIDATORS 64
+
+_Static_assert(EMAIL_PIPE_MIN_BLOCK > 2 * EMAIL_PIPE_LINE_KEEP, "a block holds a kept line head");
+#define EMAIL_PIPE_SPINS 128      // polls before the first yield
+#define EMAIL_PIPE_YIELDS 64      // yields before the first sleep
+#define EMAIL_PIPE_SLEEP_NS 50000
+
+// ---- Rings ----
+
+typedef struct {
+    _Alignas(64) _Atomic size_t head;   // next to pop, written by the consumer
+    _Alignas(64) _Atomic size_t tail;   // next to push, written by the producer
+    _Atomic size_t peak;                // most items ever in the ring
+    _Alignas(64) void** items;
+    size_t mask;
+} email_ring;
+
+static bool email_ring_init(email_ring* r, size_t capacity) {
+    size_t n = 1;
+    while (n < capacity) {
+        n <<= 1;
+    }
+    r->items = calloc(n, sizeof(*r->items));
+    r->mask = n - 1;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->peak, 0);
+    return r->items != NULL;
+}
+
+static bool email_ring_push(email_ring* r, void* item) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (tail - head > r->mask) {
+        return false;
+    }
+    r->items[tail & r->mask] = item;
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    size_t depth = tail + 1 - head;
+    if (depth > atomic_load_explicit(&r->peak, memory_order_relaxed)) {
+        atomic_store_explicit(&r->peak, depth, memory_order_relaxed);
+    }
+    return true;
+}
+
+static bool email_ring_pop(email_ring* r, void** item) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head == tail) {
+        return false;
+    }
+    *item = r->items[head & r->mask];
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return true;
+}
+
+// Items in the ring, for any thread; a moment's estimate while it is in use
+static size_t email_ring_depth(email_ring* r) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+// ---- Pipeline ----
+
+typedef struct {
+    char* data;
+    size_t cap;
+    size_t len;                 // whole lines, except in the last block
+} email_pipe_block;
+
+typedef struct {
+    email_pipe_batch view;      // what the callbacks see
+    const char** lines;
+    size_t* lens;
+    uint8_t* valid;
+    uint8_t* flags;
+    size_t bytes;
+    email_pipe_block* release;  // the block to free once this batch is written
+} email_pipe_item;
+
+typedef struct {
+    _Atomic uint64_t batches;
+    _Atomic uint64_t lines;
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t busy_ns;
+    _Atomic uint64_t starved_ns;
+    _Atomic uint64_t blocked_ns;
+    _Atomic uint64_t valid;     // write stage only
+} email_pipe_counters;
+
+typedef struct {
+    _Alignas(64) email_pipe_counters counters;
+    struct email_pipeline* p;
+    email_pipe_stage stage;
+    unsigned index;             // among the validators
+    pthread_t thread;
+    bool started;
+} email_pipe_worker;
+
+struct email_pipeline {
+    int fd;
+    email_pipeline_options opts;     // defaults filled in
+    email_validator validator;
+    uint64_t started_ns;
+
+    email_ring free_blocks;          // write -> read
+    email_ring blocks;               // read -> split
+    email_ring* to_validate;         // split -> validate[w]
+    email_ring* validated;           // validate[w] -> enrich
+    email_ring enriched;             // enrich -> write
+    email_ring free_batches;         // write -> split
+
+    email_pipe_block* block_pool;
+    email_pipe_item* batch_pool;
+    size_t batch_count;
+
+    email_pipe_worker* workers;      // read, split, validators, enrich, write
+    unsigned worker_count;
+
+    _Atomic bool stop;
+    _Atomic int rc;                  // first non-zero result
+    int read_errno;
+};
+
+static uint64_t email_pipe_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Adds to a counter only its own thread writes
+static inline void email_pipe_add(_Atomic uint64_t* counter, uint64_t n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static void email_pipe_backoff(unsigned round) {
+    if (round < EMAIL_PIPE_SPINS) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    } else if (round < EMAIL_PIPE_SPINS + EMAIL_PIPE_YIELDS) {
+        sched_yield();
+    } else {
+        struct timespec ts = { 0, EMAIL_PIPE_SLEEP_NS };
+        nanosleep(&ts, NULL);
+    }
+}
+
+// Stops every stage; the first result recorded is the one returned
+static void email_pipe_fail(email_pipeline* p, int rc) {
+    int none = 0;
+    atomic_compare_exchange_strong(&p->rc, &none, rc);
+    atomic_store(&p->stop, true);
+}
+
+/*
+ * Pops from r, waiting (counted in *waited) while it is empty; false
+ * when the pipeline stops first
+ */
+static bool email_pipe_pop(email_pipeline* p, email_ring* r, void** item,
+                           _Atomic uint64_t* waited) {
+    if (email_ring_pop(r, item)) {
+        return true;
+    }
+    uint64_t start = email_pipe_now();
+    bool ok = true;
+    for (unsigned round = 0; !email_ring_pop(r, item); round++) {
+        if (atomic_load_explicit(&p->stop, memory_order_relaxed)) {
+            ok = false;
+            break;
+        }
+        email_pipe_backoff(round);
+    }
+    email_pipe_add(waited, email_pipe_now() - start);
+    return ok;
+}
+
+// The same for a push to a full ring
+static bool email_pipe_push(email_pipeline* p, email_ring* r, void* item,
+                            _Atomic uint64_t* waited) {
+    if (email_ring_push(r, item)) {
+        return true;
+    }
+    uint64_t start = email_pipe_now();
+    bool ok = true;
+    for (unsigned round = 0; !email_ring_push(r, item); round++) {
+        if (atomic_load_explicit(&p->stop, memory_order_relaxed)) {
+            ok = false;
+            break;
+        }
+        email_pipe_backoff(round);
+    }
+    email_pipe_add(waited, email_pipe_now() - start);
+    return ok;
+}
+
+// ---- Stages ----
+
+/*
+ * Reads blocks of whole lines. After each read() that brings a line end,
+ * everything up to the last one goes on and the rest starts the next
+ * block. A line longer than any address keeps only its first
+ * EMAIL_PIPE_LINE_KEEP bytes: the rest is dropped as it arrives, so a
+ * block never grows.
+ */
+static void email_pipe_read(email_pipe_worker* w) {
+    email_pipeline* p = w->p;
+    email_pipe_counters* c = &w->counters;
+    void* item;
+    if (!email_pipe_pop(p, &p->free_blocks, &item, &c->blocked_ns)) {
+        return;
+    }
+    email_pipe_block* b = item;
+    size_t used = 0;
+    bool dropping = false;      // b holds just the kept head of a long line
+
+    for (;;) {
+        uint64_t start = email_pipe_now();
+        ssize_t got = read(p->fd, b->data + used, b->cap - used);
+        email_pipe_add(&c->busy_ns, email_pipe_now() - start);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            p->read_errno = errno;
+            email_pipe_fail(p, -1);
+            return;
+        }
+        if (got == 0) {
+            break;
+        }
+        email_pipe_add(&c->bytes, (uint64_t)got);
+        size_t fresh = used;
+        used += (size_t)got;
+
+        if (dropping) {
+            const char* nl = memchr(b->data + fresh, '\n', used - fresh);
+            if (nl == NULL) {
+                used = fresh;
+                continue;
+            }
+            // The long line ends: its head, then the '\n' and what follows
+            size_t rest = used - (size_t)(nl - b->data);
+            memmove(b->data + fresh, nl, rest);
+            used = fresh + rest;
+            dropping = false;
+        }
+
+        const char* last = NULL;
+        for (size_t i = used; i > fresh; i--) {
+            if (b->data[i - 1] == '\n') {
+                last = b->data + i - 1;
+                break;
+            }
+        }
+        if (last == NULL) {
+            // b holds one partial line and nothing else
+            if (used > EMAIL_PIPE_LINE_KEEP) {
+                used = EMAIL_PIPE_LINE_KEEP;
+                dropping = true;
+            }
+            continue;
+        }
+
+        // The partial line after the last '\n' moves to the next block
+        if (!email_pipe_pop(p, &p->free_blocks, &item, &c->blocked_ns)) {
+            return;
+        }
+        email_pipe_block* next = item;
+        size_t keep = (size_t)(last + 1 - b->data);
+        size_t tail = used - keep;
+        dropping = tail > EMAIL_PIPE_LINE_KEEP;
+        if (dropping) {
+            tail = EMAIL_PIPE_LINE_KEEP;
+        }
+        memcpy(next->data, b->data + keep, tail);
+        b->len = keep;
+        email_pipe_add(&c->batches, 1);
+        if (!email_pipe_push(p, &p->blocks, b, &c->blocked_ns)) {
+            return;
+        }
+        b = next;
+        used = tail;
+    }
+
+    // The last line may have no line end; an empty block simply stays here
+    if (used > 0) {
+        b->len = used;
+        email_pipe_add(&c->batches, 1);
+        if (!email_pipe_push(p, &p->blocks, b, &c->blocked_ns)) {
+            return;
+        }
+    }
+    email_pipe_push(p, &p->blocks, NULL, &c->blocked_ns);
+}
+
+// Cuts blocks into batches and deals them to the validators in turn
+static void email_pipe_split(email_pipe_worker* w) {
+    email_pipeline* p = w->p;
+    email_pipe_counters* c = &w->counters;
+    unsigned validators = p->opts.validators;
+    unsigned turn = 0;
+    uint64_t line_no = 1;
+    void* item;
+
+    while (email_pipe_pop(p, &p->blocks, &item, &c->starved_ns)) {
+        email_pipe_block* b = item;
+        if (b == NULL) {
+            for (unsigned v = 0; v < validators; v++) {
+                if (!email_pipe_push(p, &p->to_validate[v], NULL, &c->blocked_ns)) {
+                    return;
+                }
+            }
+            return;
+        }
+
+        // Once its last batch is dealt the block may be written and reused, so
+        // its length is read only here
+        size_t size = b->len;
+        size_t pos = 0;
+        while (pos < size) {
+            if (!email_pipe_pop(p, &p->free_batches, &item, &c->blocked_ns)) {
+                return;
+            }
+            email_pipe_item* batch = item;
+            uint64_t start = email_pipe_now();
+            size_t n = 0;
+            size_t bytes = 0;
+            while (n < p->opts.batch_size && pos < size) {
+                const char* line = b->data + pos;
+                const char* nl = memchr(line, '\n', size - pos);
+                size_t len = nl != NULL ? (size_t)(nl - line) : size - pos;
+                pos += len + (nl != NULL);
+                // Accept CRLF files, as the streaming validator does
+                if (len > 0 && line[len - 1] == '\r') {
+                    len--;
+                }
+                batch->lines[n] = line;
+                batch->lens[n] = len;
+                bytes += len;
+                n++;
+            }
+            memset(batch->flags, 0, n);
+            batch->view.first_line = line_no;
+            batch->view.count = n;
+            batch->bytes = bytes;
+            batch->release = pos >= size ? b : NULL;
+            line_no += n;
+            email_pipe_add(&c->busy_ns, email_pipe_now() - start);
+            email_pipe_add(&c->batches, 1);
+            email_pipe_add(&c->lines, n);
+            email_pipe_add(&c->bytes, bytes);
+
+            if (!email_pipe_push(p, &p->to_validate[turn], batch, &c->blocked_ns)) {
+                return;
+            }
+            turn = turn + 1 < validators ? turn + 1 : 0;
+        }
+    }
+}
+
+static void email_pipe_validate(email_pipe_worker* w) {
+    email_pipeline* p = w->p;
+    email_pipe_counters* c = &w->counters;
+    email_ring* in = &p->to_validate[w->index];
+    email_ring* out = &p->validated[w->index];
+    void* item;
+
+    while (email_pipe_pop(p, in, &item, &c->starved_ns)) {
+        email_pipe_item* batch = item;
+        if (batch != NULL) {
+            uint64_t start = email_pipe_now();
+            email_batch_validate(batch->lines, batch->lens, batch->view.count, batch->valid,
+                                 &p->validator);
+            email_pipe_add(&c->busy_ns, email_pipe_now() - start);
+            email_pipe_add(&c->batches, 1);
+            email_pipe_add(&c->lines, batch->view.count);
+            email_pipe_add(&c->bytes, batch->bytes);
+        }
+        if (!email_pipe_push(p, out, batch, &c->blocked_ns) || batch == NULL) {
+            return;
+        }
+    }
+}
+
+// Collects the validators' batches in the order they were dealt
+static void email_pipe_enrich(email_pipe_worker* w) {
+    email_pipeline* p = w->p;
+    email_pipe_counters* c = &w->counters;
+    unsigned validators = p->opts.validators;
+    unsigned turn = 0;
+    void* item;
+
+    while (email_pipe_pop(p, &p->validated[turn], &item, &c->starved_ns)) {
+        email_pipe_item* batch = item;
+        turn = turn + 1 < validators ? turn + 1 : 0;
+        // Every validator ends its ring; collect the other ends as well
+        for (unsigned ended = 1; batch == NULL && ended < validators; ended++) {
+            if (!email_pipe_pop(p, &p->validated[turn], &item, &c->starved_ns)) {
+                return;
+            }
+            turn = turn + 1 < validators ? turn + 1 : 0;
+        }
+        if (batch != NULL) {
+            uint64_t start = email_pipe_now();
+            int rc = batch->view.count > 0 && p->opts.enrich != NULL
+                         ? p->opts.enrich(&batch->view, p->opts.enrich_ctx)
+                         : 0;
+            email_pipe_add(&c->busy_ns, email_pipe_now() - start);
+            if (rc != 0) {
+                email_pipe_fail(p, rc);
+                return;
+            }
+            email_pipe_add(&c->batches, 1);
+            email_pipe_add(&c->lines, batch->view.count);
+            email_pipe_add(&c->bytes, batch->bytes);
+        }
+        if (!email_pipe_push(p, &p->enriched, batch, &c->blocked_ns) || batch == NULL) {
+            return;
+        }
+    }
+}
+
+// Hands every batch to the caller, then its batch and block back to the pool
+static void email_pipe_write(email_pipe_worker* w) {
+    email_pipeline* p = w->p;
+    email_pipe_counters* c = &w->counters;
+    void* item;
+
+    while (email_pipe_pop(p, &p->enriched, &item, &c->starved_ns)) {
+        email_pipe_item* batch = item;
+        if (batch == NULL) {
+            return;
+        }
+        size_t n = batch->view.count;
+        uint64_t start = email_pipe_now();
+        int rc = n > 0 && p->opts.write != NULL ? p->opts.write(&batch->view, p->opts.write_ctx)
+                                                : 0;
+        uint64_t valid = 0;
+        for (size_t i = 0; i < (n + 7) / 8; i++) {
+            valid += (uint64_t)__builtin_popcount(batch->valid[i]);
+        }
+        email_pipe_add(&c->busy_ns, email_pipe_now() - start);
+        if (rc != 0) {
+            email_pipe_fail(p, rc);
+            return;
+        }
+        email_pipe_add(&c->batches, 1);
+        email_pipe_add(&c->lines, n);
+        email_pipe_add(&c->bytes, batch->bytes);
+        email_pipe_add(&c->valid, valid);
+
+        // The pools have a slot for every block and batch, so these never wait
+        if (batch->release != NULL) {
+            email_ring_push(&p->free_blocks, batch->release);
+        }
+        email_ring_push(&p->free_batches, batch);
+    }
+}
+
+static void* email_pipe_main(void* arg) {
+    email_pipe_worker* w = arg;
+    switch (w->stage) {
+    case EMAIL_PIPE_READ:
+        email_pipe_read(w);
+        break;
+    case EMAIL_PIPE_SPLIT:
+        email_pipe_split(w);
+        break;
+    case EMAIL_PIPE_VALIDATE:
+        email_pipe_validate(w);
+        break;
+    case EMAIL_PIPE_ENRICH:
+        email_pipe_enrich(w);
+        break;
+    default:
+        email_pipe_write(w);
+        break;
+    }
+    return NULL;
+}
+
+// ---- Set-up ----
+
+static void email_pipe_free(email_pipeline* p) {
+    unsigned validators = p->opts.validators;
+    free(p->free_blocks.items);
+    free(p->blocks.items);
+    free(p->enriched.items);
+    free(p->free_batches.items);
+    for (unsigned v = 0; p->to_validate != NULL && v < validators; v++) {
+        free(p->to_validate[v].items);
+    }
+    for (unsigned v = 0; p->validated != NULL && v < validators; v++) {
+        free(p->validated[v].items);
+    }
+    free(p->to_validate);
+    free(p->validated);
+    for (unsigned i = 0; p->block_pool != NULL && i < p->opts.blocks; i++) {
+        free(p->block_pool[i].data);
+    }
+    free(p->block_pool);
+    for (size_t i = 0; p->batch_pool != NULL && i < p->batch_count; i++) {
+        free(p->batch_pool[i].lines);
+        free(p->batch_pool[i].lens);
+        free(p->batch_pool[i].valid);
+        free(p->batch_pool[i].flags);
+    }
+    free(p->batch_pool);
+    free(p->workers);
+    email_domain_cache_destroy(p->validator.cache);
+    free(p);
+}
+
+// Allocates the rings and pools, and puts every block and batch in its pool
+static bool email_pipe_alloc(email_pipeline* p) {
+    const email_pipeline_options* o = &p->opts;
+    unsigned validators = o->validators;
+    p->batch_count = (size_t)o->queue_depth * 2;
+
+    p->to_validate = calloc(validators, sizeof(*p->to_validate));
+    p->validated = calloc(validators, sizeof(*p->validated));
+    p->block_pool = calloc(o->blocks, sizeof(*p->block_pool));
+    p->batch_pool = calloc(p->batch_count, sizeof(*p->batch_pool));
+    if (p->to_validate == NULL || p->validated == NULL || p->block_pool == NULL ||
+        p->batch_pool == NULL) {
+        return false;
+    }
+    bool ok = email_ring_init(&p->free_blocks, o->blocks) &&
+              email_ring_init(&p->blocks, o->queue_depth) &&
+              email_ring_init(&p->enriched, o->queue_depth) &&
+              email_ring_init(&p->free_batches, p->batch_count);
+    for (unsigned v = 0; ok && v < validators; v++) {
+        ok = email_ring_init(&p->to_validate[v], o->queue_depth) &&
+             email_ring_init(&p->validated[v], o->queue_depth);
+    }
+    for (unsigned i = 0; ok && i < o->blocks; i++) {
+        email_pipe_block* b = &p->block_pool[i];
+        b->data = malloc(o->block_size);
+        b->cap = o->block_size;
+        ok = b->data != NULL && email_ring_push(&p->free_blocks, b);
+    }
+    for (size_t i = 0; ok && i < p->batch_count; i++) {
+        email_pipe_item* batch = &p->batch_pool[i];
+        batch->lines = malloc(o->batch_size * sizeof(*batch->lines));
+        batch->lens = malloc(o->batch_size * sizeof(*batch->lens));
+        batch->valid = malloc((o->batch_size + 7) / 8);
+        batch->flags = malloc(o->batch_size);
+        batch->view.lines = batch->lines;
+        batch->view.lens = batch->lens;
+        batch->view.valid = batch->valid;
+        batch->view.flags = batch->flags;
+        ok = batch->lines != NULL && batch->lens != NULL && batch->valid != NULL &&
+             batch->flags != NULL && email_ring_push(&p->free_batches, batch);
+    }
+    return ok;
+}
+
+// Joins every started thread
+static void email_pipe_join(email_pipeline* p) {
+    for (unsigned i = 0; i < p->worker_count; i++) {
+        if (p->workers[i].started) {
+            pthread_join(p->workers[i].thread, NULL);
+            p->workers[i].started = false;
+        }
+    }
+}
+
+/**
+ * Function: email_pipeline_start
+ * Purpose: Allocates the pools and rings and starts one thread per stage
+ *          (opts->validators for the validate stage)
+ *
+ * Returns:
+ *   the pipeline, or NULL with errno set (EINVAL for more than 64
+ *   validators, ENOMEM, or what pthread_create() failed with)
+ */
+email_pipeline* email_pipeline_start(int fd, const email_pipeline_options* opts) {
+    email_pipeline* p = calloc(1, sizeof(*p));
+    if (p == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    p->fd = fd;
+    if (opts != NULL) {
+        p->opts = *opts;
+    }
+    email_pipeline_options* o = &p->opts;
+    if (o->validators > EMAIL_PIPE_MAX_VALIDATORS) {
+        free(p);
+        errno = EINVAL;
+        return NULL;
+    }
+    o->validators = o->validators != 0 ? o->validators : 1;
+    o->batch_size = o->batch_size != 0 ? o->batch_size : EMAIL_PIPE_DEFAULT_BATCH;
+    o->block_size = o->block_size == 0             ? EMAIL_PIPE_DEFAULT_BLOCK
+                    : o->block_size < EMAIL_PIPE_MIN_BLOCK ? EMAIL_PIPE_MIN_BLOCK
+                                                           : o->block_size;
+    o->blocks = o->blocks >= 2 ? o->blocks : EMAIL_PIPE_DEFAULT_BLOCKS;
+    o->queue_depth = o->queue_depth != 0 ? o->queue_depth : EMAIL_PIPE_DEFAULT_DEPTH;
+
+    email_validator_select(&p->validator, o->strict, o->utf8, o->rfc);
+    if (o->domain_cache && !o->utf8 && !o->rfc) {
+        p->validator.cache = email_domain_cache_create();
+    }
+    p->worker_count = 4 + o->validators;
+    p->workers = aligned_alloc(64, sizeof(*p->workers) * p->worker_count);
+    if (p->workers == NULL || !email_pipe_alloc(p)) {
+        email_pipe_free(p);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    memset(p->workers, 0, sizeof(*p->workers) * p->worker_count);
+    for (unsigned i = 0; i < p->worker_count; i++) {
+        email_pipe_worker* w = &p->workers[i];
+        w->p = p;
+        if (i < 2) {
+            w->stage = i == 0 ? EMAIL_PIPE_READ : EMAIL_PIPE_SPLIT;
+        } else if (i < 2 + o->validators) {
+            w->stage = EMAIL_PIPE_VALIDATE;
+            w->index = i - 2;
+        } else {
+            w->stage = i == p->worker_count - 2 ? EMAIL_PIPE_ENRICH : EMAIL_PIPE_WRITE;
+        }
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    p->started_ns = email_pipe_now();
+    for (unsigned i = 0; i < p->worker_count; i++) {
+        email_pipe_worker* w = &p->workers[i];
+        int rc = pthread_create(&w->thread, NULL, email_pipe_main, w);
+        if (rc != 0) {
+            email_pipe_fail(p, -1);
+            email_pipe_join(p);
+            email_pipe_free(p);
+            errno = rc;
+            return NULL;
+        }
+        w->started = true;
+        if (o->pin && cpus > 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET((i % (unsigned long)cpus) % CPU_SETSIZE, &set);
+            pthread_setaffinity_np(w->thread, sizeof(set), &set);
+        }
+    }
+    return p;
+}
+
+int email_pipeline_wait(email_pipeline* p, email_pipeline_stats* stats) {
+    email_pipe_join(p);
+    if (stats != NULL) {
+        email_pipeline_snapshot(p, stats);
+    }
+    int rc = atomic_load(&p->rc);
+    int saved = p->read_errno;
+    email_pipe_free(p);
+    if (rc == -1) {
+        errno = saved;
+    }
+    return rc;
+}
+
+static void email_pipe_add_ring(email_pipe_stage_stats* s, email_ring* ring) {
+    s->queue_depth += email_ring_depth(ring);
+    s->queue_peak += atomic_load_explicit(&ring->peak, memory_order_relaxed);
+    s->queue_capacity += ring->mask + 1;
+}
+
+void email_pipeline_snapshot(email_pipeline* p, email_pipeline_stats* out) {
+    memset(out, 0, sizeof(*out));
+    out->elapsed_ns = email_pipe_now() - p->started_ns;
+
+    for (unsigned i = 0; i < p->worker_count; i++) {
+        const email_pipe_worker* w = &p->workers[i];
+        email_pipe_stage_stats* s = &out->stage[w->stage];
+        const email_pipe_counters* c = &w->counters;
+        s->threads++;
+        s->batches += atomic_load_explicit(&c->batches, memory_order_relaxed);
+        s->lines += atomic_load_explicit(&c->lines, memory_order_relaxed);
+        s->bytes += atomic_load_explicit(&c->bytes, memory_order_relaxed);
+        s->busy_ns += atomic_load_explicit(&c->busy_ns, memory_order_relaxed);
+        s->starved_ns += atomic_load_explicit(&c->starved_ns, memory_order_relaxed);
+        s->blocked_ns += atomic_load_explicit(&c->blocked_ns, memory_order_relaxed);
+        if (w->stage == EMAIL_PIPE_WRITE) {
+            out->valid = atomic_load_explicit(&c->valid, memory_order_relaxed);
+            out->invalid = s->lines - out->valid;
+        }
+    }
+
+    // The input ring(s) of each stage; the read stage has none
+    email_pipe_add_ring(&out->stage[EMAIL_PIPE_SPLIT], &p->blocks);
+    for (unsigned v = 0; v < p->opts.validators; v++) {
+        email_pipe_add_ring(&out->stage[EMAIL_PIPE_VALIDATE], &p->to_validate[v]);
+        email_pipe_add_ring(&out->stage[EMAIL_PIPE_ENRICH], &p->validated[v]);
+    }
+    email_pipe_add_ring(&out->stage[EMAIL_PIPE_WRITE], &p->enriched);
+}
+
+const char* email_pipeline_stage_name(email_pipe_stage stage) {
+    static const char* const names[EMAIL_PIPE_STAGE_COUNT] = {
+        "read", "split", "validate", "enrich", "write"
+    };
+    return (unsigned)stage < EMAIL_PIPE_STAGE_COUNT ? names[stage] : "unknown";
+}
@@ -0,0 +1,65 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "email_internal.h"
+
+/*
+ * RFC 5321 mode
+ *
+ * The tables come from email_rfc_gen (src/email_rfc_gen.c), which
+ * compiles the Mailbox grammar into a minimal DFA at build time. A state
+ * is the offset of its row, so the scan is one class lookup and one
+ * transition per byte, with no branch on the byte itself. Rows below
+ * EMAIL_RFC_SINK_ROWS are the absorbing reject states, one per reason;
+ * reaching one ends the scan at the byte responsible. Only the local
+ * part limit is left to check afterwards, since counting to 64 in the
+ * automaton would multiply its states for both local part forms.
+ */
+#include "email_rfc_dfa.inc"
+
+#define EMAIL_FAIL(reason, pos)   \
+    do {                          \
+        if (offset != NULL) {     \
+            *offset = (pos);      \
+        }                         \
+        return (reason);          \
+    } while (0)
+
+email_reason email_check_rfc(const char* p, size_t len, size_t* offset) {
+    if (p == NULL) {
+        EMAIL_FAIL(EMAIL_NULL_INPUT, 0);
+    }
+    if (len > EMAIL_RFC_MAX_LENGTH) {
+        EMAIL_FAIL(EMAIL_TOO_LONG, EMAIL_RFC_MAX_LENGTH);
+    }
+
+    const unsigned char* s = (const unsigned char*)p;
+    unsigned row = EMAIL_RFC_START;
+    for (size_t i = 0; i < len; i++) {
+        row = email_rfc_next[row + email_rfc_class[s[i]]];
+        if (row < EMAIL_RFC_SINK_ROWS) {
+            EMAIL_FAIL((email_reason)email_rfc_final[row / EMAIL_RFC_CLASSES], i);
+        }
+    }
+    email_reason reason = (email_reason)email_rfc_final[row / EMAIL_RFC_CLASSES];
+    if (reason != EMAIL_VALID) {
+        EMAIL_FAIL(reason, len);
+    }
+
+    // A valid domain holds no '@', so the local part ends at the last one
+    size_t at = len;
+    while (s[--at] != '@') {
+    }
+    if (at > EMAIL_RFC_MAX_LOCAL) {
+        EMAIL_FAIL(EMAIL_LOCAL_TOO_LONG, EMAIL_RFC_MAX_LOCAL);
+    }
+    return EMAIL_VALID;
+}
+
+bool is_valid_email_rfc(const char* p, size_t len) {
+    bool valid = email_check_rfc(p, len, NULL) == EMAIL_VALID;
+
+    EMAIL_METRICS_VERDICT(valid, p, len, email_check_rfc);
+    return valid;
+}
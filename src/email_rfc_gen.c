@@ -0,0 +1,588 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "email_validate.h"
+
+/*
+ * email_rfc_gen: compiles the RFC 5321 Mailbox grammar into the DFA that
+ * is_valid_email_rfc() runs
+ *
+ * Usage: email_rfc_gen OUTPUT
+ *
+ * The grammar is written below as a step function over a small state
+ * record: which part of the address the scan is in, plus the counters a
+ * regular grammar needs spelled out (label length, IPv6 groups, the value
+ * of a dotted-decimal octet). Starting from the initial state every
+ * reachable state is enumerated, bytes that behave the same everywhere
+ * are merged into classes, and the automaton is minimized (Moore's
+ * algorithm). Every reject reason gets one absorbing state, numbered
+ * first, so the runtime stops at the first byte that lands below
+ * EMAIL_RFC_SINK_ROWS and reports it. The output is an include file of
+ * tables; the build regenerates it whenever this file or the headers
+ * change.
+ */
+
+// ---- The grammar as a step function ----
+
+enum {
+    P_REJECT,       // absorbing; reason says why
+    P_START,
+    P_ATOM,         // dot-string, after an atext byte
+    P_ATOM_DOT,     // dot-string, after a '.'
+    P_QUOTE,        // quoted-string, inside the quotes
+    P_QUOTE_ESC,    // quoted-string, after a '\'
+    P_QUOTE_END,    // after the closing quote
+    P_DOMAIN_START, // after the '@'
+    P_LABEL,        // in a domain label
+    P_LABEL_DOT,    // after a '.' of the domain
+    P_LITERAL,      // after the '['
+    P_TAG,          // reading the "IPv6:" tag
+    P_V4,           // in a dotted-decimal IPv4 address
+    P_V6,           // in an IPv6 address
+    P_LITERAL_END   // after the ']'
+};
+
+// Where an IPv6 address is (P_V6)
+enum { V6_START, V6_LEAD, V6_GROUP, V6_COLON, V6_DCOLON };
+
+// A dotted-decimal octet of more than 3 digits or above 255
+#define OCTET_DEAD 4
+
+typedef struct {
+    uint8_t part;
+    uint8_t reason;   // P_REJECT: the email_reason
+    uint8_t count;    // P_LABEL: bytes of the label; P_TAG: bytes of the tag read;
+                      // P_V4: octets begun; P_V6: groups completed
+    uint8_t flag;     // P_LABEL: the last byte was '-'; P_V6: "::" seen
+    uint8_t sub;      // P_V6: V6_*
+    uint8_t hex;      // P_V6: hex digits of the current group
+    uint8_t digits;   // P_V4, P_V6: decimal digits of the current group, or OCTET_DEAD
+    uint8_t value;    // and their value
+} rfc_state;
+
+static rfc_state state_of(unsigned part) {
+    rfc_state s;
+    memset(&s, 0, sizeof(s));
+    s.part = (uint8_t)part;
+    return s;
+}
+
+static rfc_state reject(email_reason reason) {
+    rfc_state s = state_of(P_REJECT);
+    s.reason = (uint8_t)reason;
+    return s;
+}
+
+static bool is_digit(unsigned c) {
+    return c >= '0' && c <= '9';
+}
+
+static bool is_hex(unsigned c) {
+    return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static bool is_space(unsigned c) {
+    return (EMAIL_CHAR_CLASS(c) & EMAIL_CHAR_SPACE) != 0;
+}
+
+// Appends a byte to a group that may turn out to be a dotted-decimal octet
+static void octet_add(rfc_state* s, unsigned c) {
+    if (!is_digit(c) || s->digits >= 3 || s->value * 10u + (c - '0') > 255) {
+        s->digits = OCTET_DEAD;
+        s->value = 0;
+    } else {
+        s->digits++;
+        s->value = (uint8_t)(s->value * 10u + (c - '0'));
+    }
+}
+
+static rfc_state label(unsigned count, bool hyphen) {
+    rfc_state s = state_of(P_LABEL);
+    s.count = (uint8_t)count;
+    s.flag = hyphen;
+    return s;
+}
+
+// Bytes that cannot be in a domain
+static rfc_state bad_domain_char(unsigned c) {
+    if (c == '@') {
+        return reject(EMAIL_MULTIPLE_AT);
+    }
+    return reject(is_space(c) ? EMAIL_WHITESPACE : EMAIL_BAD_DOMAIN_CHAR);
+}
+
+static rfc_state v6_group(rfc_state s, unsigned c) {
+    s.sub = V6_GROUP;
+    s.hex = 1;
+    s.digits = 0;
+    s.value = 0;
+    octet_add(&s, c);
+    return s;
+}
+
+/*
+ * IPv6-addr (RFC 5321 section 4.1.3):
+ *   IPv6-full    8 groups
+ *   IPv6-comp    [groups] "::" [groups], at most 6 groups in all
+ *   IPv6v4-full  6 groups ":" IPv4
+ *   IPv6v4-comp  [groups] "::" [groups ":"] IPv4, at most 4 groups in all
+ * A group is 1-4 hex digits. When a group is followed by '.', it was the
+ * first octet of the IPv4 part.
+ */
+static rfc_state step_v6(rfc_state s, unsigned c) {
+    switch (s.sub) {
+    case V6_START:
+        if (is_hex(c)) {
+            return v6_group(s, c);
+        }
+        if (c == ':') {
+            s.sub = V6_LEAD;
+            return s;
+        }
+        break;
+    case V6_LEAD:
+        if (c == ':') {
+            s.sub = V6_DCOLON;
+            s.flag = 1;
+            return s;
+        }
+        break;
+    case V6_COLON:
+        if (is_hex(c)) {
+            return v6_group(s, c);
+        }
+        if (c == ':' && !s.flag && s.count <= 6) {
+            s.sub = V6_DCOLON;
+            s.flag = 1;
+            return s;
+        }
+        break;
+    case V6_DCOLON:
+        if (is_hex(c)) {
+            return v6_group(s, c);
+        }
+        if (c == ']') {
+            return state_of(P_LITERAL_END);
+        }
+        break;
+    case V6_GROUP:
+        if (is_hex(c)) {
+            if (s.hex == 4) {
+                break;
+            }
+            s.hex++;
+            octet_add(&s, c);
+            return s;
+        }
+        if (c == ':') {
+            s.count++;
+            // Room for one more group
+            if (s.count >= (s.flag ? 6 : 8)) {
+                break;
+            }
+            s.sub = V6_COLON;
+            s.hex = 0;
+            s.digits = 0;
+            s.value = 0;
+            return s;
+        }
+        if (c == '.') {
+            if (s.digits == OCTET_DEAD || (s.flag ? s.count > 4 : s.count != 6)) {
+                break;
+            }
+            rfc_state v4 = state_of(P_V4);
+            v4.count = 2;
+            return v4;
+        }
+        if (c == ']' && (s.flag ? s.count + 1 <= 6 : s.count + 1 == 8)) {
+            return state_of(P_LITERAL_END);
+        }
+        break;
+    }
+    return reject(EMAIL_BAD_ADDRESS_LITERAL);
+}
+
+static rfc_state step(rfc_state s, unsigned c) {
+    switch (s.part) {
+    case P_REJECT:
+        return s;
+
+    // Local-part = Dot-string / Quoted-string
+    case P_START:
+        if (EMAIL_IS_ATEXT(c)) {
+            return state_of(P_ATOM);
+        }
+        if (c == '"') {
+            return state_of(P_QUOTE);
+        }
+        if (c == '.') {
+            return reject(EMAIL_LOCAL_LEADING_DOT);
+        }
+        if (c == '@') {
+            return reject(EMAIL_EMPTY_LOCAL);
+        }
+        return reject(is_space(c) ? EMAIL_WHITESPACE : EMAIL_BAD_LOCAL_CHAR);
+    case P_ATOM:
+    case P_ATOM_DOT:
+        if (EMAIL_IS_ATEXT(c)) {
+            return state_of(P_ATOM);
+        }
+        if (c == '.') {
+            return s.part == P_ATOM_DOT ? reject(EMAIL_LOCAL_DOUBLE_DOT) : state_of(P_ATOM_DOT);
+        }
+        if (c == '@') {
+            return s.part == P_ATOM_DOT ? reject(EMAIL_LOCAL_TRAILING_DOT)
+                                        : state_of(P_DOMAIN_START);
+        }
+        return reject(is_space(c) ? EMAIL_WHITESPACE : EMAIL_BAD_LOCAL_CHAR);
+    case P_QUOTE:
+        if (c == '\\') {
+            return state_of(P_QUOTE_ESC);
+        }
+        if (c == '"') {
+            return state_of(P_QUOTE_END);
+        }
+        return c >= ' ' && c <= '~' ? s : reject(EMAIL_BAD_QUOTED_LOCAL);
+    case P_QUOTE_ESC:
+        return c >= ' ' && c <= '~' ? state_of(P_QUOTE) : reject(EMAIL_BAD_QUOTED_LOCAL);
+    case P_QUOTE_END:
+        return c == '@' ? state_of(P_DOMAIN_START) : reject(EMAIL_BAD_QUOTED_LOCAL);
+
+    // Domain = sub-domain *("." sub-domain), or an address literal
+    case P_DOMAIN_START:
+    case P_LABEL_DOT:
+        if (EMAIL_IS_ALNUM(c)) {
+            return label(1, false);
+        }
+        if (c == '[' && s.part == P_DOMAIN_START) {
+            return state_of(P_LITERAL);
+        }
+        if (c == '.' && s.part == P_LABEL_DOT) {
+            return reject(EMAIL_DOMAIN_DOUBLE_DOT);
+        }
+        if (c == '.' || c == '-') {
+            return reject(EMAIL_DOMAIN_BAD_START);
+        }
+        return bad_domain_char(c);
+    case P_LABEL:
+        if (EMAIL_IS_ALNUM(c) || c == '-') {
+            if (s.count == EMAIL_RFC_MAX_LABEL) {
+                return reject(EMAIL_LABEL_TOO_LONG);
+            }
+            return label(s.count + 1u, c == '-');
+        }
+        if (c == '.') {
+            return s.flag ? reject(EMAIL_DOMAIN_BAD_END) : state_of(P_LABEL_DOT);
+        }
+        return bad_domain_char(c);
+
+    // "[" (IPv4-address-literal / "IPv6:" IPv6-addr) "]"
+    case P_LITERAL:
+        if (is_digit(c)) {
+            rfc_state v4 = state_of(P_V4);
+            v4.count = 1;
+            octet_add(&v4, c);
+            return v4;
+        }
+        if (c == 'I' || c == 'i') {
+            rfc_state tag = state_of(P_TAG);
+            tag.count = 1;
+            return tag;
+        }
+        break;
+    case P_TAG: {
+        static const char tag[] = "ipv6:";
+        unsigned lower = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+        if (lower != (unsigned char)tag[s.count]) {
+            break;
+        }
+        if (s.count + 1u < sizeof(tag) - 1) {
+            s.count++;
+            return s;
+        }
+        rfc_state v6 = state_of(P_V6);
+        v6.sub = V6_START;
+        return v6;
+    }
+    case P_V4:
+        if (is_digit(c)) {
+            octet_add(&s, c);
+            if (s.digits == OCTET_DEAD) {
+                break;
+            }
+            return s;
+        }
+        if (c == '.' && s.digits > 0 && s.count < 4) {
+            s.count++;
+            s.digits = 0;
+            s.value = 0;
+            return s;
+        }
+        if (c == ']' && s.digits > 0 && s.count == 4) {
+            return state_of(P_LITERAL_END);
+        }
+        break;
+    case P_V6:
+        return step_v6(s, c);
+    case P_LITERAL_END:
+        return c == '@' ? reject(EMAIL_MULTIPLE_AT) : reject(EMAIL_BAD_ADDRESS_LITERAL);
+    }
+    return reject(EMAIL_BAD_ADDRESS_LITERAL);
+}
+
+// The verdict when the input ends in state s
+static email_reason finish(rfc_state s) {
+    switch (s.part) {
+    case P_REJECT:       return (email_reason)s.reason;
+    case P_START:        return EMAIL_TOO_SHORT;
+    case P_ATOM:
+    case P_ATOM_DOT:
+    case P_QUOTE_END:    return EMAIL_MISSING_AT;
+    case P_QUOTE:
+    case P_QUOTE_ESC:    return EMAIL_BAD_QUOTED_LOCAL;
+    case P_DOMAIN_START: return EMAIL_EMPTY_DOMAIN;
+    case P_LABEL:        return s.flag ? EMAIL_DOMAIN_BAD_END : EMAIL_VALID;
+    case P_LABEL_DOT:    return EMAIL_DOMAIN_BAD_END;
+    case P_LITERAL_END:  return EMAIL_VALID;
+    default:             return EMAIL_BAD_ADDRESS_LITERAL;
+    }
+}
+
+// ---- Subset enumeration ----
+
+typedef struct {
+    rfc_state* states;
+    uint32_t* next;       // 256 per state
+    size_t count;
+    size_t cap;
+    uint32_t* slots;      // open addressing over states, index + 1
+    size_t slot_mask;
+} rfc_nfa;
+
+static void* gen_alloc(size_t n, size_t size) {
+    void* p = calloc(n, size);
+    if (p == NULL) {
+        fprintf(stderr, "email_rfc_gen: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static uint64_t state_key(rfc_state s) {
+    uint64_t key;
+    memcpy(&key, &s, sizeof(key));
+    return key;
+}
+
+static uint32_t state_id(rfc_nfa* a, rfc_state s) {
+    uint64_t key = state_key(s);
+    size_t slot = (size_t)((key * 0x9E3779B97F4A7C15ull) >> 40) & a->slot_mask;
+    for (;; slot = (slot + 1) & a->slot_mask) {
+        uint32_t id = a->slots[slot];
+        if (id == 0) {
+            break;
+        }
+        if (state_key(a->states[id - 1]) == key) {
+            return id - 1;
+        }
+    }
+    if (a->count == a->cap || a->count * 2 > a->slot_mask) {
+        fprintf(stderr, "email_rfc_gen: more than %zu states\n", a->cap);
+        exit(1);
+    }
+    a->states[a->count] = s;
+    a->slots[slot] = (uint32_t)(a->count + 1);
+    return (uint32_t)a->count++;
+}
+
+// ---- Minimization ----
+
+// Splits blocks until every state of a block goes to the same blocks;
+// block[] holds the initial partition and receives the final one
+static size_t minimize(const rfc_nfa* a, const uint8_t* class_rep, size_t classes,
+                       uint32_t* block, size_t blocks) {
+    size_t n = a->count;
+    size_t sig_len = classes + 1;
+    uint32_t* sig = gen_alloc(n * sig_len, sizeof(uint32_t));
+    uint32_t* next_block = gen_alloc(n, sizeof(uint32_t));
+    size_t slot_mask = 1;
+    while (slot_mask < 2 * n) {
+        slot_mask = slot_mask * 2 + 1;
+    }
+    uint32_t* slots = gen_alloc(slot_mask + 1, sizeof(uint32_t));
+
+    for (;;) {
+        memset(slots, 0, (slot_mask + 1) * sizeof(uint32_t));
+        size_t found = 0;
+        for (size_t s = 0; s < n; s++) {
+            uint32_t* v = sig + s * sig_len;
+            uint64_t h = block[s];
+            v[0] = block[s];
+            for (size_t c = 0; c < classes; c++) {
+                v[c + 1] = block[a->next[s * 256 + class_rep[c]]];
+                h = (h ^ v[c + 1]) * 0x100000001B3ull;
+            }
+            size_t slot = (size_t)(h ^ (h >> 29)) & slot_mask;
+            for (;; slot = (slot + 1) & slot_mask) {
+                uint32_t rep = slots[slot];
+                if (rep == 0) {
+                    slots[slot] = (uint32_t)(s + 1);
+                    next_block[s] = (uint32_t)found++;
+                    break;
+                }
+                if (memcmp(sig + (rep - 1) * sig_len, v, sig_len * sizeof(uint32_t)) == 0) {
+                    next_block[s] = next_block[rep - 1];
+                    break;
+                }
+            }
+        }
+        memcpy(block, next_block, n * sizeof(uint32_t));
+        if (found == blocks) {
+            break;
+        }
+        blocks = found;
+    }
+    free(slots);
+    free(next_block);
+    free(sig);
+    return blocks;
+}
+
+// ---- Output ----
+
+static void emit_table(FILE* out, const char* decl, const unsigned* v, size_t n) {
+    fprintf(out, "%s = {", decl);
+    for (size_t i = 0; i < n; i++) {
+        fprintf(out, "%s%u,", i % 16 == 0 ? "\n   " : " ", v[i]);
+    }
+    fprintf(out, "\n};\n\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: email_rfc_gen OUTPUT\n");
+        return 2;
+    }
+
+    rfc_nfa a;
+    a.cap = 1u << 16;
+    a.slot_mask = (1u << 17) - 1;
+    a.states = gen_alloc(a.cap, sizeof(rfc_state));
+    a.next = gen_alloc(a.cap * 256, sizeof(uint32_t));
+    a.slots = gen_alloc(a.slot_mask + 1, sizeof(uint32_t));
+    a.count = 0;
+
+    // Breadth-first over everything reachable from the start
+    uint32_t start = state_id(&a, state_of(P_START));
+    for (size_t s = 0; s < a.count; s++) {
+        for (unsigned c = 0; c < 256; c++) {
+            a.next[s * 256 + c] = state_id(&a, step(a.states[s], c));
+        }
+    }
+
+    // Byte classes: bytes whose column is the same in every state
+    uint8_t byte_class[256];
+    uint8_t class_rep[256];
+    size_t classes = 0;
+    for (unsigned c = 0; c < 256; c++) {
+        size_t k = 0;
+        for (; k < classes; k++) {
+            size_t s = 0;
+            while (s < a.count && a.next[s * 256 + c] == a.next[s * 256 + class_rep[k]]) {
+                s++;
+            }
+            if (s == a.count) {
+                break;
+            }
+        }
+        if (k == classes) {
+            class_rep[classes++] = (uint8_t)c;
+        }
+        byte_class[c] = (uint8_t)k;
+    }
+
+    // Initial partition: one block per (final verdict, absorbing)
+    uint32_t* block = gen_alloc(a.count, sizeof(uint32_t));
+    for (size_t s = 0; s < a.count; s++) {
+        bool sink = a.states[s].part == P_REJECT;
+        block[s] = (uint32_t)finish(a.states[s]) * 2 + sink;
+    }
+    size_t blocks = minimize(&a, class_rep, classes, block, 0);
+
+    // Number the blocks: absorbing ones first (by reason), then the rest
+    // in the order the scan reaches them
+    uint32_t* number = gen_alloc(blocks, sizeof(uint32_t));
+    uint32_t* rep = gen_alloc(blocks, sizeof(uint32_t));
+    bool* seen = gen_alloc(blocks, sizeof(bool));
+    size_t states = 0;
+    for (unsigned r = 0; r < EMAIL_REASON_COUNT; r++) {
+        for (size_t s = 0; s < a.count; s++) {
+            if (a.states[s].part == P_REJECT && a.states[s].reason == r && !seen[block[s]]) {
+                seen[block[s]] = true;
+                rep[states] = (uint32_t)s;
+                number[block[s]] = (uint32_t)states++;
+            }
+        }
+    }
+    size_t sinks = states;
+    for (size_t s = 0; s < a.count; s++) {
+        if (!seen[block[s]]) {
+            seen[block[s]] = true;
+            rep[states] = (uint32_t)s;
+            number[block[s]] = (uint32_t)states++;
+        }
+    }
+    if (states * classes > UINT16_MAX) {
+        fprintf(stderr, "email_rfc_gen: %zu rows do not fit 16-bit offsets\n", states * classes);
+        return 1;
+    }
+
+    FILE* out = fopen(argv[1], "w");
+    if (out == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    fprintf(out, "// Generated by email_rfc_gen from src/email_rfc_gen.c; do not edit\n");
+    fprintf(out, "// %zu states (%zu before minimization), %zu byte classes\n\n", states, a.count,
+            classes);
+    fprintf(out, "#define EMAIL_RFC_STATES %zu\n", states);
+    fprintf(out, "#define EMAIL_RFC_CLASSES %zu\n", classes);
+    fprintf(out, "#define EMAIL_RFC_SINK_ROWS %zu  // rows below this reject for good\n",
+            sinks * classes);
+    fprintf(out, "#define EMAIL_RFC_START %zu\n\n", (size_t)number[block[start]] * classes);
+
+    unsigned* v = gen_alloc(states * classes > 256 ? states * classes : 256, sizeof(unsigned));
+    for (unsigned c = 0; c < 256; c++) {
+        v[c] = byte_class[c];
+    }
+    emit_table(out, "static const uint8_t email_rfc_class[256]", v, 256);
+    for (size_t i = 0; i < states; i++) {
+        for (size_t c = 0; c < classes; c++) {
+            uint32_t target = a.next[rep[i] * 256 + class_rep[c]];
+            v[i * classes + c] = (unsigned)(number[block[target]] * classes);
+        }
+    }
+    emit_table(out, "static const uint16_t email_rfc_next[EMAIL_RFC_STATES * EMAIL_RFC_CLASSES]",
+               v, states * classes);
+    for (size_t i = 0; i < states; i++) {
+        v[i] = (unsigned)finish(a.states[rep[i]]);
+    }
+    emit_table(out, "static const uint8_t email_rfc_final[EMAIL_RFC_STATES]", v, states);
+
+    free(v);
+    free(seen);
+    free(rep);
+    free(number);
+    free(block);
+    free(a.slots);
+    free(a.next);
+    free(a.states);
+    if (fclose(out) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    return 0;
+}
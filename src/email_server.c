@@ -0,0 +1,756 @@
+#define _GNU_SOURCE   // accept4()
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "email_internal.h"
+
+/*
+ * Validation service
+ *
+ * Each reactor thread owns an epoll instance, its listening socket and the
+ * connections it accepted; nothing is shared between reactors but the
+ * validator (and its domain cache) and the stop eventfd, which is never
+ * read, so once written every reactor sees it.
+ *
+ * Connections are edge-triggered: an event means "try again", and a
+ * connection is serviced until recv() or send() would block. Servicing
+ * is a loop of
+ *
+ *   answer  - every complete line in the input buffer, EMAIL_SERVER_BATCH
+ *             at a time through the batch validator, as long as the reply
+ *             buffer has room for the worst-case reply of each
+ *   flush   - send the replies; if the socket is full, stop here and let
+ *             EPOLLOUT resume, so a client that does not read its replies
+ *             is not read from either
+ *   read    - more input
+ *
+ * A connection that keeps the loop busy for EMAIL_SERVER_BUDGET reads is
+ * put on the reactor's ready list and resumed after the other events, so
+ * one fast client cannot starve the rest. Both buffers are fixed: a line
+ * that does not fit the input buffer is far over MAX_EMAIL_LENGTH anyway,
+ * and is skipped up to its newline and answered EMAIL_TOO_LONG.
+ *
+ * No address starts with "GET ", so a connection that does is taken for
+ * an HTTP scrape: it gets the metrics in the Prometheus text format, its
+ * write side is shut down and what else it sends is dropped until it
+ * closes, which an HTTP/1.0 client does once it has the response.
+ */
+#define EMAIL_SERVER_IN_BUFFER (64 * 1024)
+#define EMAIL_SERVER_OUT_BUFFER (256 * 1024)
+#define EMAIL_SERVER_BATCH 256
+#define EMAIL_SERVER_REPLY_MAX 64          // "ERR <longest reason> <offset>\n"
+#define EMAIL_SERVER_BUDGET 16
+#define EMAIL_SERVER_EVENTS 64
+#define EMAIL_SERVER_HTTP_HEADER 128       // room left before the metrics body
+
+typedef struct email_conn {
+    struct email_conn* prev;
+    struct email_conn* next;
+    struct email_conn* next_ready;
+    int fd;
+    bool eof;          // the peer will send no more
+    bool discarding;   // inside a line longer than the input buffer
+    bool ready;        // on the ready list
+    bool closed;       // closed while on the ready list, freed when it comes off
+    bool answered;     // at least one line was answered
+    bool http;         // a metrics scrape, see above
+    bool shut;         // its response is sent and the write side shut down
+    size_t in_used;
+    size_t out_used;
+    size_t out_sent;
+    char in[EMAIL_SERVER_IN_BUFFER];
+    char out[EMAIL_SERVER_OUT_BUFFER];
+} email_conn;
+
+typedef struct {
+    email_server* server;
+    pthread_t thread;
+    bool started;
+    int epfd;
+    int listen_fd;            // its own for TCP, the server's for a Unix socket
+    email_conn* conns;
+    email_conn* ready;
+    email_conn** ready_tail;
+
+    // Written by the reactor only, read by email_server_snapshot()
+    _Alignas(64) _Atomic uint64_t connections;
+    _Atomic uint64_t requests;
+    _Atomic uint64_t valid;
+    _Atomic uint64_t invalid;
+    _Atomic uint64_t bytes;
+} email_reactor;
+
+struct email_server {
+    email_validator validator;
+    int stop_fd;
+    int unix_fd;              // shared listening socket, -1 for TCP
+    char unix_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+    unsigned port;
+    unsigned reactor_count;
+    email_reactor* reactors;
+};
+
+static inline void email_server_add(_Atomic uint64_t* counter, uint64_t n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static void email_server_collect(const email_server* server, email_server_stats* out);
+
+// ---- Replies -------------------------------------------------------------------
+
+static size_t email_reply(char* out, email_reason reason, size_t offset) {
+    if (reason == EMAIL_VALID) {
+        memcpy(out, "OK\n", 3);
+        return 3;
+    }
+
+    const char* name = email_reason_name(reason);
+    size_t name_len = strlen(name);
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[n++] = (char)('0' + offset % 10);
+        offset /= 10;
+    } while (offset != 0);
+
+    char* p = out;
+    memcpy(p, "ERR ", 4);
+    p += 4;
+    memcpy(p, name, name_len);
+    p += name_len;
+    *p++ = ' ';
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+    *p++ = '\n';
+    return (size_t)(p - out);
+}
+
+// Writes the HTTP response of a metrics scrape into the reply buffer
+static void email_conn_metrics(email_reactor* r, email_conn* c) {
+    email_server_stats stats;
+    email_server_collect(r->server, &stats);
+
+    char* body = c->out + EMAIL_SERVER_HTTP_HEADER;
+    size_t cap = EMAIL_SERVER_OUT_BUFFER - EMAIL_SERVER_HTTP_HEADER;
+    int n = snprintf(body, cap,
+                     "# HELP email_server_connections_total Connections accepted\n"
+                     "# TYPE email_server_connections_total counter\n"
+                     "email_server_connections_total %llu\n"
+                     "# HELP email_server_requests_total Lines answered, by verdict\n"
+                     "# TYPE email_server_requests_total counter\n"
+                     "email_server_requests_total{verdict=\"valid\"} %llu\n"
+                     "email_server_requests_total{verdict=\"invalid\"} %llu\n"
+                     "# HELP email_server_received_bytes_total Bytes received\n"
+                     "# TYPE email_server_received_bytes_total counter\n"
+                     "email_server_received_bytes_total %llu\n"
+                     "# HELP email_server_reactors Event loop threads\n"
+                     "# TYPE email_server_reactors gauge\n"
+                     "email_server_reactors %u\n",
+                     (unsigned long long)stats.connections, (unsigned long long)stats.valid,
+                     (unsigned long long)stats.invalid, (unsigned long long)stats.bytes,
+                     stats.reactors);
+    size_t len = n > 0 ? (size_t)n : 0;
+
+    email_metrics m;
+    if (email_metrics_snapshot(&m)) {
+        size_t more = email_metrics_prometheus(&m, body + len, cap - len);
+        len += more < cap - len ? more : cap - len - 1;
+    }
+
+    char header[EMAIL_SERVER_HTTP_HEADER];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 200 OK\r\n"
+                              "Content-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %zu\r\n"
+                              "Connection: close\r\n\r\n",
+                              len);
+    memmove(c->out + header_len, body, len);
+    memcpy(c->out, header, (size_t)header_len);
+    c->out_used = (size_t)header_len + len;
+    c->out_sent = 0;
+}
+
+/*
+ * Answers the complete lines in the input buffer while the reply buffer
+ * has room, and moves what is left to the front. At end of input an
+ * unterminated last line counts as a line.
+ */
+static void email_conn_answer(email_reactor* r, email_conn* c) {
+    const email_server* s = r->server;
+    size_t pos = 0;
+
+    if (!c->answered && !c->http) {
+        size_t seen = c->in_used < 4 ? c->in_used : 4;
+        if (memcmp(c->in, "GET ", seen) == 0) {
+            if (seen < 4 && !c->eof) {
+                return;   // could still be a scrape
+            }
+            if (seen == 4) {
+                c->http = true;
+                email_conn_metrics(r, c);
+            }
+        }
+    }
+    if (c->http) {
+        c->in_used = 0;
+        return;
+    }
+
+    for (;;) {
+        size_t room = (EMAIL_SERVER_OUT_BUFFER - c->out_used) / EMAIL_SERVER_REPLY_MAX;
+        size_t max = room < EMAIL_SERVER_BATCH ? room : EMAIL_SERVER_BATCH;
+        const char* ptrs[EMAIL_SERVER_BATCH];
+        size_t lens[EMAIL_SERVER_BATCH];
+        uint8_t too_long[EMAIL_SERVER_BATCH / 8] = {0};
+        size_t n = 0;
+
+        while (n < max && pos < c->in_used) {
+            char* line = c->in + pos;
+            char* nl = memchr(line, '\n', c->in_used - pos);
+            if (nl == NULL && !c->eof) {
+                break;
+            }
+            size_t len = nl != NULL ? (size_t)(nl - line) : c->in_used - pos;
+            pos += len + (nl != NULL);
+            if (len > 0 && line[len - 1] == '\r') {
+                len--;
+            }
+            // The tail of a line too long to buffer is answered as too long
+            if (c->discarding) {
+                too_long[n / 8] |= (uint8_t)(1u << (n % 8));
+                len = 0;
+                c->discarding = false;
+            }
+            ptrs[n] = line;
+            lens[n] = len;
+            n++;
+        }
+        if (n == 0) {
+            break;
+        }
+
+        EMAIL_METRICS_START(start);
+        uint8_t bitmap[EMAIL_SERVER_BATCH / 8];
+        size_t valid = email_batch_validate(ptrs, lens, n, bitmap, &s->validator);
+
+        char* out = c->out + c->out_used;
+        for (size_t i = 0; i < n; i++) {
+            if (bitmap[i / 8] & (1u << (i % 8))) {
+                out += email_reply(out, EMAIL_VALID, 0);
+            } else if (too_long[i / 8] & (1u << (i % 8))) {
+                out += email_reply(out, EMAIL_TOO_LONG, s->validator.max_length);
+            } else {
+                size_t offset;
+                email_reason reason = s->validator.check(ptrs[i], lens[i], &offset);
+                out += email_reply(out, reason, offset);
+            }
+        }
+        c->out_used = (size_t)(out - c->out);
+        c->answered = true;
+        EMAIL_METRICS_STOP(EMAIL_METRICS_SERVER, start);
+
+        email_server_add(&r->requests, n);
+        email_server_add(&r->valid, valid);
+        email_server_add(&r->invalid, n - valid);
+    }
+
+    c->in_used -= pos;
+    memmove(c->in, c->in + pos, c->in_used);
+    if (c->in_used == EMAIL_SERVER_IN_BUFFER && memchr(c->in, '\n', c->in_used) == NULL) {
+        c->discarding = true;
+        c->in_used = 0;
+    }
+}
+
+// Sends pending replies; false when the connection is broken
+static bool email_conn_flush(email_conn* c, bool* blocked) {
+    *blocked = false;
+    while (c->out_sent < c->out_used) {
+        ssize_t n = send(c->fd, c->out + c->out_sent, c->out_used - c->out_sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            c->out_sent += (size_t)n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            *blocked = true;
+            return true;
+        } else {
+            return false;
+        }
+    }
+    c->out_used = c->out_sent = 0;
+    return true;
+}
+
+// ---- Connections ---------------------------------------------------------------
+
+static void email_conn_close(email_reactor* r, email_conn* c) {
+    close(c->fd);
+    if (c->prev != NULL) {
+        c->prev->next = c->next;
+    } else {
+        r->conns = c->next;
+    }
+    if (c->next != NULL) {
+        c->next->prev = c->prev;
+    }
+    if (c->ready) {
+        c->closed = true;
+    } else {
+        free(c);
+    }
+}
+
+static void email_conn_service(email_reactor* r, email_conn* c) {
+    for (int reads = 0;;) {
+        email_conn_answer(r, c);
+
+        bool blocked;
+        if (!email_conn_flush(c, &blocked)) {
+            email_conn_close(r, c);
+            return;
+        }
+        if (blocked) {
+            return;   // EPOLLOUT resumes
+        }
+        if (c->http && !c->shut) {
+            shutdown(c->fd, SHUT_WR);
+            c->shut = true;
+        }
+        if (c->eof) {
+            if (c->in_used == 0) {
+                email_conn_close(r, c);
+                return;
+            }
+            continue;
+        }
+        if (c->in_used == EMAIL_SERVER_IN_BUFFER) {
+            continue;   // replies were full; answer the rest first
+        }
+
+        if (reads == EMAIL_SERVER_BUDGET) {
+            if (!c->ready) {
+                c->ready = true;
+                c->next_ready = NULL;
+                *r->ready_tail = c;
+                r->ready_tail = &c->next_ready;
+            }
+            return;
+        }
+        ssize_t n = recv(c->fd, c->in + c->in_used, EMAIL_SERVER_IN_BUFFER - c->in_used, 0);
+        if (n > 0) {
+            c->in_used += (size_t)n;
+            email_server_add(&r->bytes, (uint64_t)n);
+            reads++;
+        } else if (n == 0) {
+            c->eof = true;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
+        } else if (errno != EINTR) {
+            email_conn_close(r, c);
+            return;
+        }
+    }
+}
+
+// Services the connections that used up their budget, as they were queued
+static void email_reactor_run_ready(email_reactor* r) {
+    email_conn* c = r->ready;
+    r->ready = NULL;
+    r->ready_tail = &r->ready;
+
+    while (c != NULL) {
+        email_conn* next = c->next_ready;
+        c->ready = false;
+        if (c->closed) {
+            free(c);
+        } else {
+            email_conn_service(r, c);
+        }
+        c = next;
+    }
+}
+
+static void email_reactor_accept(email_reactor* r) {
+    for (;;) {
+        int fd = accept4(r->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;   // EAGAIN: another reactor took it, or nothing left
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));   // fails on Unix sockets
+
+        email_conn* c = malloc(sizeof(*c));
+        if (c == NULL) {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->eof = c->discarding = c->ready = c->closed = false;
+        c->answered = c->http = c->shut = false;
+        c->in_used = c->out_used = c->out_sent = 0;
+        c->next_ready = NULL;
+
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+                                  .data.ptr = c };
+        if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            free(c);
+            continue;
+        }
+        c->prev = NULL;
+        c->next = r->conns;
+        if (r->conns != NULL) {
+            r->conns->prev = c;
+        }
+        r->conns = c;
+        email_server_add(&r->connections, 1);
+    }
+}
+
+static void* email_reactor_run(void* arg) {
+    email_reactor* r = arg;
+    struct epoll_event events[EMAIL_SERVER_EVENTS];
+
+    for (bool stop = false; !stop;) {
+        int n = epoll_wait(r->epfd, events, EMAIL_SERVER_EVENTS, r->ready != NULL ? 0 : -1);
+        if (n < 0 && errno != EINTR) {
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            void* tag = events[i].data.ptr;
+            if (tag == &r->server->stop_fd) {
+                stop = true;
+            } else if (tag == &r->listen_fd) {
+                email_reactor_accept(r);
+            } else {
+                email_conn_service(r, tag);
+            }
+        }
+        email_reactor_run_ready(r);
+    }
+
+    while (r->conns != NULL) {
+        email_conn_close(r, r->conns);
+    }
+    email_reactor_run_ready(r);   // frees the closed ones still queued
+    return NULL;
+}
+
+// ---- Server --------------------------------------------------------------------
+
+// Parses "host:port", ":port", "[v6]:port" or "unix:/path"
+static int email_server_address(const char* listen, struct sockaddr_storage* addr,
+                                socklen_t* addr_len) {
+    memset(addr, 0, sizeof(*addr));
+
+    if (strncmp(listen, "unix:", 5) == 0) {
+        struct sockaddr_un* un = (struct sockaddr_un*)addr;
+        size_t len = strlen(listen + 5);
+        if (len == 0 || len >= sizeof(un->sun_path)) {
+            return EINVAL;
+        }
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, listen + 5, len + 1);
+        *addr_len = (socklen_t)sizeof(*un);
+        return 0;
+    }
+
+    const char* colon = strrchr(listen, ':');
+    if (colon == NULL || colon[1] == '\0') {
+        return EINVAL;
+    }
+    char host[256];
+    size_t host_len = (size_t)(colon - listen);
+    if (host_len >= 2 && listen[0] == '[' && listen[host_len - 1] == ']') {
+        listen++;
+        host_len -= 2;
+    }
+    if (host_len >= sizeof(host)) {
+        return EINVAL;
+    }
+    memcpy(host, listen, host_len);
+    host[host_len] = '\0';
+
+    struct addrinfo hints = { .ai_flags = AI_PASSIVE | AI_NUMERICSERV,
+                              .ai_family = AF_UNSPEC,
+                              .ai_socktype = SOCK_STREAM };
+    struct addrinfo* found;
+    if (getaddrinfo(host_len > 0 ? host : NULL, colon + 1, &hints, &found) != 0) {
+        return EINVAL;
+    }
+    memcpy(addr, found->ai_addr, found->ai_addrlen);
+    *addr_len = found->ai_addrlen;
+    freeaddrinfo(found);
+    return 0;
+}
+
+static int email_server_listen(const struct sockaddr_storage* addr, socklen_t addr_len,
+                               bool reuseport) {
+    int fd = socket(addr->ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    if ((reuseport && (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+                       setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0)) ||
+        bind(fd, (const struct sockaddr*)addr, addr_len) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+static void email_server_set_port(struct sockaddr_storage* addr, unsigned port) {
+    if (addr->ss_family == AF_INET) {
+        ((struct sockaddr_in*)addr)->sin_port = htons((uint16_t)port);
+    } else if (addr->ss_family == AF_INET6) {
+        ((struct sockaddr_in6*)addr)->sin6_port = htons((uint16_t)port);
+    }
+}
+
+static unsigned email_server_get_port(int fd) {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd, (struct sockaddr*)&addr, &len) != 0) {
+        return 0;
+    }
+    if (addr.ss_family == AF_INET) {
+        return ntohs(((struct sockaddr_in*)&addr)->sin_port);
+    }
+    if (addr.ss_family == AF_INET6) {
+        return ntohs(((struct sockaddr_in6*)&addr)->sin6_port);
+    }
+    return 0;
+}
+
+// Joins the reactors that were started and releases everything
+static void email_server_free(email_server* s) {
+    if (s->stop_fd >= 0) {
+        uint64_t one = 1;
+        (void)!write(s->stop_fd, &one, sizeof(one));
+    }
+    for (unsigned i = 0; i < s->reactor_count; i++) {
+        email_reactor* r = &s->reactors[i];
+        if (r->started) {
+            pthread_join(r->thread, NULL);
+        }
+        if (r->epfd >= 0) {
+            close(r->epfd);
+        }
+        if (r->listen_fd >= 0 && r->listen_fd != s->unix_fd) {
+            close(r->listen_fd);
+        }
+    }
+    if (s->unix_fd >= 0) {
+        close(s->unix_fd);
+        unlink(s->unix_path);
+    }
+    if (s->stop_fd >= 0) {
+        close(s->stop_fd);
+    }
+    email_domain_cache_destroy(s->validator.cache);
+    free(s->reactors);
+    free(s);
+}
+
+static int email_reactor_init(email_server* s, email_reactor* r, int listen_fd) {
+    r->server = s;
+    r->listen_fd = listen_fd;
+    r->ready_tail = &r->ready;
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epfd < 0) {
+        return -1;
+    }
+
+    // A shared Unix listener wakes one reactor per connection
+    struct epoll_event lev = { .events = EPOLLIN | (listen_fd == s->unix_fd ? EPOLLEXCLUSIVE : 0),
+                               .data.ptr = &r->listen_fd };
+    struct epoll_event sev = { .events = EPOLLIN, .data.ptr = &s->stop_fd };
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, listen_fd, &lev) != 0 ||
+        epoll_ctl(r->epfd, EPOLL_CTL_ADD, s->stop_fd, &sev) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function: email_server_start
+ * Purpose: Binds the listening socket(s) and starts the reactor threads
+ *
+ * Parameters:
+ *   opts - where to listen and how to validate; listen must be set
+ *
+ * Returns:
+ *   the running server, or NULL with errno set
+ */
+email_server* email_server_start(const email_server_options* opts) {
+    if (opts == NULL || opts->listen == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int rc = email_server_address(opts->listen, &addr, &addr_len);
+    if (rc != 0) {
+        errno = rc;
+        return NULL;
+    }
+
+    unsigned count = opts->reactors;
+    if (count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        count = cpus > 0 ? (unsigned)cpus : 1;
+    }
+    if (count > EMAIL_MAX_THREADS) {
+        count = EMAIL_MAX_THREADS;
+    }
+
+    email_server* s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        return NULL;
+    }
+    s->stop_fd = s->unix_fd = -1;
+    email_validator_select(&s->validator, opts->strict, opts->utf8, opts->rfc);
+    s->reactors = aligned_alloc(64, sizeof(*s->reactors) * count);
+    if (s->reactors == NULL) {
+        free(s);
+        errno = ENOMEM;
+        return NULL;
+    }
+    for (unsigned i = 0; i < count; i++) {
+        email_reactor* r = &s->reactors[i];
+        memset(r, 0, sizeof(*r));
+        r->epfd = r->listen_fd = -1;
+    }
+    s->reactor_count = count;
+
+    int saved = ENOMEM;
+    if (opts->domain_cache && !opts->utf8 && !opts->rfc &&
+        (s->validator.cache = email_domain_cache_create()) == NULL) {
+        goto fail;
+    }
+    s->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (s->stop_fd < 0) {
+        saved = errno;
+        goto fail;
+    }
+
+    if (addr.ss_family == AF_UNIX) {
+        s->unix_fd = email_server_listen(&addr, addr_len, false);
+        if (s->unix_fd < 0) {
+            saved = errno;
+            goto fail;
+        }
+        strcpy(s->unix_path, ((struct sockaddr_un*)&addr)->sun_path);
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        email_reactor* r = &s->reactors[i];
+        int fd = s->unix_fd;
+        if (fd < 0) {
+            // The first bind picks the port when 0 was asked for; the
+            // others join it
+            fd = email_server_listen(&addr, addr_len, true);
+            if (fd >= 0 && i == 0) {
+                s->port = email_server_get_port(fd);
+                email_server_set_port(&addr, s->port);
+            }
+        }
+        if (fd < 0) {
+            saved = errno;
+            goto fail;
+        }
+        if (email_reactor_init(s, r, fd) != 0) {
+            saved = errno;
+            goto fail;
+        }
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        email_reactor* r = &s->reactors[i];
+        rc = pthread_create(&r->thread, NULL, email_reactor_run, r);
+        if (rc != 0) {
+            saved = rc;
+            goto fail;
+        }
+        r->started = true;
+        if (opts->pin) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % CPU_SETSIZE, &cpus);
+            pthread_setaffinity_np(r->thread, sizeof(cpus), &cpus);
+        }
+    }
+    return s;
+
+fail:
+    email_server_free(s);
+    errno = saved;
+    return NULL;
+}
+
+/**
+ * Function: email_server_stop
+ * Purpose: Stops the reactors and frees the server; NULL is ignored
+ */
+void email_server_stop(email_server* server) {
+    if (server != NULL) {
+        email_server_free(server);
+    }
+}
+
+/**
+ * Function: email_server_port
+ * Purpose: Returns the TCP port the server listens on, 0 for a Unix socket
+ */
+unsigned email_server_port(const email_server* server) {
+    return server->port;
+}
+
+/**
+ * Function: email_server_snapshot
+ * Purpose: Copies the counters summed over all reactors into *out
+ */
+void email_server_snapshot(email_server* server, email_server_stats* out) {
+    email_server_collect(server, out);
+}
+
+static void email_server_collect(const email_server* server, email_server_stats* out) {
+    memset(out, 0, sizeof(*out));
+    out->reactors = server->reactor_count;
+    for (unsigned i = 0; i < server->reactor_count; i++) {
+        email_reactor* r = &server->reactors[i];
+        out->connections += atomic_load_explicit(&r->connections, memory_order_relaxed);
+        out->requests += atomic_load_explicit(&r->requests, memory_order_relaxed);
+        out->valid += atomic_load_explicit(&r->valid, memory_order_relaxed);
+        out->invalid += atomic_load_explicit(&r->invalid, memory_order_relaxed);
+        out->bytes += atomic_load_explicit(&r->bytes, memory_order_relaxed);
+    }
+}
@@ -0,0 +1,420 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// SIMD kernels available to is_valid_email_simd(); AVX2 is chosen at run time
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define EMAIL_HAVE_SSE2 1
+#if defined(__GNUC__)
+#define EMAIL_HAVE_AVX2 1
+#endif
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define EMAIL_HAVE_NEON 1
+#endif
+
+#include "email_internal.h"
+
+/*
+ * Vectorized validation
+ *
+ * The SIMD kernels classify 16 (SSE2, NEON) or 32 (AVX2) bytes at a time
+ * and turn the address into five bitmasks, one bit per byte: '@', '.', '-'
+ * and "not allowed in the local part" / "not allowed in the domain". Every
+ * rule of the validator is then a handful of bit operations on those masks,
+ * with no per-byte branches. MAX_EMAIL_LENGTH bytes fit in four 64-bit words.
+ */
+#if defined(EMAIL_HAVE_SSE2) || defined(EMAIL_HAVE_NEON)
+#define EMAIL_MASK_WORDS ((MAX_EMAIL_LENGTH + 63) / 64)
+
+typedef struct {
+    uint64_t at[EMAIL_MASK_WORDS];
+    uint64_t dot[EMAIL_MASK_WORDS];
+    uint64_t hyphen[EMAIL_MASK_WORDS];
+    uint64_t bad_local[EMAIL_MASK_WORDS];
+    uint64_t bad_domain[EMAIL_MASK_WORDS];
+} email_masks;
+
+// Bits lo..hi-1 of mask word k (lo < hi, both absolute byte positions)
+static inline uint64_t email_word_range(size_t k, size_t lo, size_t hi) {
+    size_t base = k * 64;
+    if (hi <= base || lo >= base + 64) {
+        return 0;
+    }
+    uint64_t m = ~(uint64_t)0;
+    if (lo > base) {
+        m &= ~(uint64_t)0 << (lo - base);
+    }
+    if (hi < base + 64) {
+        m &= ~(~(uint64_t)0 << (hi - base));
+    }
+    return m;
+}
+
+static inline bool email_mask_bit(const uint64_t* w, size_t i) {
+    return (w[i / 64] >> (i % 64)) & 1;
+}
+
+/**
+ * Function: email_check_masks
+ * Purpose: Applies the validation rules to the bitmasks of an address
+ *
+ * Parameters:
+ *   m   - masks produced by one of the classify kernels
+ *   len - length of the address, MIN_EMAIL_LENGTH..MAX_EMAIL_LENGTH
+ *
+ * Bits past len are cleared in the '@', '.' and '-' masks by the kernels
+ * but may be set in the "bad" masks, so those two are only ever looked at
+ * through a range mask.
+ */
+static bool email_check_masks(const email_masks* m, size_t len) {
+    size_t words = (len + 63) / 64;
+    size_t at_count = 0;
+    size_t at_pos = 0;
+    size_t last_dot_pos = 0;
+
+    // Must have exactly one '@' symbol; remember where it is
+    for (size_t k = 0; k < words; k++) {
+        if (m->at[k] != 0 && at_count == 0) {
+            at_pos = k * 64 + (size_t)__builtin_ctzll(m->at[k]);
+        }
+        at_count += (size_t)__builtin_popcountll(m->at[k]);
+    }
+    if (at_count != 1 || at_pos == 0 || at_pos >= len - 1) {
+        return false;
+    }
+
+    uint64_t bad = 0;
+    for (size_t k = 0; k < words; k++) {
+        // Disallowed characters on either side of the '@'
+        bad |= m->bad_local[k] & email_word_range(k, 0, at_pos);
+        bad |= m->bad_domain[k] & email_word_range(k, at_pos + 1, len);
+
+        // Two dots in a row anywhere ('@' sits between the two parts)
+        uint64_t next = m->dot[k] >> 1;
+        if (k + 1 < words) {
+            next |= m->dot[k + 1] << 63;
+        }
+        bad |= m->dot[k] & next;
+
+        // Highest dot overall; it is in the domain if it is past the '@'
+        if (m->dot[k] != 0) {
+            last_dot_pos = k * 64 + 63 - (size_t)__builtin_clzll(m->dot[k]);
+        }
+    }
+    if (bad != 0) {
+        return false;
+    }
+
+    // Local part cannot start or end with '.'
+    if (email_mask_bit(m->dot, 0) || email_mask_bit(m->dot, at_pos - 1)) {
+        return false;
+    }
+
+    // Domain cannot start or end with '.' or '-'
+    if (email_mask_bit(m->dot, at_pos + 1) || email_mask_bit(m->hyphen, at_pos + 1) ||
+        email_mask_bit(m->dot, len - 1) || email_mask_bit(m->hyphen, len - 1)) {
+        return false;
+    }
+
+    // Domain must have at least one dot and a TLD of at least
+    // EMAIL_MIN_TLD_LENGTH characters
+    if (last_dot_pos <= at_pos || len - last_dot_pos - 1 < EMAIL_MIN_TLD_LENGTH) {
+        return false;
+    }
+
+    return true;
+}
+
+// Stores a 16- or 32-bit block mask at byte offset i of a mask array
+static inline void email_put_mask(uint64_t* w, size_t i, uint64_t bits) {
+    w[i / 64] |= bits << (i % 64);
+}
+
+/*
+ * The last block of an address is usually partial and is loaded whole when
+ * email_block_in_page() allows it (see email_internal.h). The bytes past
+ * len are garbage and are masked off with email_block_valid().
+ */
+// Bits for the bytes of a block that are inside the address
+static inline uint64_t email_block_valid(size_t remaining, size_t block) {
+    return remaining >= block ? (~(uint64_t)0 >> (64 - block))
+                              : ~(~(uint64_t)0 << remaining);
+}
+
+// Only the words covering len bytes are ever read
+static inline void email_clear_masks(email_masks* m, size_t len) {
+    for (size_t k = 0; k < (len + 63) / 64; k++) {
+        m->at[k] = m->dot[k] = m->hyphen[k] = 0;
+        m->bad_local[k] = m->bad_domain[k] = 0;
+    }
+}
+
+#if defined(EMAIL_HAVE_SSE2)
+// Lanes where the unsigned byte x - lo is <= n, i.e. lo <= x <= lo + n
+static inline __m128i email_in_range_sse2(__m128i x, char lo, char n) {
+    __m128i t = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(n)), t);
+}
+
+EMAIL_NO_SANITIZE_ADDRESS
+static void email_classify_sse2(const char* p, size_t len, email_masks* m) {
+    email_clear_masks(m, len);
+
+    for (size_t i = 0; i < len; i += 16) {
+        __m128i x;
+        if (len - i >= 16 || email_block_in_page(p + i, 16)) {
+            x = _mm_loadu_si128((const __m128i*)(p + i));
+        } else {
+            char tail[16] = { 0 };
+            memcpy(tail, p + i, len - i);
+            x = _mm_loadu_si128((const __m128i*)tail);
+        }
+        uint64_t valid = email_block_valid(len - i, 16);
+
+        __m128i alnum = _mm_or_si128(
+            email_in_range_sse2(x, '0', 9),
+            email_in_range_sse2(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 25));
+        __m128i at = _mm_cmpeq_epi8(x, _mm_set1_epi8('@'));
+        __m128i dot = _mm_cmpeq_epi8(x, _mm_set1_epi8('.'));
+        __m128i hyphen = _mm_cmpeq_epi8(x, _mm_set1_epi8('-'));
+        __m128i domain = _mm_or_si128(alnum, _mm_or_si128(dot, hyphen));
+        __m128i local = _mm_or_si128(domain, _mm_or_si128(
+            _mm_cmpeq_epi8(x, _mm_set1_epi8('_')),
+            _mm_cmpeq_epi8(x, _mm_set1_epi8('+'))));
+
+        email_put_mask(m->at, i, (uint16_t)_mm_movemask_epi8(at) & valid);
+        email_put_mask(m->dot, i, (uint16_t)_mm_movemask_epi8(dot) & valid);
+        email_put_mask(m->hyphen, i, (uint16_t)_mm_movemask_epi8(hyphen) & valid);
+        email_put_mask(m->bad_local, i, (uint16_t)~_mm_movemask_epi8(local));
+        email_put_mask(m->bad_domain, i, (uint16_t)~_mm_movemask_epi8(domain));
+    }
+}
+#endif
+
+#if defined(EMAIL_HAVE_AVX2)
+__attribute__((target("avx2")))
+static inline __m256i email_in_range_avx2(__m256i x, char lo, char n) {
+    __m256i t = _mm256_sub_epi8(x, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(n)), t);
+}
+
+__attribute__((target("avx2"))) EMAIL_NO_SANITIZE_ADDRESS
+static void email_classify_avx2(const char* p, size_t len, email_masks* m) {
+    email_clear_masks(m, len);
+
+    for (size_t i = 0; i < len; i += 32) {
+        __m256i x;
+        if (len - i >= 32 || email_block_in_page(p + i, 32)) {
+            x = _mm256_loadu_si256((const __m256i*)(p + i));
+        } else {
+            char tail[32] = { 0 };
+            memcpy(tail, p + i, len - i);
+            x = _mm256_loadu_si256((const __m256i*)tail);
+        }
+        uint64_t valid = email_block_valid(len - i, 32);
+
+        __m256i alnum = _mm256_or_si256(
+            email_in_range_avx2(x, '0', 9),
+            email_in_range_avx2(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 25));
+        __m256i at = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('@'));
+        __m256i dot = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('.'));
+        __m256i hyphen = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('-'));
+        __m256i domain = _mm256_or_si256(alnum, _mm256_or_si256(dot, hyphen));
+        __m256i local = _mm256_or_si256(domain, _mm256_or_si256(
+            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')),
+            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('+'))));
+
+        email_put_mask(m->at, i, (uint32_t)_mm256_movemask_epi8(at) & valid);
+        email_put_mask(m->dot, i, (uint32_t)_mm256_movemask_epi8(dot) & valid);
+        email_put_mask(m->hyphen, i, (uint32_t)_mm256_movemask_epi8(hyphen) & valid);
+        email_put_mask(m->bad_local, i, (uint32_t)~_mm256_movemask_epi8(local));
+        email_put_mask(m->bad_domain, i, (uint32_t)~_mm256_movemask_epi8(domain));
+    }
+}
+#endif
+
+#if defined(EMAIL_HAVE_NEON)
+static inline uint8x16_t email_in_range_neon(uint8x16_t x, uint8_t lo, uint8_t n) {
+    return vcleq_u8(vsubq_u8(x, vdupq_n_u8(lo)), vdupq_n_u8(n));
+}
+
+// NEON has no movemask: weight each lane by its bit and add up each half
+static inline uint16_t email_movemask_neon(uint8x16_t v) {
+    static const uint8_t weights[16] = {
+        1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+    };
+    uint8x16_t bits = vandq_u8(v, vld1q_u8(weights));
+    return (uint16_t)(vaddv_u8(vget_low_u8(bits)) |
+                      (vaddv_u8(vget_high_u8(bits)) << 8));
+}
+
+EMAIL_NO_SANITIZE_ADDRESS
+static void email_classify_neon(const char* p, size_t len, email_masks* m) {
+    email_clear_masks(m, len);
+
+    for (size_t i = 0; i < len; i += 16) {
+        uint8x16_t x;
+        if (len - i >= 16 || email_block_in_page(p + i, 16)) {
+            x = vld1q_u8((const uint8_t*)(p + i));
+        } else {
+            uint8_t tail[16] = { 0 };
+            memcpy(tail, p + i, len - i);
+            x = vld1q_u8(tail);
+        }
+        uint64_t valid = email_block_valid(len - i, 16);
+
+        uint8x16_t alnum = vorrq_u8(
+            email_in_range_neon(x, '0', 9),
+            email_in_range_neon(vorrq_u8(x, vdupq_n_u8(0x20)), 'a', 25));
+        uint8x16_t at = vceqq_u8(x, vdupq_n_u8('@'));
+        uint8x16_t dot = vceqq_u8(x, vdupq_n_u8('.'));
+        uint8x16_t hyphen = vceqq_u8(x, vdupq_n_u8('-'));
+        uint8x16_t domain = vorrq_u8(alnum, vorrq_u8(dot, hyphen));
+        uint8x16_t local = vorrq_u8(domain, vorrq_u8(
+            vceqq_u8(x, vdupq_n_u8('_')), vceqq_u8(x, vdupq_n_u8('+'))));
+
+        email_put_mask(m->at, i, email_movemask_neon(at) & valid);
+        email_put_mask(m->dot, i, email_movemask_neon(dot) & valid);
+        email_put_mask(m->hyphen, i, email_movemask_neon(hyphen) & valid);
+        email_put_mask(m->bad_local, i, (uint16_t)~email_movemask_neon(local));
+        email_put_mask(m->bad_domain, i, (uint16_t)~email_movemask_neon(domain));
+    }
+}
+#endif
+#endif  // EMAIL_HAVE_SSE2 || EMAIL_HAVE_NEON
+
+// Defines name(), which counts its verdicts, and name_uncounted()
+#define EMAIL_SIMD_VALIDATOR(name, classify)                                \
+    static inline bool name##_run(const char* p, size_t len,                \
+                                  email_reject_stage* stage) {              \
+        *stage = email_precheck(p, len);                                    \
+        if (*stage != EMAIL_STAGE_PASSED) {                                 \
+            return false;                                                   \
+        }                                                                   \
+        email_masks m;                                                      \
+        classify(p, len, &m);                                               \
+        bool valid = email_check_masks(&m, len);                            \
+        if (!valid) {                                                       \
+            *stage = EMAIL_STAGE_FULL_SCAN;                                 \
+        }                                                                   \
+        return valid;                                                       \
+    }                                                                       \
+    static bool name(const char* p, size_t len) {                           \
+        email_reject_stage stage;                                           \
+        bool valid = name##_run(p, len, &stage);                            \
+        EMAIL_PROFILE_VERDICT(stage, valid, p, len);                        \
+        EMAIL_METRICS_VERDICT(valid, p, len, email_check);                  \
+        return valid;                                                       \
+    }                                                                       \
+    static bool name##_uncounted(const char* p, size_t len) {               \
+        email_reject_stage stage;                                           \
+        return name##_run(p, len, &stage);                                  \
+    }
+
+#if defined(EMAIL_HAVE_SSE2)
+EMAIL_SIMD_VALIDATOR(email_validate_sse2, email_classify_sse2)
+#endif
+#if defined(EMAIL_HAVE_AVX2)
+EMAIL_SIMD_VALIDATOR(email_validate_avx2, email_classify_avx2)
+#endif
+#if defined(EMAIL_HAVE_NEON)
+EMAIL_SIMD_VALIDATOR(email_validate_neon, email_classify_neon)
+#endif
+
+/**
+ * Function: email_is_ascii
+ * Purpose: Tells whether p[0..len) is all ASCII, i.e. has no byte >= 0x80
+ *
+ * The bytes are ORed together 16 at a time and the sign bits tested once
+ * at the end, so an ASCII address costs a handful of instructions; the
+ * rest, and targets without SSE2 or NEON, go eight bytes at a time, the
+ * last few in one email_load_word().
+ */
+bool email_is_ascii(const char* p, size_t len) {
+    size_t i = 0;
+#if defined(EMAIL_HAVE_SSE2)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16) {
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i*)(p + i)));
+    }
+    if (_mm_movemask_epi8(acc) != 0) {
+        return false;
+    }
+#elif defined(EMAIL_HAVE_NEON)
+    uint8x16_t acc = vdupq_n_u8(0);
+    for (; i + 16 <= len; i += 16) {
+        acc = vorrq_u8(acc, vld1q_u8((const uint8_t*)p + i));
+    }
+    if (vmaxvq_u8(acc) >= 0x80) {
+        return false;
+    }
+#endif
+    uint64_t bits = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        bits |= w;
+    }
+    if (i < len) {
+        bits |= email_load_word(p + i, len - i);
+    }
+    return (bits & 0x8080808080808080ull) == 0;
+}
+
+/**
+ * Function: email_select_kernel
+ * Purpose: Picks the fastest validator for the running CPU
+ *
+ * AVX2 when the CPU reports it, SSE2 on every other x86-64 CPU, NEON on
+ * aarch64, and is_valid_email_n() anywhere else.
+ */
+email_kernel_fn email_select_kernel(void) {
+#if defined(EMAIL_HAVE_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        return email_validate_avx2;
+    }
+#endif
+#if defined(EMAIL_HAVE_SSE2)
+    return email_validate_sse2;
+#elif defined(EMAIL_HAVE_NEON)
+    return email_validate_neon;
+#else
+    return is_valid_email_n;
+#endif
+}
+
+// email_select_kernel()'s choice, without counting verdicts
+email_kernel_fn email_select_uncounted_kernel(void) {
+#if defined(EMAIL_HAVE_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        return email_validate_avx2_uncounted;
+    }
+#endif
+#if defined(EMAIL_HAVE_SSE2)
+    return email_validate_sse2_uncounted;
+#elif defined(EMAIL_HAVE_NEON)
+    return email_validate_neon_uncounted;
+#else
+    return email_valid_uncounted;
+#endif
+}
+
+/**
+ * Function: is_valid_email_simd
+ * Purpose: Validates p[0..len) with the vectorized kernels
+ *
+ * Parameters:
+ *   p   - pointer to the first byte of the address (need not be NUL-terminated)
+ *   len - number of bytes in the address
+ *
+ * Returns:
+ *   true if email is valid, false otherwise
+ *
+ * The kernel is picked at run time by email_select_kernel().
+ */
+bool is_valid_email_simd(const char* p, size_t len) {
+    return email_select_kernel()(p, len);
+}
@@ -0,0 +1,704 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "email_internal.h"
+
+/*
+ * Address store
+ *
+ * Addresses live in two parallel arrays indexed by address id: the
+ * offset of the local part in the local arena, and the id of the domain.
+ * The arena holds each local part as one length byte and the bytes; a
+ * valid local part is at most MAX_EMAIL_LENGTH - 2 bytes, so the byte
+ * always suffices. Domains are the same one level down: an offset array
+ * indexed by domain id into a text arena of length-prefixed, lowercased
+ * domains.
+ *
+ * Both hash tables are open addressing with linear probing over 64-bit
+ * slots: 0 while empty, otherwise the top 32 bits of the hash and the id
+ * plus one. The tag rejects almost every mismatch without touching the
+ * arenas. A domain hashes its text; an address hashes its local part
+ * seeded with its domain id, so the same local part at two domains lands
+ * in two places. Tables double when three quarters full and are rebuilt
+ * from the arrays; the arrays and arenas double when they run out.
+ *
+ * Nothing here depends on where the memory is, so email_store_save()
+ * writes every array as it is and email_store_open() points the same
+ * fields into a read-only mapping of the file.
+ */
+#define EMAIL_STORE_MIN_SLOTS 16
+#define EMAIL_STORE_MAX_IDS (UINT32_MAX - 1)
+#define EMAIL_STORE_MAGIC "EMSTORE"
+#define EMAIL_STORE_VERSION 1
+#define EMAIL_STORE_BYTE_ORDER 0x01020304u
+
+struct email_store {
+    // Addresses, by id
+    uint64_t* local_at;         // offset of the local part in local
+    uint32_t* domain_of;
+    size_t count;
+    size_t cap;
+    uint64_t* slots;
+    size_t mask;                // slot count - 1
+    char* local;
+    size_t local_used;
+    size_t local_cap;
+
+    // Domains, by id
+    uint64_t* domain_at;        // offset of the domain in domain_text
+    size_t domains;
+    size_t domain_cap;
+    uint64_t* domain_slots;
+    size_t domain_mask;
+    char* domain_text;
+    size_t domain_used;
+    size_t domain_text_cap;
+
+    // The file, when the store came from email_store_open()
+    void* map;
+    size_t map_size;
+};
+
+// The file header; the arrays follow in the order of email_store_layout()
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;        // EMAIL_STORE_BYTE_ORDER as the writer stored it
+    uint64_t addresses;
+    uint64_t domains;
+    uint64_t slots;
+    uint64_t domain_slots;
+    uint64_t local_bytes;
+    uint64_t domain_bytes;
+} email_store_header;
+
+// Sections of the file, in order
+enum {
+    EMAIL_SECTION_LOCAL_AT,
+    EMAIL_SECTION_DOMAIN_OF,
+    EMAIL_SECTION_SLOTS,
+    EMAIL_SECTION_DOMAIN_AT,
+    EMAIL_SECTION_DOMAIN_SLOTS,
+    EMAIL_SECTION_DOMAIN_TEXT,
+    EMAIL_SECTION_LOCAL,
+    EMAIL_SECTION_COUNT
+};
+
+static uint64_t email_store_hash(const char* p, size_t len, uint64_t seed) {
+    uint64_t h = (seed << 8 | len) * 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < len; i += 8) {
+        h = (h ^ email_load_word(p + i, len - i)) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 29;
+    }
+    return h * 0xBF58476D1CE4E5B9ull;
+}
+
+static inline uint64_t email_store_slot(uint64_t h, size_t id) {
+    return (h >> 32 << 32) | (uint64_t)(id + 1);
+}
+
+static void email_store_lower(const char* p, size_t len, char* out) {
+    for (size_t i = 0; i < len; i++) {
+        char c = p[i];
+        out[i] = c >= 'A' && c <= 'Z' ? (char)(c | 0x20) : c;
+    }
+}
+
+// The hash of entry id of either table, for rebuilding it
+static uint64_t email_store_address_hash(const email_store* s, size_t id) {
+    const char* local = s->local + s->local_at[id];
+    return email_store_hash(local + 1, (unsigned char)local[0], s->domain_of[id]);
+}
+
+static uint64_t email_store_domain_hash(const email_store* s, size_t id) {
+    const char* text = s->domain_text + s->domain_at[id];
+    return email_store_hash(text + 1, (unsigned char)text[0], 0);
+}
+
+// ---- Growth ----
+
+// Makes *buf at least need bytes, doubling from *cap
+static bool email_store_reserve(void** buf, size_t* cap, size_t need) {
+    if (need <= *cap) {
+        return true;
+    }
+    size_t n = *cap > 0 ? *cap : 64;
+    while (n < need) {
+        if (n > SIZE_MAX / 2) {
+            return false;
+        }
+        n *= 2;
+    }
+    void* p = realloc(*buf, n);
+    if (p == NULL) {
+        return false;
+    }
+    *buf = p;
+    *cap = n;
+    return true;
+}
+
+// True when one more entry would fill a table past three quarters
+static inline bool email_store_crowded(size_t count, size_t mask) {
+    return (count + 1) * 4 > (mask + 1) * 3;
+}
+
+// Rebuilds a table of count entries with twice the slots
+static bool email_store_rehash(email_store* s, uint64_t** slots, size_t* mask, size_t count,
+                               uint64_t (*hash)(const email_store*, size_t)) {
+    size_t n = (*mask + 1) * 2;
+    uint64_t* table = calloc(n, sizeof(*table));
+    if (table == NULL) {
+        return false;
+    }
+    for (size_t id = 0; id < count; id++) {
+        uint64_t h = hash(s, id);
+        size_t i = (size_t)h & (n - 1);
+        while (table[i] != 0) {
+            i = (i + 1) & (n - 1);
+        }
+        table[i] = email_store_slot(h, id);
+    }
+    free(*slots);
+    *slots = table;
+    *mask = n - 1;
+    return true;
+}
+
+// ---- Lookup ----
+
+/*
+ * Finds the domain text[0..len) (lowercased) with hash h: returns true
+ * with its id in *id, or false with the empty slot it would go in
+ * in *slot
+ */
+static bool email_store_find_domain(const email_store* s, const char* text, size_t len,
+                                    uint64_t h, uint32_t* id, size_t* slot) {
+    uint64_t tag = h >> 32;
+    for (size_t i = (size_t)h & s->domain_mask;; i = (i + 1) & s->domain_mask) {
+        uint64_t v = s->domain_slots[i];
+        if (v == 0) {
+            *slot = i;
+            return false;
+        }
+        if (v >> 32 == tag) {
+            uint32_t d = (uint32_t)v - 1;
+            const char* entry = s->domain_text + s->domain_at[d];
+            if ((unsigned char)entry[0] == len && memcmp(entry + 1, text, len) == 0) {
+                *id = d;
+                return true;
+            }
+        }
+    }
+}
+
+// The same for the local part local[0..len) at domain id domain
+static bool email_store_find_address(const email_store* s, const char* local, size_t len,
+                                     uint32_t domain, uint64_t h, uint32_t* id, size_t* slot) {
+    uint64_t tag = h >> 32;
+    for (size_t i = (size_t)h & s->mask;; i = (i + 1) & s->mask) {
+        uint64_t v = s->slots[i];
+        if (v == 0) {
+            *slot = i;
+            return false;
+        }
+        if (v >> 32 == tag) {
+            uint32_t a = (uint32_t)v - 1;
+            const char* entry = s->local + s->local_at[a];
+            if (s->domain_of[a] == domain && (unsigned char)entry[0] == len &&
+                memcmp(entry + 1, local, len) == 0) {
+                *id = a;
+                return true;
+            }
+        }
+    }
+}
+
+// ---- Building ----
+
+// Makes room for cap addresses in the parallel arrays
+static bool email_store_grow_addresses(email_store* s, size_t cap) {
+    uint64_t* local_at = realloc(s->local_at, cap * sizeof(*local_at));
+    if (local_at == NULL) {
+        return false;
+    }
+    s->local_at = local_at;
+    uint32_t* domain_of = realloc(s->domain_of, cap * sizeof(*domain_of));
+    if (domain_of == NULL) {
+        return false;
+    }
+    s->domain_of = domain_of;
+    s->cap = cap;
+    return true;
+}
+
+/**
+ * Function: email_store_create
+ * Purpose: Allocates an empty store
+ *
+ * Parameters:
+ *   expected_addresses - addresses to size the tables for up front, 0
+ *                        for a small start
+ *
+ * Returns:
+ *   the store, or NULL when out of memory
+ */
+email_store* email_store_create(size_t expected_addresses) {
+    email_store* s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        return NULL;
+    }
+    if (expected_addresses > EMAIL_STORE_MAX_IDS) {
+        expected_addresses = EMAIL_STORE_MAX_IDS;
+    }
+    size_t slots = EMAIL_STORE_MIN_SLOTS;
+    while (slots / 4 * 3 < expected_addresses) {
+        slots *= 2;
+    }
+    s->slots = calloc(slots, sizeof(*s->slots));
+    s->domain_slots = calloc(EMAIL_STORE_MIN_SLOTS, sizeof(*s->domain_slots));
+    if (s->slots == NULL || s->domain_slots == NULL ||
+        (expected_addresses > 0 && !email_store_grow_addresses(s, expected_addresses))) {
+        email_store_destroy(s);
+        return NULL;
+    }
+    s->mask = slots - 1;
+    s->domain_mask = EMAIL_STORE_MIN_SLOTS - 1;
+    return s;
+}
+
+/**
+ * Function: email_store_destroy
+ * Purpose: Frees a store, or unmaps one from email_store_open(); NULL is
+ *          ignored
+ */
+void email_store_destroy(email_store* store) {
+    if (store == NULL) {
+        return;
+    }
+    if (store->map != NULL) {
+        munmap(store->map, store->map_size);
+    } else {
+        free(store->local_at);
+        free(store->domain_of);
+        free(store->slots);
+        free(store->local);
+        free(store->domain_at);
+        free(store->domain_slots);
+        free(store->domain_text);
+    }
+    free(store);
+}
+
+// The id of the lowercased domain text[0..len), added when it is new
+static bool email_store_intern(email_store* s, const char* text, size_t len, uint32_t* id) {
+    uint64_t h = email_store_hash(text, len, 0);
+    size_t slot;
+    if (email_store_find_domain(s, text, len, h, id, &slot)) {
+        return true;
+    }
+    if (s->domains >= EMAIL_STORE_MAX_IDS ||
+        !email_store_reserve((void**)&s->domain_text, &s->domain_text_cap,
+                             s->domain_used + len + 1)) {
+        return false;
+    }
+    if (s->domains == s->domain_cap) {
+        size_t cap = s->domain_cap > 0 ? s->domain_cap * 2 : EMAIL_STORE_MIN_SLOTS;
+        uint64_t* domain_at = realloc(s->domain_at, cap * sizeof(*domain_at));
+        if (domain_at == NULL) {
+            return false;
+        }
+        s->domain_at = domain_at;
+        s->domain_cap = cap;
+    }
+    if (email_store_crowded(s->domains, s->domain_mask)) {
+        if (!email_store_rehash(s, &s->domain_slots, &s->domain_mask, s->domains,
+                                email_store_domain_hash)) {
+            return false;
+        }
+        email_store_find_domain(s, text, len, h, id, &slot);
+    }
+
+    s->domain_at[s->domains] = s->domain_used;
+    s->domain_text[s->domain_used] = (char)len;
+    memcpy(s->domain_text + s->domain_used + 1, text, len);
+    s->domain_used += len + 1;
+    s->domain_slots[slot] = email_store_slot(h, s->domains);
+    *id = (uint32_t)s->domains++;
+    return true;
+}
+
+/**
+ * Function: email_store_add
+ * Purpose: Validates p[0..len) and stores it unless it is there already
+ *
+ * Parameters:
+ *   store  - a store from email_store_create()
+ *   p, len - the address
+ *   id     - receives the id of the address when it is or was stored,
+ *            may be NULL
+ *
+ * Returns:
+ *   EMAIL_STORE_ADDED, EMAIL_STORE_PRESENT, EMAIL_STORE_INVALID, or
+ *   EMAIL_STORE_FULL when memory or ids run out or the store is mapped
+ */
+email_store_result email_store_add(email_store* store, const char* p, size_t len,
+                                   uint32_t* id) {
+    size_t at;
+    if (email_check_split(p, len, NULL, &at) != EMAIL_VALID) {
+        return EMAIL_STORE_INVALID;
+    }
+    if (store->map != NULL) {
+        return EMAIL_STORE_FULL;
+    }
+
+    char domain[MAX_EMAIL_LENGTH];
+    size_t domain_len = len - at - 1;
+    email_store_lower(p + at + 1, domain_len, domain);
+    uint32_t d;
+    if (!email_store_intern(store, domain, domain_len, &d)) {
+        return EMAIL_STORE_FULL;
+    }
+
+    uint64_t h = email_store_hash(p, at, d);
+    uint32_t found;
+    size_t slot;
+    if (email_store_find_address(store, p, at, d, h, &found, &slot)) {
+        if (id != NULL) {
+            *id = found;
+        }
+        return EMAIL_STORE_PRESENT;
+    }
+
+    size_t n = store->count;
+    if (n >= EMAIL_STORE_MAX_IDS ||
+        !email_store_reserve((void**)&store->local, &store->local_cap, store->local_used + at + 1)) {
+        return EMAIL_STORE_FULL;
+    }
+    if (n == store->cap &&
+        !email_store_grow_addresses(store, n > 0 ? n * 2 : EMAIL_STORE_MIN_SLOTS)) {
+        return EMAIL_STORE_FULL;
+    }
+    if (email_store_crowded(n, store->mask)) {
+        if (!email_store_rehash(store, &store->slots, &store->mask, n,
+                                email_store_address_hash)) {
+            return EMAIL_STORE_FULL;
+        }
+        email_store_find_address(store, p, at, d, h, &found, &slot);
+    }
+
+    store->local_at[n] = store->local_used;
+    store->domain_of[n] = d;
+    store->local[store->local_used] = (char)at;
+    memcpy(store->local + store->local_used + 1, p, at);
+    store->local_used += at + 1;
+    store->slots[slot] = email_store_slot(h, n);
+    store->count = n + 1;
+    if (id != NULL) {
+        *id = (uint32_t)n;
+    }
+    return EMAIL_STORE_ADDED;
+}
+
+// ---- Queries ----
+
+/**
+ * Function: email_store_find
+ * Purpose: Returns true, with its id in *id (may be NULL), when p[0..len)
+ *          is in the store
+ *
+ * The address is split at its first '@' and not validated: anything that
+ * is not a stored address is simply not found.
+ */
+bool email_store_find(const email_store* store, const char* p, size_t len, uint32_t* id) {
+    if (p == NULL || len > MAX_EMAIL_LENGTH) {
+        return false;
+    }
+    const char* at = memchr(p, '@', len);
+    if (at == NULL) {
+        return false;
+    }
+    size_t local_len = (size_t)(at - p);
+    size_t domain_len = len - local_len - 1;
+    char domain[MAX_EMAIL_LENGTH];
+    email_store_lower(at + 1, domain_len, domain);
+
+    uint32_t d, found;
+    size_t slot;
+    if (!email_store_find_domain(store, domain, domain_len, email_store_hash(domain, domain_len, 0),
+                                 &d, &slot) ||
+        !email_store_find_address(store, p, local_len, d, email_store_hash(p, local_len, d),
+                                  &found, &slot)) {
+        return false;
+    }
+    if (id != NULL) {
+        *id = found;
+    }
+    return true;
+}
+
+/**
+ * Function: email_store_get
+ * Purpose: Writes address id to out[0..cap), NUL-terminated
+ *
+ * Returns:
+ *   its length, or 0 when there is no such id or it does not fit
+ */
+size_t email_store_get(const email_store* store, uint32_t id, char* out, size_t cap) {
+    if (id >= store->count) {
+        return 0;
+    }
+    const char* local = store->local + store->local_at[id];
+    const char* domain = store->domain_text + store->domain_at[store->domain_of[id]];
+    size_t local_len = (unsigned char)local[0];
+    size_t domain_len = (unsigned char)domain[0];
+    size_t len = local_len + 1 + domain_len;
+    if (len >= cap) {
+        return 0;
+    }
+    memcpy(out, local + 1, local_len);
+    out[local_len] = '@';
+    memcpy(out + local_len + 1, domain + 1, domain_len);
+    out[len] = '\0';
+    return len;
+}
+
+/**
+ * Function: email_store_domain_of
+ * Purpose: The domain id of address id, UINT32_MAX when there is no such
+ *          address
+ */
+uint32_t email_store_domain_of(const email_store* store, uint32_t id) {
+    return id < store->count ? store->domain_of[id] : UINT32_MAX;
+}
+
+/**
+ * Function: email_store_domain
+ * Purpose: The lowercased text of domain id, not NUL-terminated, with
+ *          its length in *len; NULL when there is no such domain
+ */
+const char* email_store_domain(const email_store* store, uint32_t domain, size_t* len) {
+    if (domain >= store->domains) {
+        return NULL;
+    }
+    const char* text = store->domain_text + store->domain_at[domain];
+    *len = (unsigned char)text[0];
+    return text + 1;
+}
+
+/**
+ * Function: email_store_snapshot
+ * Purpose: Copies the sizes of the store into *out
+ */
+void email_store_snapshot(const email_store* store, email_store_stats* out) {
+    out->addresses = store->count;
+    out->domains = store->domains;
+    out->local_bytes = store->local_used;
+    out->domain_bytes = store->domain_used;
+    if (store->map != NULL) {
+        out->memory = store->map_size;
+    } else {
+        out->memory = sizeof(*store) + store->cap * (sizeof(uint64_t) + sizeof(uint32_t)) +
+                      (store->mask + 1) * sizeof(uint64_t) + store->local_cap +
+                      store->domain_cap * sizeof(uint64_t) +
+                      (store->domain_mask + 1) * sizeof(uint64_t) + store->domain_text_cap;
+    }
+}
+
+// ---- Files ----
+
+/*
+ * Offsets of the sections of a file with header h, each 8-byte aligned;
+ * returns the size of the file, or 0 when the counts are out of range
+ * for a file of at most limit bytes
+ */
+static size_t email_store_layout(const email_store_header* h, size_t limit,
+                                 size_t at[EMAIL_SECTION_COUNT]) {
+    if (h->addresses > EMAIL_STORE_MAX_IDS || h->domains > EMAIL_STORE_MAX_IDS ||
+        h->slots > limit / 8 || h->domain_slots > limit / 8 || h->local_bytes > limit ||
+        h->domain_bytes > limit) {
+        return 0;
+    }
+    const uint64_t size[EMAIL_SECTION_COUNT] = {
+        [EMAIL_SECTION_LOCAL_AT] = h->addresses * sizeof(uint64_t),
+        [EMAIL_SECTION_DOMAIN_OF] = h->addresses * sizeof(uint32_t),
+        [EMAIL_SECTION_SLOTS] = h->slots * sizeof(uint64_t),
+        [EMAIL_SECTION_DOMAIN_AT] = h->domains * sizeof(uint64_t),
+        [EMAIL_SECTION_DOMAIN_SLOTS] = h->domain_slots * sizeof(uint64_t),
+        [EMAIL_SECTION_DOMAIN_TEXT] = h->domain_bytes,
+        [EMAIL_SECTION_LOCAL] = h->local_bytes,
+    };
+    uint64_t total = sizeof(email_store_header);
+    for (int i = 0; i < EMAIL_SECTION_COUNT; i++) {
+        at[i] = (size_t)total;
+        total += (size[i] + 7) & ~(uint64_t)7;
+    }
+    return total <= limit ? (size_t)total : 0;
+}
+
+// Writes p[0..len) in full
+static bool email_store_write_all(int fd, const void* p, size_t len) {
+    const char* q = p;
+    while (len > 0) {
+        ssize_t n = write(fd, q, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        q += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// Writes p[0..len) and the padding to the next multiple of 8
+static bool email_store_write(int fd, const void* p, size_t len) {
+    static const char zeros[8];
+    return email_store_write_all(fd, p, len) &&
+           email_store_write_all(fd, zeros, (8 - len % 8) % 8);
+}
+
+/**
+ * Function: email_store_save
+ * Purpose: Writes the store to path, through a temporary file beside it
+ *          that is renamed over path once complete
+ *
+ * Returns:
+ *   0, or -1 with errno set
+ */
+int email_store_save(const email_store* store, const char* path) {
+    email_store_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, EMAIL_STORE_MAGIC, sizeof(h.magic));
+    h.version = EMAIL_STORE_VERSION;
+    h.byte_order = EMAIL_STORE_BYTE_ORDER;
+    h.addresses = store->count;
+    h.domains = store->domains;
+    h.slots = store->mask + 1;
+    h.domain_slots = store->domain_mask + 1;
+    h.local_bytes = store->local_used;
+    h.domain_bytes = store->domain_used;
+
+    size_t tmp_len = strlen(path) + sizeof(".tmp");
+    char* tmp = malloc(tmp_len);
+    if (tmp == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    snprintf(tmp, tmp_len, "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        int saved = errno;
+        free(tmp);
+        errno = saved;
+        return -1;
+    }
+
+    bool ok = email_store_write(fd, &h, sizeof(h)) &&
+              email_store_write(fd, store->local_at, store->count * sizeof(uint64_t)) &&
+              email_store_write(fd, store->domain_of, store->count * sizeof(uint32_t)) &&
+              email_store_write(fd, store->slots, (store->mask + 1) * sizeof(uint64_t)) &&
+              email_store_write(fd, store->domain_at, store->domains * sizeof(uint64_t)) &&
+              email_store_write(fd, store->domain_slots,
+                                (store->domain_mask + 1) * sizeof(uint64_t)) &&
+              email_store_write(fd, store->domain_text, store->domain_used) &&
+              email_store_write(fd, store->local, store->local_used) &&
+              fsync(fd) == 0;
+    int saved = errno;
+    if (close(fd) != 0 && ok) {
+        ok = false;
+        saved = errno;
+    }
+    if (ok && rename(tmp, path) != 0) {
+        ok = false;
+        saved = errno;
+    }
+    if (!ok) {
+        unlink(tmp);
+    }
+    free(tmp);
+    errno = saved;
+    return ok ? 0 : -1;
+}
+
+/**
+ * Function: email_store_open
+ * Purpose: Maps a file written by email_store_save() as a read-only store
+ *
+ * Returns:
+ *   the store, or NULL with errno set: EINVAL when the file is not a
+ *   store of this version and byte order, or its size does not match
+ */
+email_store* email_store_open(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return NULL;
+    }
+    if (st.st_size < (off_t)sizeof(email_store_header)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    int saved = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        errno = saved;
+        return NULL;
+    }
+
+    const email_store_header* h = map;
+    size_t at[EMAIL_SECTION_COUNT];
+    email_store* s = NULL;
+    if (memcmp(h->magic, EMAIL_STORE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != EMAIL_STORE_VERSION || h->byte_order != EMAIL_STORE_BYTE_ORDER ||
+        h->slots < EMAIL_STORE_MIN_SLOTS || (h->slots & (h->slots - 1)) != 0 ||
+        h->domain_slots < EMAIL_STORE_MIN_SLOTS || (h->domain_slots & (h->domain_slots - 1)) != 0 ||
+        h->addresses >= h->slots || h->domains >= h->domain_slots ||
+        email_store_layout(h, size, at) != size) {
+        saved = EINVAL;
+    } else if ((s = calloc(1, sizeof(*s))) == NULL) {
+        saved = ENOMEM;
+    }
+    if (s == NULL) {
+        munmap(map, size);
+        errno = saved;
+        return NULL;
+    }
+
+    char* base = map;
+    s->local_at = (uint64_t*)(base + at[EMAIL_SECTION_LOCAL_AT]);
+    s->domain_of = (uint32_t*)(base + at[EMAIL_SECTION_DOMAIN_OF]);
+    s->slots = (uint64_t*)(base + at[EMAIL_SECTION_SLOTS]);
+    s->domain_at = (uint64_t*)(base + at[EMAIL_SECTION_DOMAIN_AT]);
+    s->domain_slots = (uint64_t*)(base + at[EMAIL_SECTION_DOMAIN_SLOTS]);
+    s->domain_text = base + at[EMAIL_SECTION_DOMAIN_TEXT];
+    s->local = base + at[EMAIL_SECTION_LOCAL];
+    s->count = s->cap = (size_t)h->addresses;
+    s->mask = (size_t)h->slots - 1;
+    s->local_used = s->local_cap = (size_t)h->local_bytes;
+    s->domains = s->domain_cap = (size_t)h->domains;
+    s->domain_mask = (size_t)h->domain_slots - 1;
+    s->domain_used = s->domain_text_cap = (size_t)h->domain_bytes;
+    s->map = map;
+    s->map_size = size;
+    return s;
+}
@@ -0,0 +1,295 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "email_internal.h"
+
+/*
+ * Streaming validation of newline-delimited input
+ *
+ * Regular files are memory-mapped and scanned in place. Pipes, terminals
+ * and anything else that cannot be mapped are read in large blocks into
+ * one buffer; a line that straddles two reads is moved to the front of
+ * the buffer before the next read. The buffer never grows: of a line
+ * longer than any address only the first EMAIL_STREAM_LINE_KEEP bytes are
+ * kept, and the rest is dropped as it arrives. Either way, each line is
+ * handed to the validator and the callback as a view into the buffer: no
+ * line is copied on its own. Line ends are found with memchr(), which libc vectorizes.
+ */
+#define EMAIL_STREAM_BLOCK (1 << 20)  // bytes per read() on unmappable input
+
+// Bytes kept of a line longer than any address; still too long with its
+// '\r' dropped, so the line is reported invalid (EMAIL_TOO_LONG)
+#define EMAIL_STREAM_LINE_KEEP (MAX_EMAIL_LENGTH + 2)
+
+_Static_assert(EMAIL_STREAM_BLOCK > 2 * EMAIL_STREAM_LINE_KEEP, "a block holds a kept line head");
+
+typedef struct {
+    email_validator validator;  // with a domain cache only if opts->domain_cache
+    email_dedup* dedup;
+    email_line_fn fn;
+    email_duplicate_fn on_duplicate;
+    void* ctx;
+    uint64_t line_no;
+    email_stream_stats stats;
+} email_stream;
+
+// Validates one line (without its '\n') and reports it to the callback
+static int email_stream_line(email_stream* s, const char* line, size_t len) {
+    // Accept CRLF files: the '\r' is part of the line ending, not the address
+    if (len > 0 && line[len - 1] == '\r') {
+        len--;
+    }
+
+    bool valid;
+    bool duplicate = false;
+    uint64_t first_line = 0;
+
+    s->line_no++;
+    if (s->dedup != NULL) {
+        valid = email_dedup_validate(s->dedup, line, len, s->line_no, &s->validator,
+                                     &duplicate, &first_line);
+        if (duplicate) {
+            s->stats.duplicates++;
+        } else {
+            s->stats.unique++;
+        }
+    } else {
+        valid = email_validator_run(&s->validator, line, len);
+    }
+
+    s->stats.lines++;
+    s->stats.bytes += len;
+    if (valid) {
+        s->stats.valid++;
+    } else {
+        s->stats.invalid++;
+    }
+
+    if (duplicate) {
+        return s->on_duplicate != NULL
+                   ? s->on_duplicate(line, len, s->line_no, first_line, valid, s->ctx) : 0;
+    }
+    return s->fn != NULL ? s->fn(line, len, s->line_no, valid, s->ctx) : 0;
+}
+
+// Splits buf[0..len) into lines; returns the number of bytes consumed,
+// which stops short of a trailing partial line unless final is set
+static int email_stream_split(email_stream* s, const char* buf, size_t len,
+                              bool final, size_t* consumed) {
+    const char* p = buf;
+    const char* end = buf + len;
+
+    while (p < end) {
+        const char* nl = memchr(p, '\n', (size_t)(end - p));
+        if (nl == NULL) {
+            if (!final) {
+                break;
+            }
+            nl = end;
+        }
+        int rc = email_stream_line(s, p, (size_t)(nl - p));
+        if (rc != 0) {
+            *consumed = (size_t)(nl - buf);
+            return rc;
+        }
+        p = nl < end ? nl + 1 : end;
+    }
+
+    *consumed = (size_t)(p - buf);
+    return 0;
+}
+
+// Returns false when the file cannot be mapped and must be read instead
+static bool email_stream_mapped(email_stream* s, int fd, size_t size, int* rc) {
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    size_t consumed;
+    *rc = email_stream_split(s, map, size, true, &consumed);
+
+    munmap(map, size);
+    return true;
+}
+
+static int email_stream_read(email_stream* s, int fd) {
+    char* buf = malloc(EMAIL_STREAM_BLOCK);
+    size_t used = 0;
+    bool dropping = false;      // buf holds the kept head of a line too long
+    int rc = 0;
+
+    if (buf == NULL) {
+        return -1;
+    }
+
+    for (;;) {
+        ssize_t got = read(fd, buf + used, EMAIL_STREAM_BLOCK - used);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            rc = -1;
+            break;
+        }
+        bool final = got == 0;
+        size_t fresh = used;
+        used += (size_t)got;
+
+        // Of a line too long to be an address only its end matters: the
+        // bytes before it are dropped, and the kept head is reported then
+        if (dropping) {
+            const char* nl = memchr(buf + fresh, '\n', used - fresh);
+            if (nl == NULL && !final) {
+                used = fresh;
+                continue;
+            }
+            dropping = false;
+            rc = email_stream_line(s, buf, fresh);
+            size_t next = nl != NULL ? (size_t)(nl + 1 - buf) : used;
+            memmove(buf, buf + next, used - next);
+            used -= next;
+            if (rc != 0) {
+                break;
+            }
+        }
+
+        size_t consumed;
+        rc = email_stream_split(s, buf, used, final, &consumed);
+        if (rc != 0 || final) {
+            break;
+        }
+
+        // Keep the partial last line for the next read, or its head
+        memmove(buf, buf + consumed, used - consumed);
+        used -= consumed;
+        if (used > EMAIL_STREAM_LINE_KEEP) {
+            used = EMAIL_STREAM_LINE_KEEP;
+            dropping = true;
+        }
+    }
+
+    int saved = errno;
+    free(buf);
+    errno = saved;
+    return rc;
+}
+
+/**
+ * Function: validate_email_stream_fd
+ * Purpose: Validates every line read from a file descriptor
+ *
+ * Parameters:
+ *   fd    - descriptor to read until end of file
+ *   fn    - called for every line in order, may be NULL; a non-zero
+ *           return value stops the scan and is passed back to the caller
+ *   ctx   - passed through to fn
+ *   stats - receives line, byte and verdict counts, may be NULL
+ *
+ * Returns:
+ *   0 at end of input, -1 with errno set on a read or mapping error,
+ *   or the non-zero value returned by fn
+ *
+ * The line views passed to fn do not include the '\n' (or "\r\n") and are
+ * only valid during the call. On input that is not memory-mapped, a line
+ * longer than MAX_EMAIL_LENGTH + 1 bytes is passed cut to its first
+ * MAX_EMAIL_LENGTH + 2 bytes (and is invalid either way).
+ */
+int validate_email_stream_fd(int fd, email_line_fn fn, void* ctx,
+                             email_stream_stats* stats) {
+    return validate_email_stream_fd_ex(fd, NULL, fn, ctx, stats);
+}
+
+/**
+ * Function: validate_email_stream_fd_ex
+ * Purpose: validate_email_stream_fd() with options
+ *
+ * opts may be NULL for the defaults; with opts->strict every line is
+ * checked with is_valid_email_strict(), with opts->utf8 with
+ * is_valid_email_utf8() (or its strict form), with opts->rfc with
+ * is_valid_email_rfc() whatever the other two say. With opts->domain_cache the domain
+ * verdicts are cached for the length of the scan (if the cache cannot be
+ * allocated the scan runs without it). With opts->dedup every line is
+ * added to the set first; a line already in it keeps the verdict of its
+ * first occurrence, is counted in stats->duplicates and is passed to
+ * opts->on_duplicate instead of fn. Lines are added as they are, after
+ * the "\r" of a CRLF ending is dropped. With opts->verdicts a line is
+ * looked up in that cache before it is validated, and its verdict is
+ * recorded there when it was not found.
+ */
+int validate_email_stream_fd_ex(int fd, const email_stream_options* opts,
+                                email_line_fn fn, void* ctx,
+                                email_stream_stats* stats) {
+    email_stream s;
+    memset(&s, 0, sizeof(s));
+    bool utf8 = opts != NULL && opts->utf8;
+    bool rfc = opts != NULL && opts->rfc;
+    email_validator_select(&s.validator, opts != NULL && opts->strict, utf8, rfc);
+    s.validator.verdicts = opts != NULL ? opts->verdicts : NULL;
+    s.validator.cache = opts != NULL && opts->domain_cache && !utf8 && !rfc
+                          ? email_domain_cache_create()
+                          : NULL;
+    s.dedup = opts != NULL ? opts->dedup : NULL;
+    s.on_duplicate = opts != NULL ? opts->on_duplicate : NULL;
+    s.fn = fn;
+    s.ctx = ctx;
+
+    struct stat st;
+    int rc;
+    if (!(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+          email_stream_mapped(&s, fd, (size_t)st.st_size, &rc))) {
+        rc = email_stream_read(&s, fd);
+    }
+
+    int saved = errno;
+    email_domain_cache_destroy(s.validator.cache);
+    errno = saved;
+
+    if (stats != NULL) {
+        *stats = s.stats;
+    }
+    return rc;
+}
+
+/**
+ * Function: validate_email_file
+ * Purpose: Validates every line of the file at path ("-" reads stdin)
+ *
+ * Same callback, statistics and return values as validate_email_stream_fd().
+ */
+int validate_email_file(const char* path, email_line_fn fn, void* ctx,
+                        email_stream_stats* stats) {
+    return validate_email_file_ex(path, NULL, fn, ctx, stats);
+}
+
+/**
+ * Function: validate_email_file_ex
+ * Purpose: validate_email_file() with options, see validate_email_stream_fd_ex()
+ */
+int validate_email_file_ex(const char* path, const email_stream_options* opts,
+                           email_line_fn fn, void* ctx,
+                           email_stream_stats* stats) {
+    if (strcmp(path, "-") == 0) {
+        return validate_email_stream_fd_ex(STDIN_FILENO, opts, fn, ctx, stats);
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int rc = validate_email_stream_fd_ex(fd, opts, fn, ctx, stats);
+
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return rc;
+}
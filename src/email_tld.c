@@ -0,0 +1,464 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "email_internal.h"
+
+/*
+ * Known top-level domains
+ *
+ * The TLDs are kept in a minimal perfect hash table built with "hash and
+ * displace": every key is hashed once; the high bits pick one of about
+ * count / EMAIL_TLD_BUCKET_KEYS buckets, and each bucket stores the
+ * displacement that sends all of its keys to free slots. A lookup is one
+ * hash of the TLD, eight bytes at a time and lowercased on the fly, one
+ * displacement load, one slot load and a compare of the 16-byte prefix
+ * kept in the slot, with no probing and no allocation.
+ *
+ * The table is built when it is first needed, from the list compiled in
+ * from data/tlds-alpha-by-domain.txt, or by email_tld_load_file() from a
+ * file in the same format. Loading publishes a new table with an atomic
+ * pointer swap, so lookups never lock. Old tables are not freed: threads
+ * may still be reading them, and reloads are rare.
+ */
+#define EMAIL_TLD_MAX_LENGTH 63    // longest DNS label
+#define EMAIL_TLD_BUCKET_KEYS 4    // average keys per displacement bucket
+#define EMAIL_TLD_MAX_DISPLACE 65535
+#define EMAIL_TLD_MAX_SEEDS 64     // fresh hash seeds tried before giving up
+
+// The built-in list, in the format email_tld_load_list() reads (generated by CMake)
+static const char email_builtin_tlds[] =
+#include "email_tlds.inc"
+;
+
+typedef struct {
+    uint64_t prefix[2];  // first 16 bytes of the key, zero padded
+    uint32_t offset;     // first byte of the key in keys[]
+    uint32_t len;
+} email_tld_slot;
+
+typedef struct email_tld_table {
+    uint32_t count;                     // keys, and slots
+    uint32_t buckets;
+    uint64_t seed;
+    uint16_t* displace;                 // per bucket
+    email_tld_slot* slots;
+    char* keys;                         // the lowercased TLDs, back to back
+    struct email_tld_table* retired;    // the table this one replaced
+} email_tld_table;
+
+static _Atomic(email_tld_table*) email_tld_active;
+static pthread_mutex_t email_tld_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t email_tld_once = PTHREAD_ONCE_INIT;
+
+static inline uint64_t email_tld_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Maps a 32-bit hash onto [0, n) without a division
+static inline uint32_t email_tld_range(uint64_t h, uint32_t n) {
+    return (uint32_t)(((h & 0xFFFFFFFFull) * n) >> 32);
+}
+
+/*
+ * Hashes key[0..len) case-insensitively, eight bytes per step, and
+ * returns its first 16 lowercased bytes in prefix[] for the compare.
+ */
+static inline uint64_t email_tld_hash(const char* key, size_t len, uint64_t seed,
+                                      uint64_t prefix[2]) {
+    uint64_t h = seed ^ len;
+    prefix[0] = prefix[1] = 0;
+
+    for (size_t i = 0; i < len; i += 8) {
+        uint64_t w = email_load_word(key + i, len - i);
+        w = email_lower_word(w);
+        if (i < 16) {
+            prefix[i / 8] = w;
+        }
+        h = (h ^ w) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 32;
+    }
+    return email_tld_mix(h);
+}
+
+static inline uint32_t email_tld_bucket(const email_tld_table* t, uint64_t h) {
+    return email_tld_range(h >> 32, t->buckets);
+}
+
+// The low half of the hash, scrambled by a multiple of the displacement
+static inline uint32_t email_tld_slot_of(const email_tld_table* t, uint64_t h, uint32_t d) {
+    return email_tld_range(h ^ (d * 0x9E3779B9u), t->count);
+}
+
+static inline char email_tld_lower(char c) {
+    return c >= 'A' && c <= 'Z' ? (char)(c | 0x20) : c;
+}
+
+// A key while the list is parsed; p points into the lowercased keys
+typedef struct {
+    const char* p;
+    email_tld_slot slot;
+} email_tld_key;
+
+static int email_tld_compare(const void* a, const void* b) {
+    const email_tld_key* x = a;
+    const email_tld_key* y = b;
+    size_t n = x->slot.len < y->slot.len ? x->slot.len : y->slot.len;
+    int c = memcmp(x->p, y->p, n);
+    return c != 0 ? c : (int)x->slot.len - (int)y->slot.len;
+}
+
+/*
+ * Finds displacements for one seed. order lists the buckets largest
+ * first; members holds the keys of each bucket, starting at first[b].
+ * Returns false when some bucket cannot be placed.
+ */
+static bool email_tld_place(email_tld_table* t, const uint64_t* hashes,
+                            const uint32_t* order, const uint32_t* first,
+                            const uint32_t* members, uint8_t* taken) {
+    memset(taken, 0, t->count);
+
+    for (uint32_t i = 0; i < t->buckets; i++) {
+        uint32_t b = order[i];
+        uint32_t n = first[b + 1] - first[b];
+        const uint32_t* keys = members + first[b];
+        if (n == 0) {
+            t->displace[b] = 0;
+            continue;
+        }
+
+        uint32_t d;
+        for (d = 0; d <= EMAIL_TLD_MAX_DISPLACE; d++) {
+            uint32_t k;
+            for (k = 0; k < n; k++) {
+                uint32_t slot = email_tld_slot_of(t, hashes[keys[k]], d);
+                if (taken[slot]) {
+                    break;
+                }
+                taken[slot] = 1;
+            }
+            if (k == n) {
+                break;
+            }
+            // Undo the partial placement and try the next displacement
+            while (k-- > 0) {
+                taken[email_tld_slot_of(t, hashes[keys[k]], d)] = 0;
+            }
+        }
+        if (d > EMAIL_TLD_MAX_DISPLACE) {
+            return false;
+        }
+        t->displace[b] = (uint16_t)d;
+    }
+    return true;
+}
+
+/**
+ * Function: email_tld_build
+ * Purpose: Parses a TLD list and builds its perfect hash table
+ *
+ * Parameters:
+ *   text - the list: one TLD per line, '#' starts a comment line, blank
+ *          lines and surrounding spaces are ignored, case is not significant
+ *   len  - bytes in text
+ *
+ * Returns:
+ *   the new table, or NULL with errno set (EINVAL for a line that is not
+ *   a TLD, ENOMEM)
+ */
+static email_tld_table* email_tld_build(const char* text, size_t len) {
+    // Upper bound on the number of keys: one per line
+    size_t max_keys = 1;
+    for (size_t i = 0; i < len; i++) {
+        max_keys += text[i] == '\n';
+    }
+
+    email_tld_key* parsed = malloc(max_keys * sizeof(*parsed));
+    char* keys = malloc(len + 1);
+    if (parsed == NULL || keys == NULL) {
+        free(parsed);
+        free(keys);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // Parse into lowercased keys
+    uint32_t count = 0;
+    size_t used = 0;
+    const char* p = text;
+    const char* end = text + len;
+    while (p < end) {
+        const char* nl = memchr(p, '\n', (size_t)(end - p));
+        const char* line_end = nl != NULL ? nl : end;
+        const char* b = p;
+        const char* e = line_end;
+        p = nl != NULL ? nl + 1 : end;
+
+        while (b < e && (EMAIL_CLASS_OF(*b) & EMAIL_CHAR_SPACE)) {
+            b++;
+        }
+        while (e > b && (EMAIL_CLASS_OF(e[-1]) & EMAIL_CHAR_SPACE)) {
+            e--;
+        }
+        if (b == e || *b == '#') {
+            continue;
+        }
+
+        size_t n = (size_t)(e - b);
+        bool ok = n <= EMAIL_TLD_MAX_LENGTH;
+        for (size_t i = 0; ok && i < n; i++) {
+            ok = (EMAIL_CLASS_OF(b[i]) & (EMAIL_CHAR_ALNUM | EMAIL_CHAR_HYPHEN)) != 0;
+            keys[used + i] = email_tld_lower(b[i]);
+        }
+        if (!ok) {
+            free(parsed);
+            free(keys);
+            errno = EINVAL;
+            return NULL;
+        }
+        parsed[count].p = keys + used;
+        parsed[count].slot.offset = (uint32_t)used;
+        parsed[count].slot.len = (uint32_t)n;
+        count++;
+        used += n;
+    }
+
+    // Drop duplicates: two equal keys can never get distinct slots
+    qsort(parsed, count, sizeof(*parsed), email_tld_compare);
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (unique == 0 || email_tld_compare(&parsed[unique - 1], &parsed[i]) != 0) {
+            parsed[unique++] = parsed[i];
+        }
+    }
+    count = unique;
+
+    uint32_t buckets = count / EMAIL_TLD_BUCKET_KEYS + 1;
+    email_tld_table* t = calloc(1, sizeof(*t));
+    uint64_t* hashes = malloc((count + 1) * sizeof(*hashes));
+    uint32_t* first = calloc(buckets + 2, sizeof(*first));
+    uint32_t* members = malloc((count + 1) * sizeof(*members));
+    uint32_t* order = malloc(buckets * sizeof(*order));
+    uint32_t* fill = malloc((buckets + 1) * sizeof(*fill));
+    uint8_t* taken = malloc(count + 1);
+    bool built = false;
+
+    if (t != NULL && hashes != NULL && first != NULL && members != NULL &&
+        order != NULL && fill != NULL && taken != NULL) {
+        t->count = count;
+        t->buckets = buckets;
+        t->keys = keys;
+        t->slots = malloc((count + 1) * sizeof(*t->slots));
+        t->displace = malloc(buckets * sizeof(*t->displace));
+        built = t->slots != NULL && t->displace != NULL;
+    }
+
+    for (uint32_t attempt = 0; built && count > 0; attempt++) {
+        if (attempt == EMAIL_TLD_MAX_SEEDS) {
+            built = false;
+            break;
+        }
+        t->seed = email_tld_mix(0x243F6A8885A308D3ull + attempt);
+
+        // Bucket the keys (counting sort), then order buckets largest first
+        memset(first, 0, (buckets + 2) * sizeof(*first));
+        for (uint32_t i = 0; i < count; i++) {
+            hashes[i] = email_tld_hash(parsed[i].p, parsed[i].slot.len, t->seed,
+                                       parsed[i].slot.prefix);
+            first[email_tld_bucket(t, hashes[i]) + 1]++;
+        }
+        for (uint32_t b = 0; b < buckets; b++) {
+            first[b + 1] += first[b];
+        }
+        memcpy(fill, first, buckets * sizeof(*fill));
+        for (uint32_t i = 0; i < count; i++) {
+            members[fill[email_tld_bucket(t, hashes[i])]++] = i;
+        }
+
+        uint32_t largest = 0;
+        for (uint32_t b = 0; b < buckets; b++) {
+            uint32_t n = first[b + 1] - first[b];
+            largest = n > largest ? n : largest;
+        }
+        uint32_t placed = 0;
+        for (uint32_t size = largest + 1; size-- > 0;) {
+            for (uint32_t b = 0; b < buckets; b++) {
+                if (first[b + 1] - first[b] == size) {
+                    order[placed++] = b;
+                }
+            }
+        }
+
+        if (email_tld_place(t, hashes, order, first, members, taken)) {
+            for (uint32_t i = 0; i < count; i++) {
+                uint64_t h = hashes[i];
+                t->slots[email_tld_slot_of(t, h, t->displace[email_tld_bucket(t, h)])] = parsed[i].slot;
+            }
+            break;
+        }
+    }
+
+    free(parsed);
+    free(hashes);
+    free(first);
+    free(members);
+    free(order);
+    free(fill);
+    free(taken);
+
+    if (!built) {
+        if (t != NULL) {
+            free(t->slots);
+            free(t->displace);
+            free(t);
+        }
+        free(keys);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return t;
+}
+
+// Makes t the table used by lookups
+static void email_tld_publish(email_tld_table* t) {
+    pthread_mutex_lock(&email_tld_lock);
+    t->retired = atomic_load_explicit(&email_tld_active, memory_order_relaxed);
+    atomic_store_explicit(&email_tld_active, t, memory_order_release);
+    pthread_mutex_unlock(&email_tld_lock);
+}
+
+static void email_tld_init_builtin(void) {
+    if (atomic_load_explicit(&email_tld_active, memory_order_acquire) == NULL) {
+        email_tld_load_builtin();
+    }
+}
+
+static const email_tld_table* email_tld_current(void) {
+    email_tld_table* t = atomic_load_explicit(&email_tld_active, memory_order_acquire);
+    if (t == NULL) {
+        pthread_once(&email_tld_once, email_tld_init_builtin);
+        t = atomic_load_explicit(&email_tld_active, memory_order_acquire);
+    }
+    return t;
+}
+
+/**
+ * Function: email_tld_is_known
+ * Purpose: Looks up a top-level domain, ignoring case
+ *
+ * Parameters:
+ *   tld - the label after the last '.', without the dot (need not be
+ *         NUL-terminated)
+ *   len - bytes in tld
+ *
+ * Returns:
+ *   true if tld is in the current list
+ */
+bool email_tld_is_known(const char* tld, size_t len) {
+    if (tld == NULL || len == 0 || len > EMAIL_TLD_MAX_LENGTH) {
+        return false;
+    }
+    const email_tld_table* t = email_tld_current();
+    if (t == NULL || t->count == 0) {
+        return false;
+    }
+
+    uint64_t prefix[2];
+    uint64_t h = email_tld_hash(tld, len, t->seed, prefix);
+    const email_tld_slot* s =
+        &t->slots[email_tld_slot_of(t, h, t->displace[email_tld_bucket(t, h)])];
+
+    if (s->len != len || s->prefix[0] != prefix[0] || s->prefix[1] != prefix[1]) {
+        return false;
+    }
+    // Only the rare TLD longer than 16 bytes has more to compare
+    for (size_t i = 16; i < len; i++) {
+        if (t->keys[s->offset + i] != email_tld_lower(tld[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Function: email_tld_count
+ * Purpose: Returns the number of TLDs in the current list
+ */
+size_t email_tld_count(void) {
+    const email_tld_table* t = email_tld_current();
+    return t != NULL ? t->count : 0;
+}
+
+/**
+ * Function: email_tld_load_list
+ * Purpose: Replaces the TLD list with the one in text[0..len)
+ *
+ * Returns:
+ *   0 on success, -1 with errno set (EINVAL for a malformed line, ENOMEM);
+ *   on failure the current list stays in use
+ */
+int email_tld_load_list(const char* text, size_t len) {
+    email_tld_table* t = email_tld_build(text, len);
+    if (t == NULL) {
+        return -1;
+    }
+    email_tld_publish(t);
+    return 0;
+}
+
+/**
+ * Function: email_tld_load_builtin
+ * Purpose: Goes back to the list compiled into the library
+ */
+int email_tld_load_builtin(void) {
+    return email_tld_load_list(email_builtin_tlds, sizeof(email_builtin_tlds) - 1);
+}
+
+/**
+ * Function: email_tld_load_file
+ * Purpose: Replaces the TLD list with the file at path
+ *
+ * The file has the format of IANA's tlds-alpha-by-domain.txt. Returns as
+ * for email_tld_load_list(), with errno from the failed call on an I/O error.
+ */
+int email_tld_load_file(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return -1;
+    }
+
+    size_t cap = 1 << 16;
+    size_t used = 0;
+    char* buf = malloc(cap);
+    int rc = -1;
+
+    while (buf != NULL) {
+        used += fread(buf + used, 1, cap - used, f);
+        if (used < cap) {
+            if (!ferror(f)) {
+                rc = email_tld_load_list(buf, used);
+            }
+            break;
+        }
+        char* bigger = realloc(buf, cap * 2);
+        if (bigger == NULL) {
+            break;
+        }
+        buf = bigger;
+        cap *= 2;
+    }
+
+    int saved = errno;
+    free(buf);
+    fclose(f);
+    errno = saved;
+    return rc;
+}
@@ -0,0 +1,720 @@
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#ifdef EMAIL_VALIDATE_PROFILE_REJECTS
+#include <stdatomic.h>
+#endif
+
+#include "email_internal.h"
+
+// The class table; see EMAIL_CHAR_CLASS() in email_rules.h
+const unsigned char email_char_class[256] = {
+    EMAIL_CHAR_CLASS_ROW(0x00), EMAIL_CHAR_CLASS_ROW(0x10),
+    EMAIL_CHAR_CLASS_ROW(0x20), EMAIL_CHAR_CLASS_ROW(0x30),
+    EMAIL_CHAR_CLASS_ROW(0x40), EMAIL_CHAR_CLASS_ROW(0x50),
+    EMAIL_CHAR_CLASS_ROW(0x60), EMAIL_CHAR_CLASS_ROW(0x70),
+    EMAIL_CHAR_CLASS_ROW(0x80), EMAIL_CHAR_CLASS_ROW(0x90),
+    EMAIL_CHAR_CLASS_ROW(0xA0), EMAIL_CHAR_CLASS_ROW(0xB0),
+    EMAIL_CHAR_CLASS_ROW(0xC0), EMAIL_CHAR_CLASS_ROW(0xD0),
+    EMAIL_CHAR_CLASS_ROW(0xE0), EMAIL_CHAR_CLASS_ROW(0xF0)
+};
+
+/**
+ * Function: is_valid_email_reference
+ * Purpose: Validates an email address according to basic RFC standards
+ *
+ * This is the original rule-by-rule implementation, one loop per rule.
+ * is_valid_email() now runs the single-pass is_valid_email_n(); this
+ * version is kept so the two can be diffed against each other.
+ * 
+ * Parameters:
+ *   email - pointer to the email string to validate
+ * 
+ * Returns:
+ *   true if email is valid, false otherwise
+ * 
+ * Validation Rules Applied:
+ *   1. Must contain exactly one '@' symbol
+ *   2. Must have at least one character before '@' (local part)
+ *   3. Must have at least one character after '@' (domain part)
+ *   4. Domain must contain at least one '.' after the '@'
+ *   5. Must end with at least 2 characters after the last '.'
+ *   6. No spaces allowed anywhere in the email
+ *   7. Local part cannot start or end with '.'
+ *   8. Domain part cannot start or end with '.' or '-'
+ */
+bool is_valid_email_reference(const char* email) {
+    // Check for NULL pointer - safety first
+    if (email == NULL) {
+        return false;
+    }
+    
+    // Get the length of the email string
+    int len = strlen(email);
+    
+    // Check minimum and maximum length constraints
+    if (len < MIN_EMAIL_LENGTH || len > MAX_EMAIL_LENGTH) {
+        return false;
+    }
+    
+    // Find the position of the '@' symbol
+    // There must be exactly one '@' symbol in a valid email
+    int at_pos = -1;
+    int at_count = 0;
+    
+    for (int i = 0; i < len; i++) {
+        if (email[i] == '@') {
+            at_pos = i;
+            at_count++;
+        }
+        // Check for spaces (not allowed in email addresses)
+        if (EMAIL_CLASS_OF(email[i]) & EMAIL_CHAR_SPACE) {
+            return false;
+        }
+    }
+    
+    // Must have exactly one '@' symbol
+    if (at_count != 1) {
+        return false;
+    }
+    
+    // '@' cannot be at the beginning or end
+    if (at_pos == 0 || at_pos == len - 1) {
+        return false;
+    }
+    
+    // Validate the local part (before '@')
+    // Local part cannot be empty and cannot start/end with '.'
+    if (email[0] == '.' || email[at_pos - 1] == '.') {
+        return false;
+    }
+    
+    // Check for consecutive dots in local part (not allowed)
+    for (int i = 0; i < at_pos - 1; i++) {
+        if (email[i] == '.' && email[i + 1] == '.') {
+            return false;
+        }
+    }
+    
+    // Validate the domain part (after '@')
+    char* domain = (char*)(email + at_pos + 1);
+    int domain_len = len - at_pos - 1;
+    
+    // Domain cannot start or end with '.' or '-'
+    if (domain[0] == '.' || domain[0] == '-' || 
+        domain[domain_len - 1] == '.' || domain[domain_len - 1] == '-') {
+        return false;
+    }
+    
+    // Find the last dot in domain (for TLD validation)
+    int last_dot_pos = -1;
+    int dot_count = 0;
+    
+    for (int i = 0; i < domain_len; i++) {
+        if (domain[i] == '.') {
+            last_dot_pos = i;
+            dot_count++;
+        }
+    }
+    
+    // Domain must have at least one dot (for TLD)
+    if (dot_count == 0) {
+        return false;
+    }
+    
+    // TLD (Top Level Domain) must be at least 2 characters
+    if (domain_len - last_dot_pos - 1 < 2) {
+        return false;
+    }
+    
+    // Check for consecutive dots in domain (not allowed)
+    for (int i = 0; i < domain_len - 1; i++) {
+        if (domain[i] == '.' && domain[i + 1] == '.') {
+            return false;
+        }
+    }
+    
+    // Validate characters in local part
+    // Allow alphanumeric, dots, hyphens, underscores, plus signs
+    for (int i = 0; i < at_pos; i++) {
+        if (!(EMAIL_CLASS_OF(email[i]) & EMAIL_CHAR_LOCAL)) {
+            return false;
+        }
+    }
+    
+    // Validate characters in domain part
+    // Allow alphanumeric, dots, and hyphens only
+    for (int i = 0; i < domain_len; i++) {
+        if (!(EMAIL_CLASS_OF(domain[i]) & EMAIL_CHAR_DOMAIN)) {
+            return false;
+        }
+    }
+    
+    // If we've made it through all checks, the email is valid
+    return true;
+}
+
+/*
+ * The single-pass scanner
+ *
+ * email_scan() checks an address with the same rules as
+ * is_valid_email_reference, in one left-to-right scan driven by a small
+ * state machine. It runs in two phases: email_scan_local() up to the '@'
+ * and email_scan_domain() after it. Every byte is looked at exactly once.
+ * The reason for a rejection is only worked out on the way out of the
+ * failing branch, so the accept path of each loop is the same as for a
+ * plain yes/no answer; the functions are inlined into each caller, and with
+ * offset == NULL the stores vanish.
+ *
+ * The domain phase depends on nothing but the domain bytes, which is what
+ * lets the bulk validators cache its verdict per domain (email_domain_cache.c).
+ */
+#define EMAIL_FAIL(reason, pos)   \
+    do {                          \
+        if (offset != NULL) {     \
+            *offset = (pos);      \
+        }                         \
+        return (reason);          \
+    } while (0)
+
+/**
+ * Function: email_scan_local
+ * Purpose: Checks the local part of p[0..len), up to and including the '@'
+ *
+ * Parameters:
+ *   p      - pointer to the first byte of the address
+ *   len    - number of bytes in the address
+ *   at     - receives the position of the '@' on success
+ *   offset - receives the position of the offending byte on failure, may be NULL
+ *
+ * Returns:
+ *   EMAIL_VALID when the local part is followed by an '@', or the first
+ *   rule it breaks
+ *
+ * States:
+ *   LOCAL_START   - nothing read yet
+ *   LOCAL         - last byte was a local-part character other than '.'
+ *   LOCAL_DOT     - last byte was a '.' in the local part
+ */
+static inline email_reason email_scan_local(const char* p, size_t len, size_t* at,
+                                            size_t* offset) {
+    enum {
+        LOCAL_START,
+        LOCAL,
+        LOCAL_DOT
+    } state = LOCAL_START;
+
+    for (size_t i = 0; i < len; i++) {
+        unsigned char cls = EMAIL_CLASS_OF(p[i]);
+
+        if ((cls & (EMAIL_CHAR_LOCAL | EMAIL_CHAR_DOT)) == EMAIL_CHAR_LOCAL) {
+            state = LOCAL;
+        } else if ((cls & EMAIL_CHAR_DOT) && state == LOCAL) {
+            // Leading dots and consecutive dots are rejected here
+            state = LOCAL_DOT;
+        } else if (p[i] == '@' && state == LOCAL) {
+            // Empty local part or trailing dot before '@' are rejected
+            *at = i;
+            return EMAIL_VALID;
+        } else if (cls & EMAIL_CHAR_DOT) {
+            EMAIL_FAIL(state == LOCAL_START ? EMAIL_LOCAL_LEADING_DOT
+                                            : EMAIL_LOCAL_DOUBLE_DOT, i);
+        } else if (p[i] == '@') {
+            EMAIL_FAIL(state == LOCAL_START ? EMAIL_EMPTY_LOCAL
+                                            : EMAIL_LOCAL_TRAILING_DOT, i);
+        } else {
+            EMAIL_FAIL(cls & EMAIL_CHAR_SPACE ? EMAIL_WHITESPACE
+                                              : EMAIL_BAD_LOCAL_CHAR, i);
+        }
+    }
+
+    EMAIL_FAIL(EMAIL_MISSING_AT, len);
+}
+
+/**
+ * Function: email_scan_domain
+ * Purpose: Checks the domain p[start..len), where p[start - 1] is the '@'
+ *
+ * Parameters:
+ *   p      - pointer to the first byte of the address
+ *   start  - position of the first domain byte (at least 1)
+ *   len    - number of bytes in the address
+ *   offset - receives the position of the offending byte on failure, may be NULL
+ *   tld    - receives the position of the TLD (the byte after the last '.')
+ *            when the domain is valid, may be NULL
+ *
+ * Returns:
+ *   EMAIL_VALID, or the first rule the domain breaks
+ *
+ * States:
+ *   DOMAIN_START  - nothing read yet (last byte was the '@')
+ *   DOMAIN        - last byte was a letter or digit
+ *   DOMAIN_DOT    - last byte was a '.'
+ *   DOMAIN_HYPHEN - last byte was a '-'
+ */
+static inline email_reason email_scan_domain(const char* p, size_t start, size_t len,
+                                             size_t* offset, size_t* tld) {
+    enum {
+        DOMAIN_START,
+        DOMAIN,
+        DOMAIN_DOT,
+        DOMAIN_HYPHEN
+    } state = DOMAIN_START;
+
+    size_t last_dot_pos = 0;  // position of the last '.' seen in the domain
+
+    for (size_t i = start; i < len; i++) {
+        unsigned char cls = EMAIL_CLASS_OF(p[i]);
+
+        if (cls & EMAIL_CHAR_ALNUM) {
+            state = DOMAIN;
+        } else if ((cls & EMAIL_CHAR_DOT) && (state == DOMAIN || state == DOMAIN_HYPHEN)) {
+            // The domain cannot start with '.' and cannot contain '..'
+            last_dot_pos = i;
+            state = DOMAIN_DOT;
+        } else if ((cls & EMAIL_CHAR_HYPHEN) && state != DOMAIN_START) {
+            // The domain cannot start with '-'
+            state = DOMAIN_HYPHEN;
+        } else if (cls & (EMAIL_CHAR_DOT | EMAIL_CHAR_HYPHEN)) {
+            EMAIL_FAIL(state == DOMAIN_START ? EMAIL_DOMAIN_BAD_START
+                                             : EMAIL_DOMAIN_DOUBLE_DOT, i);
+        } else if (p[i] == '@') {
+            EMAIL_FAIL(EMAIL_MULTIPLE_AT, i);
+        } else {
+            EMAIL_FAIL(cls & EMAIL_CHAR_SPACE ? EMAIL_WHITESPACE
+                                              : EMAIL_BAD_DOMAIN_CHAR, i);
+        }
+    }
+
+    // The scan must end on a letter or digit: this rejects an empty domain
+    // and a domain ending in '.' or '-'
+    switch (state) {
+    case DOMAIN:
+        break;
+    case DOMAIN_START:
+        EMAIL_FAIL(EMAIL_EMPTY_DOMAIN, len);
+    default:
+        EMAIL_FAIL(EMAIL_DOMAIN_BAD_END, len - 1);
+    }
+
+    // Domain must have at least one dot and a TLD of at least
+    // EMAIL_MIN_TLD_LENGTH characters. The '@' comes before any domain
+    // dot, so position 0 means "no dot".
+    if (last_dot_pos == 0) {
+        EMAIL_FAIL(EMAIL_DOMAIN_NO_DOT, start);
+    }
+    if (len - last_dot_pos - 1 < EMAIL_MIN_TLD_LENGTH) {
+        EMAIL_FAIL(EMAIL_TLD_TOO_SHORT, last_dot_pos + 1);
+    }
+
+    if (tld != NULL) {
+        *tld = last_dot_pos + 1;
+    }
+    return EMAIL_VALID;
+}
+
+/**
+ * Function: email_scan
+ * Purpose: Checks the email address held in p[0..len)
+ *
+ * Parameters:
+ *   p      - pointer to the first byte of the address (need not be NUL-terminated)
+ *   len    - number of bytes in the address
+ *   offset - receives the position of the offending byte on failure, may be NULL
+ *   tld    - receives the position of the TLD (the byte after the last '.')
+ *            when the address is valid, may be NULL
+ *   at     - receives the position of the '@' when the address is valid,
+ *            may be NULL
+ *
+ * Returns:
+ *   EMAIL_VALID, or the first rule the address breaks
+ */
+static inline email_reason email_scan(const char* p, size_t len, size_t* offset,
+                                      size_t* tld, size_t* at) {
+    // Check minimum and maximum length constraints before touching the bytes
+    if (p == NULL) {
+        EMAIL_FAIL(EMAIL_NULL_INPUT, 0);
+    }
+    if (len < MIN_EMAIL_LENGTH) {
+        EMAIL_FAIL(EMAIL_TOO_SHORT, len);
+    }
+    if (len > MAX_EMAIL_LENGTH) {
+        EMAIL_FAIL(EMAIL_TOO_LONG, MAX_EMAIL_LENGTH);
+    }
+
+    size_t at_pos;
+    email_reason reason = email_scan_local(p, len, &at_pos, offset);
+    if (reason != EMAIL_VALID) {
+        return reason;
+    }
+    if (at != NULL) {
+        *at = at_pos;
+    }
+    return email_scan_domain(p, at_pos + 1, len, offset, tld);
+}
+
+#undef EMAIL_FAIL
+
+/**
+ * Function: is_valid_email_n
+ * Purpose: Validates the email address held in p[0..len)
+ *
+ * Parameters:
+ *   p   - pointer to the first byte of the address (need not be NUL-terminated)
+ *   len - number of bytes in the address
+ *
+ * Returns:
+ *   true if email is valid, false otherwise
+ */
+bool is_valid_email_n(const char* p, size_t len) {
+    // Cheap checks first; see email_precheck()
+    email_reject_stage stage = email_precheck(p, len);
+    bool valid = stage == EMAIL_STAGE_PASSED &&
+                 email_scan(p, len, NULL, NULL, NULL) == EMAIL_VALID;
+
+    EMAIL_PROFILE_VERDICT(stage == EMAIL_STAGE_PASSED && !valid ? EMAIL_STAGE_FULL_SCAN : stage,
+                          valid, p, len);
+    EMAIL_METRICS_VERDICT(valid, p, len, email_check);
+    return valid;
+}
+
+bool email_valid_uncounted(const char* p, size_t len) {
+    return email_precheck(p, len) == EMAIL_STAGE_PASSED &&
+           email_scan(p, len, NULL, NULL, NULL) == EMAIL_VALID;
+}
+
+/**
+ * Function: email_check
+ * Purpose: Validates p[0..len) and says why it was rejected
+ *
+ * Parameters:
+ *   p      - pointer to the first byte of the address (need not be NUL-terminated)
+ *   len    - number of bytes in the address
+ *   offset - receives the position of the offending byte, may be NULL;
+ *            for rules about the end of the address it is len or the
+ *            start of the part at fault
+ *
+ * Returns:
+ *   EMAIL_VALID, or the first rule the address breaks in scan order
+ */
+email_reason email_check(const char* p, size_t len, size_t* offset) {
+    return email_scan(p, len, offset, NULL, NULL);
+}
+
+/**
+ * Function: email_check_split
+ * Purpose: email_check() that also gives the position of the '@' of a
+ *          valid address in *at, for callers that split it there
+ */
+email_reason email_check_split(const char* p, size_t len, size_t* offset, size_t* at) {
+    return email_scan(p, len, offset, NULL, at);
+}
+
+/**
+ * Function: email_check_strict
+ * Purpose: email_check() plus a lookup of the TLD in the known-TLD list
+ *
+ * Returns:
+ *   as email_check(), or EMAIL_UNKNOWN_TLD with *offset at the start of
+ *   the TLD when the address is well-formed but its TLD is not known
+ */
+email_reason email_check_strict(const char* p, size_t len, size_t* offset) {
+    size_t tld;
+    email_reason reason = email_scan(p, len, offset, &tld, NULL);
+
+    if (reason == EMAIL_VALID && !email_tld_is_known(p + tld, len - tld)) {
+        if (offset != NULL) {
+            *offset = tld;
+        }
+        return EMAIL_UNKNOWN_TLD;
+    }
+    return reason;
+}
+
+/**
+ * Function: is_valid_email_strict
+ * Purpose: is_valid_email_n() that also requires a known TLD
+ *
+ * The TLD is the one the scan found after the last '.', so the lookup
+ * adds no second pass over the address.
+ */
+bool is_valid_email_strict(const char* p, size_t len) {
+    bool valid = email_valid_strict_uncounted(p, len);
+
+    EMAIL_METRICS_VERDICT(valid, p, len, email_check_strict);
+    return valid;
+}
+
+bool email_valid_strict_uncounted(const char* p, size_t len) {
+    size_t tld;
+    return email_precheck(p, len) == EMAIL_STAGE_PASSED &&
+           email_scan(p, len, NULL, &tld, NULL) == EMAIL_VALID &&
+           email_tld_is_known(p + tld, len - tld);
+}
+
+/*
+ * The local part of an address that passed email_precheck(): the first
+ * byte is known to be a local-part byte other than '.', and so is the one
+ * before the first '@'. What is left is to find that '@' and to make sure
+ * there is no '..' on the way, which takes one load and no unpredictable
+ * branch per byte. Gives the same verdict as email_scan_local().
+ */
+static inline bool email_local_after_precheck(const char* p, size_t len, size_t* at) {
+    unsigned prev = EMAIL_CLASS_OF(p[0]);
+    unsigned pairs = 0;
+    size_t i = 1;
+
+    while (i < len) {
+        unsigned cls = EMAIL_CLASS_OF(p[i]);
+        if (!(cls & EMAIL_CHAR_LOCAL)) {
+            break;
+        }
+        pairs |= prev & cls;
+        prev = cls;
+        i++;
+    }
+
+    *at = i;
+    return i < len && p[i] == '@' && !(pairs & EMAIL_CHAR_DOT) && !(prev & EMAIL_CHAR_DOT);
+}
+
+/**
+ * Function: email_validate_cached
+ * Purpose: is_valid_email_n(), or is_valid_email_strict() when strict is
+ *          set, with the domain verdict taken from cache when it is there
+ *
+ * The verdict cached for a domain is the answer of email_scan_domain()
+ * and the position of its TLD, so the known-TLD lookup of strict mode
+ * needs no scan either; that lookup itself is not cached, since the TLD
+ * list can be reloaded while the cache lives.
+ */
+bool email_validate_cached(email_domain_cache* cache, const char* p, size_t len,
+                           bool strict) {
+    email_reject_stage stage = email_precheck(p, len);
+    size_t at_pos = 0;
+    unsigned verdict = 0;
+
+    if (stage == EMAIL_STAGE_PASSED && email_local_after_precheck(p, len, &at_pos)) {
+        email_domain_key key;
+        if (!email_domain_cache_lookup(cache, p + at_pos + 1, len - at_pos - 1, &key, &verdict)) {
+            size_t tld;
+            verdict = email_scan_domain(p, at_pos + 1, len, NULL, &tld) == EMAIL_VALID
+                          ? EMAIL_DOMAIN_OK | (unsigned)(tld - at_pos - 1) << EMAIL_DOMAIN_TLD_SHIFT
+                          : 0;
+            email_domain_cache_store(cache, &key, verdict);
+        }
+    }
+
+    bool valid = (verdict & EMAIL_DOMAIN_OK) != 0;
+    if (strict) {
+        size_t tld = at_pos + 1 + (verdict >> EMAIL_DOMAIN_TLD_SHIFT);
+        valid = valid && email_tld_is_known(p + tld, len - tld);
+        EMAIL_METRICS_VERDICT(valid, p, len, email_check_strict);
+        return valid;
+    }
+
+    EMAIL_PROFILE_VERDICT(stage == EMAIL_STAGE_PASSED && !valid ? EMAIL_STAGE_FULL_SCAN : stage,
+                          valid, p, len);
+    EMAIL_METRICS_VERDICT(valid, p, len, email_check);
+    return valid;
+}
+
+/**
+ * Function: is_valid_email_cached
+ * Purpose: is_valid_email_n() that looks domains up in cache first
+ *
+ * Parameters:
+ *   cache - a cache from email_domain_cache_create(), may be shared by threads
+ *   p     - pointer to the first byte of the address (need not be NUL-terminated)
+ *   len   - number of bytes in the address
+ *
+ * Returns:
+ *   true if email is valid, false otherwise
+ */
+bool is_valid_email_cached(email_domain_cache* cache, const char* p, size_t len) {
+    return email_validate_cached(cache, p, len, false);
+}
+
+/**
+ * Function: email_reason_name
+ * Purpose: Returns the reason code as a short constant-style name
+ */
+const char* email_reason_name(email_reason reason) {
+    switch (reason) {
+    case EMAIL_VALID:              return "VALID";
+    case EMAIL_NULL_INPUT:         return "NULL_INPUT";
+    case EMAIL_TOO_SHORT:          return "TOO_SHORT";
+    case EMAIL_TOO_LONG:           return "TOO_LONG";
+    case EMAIL_WHITESPACE:         return "WHITESPACE";
+    case EMAIL_MISSING_AT:         return "MISSING_AT";
+    case EMAIL_MULTIPLE_AT:        return "MULTIPLE_AT";
+    case EMAIL_EMPTY_LOCAL:        return "EMPTY_LOCAL";
+    case EMAIL_LOCAL_LEADING_DOT:  return "LOCAL_LEADING_DOT";
+    case EMAIL_LOCAL_TRAILING_DOT: return "LOCAL_TRAILING_DOT";
+    case EMAIL_LOCAL_DOUBLE_DOT:   return "LOCAL_DOUBLE_DOT";
+    case EMAIL_BAD_LOCAL_CHAR:     return "BAD_LOCAL_CHAR";
+    case EMAIL_EMPTY_DOMAIN:       return "EMPTY_DOMAIN";
+    case EMAIL_DOMAIN_BAD_START:   return "DOMAIN_BAD_START";
+    case EMAIL_DOMAIN_BAD_END:     return "DOMAIN_BAD_END";
+    case EMAIL_DOMAIN_DOUBLE_DOT:  return "DOMAIN_DOUBLE_DOT";
+    case EMAIL_BAD_DOMAIN_CHAR:    return "BAD_DOMAIN_CHAR";
+    case EMAIL_DOMAIN_NO_DOT:      return "DOMAIN_NO_DOT";
+    case EMAIL_TLD_TOO_SHORT:      return "TLD_TOO_SHORT";
+    case EMAIL_UNKNOWN_TLD:        return "UNKNOWN_TLD";
+    case EMAIL_BAD_UTF8:           return "BAD_UTF8";
+    case EMAIL_BAD_IDN:            return "BAD_IDN";
+    case EMAIL_LOCAL_TOO_LONG:     return "LOCAL_TOO_LONG";
+    case EMAIL_LABEL_TOO_LONG:     return "LABEL_TOO_LONG";
+    case EMAIL_BAD_QUOTED_LOCAL:   return "BAD_QUOTED_LOCAL";
+    case EMAIL_BAD_ADDRESS_LITERAL: return "BAD_ADDRESS_LITERAL";
+    default:                       return "UNKNOWN";
+    }
+}
+
+/**
+ * Function: email_reason_message
+ * Purpose: Returns a one-line, human-readable explanation of a reason code
+ */
+const char* email_reason_message(email_reason reason) {
+    switch (reason) {
+    case EMAIL_VALID:              return "valid email address";
+    case EMAIL_NULL_INPUT:         return "no address given";
+    case EMAIL_TOO_SHORT:          return "address is too short (at least " EMAIL_STR(MIN_EMAIL_LENGTH) " characters)";
+    case EMAIL_TOO_LONG:           return "address is too long (at most " EMAIL_STR(MAX_EMAIL_LENGTH) " characters)";
+    case EMAIL_WHITESPACE:         return "spaces are not allowed";
+    case EMAIL_MISSING_AT:         return "must contain an '@' symbol";
+    case EMAIL_MULTIPLE_AT:        return "must contain exactly one '@' symbol";
+    case EMAIL_EMPTY_LOCAL:        return "must have text before the '@'";
+    case EMAIL_LOCAL_LEADING_DOT:  return "cannot start with '.'";
+    case EMAIL_LOCAL_TRAILING_DOT: return "cannot have '.' right before the '@'";
+    case EMAIL_LOCAL_DOUBLE_DOT:   return "cannot contain '..' before the '@'";
+    case EMAIL_BAD_LOCAL_CHAR:     return "only letters, digits and . - _ + are allowed before the '@'";
+    case EMAIL_EMPTY_DOMAIN:       return "must have text after the '@'";
+    case EMAIL_DOMAIN_BAD_START:   return "domain cannot start with '.' or '-'";
+    case EMAIL_DOMAIN_BAD_END:     return "domain cannot end with '.' or '-'";
+    case EMAIL_DOMAIN_DOUBLE_DOT:  return "domain cannot contain '..'";
+    case EMAIL_BAD_DOMAIN_CHAR:    return "only letters, digits, '.' and '-' are allowed in the domain";
+    case EMAIL_DOMAIN_NO_DOT:      return "domain must contain at least one '.' (dot)";
+    case EMAIL_TLD_TOO_SHORT:      return "must end with a domain extension of at least " EMAIL_STR(EMAIL_MIN_TLD_LENGTH) " characters";
+    case EMAIL_UNKNOWN_TLD:        return "domain extension is not a known top-level domain";
+    case EMAIL_BAD_UTF8:           return "address is not valid UTF-8";
+    case EMAIL_BAD_IDN:            return "character is not allowed in an internationalized domain";
+    case EMAIL_LOCAL_TOO_LONG:     return "at most " EMAIL_STR(EMAIL_RFC_MAX_LOCAL) " characters are allowed before the '@'";
+    case EMAIL_LABEL_TOO_LONG:     return "a domain label has at most " EMAIL_STR(EMAIL_RFC_MAX_LABEL) " characters";
+    case EMAIL_BAD_QUOTED_LOCAL:   return "malformed quoted text before the '@'";
+    case EMAIL_BAD_ADDRESS_LITERAL: return "malformed IP address in '[' ']'";
+    default:                       return "unknown reason";
+    }
+}
+
+/**
+ * Function: email_reject_stage_name
+ * Purpose: Returns the precheck stage as a short constant-style name
+ */
+const char* email_reject_stage_name(email_reject_stage stage) {
+    switch (stage) {
+    case EMAIL_STAGE_PASSED:      return "PASSED";
+    case EMAIL_STAGE_LENGTH:      return "LENGTH";
+    case EMAIL_STAGE_FIRST_BYTE:  return "FIRST_BYTE";
+    case EMAIL_STAGE_LAST_BYTES:  return "LAST_BYTES";
+    case EMAIL_STAGE_AT_POSITION: return "AT_POSITION";
+    case EMAIL_STAGE_FULL_SCAN:   return "FULL_SCAN";
+    default:                      return "UNKNOWN";
+    }
+}
+
+/*
+ * Rejection profile
+ *
+ * Only compiled into EMAIL_VALIDATE_PROFILE_REJECTS builds. The counters
+ * are shared by all threads and bumped with relaxed atomic adds; for
+ * rejections the reason is worked out again with email_check(), which is
+ * fine for a build that exists to collect statistics.
+ */
+#ifdef EMAIL_VALIDATE_PROFILE_REJECTS
+static _Atomic uint64_t profile_calls;
+static _Atomic uint64_t profile_valid;
+static _Atomic uint64_t profile_by_stage[EMAIL_STAGE_COUNT];
+static _Atomic uint64_t profile_by_reason[EMAIL_REASON_COUNT];
+
+void email_profile_record(email_reject_stage stage, bool valid, const char* p, size_t len) {
+    atomic_fetch_add_explicit(&profile_calls, 1, memory_order_relaxed);
+    if (valid) {
+        atomic_fetch_add_explicit(&profile_valid, 1, memory_order_relaxed);
+        return;
+    }
+    atomic_fetch_add_explicit(&profile_by_stage[stage], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&profile_by_reason[email_scan(p, len, NULL, NULL, NULL)], 1,
+                              memory_order_relaxed);
+}
+#endif
+
+/**
+ * Function: email_reject_profile_snapshot
+ * Purpose: Copies the rejection counts into *out
+ *
+ * Returns:
+ *   true in a profiling build, false (and all zeros) otherwise
+ *
+ * The counters are read one by one while other threads may be adding to
+ * them, so the totals of a snapshot taken under load can be off by the
+ * verdicts in flight.
+ */
+bool email_reject_profile_snapshot(email_reject_profile* out) {
+    memset(out, 0, sizeof(*out));
+#ifdef EMAIL_VALIDATE_PROFILE_REJECTS
+    out->calls = atomic_load_explicit(&profile_calls, memory_order_relaxed);
+    out->valid = atomic_load_explicit(&profile_valid, memory_order_relaxed);
+    for (int i = 0; i < EMAIL_STAGE_COUNT; i++) {
+        out->by_stage[i] = atomic_load_explicit(&profile_by_stage[i], memory_order_relaxed);
+    }
+    for (int i = 0; i < EMAIL_REASON_COUNT; i++) {
+        out->by_reason[i] = atomic_load_explicit(&profile_by_reason[i], memory_order_relaxed);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Function: email_reject_profile_reset
+ * Purpose: Sets all rejection counts back to zero
+ */
+void email_reject_profile_reset(void) {
+#ifdef EMAIL_VALIDATE_PROFILE_REJECTS
+    atomic_store_explicit(&profile_calls, 0, memory_order_relaxed);
+    atomic_store_explicit(&profile_valid, 0, memory_order_relaxed);
+    for (int i = 0; i < EMAIL_STAGE_COUNT; i++) {
+        atomic_store_explicit(&profile_by_stage[i], 0, memory_order_relaxed);
+    }
+    for (int i = 0; i < EMAIL_REASON_COUNT; i++) {
+        atomic_store_explicit(&profile_by_reason[i], 0, memory_order_relaxed);
+    }
+#endif
+}
+
+/**
+ * Function: is_valid_email
+ * Purpose: Validates a NUL-terminated email address
+ *
+ * Parameters:
+ *   email - pointer to the email string to validate
+ *
+ * Returns:
+ *   true if email is valid, false otherwise
+ *
+ * Anything longer than MAX_EMAIL_LENGTH is invalid, so the terminator is
+ * only searched for in the first MAX_EMAIL_LENGTH + 1 bytes.
+ */
+bool is_valid_email(const char* email) {
+    // Check for NULL pointer - safety first
+    if (email == NULL) {
+        return false;
+    }
+
+    EMAIL_METRICS_START(start);
+    bool valid = is_valid_email_n(email, strnlen(email, MAX_EMAIL_LENGTH + 1));
+    EMAIL_METRICS_STOP(EMAIL_METRICS_SINGLE, start);
+    return valid;
+}
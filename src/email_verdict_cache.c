@@ -0,0 +1,389 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "email_internal.h"
+
+/*
+ * Persistent verdict cache
+ *
+ * The file is a 64-byte header and a power-of-two array of 16-byte
+ * slots, mapped MAP_SHARED so every process works on the same pages. A
+ * slot is two atomic words:
+ *
+ *   key    the 64-bit hash of the address and mode, 0 while empty
+ *   value  0 while being written, otherwise
+ *            bits  0..31  checked_at
+ *            bits 32..39  reason
+ *            bits 40..43  DNS status + 1, 0 when not checked
+ *            bits 44..62  the top 19 bits of the key it belongs to
+ *            bit  63      set, so a written value is never 0
+ *
+ * An address may sit in any of the EMAIL_VERDICT_WINDOW slots from its
+ * hash on. Slots are never emptied again, so a probe stops at the first
+ * empty one. A writer claims an empty slot by swapping its key from 0,
+ * updates its own entry by swapping the value it read for the new one,
+ * and evicts the oldest entry of a full window by swapping that entry's
+ * value to 0 first: nobody else touches a slot whose value is 0, so the
+ * key can then be replaced and the value stored. A reader trusts a value
+ * only when its tag matches and the key reads the same after it, so an
+ * eviction racing with the lookup shows as a miss, never as the verdict
+ * of another address. A writer that dies half way leaves one slot with
+ * a value of 0, which is skipped from then on.
+ *
+ * The hash is the format: changing it, or the value layout, needs a new
+ * EMAIL_VERDICT_VERSION.
+ */
+#define EMAIL_VERDICT_MAGIC "EMVERDCT"
+#define EMAIL_VERDICT_VERSION 1
+#define EMAIL_VERDICT_BYTE_ORDER 0x01020304u
+#define EMAIL_VERDICT_DEFAULT_SLOTS ((size_t)1 << 20)
+#define EMAIL_VERDICT_MIN_SLOTS 64
+#define EMAIL_VERDICT_MAX_SLOTS ((size_t)1 << 32)
+#define EMAIL_VERDICT_WINDOW 8
+
+#define EMAIL_VERDICT_TAG(key) ((key) >> 45)
+#define EMAIL_VERDICT_VALUE_TAG(v) (((v) >> 44) & 0x7FFFF)
+#define EMAIL_VERDICT_PRESENT ((uint64_t)1 << 63)
+
+_Static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_LONG_LOCK_FREE == 2,
+               "slots are shared between processes, so their atomics must not take locks");
+_Static_assert(EMAIL_DNS_CANCELLED + 1 < 16, "the DNS status fits its 4 bits");
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t slots;
+    _Atomic uint64_t used;  // slots claimed, by every process
+    char reserved[32];
+} email_verdict_header;
+
+_Static_assert(sizeof(email_verdict_header) == 64, "the slots start on a cache line");
+
+typedef struct {
+    _Atomic uint64_t key;
+    _Atomic uint64_t value;
+} email_verdict_slot;
+
+struct email_verdict_cache {
+    email_verdict_header* header;
+    email_verdict_slot* slots;
+    size_t mask;
+    size_t map_size;
+
+    // This handle's counters
+    _Atomic uint64_t hits;
+    _Atomic uint64_t misses;
+    _Atomic uint64_t stores;
+    _Atomic uint64_t evictions;
+};
+
+static inline void email_verdict_count(_Atomic uint64_t* counter) {
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+/*
+ * The hash of p[0..len), len <= MAX_EMAIL_LENGTH, with its domain,
+ * everything after the last '@', lowercased, and mixed with seed
+ */
+uint64_t email_address_hash(const char* p, size_t len, uint64_t seed) {
+    char buf[MAX_EMAIL_LENGTH + 8];
+    const char* at = email_domain_at(p, len);
+    size_t local = at != NULL ? (size_t)(at - p) : len;
+
+    memcpy(buf, p, local);
+    for (size_t i = local; i < len; i++) {
+        char c = p[i];
+        buf[i] = c >= 'A' && c <= 'Z' ? (char)(c | 0x20) : c;
+    }
+
+    uint64_t h = len ^ seed;
+    for (size_t i = 0; i < len; i += 8) {
+        h = (h ^ email_load_word(buf + i, len - i)) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 29;
+    }
+    // The splitmix64 finalizer: the hash is the whole identity of an entry
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBull;
+    h ^= h >> 31;
+    return h;
+}
+
+// The key of p[0..len) in mode; never 0, the empty key
+static inline uint64_t email_verdict_key(unsigned mode, const char* p, size_t len) {
+    uint64_t h = email_address_hash(p, len, (uint64_t)mode << 56);
+    return h != 0 ? h : 1;
+}
+
+static inline uint64_t email_verdict_pack(uint64_t key, const email_verdict* v,
+                                          uint32_t checked_at) {
+    uint64_t dns = v->dns >= 0 && v->dns <= EMAIL_DNS_CANCELLED ? (uint64_t)v->dns + 1 : 0;
+    return EMAIL_VERDICT_PRESENT | EMAIL_VERDICT_TAG(key) << 44 | dns << 40 |
+           (uint64_t)(v->reason & 0xFF) << 32 | checked_at;
+}
+
+static inline void email_verdict_unpack(uint64_t value, email_verdict* out) {
+    out->reason = (email_reason)((value >> 32) & 0xFF);
+    out->dns = (int)((value >> 40) & 0xF) - 1;
+    out->checked_at = (uint32_t)value;
+}
+
+/**
+ * Function: email_verdict_cache_open
+ * Purpose: Maps the cache file at path, creating or finishing it first
+ *
+ * Parameters:
+ *   path  - the file
+ *   slots - entries for a new file, 0 for the default
+ *
+ * Returns:
+ *   the cache, or NULL with errno set
+ *
+ * The whole set-up runs under an exclusive flock(), so a file is
+ * initialised by exactly one process. A file whose header is still all
+ * zeros was left by a process that died setting it up, and is set up
+ * again.
+ */
+email_verdict_cache* email_verdict_cache_open(const char* path, size_t slots) {
+    if (path == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (slots == 0) {
+        slots = EMAIL_VERDICT_DEFAULT_SLOTS;
+    }
+    if (slots > EMAIL_VERDICT_MAX_SLOTS) {
+        errno = EINVAL;
+        return NULL;
+    }
+    size_t want = EMAIL_VERDICT_MIN_SLOTS;
+    while (want < slots) {
+        want <<= 1;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    email_verdict_cache* c = NULL;
+    void* map = MAP_FAILED;
+    size_t size = 0;
+    int saved = 0;
+
+    struct stat st;
+    email_verdict_header h;
+    static const email_verdict_header zero;
+    ssize_t got = 0;
+    if (flock(fd, LOCK_EX) != 0 || fstat(fd, &st) != 0 ||
+        (st.st_size > 0 && (got = pread(fd, &h, sizeof(h), 0)) < 0)) {
+        saved = errno;
+        goto out;
+    }
+
+    if (st.st_size == 0 ||
+        ((size_t)got == sizeof(h) && memcmp(&h, &zero, sizeof(h)) == 0)) {
+        // New: size the file, zero-filled (sparse), then write the header
+        size = sizeof(email_verdict_header) + want * sizeof(email_verdict_slot);
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, EMAIL_VERDICT_MAGIC, sizeof(h.magic));
+        h.version = EMAIL_VERDICT_VERSION;
+        h.byte_order = EMAIL_VERDICT_BYTE_ORDER;
+        h.slots = want;
+        ssize_t put;
+        if (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)size) != 0 ||
+            (put = pwrite(fd, &h, sizeof(h), 0)) < 0) {
+            saved = errno;
+            goto out;
+        }
+        if (put != (ssize_t)sizeof(h)) {
+            saved = EIO;
+            goto out;
+        }
+    } else {
+        if ((size_t)got != sizeof(h) ||
+            memcmp(h.magic, EMAIL_VERDICT_MAGIC, sizeof(h.magic)) != 0 ||
+            h.version != EMAIL_VERDICT_VERSION || h.byte_order != EMAIL_VERDICT_BYTE_ORDER ||
+            h.slots < EMAIL_VERDICT_MIN_SLOTS || h.slots > EMAIL_VERDICT_MAX_SLOTS ||
+            (h.slots & (h.slots - 1)) != 0 ||
+            (uint64_t)st.st_size != sizeof(h) + h.slots * sizeof(email_verdict_slot)) {
+            saved = EINVAL;
+            goto out;
+        }
+        size = (size_t)st.st_size;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        saved = errno;
+        goto out;
+    }
+    c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        saved = ENOMEM;
+        munmap(map, size);
+        goto out;
+    }
+    c->header = map;
+    c->slots = (email_verdict_slot*)((char*)map + sizeof(email_verdict_header));
+    c->mask = (size_t)c->header->slots - 1;
+    c->map_size = size;
+
+out:
+    // Closing the descriptor drops the lock; the mapping stays
+    close(fd);
+    if (c == NULL) {
+        errno = saved;
+    }
+    return c;
+}
+
+void email_verdict_cache_close(email_verdict_cache* cache) {
+    if (cache == NULL) {
+        return;
+    }
+    munmap(cache->header, cache->map_size);
+    free(cache);
+}
+
+bool email_verdict_cache_get(email_verdict_cache* cache, unsigned mode,
+                             const char* p, size_t len, uint32_t max_age,
+                             email_verdict* out) {
+    if (cache == NULL || p == NULL || len > MAX_EMAIL_LENGTH) {
+        return false;
+    }
+    uint64_t key = email_verdict_key(mode, p, len);
+
+    for (size_t i = 0; i < EMAIL_VERDICT_WINDOW; i++) {
+        email_verdict_slot* s = &cache->slots[(key + i) & cache->mask];
+        uint64_t k = atomic_load_explicit(&s->key, memory_order_acquire);
+        if (k == 0) {
+            break;
+        }
+        if (k != key) {
+            continue;
+        }
+        uint64_t v = atomic_load_explicit(&s->value, memory_order_acquire);
+        if (v == 0 || EMAIL_VERDICT_VALUE_TAG(v) != EMAIL_VERDICT_TAG(key) ||
+            atomic_load_explicit(&s->key, memory_order_relaxed) != key) {
+            continue;
+        }
+        email_verdict verdict;
+        email_verdict_unpack(v, &verdict);
+        uint32_t now = (uint32_t)time(NULL);
+        if (max_age != 0 && now > verdict.checked_at && now - verdict.checked_at > max_age) {
+            break;
+        }
+        if (out != NULL) {
+            *out = verdict;
+        }
+        email_verdict_count(&cache->hits);
+        return true;
+    }
+    email_verdict_count(&cache->misses);
+    return false;
+}
+
+void email_verdict_cache_put(email_verdict_cache* cache, unsigned mode,
+                             const char* p, size_t len, const email_verdict* verdict) {
+    if (cache == NULL || p == NULL || verdict == NULL || len > MAX_EMAIL_LENGTH) {
+        return;
+    }
+    uint64_t key = email_verdict_key(mode, p, len);
+    uint32_t now = verdict->checked_at != 0 ? verdict->checked_at : (uint32_t)time(NULL);
+    uint64_t value = email_verdict_pack(key, verdict, now);
+
+    // Our own entry, or the first empty slot
+    email_verdict_slot* oldest = NULL;
+    uint64_t oldest_value = 0;
+    for (size_t i = 0; i < EMAIL_VERDICT_WINDOW; i++) {
+        email_verdict_slot* s = &cache->slots[(key + i) & cache->mask];
+        uint64_t k = atomic_load_explicit(&s->key, memory_order_acquire);
+        if (k == 0) {
+            if (atomic_compare_exchange_strong_explicit(&s->key, &k, key,
+                                                        memory_order_acq_rel,
+                                                        memory_order_acquire)) {
+                atomic_store_explicit(&s->value, value, memory_order_release);
+                atomic_fetch_add_explicit(&cache->header->used, 1, memory_order_relaxed);
+                email_verdict_count(&cache->stores);
+                return;
+            }
+            // Claimed under us: fall through with the key that won
+        }
+        uint64_t v = atomic_load_explicit(&s->value, memory_order_acquire);
+        if (k == key) {
+            // 0: someone else is writing this entry right now, let them
+            if (v != 0 && atomic_compare_exchange_strong_explicit(&s->value, &v, value,
+                                                                  memory_order_acq_rel,
+                                                                  memory_order_relaxed)) {
+                email_verdict_count(&cache->stores);
+            }
+            return;
+        }
+        if (v != 0 && (oldest == NULL || (uint32_t)v < (uint32_t)oldest_value)) {
+            oldest = s;
+            oldest_value = v;
+        }
+    }
+
+    // A full window: take over the entry checked longest ago
+    if (oldest == NULL ||
+        !atomic_compare_exchange_strong_explicit(&oldest->value, &oldest_value, 0,
+                                                 memory_order_acq_rel,
+                                                 memory_order_relaxed)) {
+        return;
+    }
+    atomic_store_explicit(&oldest->key, key, memory_order_release);
+    atomic_store_explicit(&oldest->value, value, memory_order_release);
+    email_verdict_count(&cache->stores);
+    email_verdict_count(&cache->evictions);
+}
+
+void email_verdict_cache_snapshot(email_verdict_cache* cache,
+                                  email_verdict_cache_stats* out) {
+    memset(out, 0, sizeof(*out));
+    if (cache == NULL) {
+        return;
+    }
+    out->slots = cache->mask + 1;
+    out->used = atomic_load_explicit(&cache->header->used, memory_order_relaxed);
+    out->hits = atomic_load_explicit(&cache->hits, memory_order_relaxed);
+    out->misses = atomic_load_explicit(&cache->misses, memory_order_relaxed);
+    out->stores = atomic_load_explicit(&cache->stores, memory_order_relaxed);
+    out->evictions = atomic_load_explicit(&cache->evictions, memory_order_relaxed);
+}
+
+/**
+ * Function: email_validate_remembered
+ * Purpose: The verdict of p[0..len) from v->verdicts, or from the
+ *          validator, recorded for next time
+ *
+ * Syntax verdicts do not go stale, so any age is taken. Only rejected
+ * addresses are scanned a second time, by v->check, for the reason the
+ * entry keeps.
+ */
+bool email_validate_remembered(const email_validator* v, const char* p, size_t len) {
+    email_verdict verdict;
+    if (email_verdict_cache_get(v->verdicts, v->verdict_mode, p, len, 0, &verdict)) {
+        return verdict.reason == EMAIL_VALID;
+    }
+    bool valid = email_validator_check(v, p, len);
+    if (p != NULL && len <= MAX_EMAIL_LENGTH) {
+        verdict.reason = valid ? EMAIL_VALID : v->check(p, len, NULL);
+        verdict.dns = -1;
+        verdict.checked_at = 0;
+        email_verdict_cache_put(v->verdicts, v->verdict_mode, p, len, &verdict);
+    }
+    return valid;
+}
@@ -0,0 +1,411 @@
+/*
+ * Tests for the asynchronous MX verification stage
+ *
+ * The resolver is pointed at a small DNS server on the loopback interface
+ * that answers from a fixed zone, so nothing here needs the network. Same
+ * conventions as test_email_validate.c: each failed CHECK() prints its
+ * location and the program exits non-zero at the end.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "email_validate.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n",               \
+                    __FILE__, __LINE__, #cond);                         \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+/*
+ * The zone of the fake server. Queries for names starting with "slow" are
+ * never answered; names not listed are NXDOMAIN.
+ */
+typedef enum { ZONE_MX, ZONE_NULL_MX, ZONE_A_ONLY, ZONE_EMPTY, ZONE_NXDOMAIN } zone_kind;
+
+static const struct {
+    const char* name;
+    zone_kind kind;
+    uint32_t ttl;
+} zone[] = {
+    {"mx.test", ZONE_MX, 300},
+    {"nullmx.test", ZONE_NULL_MX, 300},
+    {"a.test", ZONE_A_ONLY, 60},
+    {"none.test", ZONE_EMPTY, 0},
+    {"nocache.test", ZONE_MX, 0},
+};
+
+typedef struct {
+    int fd;
+    unsigned port;
+    pthread_t thread;
+    _Atomic bool stop;
+    _Atomic unsigned queries[COUNT_OF(zone)];   // per zone entry, any type
+    _Atomic unsigned slow_queries;
+} fake_dns;
+
+static void put16(unsigned char* p, unsigned v) {
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)v;
+}
+
+static void put32(unsigned char* p, uint32_t v) {
+    put16(p, v >> 16);
+    put16(p + 2, v & 0xFFFF);
+}
+
+// Appends a record owned by the question name (a pointer to offset 12)
+static size_t put_record(unsigned char* p, unsigned type, uint32_t ttl,
+                         const unsigned char* rdata, unsigned rdlen) {
+    p[0] = 0xC0;
+    p[1] = 12;
+    put16(p + 2, type);
+    put16(p + 4, 1);
+    put32(p + 6, ttl);
+    put16(p + 10, rdlen);
+    memcpy(p + 12, rdata, rdlen);
+    return 12 + rdlen;
+}
+
+static size_t fake_dns_answer(fake_dns* server, const unsigned char* q, size_t len,
+                              unsigned char* out) {
+    char name[256];
+    size_t pos = 12, n = 0;
+    while (pos < len && q[pos] != 0 && n + q[pos] + 1 < sizeof(name)) {
+        size_t label = q[pos++];
+        if (n > 0) {
+            name[n++] = '.';
+        }
+        memcpy(name + n, q + pos, label);
+        n += label;
+        pos += label;
+    }
+    name[n] = '\0';
+    if (pos + 5 > len) {
+        return 0;
+    }
+    unsigned type = (unsigned)q[pos + 1] << 8 | q[pos + 2];
+    size_t question_end = pos + 5;
+
+    if (strncmp(name, "slow", 4) == 0) {
+        atomic_fetch_add(&server->slow_queries, 1);
+        return 0;
+    }
+
+    int found = -1;
+    for (size_t i = 0; i < COUNT_OF(zone); i++) {
+        if (strcmp(zone[i].name, name) == 0) {
+            found = (int)i;
+            atomic_fetch_add(&server->queries[i], 1);
+        }
+    }
+    zone_kind kind = found >= 0 ? zone[found].kind : ZONE_NXDOMAIN;
+    uint32_t ttl = found >= 0 ? zone[found].ttl : 0;
+
+    memcpy(out, q, question_end);
+    out[2] = 0x81;   // response, recursion desired
+    out[3] = 0x80;   // recursion available, NOERROR
+    put16(out + 4, 1);
+    put16(out + 6, 0);
+    put16(out + 8, 0);
+    put16(out + 10, 0);
+    size_t end = question_end;
+
+    static const unsigned char mx[] = {0, 10, 4, 'm', 'a', 'i', 'l', 0xC0, 12};
+    static const unsigned char null_mx[] = {0, 0, 0};
+    static const unsigned char a[] = {192, 0, 2, 1};
+    // Root mname and rname, serial, refresh, retry, expire, minimum 30
+    static const unsigned char soa[] = {0, 0, 0, 0, 0, 1, 0, 0, 0x0E, 0x10, 0, 0, 0x0E, 0x10,
+                                        0, 0, 0x0E, 0x10, 0, 0, 0, 30};
+
+    bool answered = false;
+    if (kind == ZONE_MX && type == 15) {
+        end += put_record(out + end, 15, ttl, mx, sizeof(mx));
+        answered = true;
+    } else if (kind == ZONE_NULL_MX && type == 15) {
+        end += put_record(out + end, 15, ttl, null_mx, sizeof(null_mx));
+        answered = true;
+    } else if ((kind == ZONE_MX || kind == ZONE_A_ONLY) && type == 1) {
+        end += put_record(out + end, 1, ttl, a, sizeof(a));
+        answered = true;
+    }
+    if (answered) {
+        put16(out + 6, 1);
+    } else {
+        if (kind == ZONE_NXDOMAIN) {
+            out[3] |= 3;
+        }
+        end += put_record(out + end, 6, 3600, soa, sizeof(soa));
+        put16(out + 8, 1);
+    }
+    return end;
+}
+
+static void* fake_dns_run(void* arg) {
+    fake_dns* server = arg;
+    unsigned char query[512], reply[512];
+
+    while (!atomic_load(&server->stop)) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t n = recvfrom(server->fd, query, sizeof(query), 0,
+                             (struct sockaddr*)&from, &from_len);
+        if (n < 12) {
+            continue;   // timed out, to look at stop again
+        }
+        size_t len = fake_dns_answer(server, query, (size_t)n, reply);
+        if (len > 0) {
+            sendto(server->fd, reply, len, 0, (struct sockaddr*)&from, from_len);
+        }
+    }
+    return NULL;
+}
+
+static bool fake_dns_start(fake_dns* server) {
+    memset(server, 0, sizeof(*server));
+    server->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (server->fd < 0) {
+        return false;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    struct timeval tv = {0, 20000};
+    if (setsockopt(server->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0 ||
+        bind(server->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        getsockname(server->fd, (struct sockaddr*)&addr, &addr_len) != 0) {
+        close(server->fd);
+        return false;
+    }
+    server->port = ntohs(addr.sin_port);
+    if (pthread_create(&server->thread, NULL, fake_dns_run, server) != 0) {
+        close(server->fd);
+        return false;
+    }
+    return true;
+}
+
+static void fake_dns_stop(fake_dns* server) {
+    atomic_store(&server->stop, true);
+    pthread_join(server->thread, NULL);
+    close(server->fd);
+}
+
+static unsigned zone_queries(fake_dns* server, const char* name) {
+    for (size_t i = 0; i < COUNT_OF(zone); i++) {
+        if (strcmp(zone[i].name, name) == 0) {
+            return atomic_load(&server->queries[i]);
+        }
+    }
+    return 0;
+}
+
+/*
+ * One answer per request; callbacks run on the resolver thread and are
+ * read after email_dns_wait() or email_dns_destroy()
+ */
+typedef struct {
+    int calls;
+    email_dns_status status;
+    char domain[64];
+} answer;
+
+static void record_answer(const char* domain, size_t len, email_dns_status status, void* ctx) {
+    answer* a = ctx;
+    a->calls++;
+    a->status = status;
+    snprintf(a->domain, sizeof(a->domain), "%.*s", (int)len, domain);
+}
+
+static email_dns* resolver_for(fake_dns* server, email_dns_options opts) {
+    char servers[32];
+    snprintf(servers, sizeof(servers), "127.0.0.1:%u", server->port);
+    opts.servers = servers;
+    return email_dns_create(&opts);
+}
+
+static void test_statuses(fake_dns* server) {
+    static const struct {
+        const char* domain;
+        email_dns_status expect;
+    } cases[] = {
+        {"mx.test", EMAIL_DNS_MX},
+        {"nullmx.test", EMAIL_DNS_NO_MAIL},
+        {"a.test", EMAIL_DNS_A},
+        {"none.test", EMAIL_DNS_NO_MAIL},
+        {"missing.test", EMAIL_DNS_NXDOMAIN},
+    };
+    answer answers[COUNT_OF(cases)];
+    memset(answers, 0, sizeof(answers));
+
+    email_dns* dns = resolver_for(server, (email_dns_options){.timeout_ms = 1000});
+    CHECK(dns != NULL);
+    if (dns == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < COUNT_OF(cases); i++) {
+        CHECK(email_dns_submit(dns, cases[i].domain, strlen(cases[i].domain),
+                               record_answer, &answers[i]) == 0);
+    }
+    CHECK(email_dns_wait(dns, 5000) == 0);
+    for (size_t i = 0; i < COUNT_OF(cases); i++) {
+        CHECK(answers[i].calls == 1);
+        CHECK(answers[i].status == cases[i].expect);
+        CHECK(strcmp(answers[i].domain, cases[i].domain) == 0);
+    }
+
+    // The domain of an address, lowercased
+    answer from_address = {0};
+    CHECK(email_dns_submit_address(dns, "User@A.Test", 11, record_answer, &from_address) == 0);
+    CHECK(email_dns_wait(dns, 5000) == 0);
+    CHECK(from_address.status == EMAIL_DNS_A && strcmp(from_address.domain, "a.test") == 0);
+
+    // A quoted local part may hold an '@' itself: the domain follows the last
+    answer quoted = {0};
+    CHECK(email_dns_submit_address(dns, "\"u@x\"@a.test", 12, record_answer, &quoted) == 0);
+    CHECK(email_dns_wait(dns, 5000) == 0);
+    CHECK(quoted.status == EMAIL_DNS_A && strcmp(quoted.domain, "a.test") == 0);
+
+    CHECK(email_dns_submit(dns, "", 0, record_answer, &from_address) == -1 && errno == EINVAL);
+    CHECK(email_dns_submit_address(dns, "no-at", 5, record_answer, &from_address) == -1);
+    CHECK(strcmp(email_dns_status_name(EMAIL_DNS_NXDOMAIN), "NXDOMAIN") == 0);
+    email_dns_destroy(dns);
+}
+
+static void test_dedup_and_cache(fake_dns* server) {
+    email_dns* dns = resolver_for(server, (email_dns_options){.timeout_ms = 1000});
+    CHECK(dns != NULL);
+    if (dns == NULL) {
+        return;
+    }
+    unsigned before = zone_queries(server, "mx.test");
+
+    // Submitted together, in any case: one query between them
+    answer answers[16];
+    memset(answers, 0, sizeof(answers));
+    for (size_t i = 0; i < COUNT_OF(answers); i++) {
+        const char* domain = i % 2 ? "MX.test" : "mx.test";
+        CHECK(email_dns_submit(dns, domain, 7, record_answer, &answers[i]) == 0);
+    }
+    CHECK(email_dns_wait(dns, 5000) == 0);
+    for (size_t i = 0; i < COUNT_OF(answers); i++) {
+        CHECK(answers[i].calls == 1 && answers[i].status == EMAIL_DNS_MX);
+    }
+    CHECK(zone_queries(server, "mx.test") == before + 1);
+
+    // Within the TTL the cache answers
+    answer again = {0};
+    CHECK(email_dns_submit(dns, "mx.test", 7, record_answer, &again) == 0);
+    CHECK(email_dns_wait(dns, 5000) == 0);
+    CHECK(again.status == EMAIL_DNS_MX);
+    CHECK(zone_queries(server, "mx.test") == before + 1);
+
+    // A TTL of 0 is never cached
+    unsigned nocache = zone_queries(server, "nocache.test");
+    for (int k = 0; k < 2; k++) {
+        answer a = {0};
+        CHECK(email_dns_submit(dns, "nocache.test", 12, record_answer, &a) == 0);
+        CHECK(email_dns_wait(dns, 5000) == 0);
+        CHECK(a.status == EMAIL_DNS_MX);
+    }
+    CHECK(zone_queries(server, "nocache.test") == nocache + 2);
+
+    email_dns_stats stats;
+    email_dns_snapshot(dns, &stats);
+    CHECK(stats.submitted == COUNT_OF(answers) + 3);
+    CHECK(stats.cache_hits + stats.joined == COUNT_OF(answers));
+    CHECK(stats.cache_hits >= 1);
+    CHECK(stats.in_flight == 0);
+    email_dns_destroy(dns);
+}
+
+static void test_timeouts_and_limits(fake_dns* server) {
+    email_dns* dns = resolver_for(server, (email_dns_options){
+        .max_in_flight = 2, .timeout_ms = 100, .tries = 1});
+    CHECK(dns != NULL);
+    if (dns == NULL) {
+        return;
+    }
+
+    static const char* const slow[] = {"slow1.test", "slow2.test", "slow3.test", "slow4.test"};
+    answer answers[COUNT_OF(slow)];
+    memset(answers, 0, sizeof(answers));
+    for (size_t i = 0; i < COUNT_OF(slow); i++) {
+        CHECK(email_dns_submit(dns, slow[i], strlen(slow[i]), record_answer, &answers[i]) == 0);
+    }
+    CHECK(email_dns_wait(dns, 10000) == 0);
+    for (size_t i = 0; i < COUNT_OF(slow); i++) {
+        CHECK(answers[i].calls == 1 && answers[i].status == EMAIL_DNS_TIMEOUT);
+    }
+
+    email_dns_stats stats;
+    email_dns_snapshot(dns, &stats);
+    CHECK(stats.in_flight_peak == 2);
+    CHECK(stats.timeouts == COUNT_OF(slow));
+
+    // Timeouts are not cached
+    unsigned sent = atomic_load(&server->slow_queries);
+    answer retry = {0};
+    CHECK(email_dns_submit(dns, "slow1.test", 10, record_answer, &retry) == 0);
+    CHECK(email_dns_wait(dns, 10000) == 0);
+    CHECK(retry.status == EMAIL_DNS_TIMEOUT);
+    CHECK(atomic_load(&server->slow_queries) > sent);
+    email_dns_destroy(dns);
+
+    // A full queue refuses new requests; destroying cancels the rest
+    dns = resolver_for(server, (email_dns_options){.max_pending = 2, .timeout_ms = 10000});
+    CHECK(dns != NULL);
+    if (dns == NULL) {
+        return;
+    }
+    memset(answers, 0, sizeof(answers));
+    CHECK(email_dns_submit(dns, slow[0], 10, record_answer, &answers[0]) == 0);
+    CHECK(email_dns_submit(dns, slow[1], 10, record_answer, &answers[1]) == 0);
+    CHECK(email_dns_submit(dns, slow[2], 10, record_answer, &answers[2]) == -1 && errno == EAGAIN);
+    CHECK(email_dns_wait(dns, 50) == -1 && errno == ETIMEDOUT);
+    email_dns_destroy(dns);
+    CHECK(answers[0].calls == 1 && answers[0].status == EMAIL_DNS_CANCELLED);
+    CHECK(answers[1].calls == 1 && answers[1].status == EMAIL_DNS_CANCELLED);
+    CHECK(answers[2].calls == 0);
+}
+
+int main(void) {
+    fake_dns server;
+    if (!fake_dns_start(&server)) {
+        perror("fake DNS server");
+        return 1;
+    }
+
+    test_statuses(&server);
+    test_dedup_and_cache(&server);
+    test_timeouts_and_limits(&server);
+
+    fake_dns_stop(&server);
+    if (failures != 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,2217 @@
+/*
+ * Tests for the email validation library
+ *
+ * Plain C with no test framework: each CHECK() that fails prints its
+ * location and the program exits non-zero at the end. Run through ctest
+ * or directly.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "email_validate.h"
+#include "email_arrow.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n",               \
+                    __FILE__, __LINE__, #cond);                         \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+#define CHECK_MSG(cond, ...)                                            \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: CHECK failed: %s: ",               \
+                    __FILE__, __LINE__, #cond);                         \
+            fprintf(stderr, __VA_ARGS__);                               \
+            fputc('\n', stderr);                                        \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+/* ---- Rule table ------------------------------------------------------------ */
+
+typedef struct {
+    const char* email;
+    email_reason reason;
+    size_t offset;
+} rule_case;
+
+static const rule_case RULE_CASES[] = {
+    { "john.doe@example.com",      EMAIL_VALID,              0 },
+    { "a@b.cd",                    EMAIL_VALID,              0 },
+    { "first_last+tag@sub-domain.example.co.uk", EMAIL_VALID, 0 },
+    { "-x-@a-.b-c.de",             EMAIL_VALID,              0 },
+    { "UPPER@CASE.ORG",            EMAIL_VALID,              0 },
+    { "+x@b.cd",                   EMAIL_VALID,              0 },
+    { "a@b.c-d",                   EMAIL_VALID,              0 },
+    { "a-@1.23",                   EMAIL_VALID,              0 },
+    { "a@b.c",                     EMAIL_TLD_TOO_SHORT,      4 },
+    { "a@bc",                      EMAIL_TOO_SHORT,          4 },
+    { "john doe@example.com",      EMAIL_WHITESPACE,         4 },
+    { "john@exa mple.com",         EMAIL_WHITESPACE,         8 },
+    { "johnexample.com",           EMAIL_MISSING_AT,         15 },
+    { "john@@example.com",         EMAIL_MULTIPLE_AT,        5 },
+    { "jo@hn@example.com",         EMAIL_MULTIPLE_AT,        5 },
+    { "@example.com",              EMAIL_EMPTY_LOCAL,        0 },
+    { ".john@example.com",         EMAIL_LOCAL_LEADING_DOT,  0 },
+    { "john.@example.com",         EMAIL_LOCAL_TRAILING_DOT, 5 },
+    { "jo..hn@example.com",        EMAIL_LOCAL_DOUBLE_DOT,   3 },
+    { "jo!hn@example.com",         EMAIL_BAD_LOCAL_CHAR,     2 },
+    { "john@",                     EMAIL_EMPTY_DOMAIN,       5 },
+    { "john@.example.com",         EMAIL_DOMAIN_BAD_START,   5 },
+    { "john@-example.com",         EMAIL_DOMAIN_BAD_START,   5 },
+    { "john@example.com.",         EMAIL_DOMAIN_BAD_END,     16 },
+    { "john@example.com-",         EMAIL_DOMAIN_BAD_END,     16 },
+    { "john@example..com",         EMAIL_DOMAIN_DOUBLE_DOT,  13 },
+    { "john@exa_mple.com",         EMAIL_BAD_DOMAIN_CHAR,    8 },
+    { "john@examplecom",           EMAIL_DOMAIN_NO_DOT,      5 },
+    { "john@example.c",            EMAIL_TLD_TOO_SHORT,      13 },
+    { "jos\xc3\xa9@example.com",   EMAIL_BAD_LOCAL_CHAR,     3 },
+};
+
+static void test_rules(void) {
+    for (size_t i = 0; i < COUNT_OF(RULE_CASES); i++) {
+        const rule_case* c = &RULE_CASES[i];
+        size_t len = strlen(c->email);
+        bool expect = c->reason == EMAIL_VALID;
+        size_t offset = 12345;
+
+        email_reason got = email_check(c->email, len, &offset);
+        CHECK_MSG(got == c->reason, "'%s': got %s, want %s", c->email,
+                  email_reason_name(got), email_reason_name(c->reason));
+        if (!expect) {
+            CHECK_MSG(offset == c->offset, "'%s': offset %zu, want %zu",
+                      c->email, offset, c->offset);
+        }
+
+        CHECK_MSG(is_valid_email_reference(c->email) == expect, "reference '%s'", c->email);
+        CHECK_MSG(is_valid_email(c->email) == expect, "is_valid_email '%s'", c->email);
+        CHECK_MSG(is_valid_email_n(c->email, len) == expect, "n '%s'", c->email);
+        CHECK_MSG(is_valid_email_simd(c->email, len) == expect, "simd '%s'", c->email);
+    }
+
+    CHECK(!is_valid_email(NULL));
+    CHECK(!is_valid_email_reference(NULL));
+    CHECK(email_check(NULL, 0, NULL) == EMAIL_NULL_INPUT);
+    CHECK(!is_valid_email_simd(NULL, 10));
+
+    for (int r = 0; r < EMAIL_REASON_COUNT; r++) {
+        CHECK(strcmp(email_reason_name((email_reason)r), "UNKNOWN") != 0);
+        CHECK(strcmp(email_reason_message((email_reason)r), "unknown reason") != 0);
+    }
+}
+
+static void test_length_limits(void) {
+    char buf[MAX_EMAIL_LENGTH + 2];
+
+    // "aaa...a@example.com" of exactly len bytes
+    for (size_t len = MAX_EMAIL_LENGTH - 1; len <= MAX_EMAIL_LENGTH + 1; len++) {
+        size_t local = len - strlen("@example.com");
+        memset(buf, 'a', local);
+        strcpy(buf + local, "@example.com");
+
+        bool expect = len <= MAX_EMAIL_LENGTH;
+        CHECK(is_valid_email(buf) == expect);
+        CHECK(is_valid_email_reference(buf) == expect);
+        CHECK(is_valid_email_n(buf, len) == expect);
+        CHECK(is_valid_email_simd(buf, len) == expect);
+        CHECK(email_check(buf, len, NULL) == (expect ? EMAIL_VALID : EMAIL_TOO_LONG));
+    }
+}
+
+static void test_not_terminated(void) {
+    // Fields inside a larger buffer, as a CSV parser would hand them over
+    const char row[] = "alice@example.com,bob@example.org,broken@x";
+
+    CHECK(is_valid_email_n(row, 17));
+    CHECK(is_valid_email_n(row + 18, 15));
+    CHECK(!is_valid_email_n(row + 34, 8));
+    CHECK(is_valid_email_simd(row, 17));
+    CHECK(is_valid_email_simd(row + 18, 15));
+    CHECK(!is_valid_email_n(row, 18));  // includes the ','
+
+    // An embedded NUL is just an invalid byte
+    CHECK(!is_valid_email_n("ab\0c@example.com", 16));
+    CHECK(!is_valid_email_simd("ab\0c@example.com", 16));
+}
+
+static void test_reject_profile(void) {
+    static const struct {
+        const char* email;
+        email_reject_stage stage;
+    } cases[] = {
+        { "a@b",                  EMAIL_STAGE_LENGTH },
+        { ".john@example.com",    EMAIL_STAGE_FIRST_BYTE },
+        { " john@example.com",    EMAIL_STAGE_FIRST_BYTE },
+        { "john@example.c",       EMAIL_STAGE_LAST_BYTES },
+        { "john@example.com.",    EMAIL_STAGE_LAST_BYTES },
+        { "johnexample.com",      EMAIL_STAGE_AT_POSITION },
+        { "john.@example.com",    EMAIL_STAGE_AT_POSITION },
+        { "john@-example.com",    EMAIL_STAGE_AT_POSITION },
+        { "john@example..com",    EMAIL_STAGE_FULL_SCAN },
+        { "john@example.com",     EMAIL_STAGE_PASSED },
+    };
+    email_reject_profile profile;
+
+    email_reject_profile_reset();
+    for (size_t i = 0; i < COUNT_OF(cases); i++) {
+        CHECK(is_valid_email(cases[i].email) == (cases[i].stage == EMAIL_STAGE_PASSED));
+    }
+
+    // Only a profiling build counts anything
+    if (!email_reject_profile_snapshot(&profile)) {
+        CHECK(profile.calls == 0 && profile.by_stage[EMAIL_STAGE_FIRST_BYTE] == 0);
+        return;
+    }
+    CHECK(profile.calls == COUNT_OF(cases));
+    CHECK(profile.valid == 1);
+    CHECK(profile.by_stage[EMAIL_STAGE_LENGTH] == 1);
+    CHECK(profile.by_stage[EMAIL_STAGE_FIRST_BYTE] == 2);
+    CHECK(profile.by_stage[EMAIL_STAGE_LAST_BYTES] == 2);
+    CHECK(profile.by_stage[EMAIL_STAGE_AT_POSITION] == 3);
+    CHECK(profile.by_stage[EMAIL_STAGE_FULL_SCAN] == 1);
+    CHECK(profile.by_reason[EMAIL_TOO_SHORT] == 1);
+    CHECK(profile.by_reason[EMAIL_DOMAIN_DOUBLE_DOT] == 1);
+    CHECK(profile.by_reason[EMAIL_LOCAL_TRAILING_DOT] == 1);
+
+    email_reject_profile_reset();
+    email_reject_profile_snapshot(&profile);
+    CHECK(profile.calls == 0);
+}
+
+static void test_metrics(void) {
+    // The histogram buckets: exact up to 32 ns, then 16 per power of two
+    CHECK(email_metrics_bucket_floor(0) == 0);
+    CHECK(email_metrics_bucket_floor(31) == 31);
+    CHECK(email_metrics_bucket_floor(32) == 32);
+    CHECK(email_metrics_bucket_floor(33) == 34);
+    CHECK(email_metrics_bucket_floor(48) == 64);
+    CHECK(email_metrics_bucket_floor(EMAIL_METRICS_BUCKETS - 1) == 31ull << 31);
+
+    static email_metrics m;
+    memset(&m, 0, sizeof(m));
+    m.calls[EMAIL_METRICS_BATCH] = 4;
+    m.latency[EMAIL_METRICS_BATCH][10] = 3;    // 10 ns
+    m.latency[EMAIL_METRICS_BATCH][48] = 1;    // 64..67 ns
+    CHECK(email_metrics_percentile(&m, EMAIL_METRICS_BATCH, 0.5) == 10);
+    CHECK(email_metrics_percentile(&m, EMAIL_METRICS_BATCH, 0.99) == 67);
+    CHECK(email_metrics_percentile(&m, EMAIL_METRICS_SINGLE, 0.5) == 0);
+
+    m.valid = 7;
+    m.invalid = m.by_reason[EMAIL_TOO_SHORT] = 2;
+    m.bytes = 123;
+    char text[16384];
+    size_t len = email_metrics_prometheus(&m, text, sizeof(text));
+    CHECK(len < sizeof(text) && strlen(text) == len);
+    CHECK(strstr(text, "email_validations_total{verdict=\"valid\"} 7\n") != NULL);
+    CHECK(strstr(text, "email_rejections_total{reason=\"TOO_SHORT\"} 2\n") != NULL);
+    CHECK(strstr(text, "email_validated_bytes_total 123\n") != NULL);
+    CHECK(strstr(text, "email_validation_latency_seconds_bucket{path=\"batch\",le=\"5e-08\"} 3\n") != NULL);
+    CHECK(strstr(text, "email_validation_latency_seconds_bucket{path=\"batch\",le=\"1e-07\"} 4\n") != NULL);
+    CHECK(strstr(text, "email_validation_latency_seconds_count{path=\"batch\"} 4\n") != NULL);
+    char small[64];
+    CHECK(email_metrics_prometheus(&m, small, sizeof(small)) == len && strlen(small) == sizeof(small) - 1);
+
+    // Only a metrics build counts anything
+    email_metrics_reset();
+    CHECK(is_valid_email("john@example.com"));
+    CHECK(!is_valid_email("john@example..com"));
+    CHECK(!is_valid_email_strict("john@example.zz", 15));
+    const char* ptrs[] = {"a@b.com", "bad"};
+    size_t lens[] = {7, 3};
+    uint8_t bitmap[1];
+    CHECK(validate_emails_batch(ptrs, lens, 2, bitmap) == 1);
+    if (!email_metrics_snapshot(&m)) {
+        CHECK(m.valid == 0 && m.calls[EMAIL_METRICS_SINGLE] == 0);
+        return;
+    }
+    CHECK(m.valid == 2 && m.invalid == 3);
+    CHECK(m.by_reason[EMAIL_DOMAIN_DOUBLE_DOT] == 1);
+    CHECK(m.by_reason[EMAIL_UNKNOWN_TLD] == 1);
+    CHECK(m.by_reason[EMAIL_TOO_SHORT] == 1);
+    CHECK(m.bytes == 16 + 17 + 15 + 7 + 3);
+    CHECK(m.calls[EMAIL_METRICS_SINGLE] == 2 && m.calls[EMAIL_METRICS_BATCH] == 1);
+    uint64_t counted = 0;
+    for (size_t b = 0; b < EMAIL_METRICS_BUCKETS; b++) {
+        counted += m.latency[EMAIL_METRICS_SINGLE][b];
+    }
+    CHECK(counted == 2);
+
+    // Each mode counts one verdict per address, and its own reason
+    email_metrics_reset();
+    CHECK(is_valid_email_utf8("用户@例子.广告", strlen("用户@例子.广告")));
+    CHECK(is_valid_email_utf8("a@b.com", 7));
+    CHECK(!is_valid_email_utf8("bad\xc3@x.de", 10));
+    CHECK(is_valid_email_utf8_strict("josé@bücher.de", strlen("josé@bücher.de")));
+    CHECK(!is_valid_email_utf8_strict("josé@bücher.zz", strlen("josé@bücher.zz")));
+    CHECK(is_valid_email_rfc("\"a b\"@example.com", 17));
+    CHECK(!is_valid_email_rfc("a@b-.com", 8));
+    email_metrics_snapshot(&m);
+    CHECK(m.valid == 4 && m.invalid == 3);
+    CHECK(m.by_reason[EMAIL_BAD_UTF8] == 1 && m.by_reason[EMAIL_UNKNOWN_TLD] == 1);
+    CHECK(m.by_reason[EMAIL_BAD_LOCAL_CHAR] == 0);
+
+    email_metrics_reset();
+    email_metrics_snapshot(&m);
+    CHECK(m.valid == 0 && m.invalid == 0 && m.calls[EMAIL_METRICS_SINGLE] == 0);
+}
+
+/* ---- Differential check of the engines -------------------------------------- */
+
+static uint64_t rng = 0x243F6A8885A308D3ull;
+
+static uint64_t next_random(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+// Random strings biased towards the characters the rules care about
+static size_t random_address(char* out, size_t max_len) {
+    static const char interesting[] = "@.-_+ \t\x80\xff\"!aZ9";
+    size_t len = (size_t)(next_random() % 24);
+    if (next_random() % 64 == 0) {
+        len = MAX_EMAIL_LENGTH - 8 + (size_t)(next_random() % 16);
+    }
+    if (len > max_len) {
+        len = max_len;
+    }
+    for (size_t i = 0; i < len; i++) {
+        uint64_t r = next_random();
+        out[i] = r % 4 == 0 ? interesting[(r >> 8) % (sizeof(interesting) - 1)]
+                            : "abcxyz0189"[(r >> 8) % 10];
+    }
+    // Make a fair share look like real addresses
+    if (len > 6 && next_random() % 2) {
+        out[len / 3] = '@';
+        out[len - 3] = '.';
+    }
+    out[len] = '\0';
+    return len;
+}
+
+static void test_engines_agree(void) {
+    char buf[MAX_EMAIL_LENGTH + 16];
+    size_t valid = 0;
+
+    for (int i = 0; i < 300000; i++) {
+        size_t len = random_address(buf, sizeof(buf) - 1);
+        bool ref = is_valid_email_reference(buf);
+        valid += ref;
+
+        // Embedded NULs make strlen() and len disagree; compare like for like
+        size_t nul_len = strlen(buf);
+        CHECK_MSG(is_valid_email(buf) == ref, "'%s'", buf);
+        CHECK_MSG(is_valid_email_n(buf, nul_len) == ref, "'%s'", buf);
+        CHECK_MSG((email_check(buf, nul_len, NULL) == EMAIL_VALID) == ref, "'%s'", buf);
+        CHECK_MSG(is_valid_email_simd(buf, len) == is_valid_email_n(buf, len), "'%s'", buf);
+        if (failures > 20) {
+            return;
+        }
+    }
+
+    // The generator must actually produce valid addresses to be useful
+    CHECK(valid > 1000);
+}
+
+/* ---- Strict mode and the TLD list ------------------------------------------ */
+
+static void test_tld_lookup(void) {
+    CHECK(email_tld_load_builtin() == 0);
+    CHECK(email_tld_count() > 1000);
+    CHECK(email_tld_is_known("com", 3));
+    CHECK(email_tld_is_known("COM", 3));
+    CHECK(email_tld_is_known("Org", 3));
+    CHECK(email_tld_is_known("io", 2));
+    CHECK(email_tld_is_known("xn--p1ai", 8));   // .рф
+    CHECK(!email_tld_is_known("zz", 2));
+    CHECK(!email_tld_is_known("co", 1));
+    CHECK(!email_tld_is_known("comm", 4));
+    CHECK(!email_tld_is_known("", 0));
+    CHECK(!email_tld_is_known(NULL, 3));
+
+    CHECK(is_valid_email_strict("user@example.com", 16));
+    CHECK(is_valid_email_strict("user@EXAMPLE.CO.UK", 18));
+    CHECK(!is_valid_email_strict("user@foo.zz", 11));
+    CHECK(!is_valid_email_strict("user@foo..com", 13));
+    size_t offset = 0;
+    CHECK(email_check_strict("user@foo.zz", 11, &offset) == EMAIL_UNKNOWN_TLD);
+    CHECK(offset == 9);
+    CHECK(email_check_strict("user@foo.c", 10, &offset) == EMAIL_TLD_TOO_SHORT);
+    CHECK(email_check_strict("user@foo.dev", 12, &offset) == EMAIL_VALID);
+    CHECK(email_check("user@foo.zz", 11, NULL) == EMAIL_VALID);
+}
+
+static void test_tld_reload(void) {
+    // A few thousand random labels: every one is found, nothing else is
+    enum { KEYS = 5000 };
+    static char list[KEYS * 16];
+    static char labels[KEYS][12];
+    size_t used = 0;
+    used += (size_t)sprintf(list, "# generated\n\n");
+    for (int i = 0; i < KEYS; i++) {
+        int n = 4 + (int)(next_random() % 7);
+        for (int k = 0; k < n; k++) {
+            labels[i][k] = "abcdefghijklmnopqrstuvwxyz0123456789-"[next_random() % 37];
+        }
+        labels[i][n] = '\0';
+        used += (size_t)sprintf(list + used, "%s%s\r\n", i % 2 ? "  " : "", labels[i]);
+    }
+    CHECK(email_tld_load_list(list, used) == 0);
+    CHECK(email_tld_count() <= KEYS && email_tld_count() > KEYS - 50);
+    for (int i = 0; i < KEYS; i++) {
+        CHECK_MSG(email_tld_is_known(labels[i], strlen(labels[i])), "'%s'", labels[i]);
+        if (failures > 20) {
+            return;
+        }
+    }
+        CHECK(!email_tld_is_known("abcdefghijkl", 12));  // longer than any key
+
+    // A bad line leaves the current list in place
+    CHECK(email_tld_load_list("com\nnot a tld\n", 15) == -1);
+    CHECK(email_tld_count() > KEYS - 50);
+
+    // Files use the same format as IANA's list
+    char path[] = "/tmp/email_validate_tlds_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd >= 0) {
+        static const char file[] = "# Version 1\nCOM\nEXAMPLE\nXN--P1AI\n";
+        CHECK(write(fd, file, sizeof(file) - 1) == (ssize_t)(sizeof(file) - 1));
+        close(fd);
+        CHECK(email_tld_load_file(path) == 0);
+        CHECK(email_tld_count() == 3);
+        CHECK(is_valid_email_strict("a@b.example", 11));
+        CHECK(!is_valid_email_strict("a@b.org", 7));
+        unlink(path);
+    }
+    CHECK(email_tld_load_file("/nonexistent/tlds.txt") == -1);
+
+    CHECK(email_tld_load_builtin() == 0);
+    CHECK(email_tld_is_known("org", 3));
+}
+
+/* ---- Batch and parallel --------------------------------------------------- */
+
+#define BATCH_SIZE 2053  // not a multiple of 8 or of the chunk size
+
+typedef struct {
+    char storage[BATCH_SIZE][32];
+    const char* ptrs[BATCH_SIZE];
+    size_t lens[BATCH_SIZE];
+    char blob[BATCH_SIZE * 32];
+    int32_t offsets[BATCH_SIZE + 1];
+    bool expect[BATCH_SIZE];
+    size_t expect_valid;
+} batch_input;
+
+static void batch_fill(batch_input* in) {
+    static const char* const samples[] = {
+        "a.b@c.de", "bad@x", "x@@y.com", "someone@example.org",
+        ".x@y.com", "q+r@s-t.uv", "", "no-at-sign.com"
+    };
+
+    in->offsets[0] = 0;
+    in->expect_valid = 0;
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        strcpy(in->storage[i], samples[next_random() % COUNT_OF(samples)]);
+        in->ptrs[i] = in->storage[i];
+        in->lens[i] = strlen(in->storage[i]);
+        if (i % 97 == 0) {
+            in->ptrs[i] = NULL;  // NULL entries count as invalid
+        }
+        in->expect[i] = in->ptrs[i] != NULL && is_valid_email_n(in->ptrs[i], in->lens[i]);
+        in->expect_valid += in->expect[i];
+
+        memcpy(in->blob + in->offsets[i], in->storage[i], in->lens[i]);
+        in->offsets[i + 1] = in->offsets[i] + (int32_t)in->lens[i];
+    }
+}
+
+static bool bitmap_bit(const uint8_t* bitmap, size_t i) {
+    return (bitmap[i / 8] >> (i % 8)) & 1;
+}
+
+static void test_batch(void) {
+    static batch_input in;
+    uint8_t bitmap[(BATCH_SIZE + 7) / 8];
+    batch_fill(&in);
+
+    memset(bitmap, 0xA5, sizeof(bitmap));
+    CHECK(validate_emails_batch(in.ptrs, in.lens, BATCH_SIZE, bitmap) == in.expect_valid);
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        CHECK_MSG(bitmap_bit(bitmap, i) == in.expect[i], "batch index %zu", i);
+    }
+    // Unused bits of the last byte are cleared
+    CHECK((bitmap[sizeof(bitmap) - 1] >> (BATCH_SIZE % 8)) == 0);
+
+    // The offsets variant sees the NULL entries as real strings
+    size_t expect_valid = 0;
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        expect_valid += is_valid_email_n(in.storage[i], in.lens[i]);
+    }
+    memset(bitmap, 0xA5, sizeof(bitmap));
+    CHECK(validate_emails_batch_offsets(in.blob, in.offsets, BATCH_SIZE, bitmap) == expect_valid);
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        CHECK_MSG(bitmap_bit(bitmap, i) == is_valid_email_n(in.storage[i], in.lens[i]),
+                  "offsets index %zu", i);
+    }
+
+    CHECK(validate_emails_batch(in.ptrs, in.lens, 0, bitmap) == 0);
+}
+
+static void test_parallel(void) {
+    static batch_input in;
+    static email_parallel_stats stats;
+    uint8_t expected[(BATCH_SIZE + 7) / 8];
+    uint8_t bitmap[(BATCH_SIZE + 7) / 8];
+    batch_fill(&in);
+    validate_emails_batch(in.ptrs, in.lens, BATCH_SIZE, expected);
+
+    static const unsigned thread_counts[] = { 1, 2, 3, 8, 0 };
+    for (size_t t = 0; t < COUNT_OF(thread_counts); t++) {
+        // chunk_size 1 rounds up to 512; every other run shares a domain cache
+        email_parallel_options opts = {
+            .threads = thread_counts[t], .chunk_size = 1, .domain_cache = t % 2 == 1
+        };
+        memset(bitmap, 0x5A, sizeof(bitmap));
+
+        size_t valid = validate_emails_parallel(in.ptrs, in.lens, BATCH_SIZE,
+                                                bitmap, &opts, &stats);
+        CHECK(valid == in.expect_valid);
+        CHECK(memcmp(bitmap, expected, sizeof(bitmap)) == 0);
+        CHECK(stats.total.valid == in.expect_valid);
+        CHECK(stats.total.valid + stats.total.invalid == BATCH_SIZE);
+        CHECK(stats.total.chunks == (BATCH_SIZE + 511) / 512);
+        CHECK(stats.threads >= 1 && stats.threads <= 5);
+
+        uint64_t per_thread_valid = 0;
+        for (unsigned k = 0; k < stats.threads; k++) {
+            per_thread_valid += stats.per_thread[k].valid;
+        }
+        CHECK(per_thread_valid == in.expect_valid);
+    }
+
+    CHECK(validate_emails_parallel(in.ptrs, in.lens, BATCH_SIZE, bitmap, NULL, NULL)
+          == in.expect_valid);
+    CHECK(validate_emails_parallel(in.ptrs, in.lens, 0, bitmap, NULL, &stats) == 0);
+}
+
+/* ---- Domain cache ----------------------------------------------------------- */
+
+static void test_domain_cache(void) {
+    static const char* const locals[] = {
+        "john.doe", "a", "x+tag", "bad..dots", ".lead", "trail.", "sp ace", "ok_1"
+    };
+    static const char* const domains[] = {
+        "gmail.com", "GMAIL.COM", "outlook.com", "example.c", "-bad.com",
+        "bad-.com", "a..b.com", "nodot", "x@y.com", "sub.example.co.uk",
+        "sp ace.com", "ex.zz",
+        // 56 bytes, the longest cached, and 57, one too long
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa.com",
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa.com",
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa.co-"
+    };
+    email_domain_cache* cache = email_domain_cache_create();
+    CHECK(cache != NULL);
+    if (cache == NULL) {
+        return;
+    }
+
+    // Twice over: the first pass fills the cache, the second hits it
+    char buf[MAX_EMAIL_LENGTH + 16];
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t l = 0; l < COUNT_OF(locals); l++) {
+            for (size_t d = 0; d < COUNT_OF(domains); d++) {
+                int len = snprintf(buf, sizeof(buf), "%s@%s", locals[l], domains[d]);
+                CHECK_MSG(is_valid_email_cached(cache, buf, (size_t)len) ==
+                          is_valid_email_n(buf, (size_t)len), "'%s' pass %d", buf, pass);
+            }
+        }
+    }
+
+    // Random input, with its collisions and take-overs of slots
+    for (int i = 0; i < 200000 && failures <= 20; i++) {
+        size_t len = random_address(buf, sizeof(buf) - 1);
+        CHECK_MSG(is_valid_email_cached(cache, buf, len) == is_valid_email_n(buf, len),
+                  "'%s'", buf);
+    }
+    CHECK(!is_valid_email_cached(cache, NULL, 10));
+
+    static batch_input in;
+    uint8_t expected[(BATCH_SIZE + 7) / 8];
+    uint8_t bitmap[(BATCH_SIZE + 7) / 8];
+    batch_fill(&in);
+    validate_emails_batch(in.ptrs, in.lens, BATCH_SIZE, expected);
+    CHECK(validate_emails_batch_cached(in.ptrs, in.lens, BATCH_SIZE, bitmap, cache)
+          == in.expect_valid);
+    CHECK(memcmp(bitmap, expected, sizeof(bitmap)) == 0);
+
+    email_domain_cache_destroy(cache);
+    email_domain_cache_destroy(NULL);
+}
+
+/* ---- Normalization ------------------------------------------------------------ */
+
+static void test_normalize(void) {
+    char buf[64];
+    email_arena arena;
+    email_normalized r;
+    email_arena_init(&arena, buf, sizeof(buf));
+
+    CHECK(email_normalize("John.Doe@Example.COM", 20, 0, &arena, &r));
+    CHECK(r.reason == EMAIL_VALID && r.len == 20 && strcmp(r.p, "John.Doe@example.com") == 0);
+    CHECK(r.p == buf && arena.used == 21);
+
+    // Whitespace around the address only goes away when lenient
+    CHECK(!email_normalize("  a@B.cd\t", 9, 0, &arena, &r));
+    CHECK(r.reason == EMAIL_WHITESPACE && r.offset == 0 && r.p == NULL);
+    CHECK(email_normalize("  a@B.cd\t", 9, EMAIL_NORMALIZE_LENIENT, &arena, &r));
+    CHECK(strcmp(r.p, "a@b.cd") == 0 && r.p == buf + 21);
+    // Offsets still point into the input
+    CHECK(!email_normalize("  a..b@c.de ", 12, EMAIL_NORMALIZE_LENIENT, &arena, &r));
+    CHECK(r.reason == EMAIL_LOCAL_DOUBLE_DOT && r.offset == 4);
+    CHECK(!email_normalize(" \t ", 3, EMAIL_NORMALIZE_LENIENT, &arena, &r) &&
+          r.reason == EMAIL_TOO_SHORT);
+    CHECK(!email_normalize("a@b.zz", 6, EMAIL_NORMALIZE_STRICT, &arena, &r) &&
+          r.reason == EMAIL_UNKNOWN_TLD);
+    CHECK(arena.used == 28);
+
+    // No room: valid, but nothing written
+    CHECK(!email_normalize("someone.with.a.long.name@sub.example.org", 40, 0, &arena, &r));
+    CHECK(r.reason == EMAIL_VALID && r.p == NULL && arena.used == 28);
+    email_arena_reset(&arena);
+    CHECK(email_normalize("someone.with.a.long.name@SUB.EXAMPLE.ORG", 40, 0, &arena, &r));
+    CHECK(strcmp(r.p, "someone.with.a.long.name@sub.example.org") == 0);
+
+    // A batch stops where the arena is full and can be resumed
+    static const char* const inputs[] = {
+        "A@B.CD", "bad", "Mixed.Case@Domain.Example", "x@y.zz", "last@ONE.io"
+    };
+    const size_t lens[] = { 6, 3, 25, 6, 11 };
+    const char* outs[5];
+    size_t out_lens[5];
+    char small[40];
+    email_arena_init(&arena, small, sizeof(small));
+    size_t done = normalize_emails_batch(inputs, lens, 5, 0, &arena, outs, out_lens);
+    CHECK(done == 4);
+    CHECK(strcmp(outs[0], "A@b.cd") == 0 && outs[1] == NULL && out_lens[1] == 0);
+    CHECK(strcmp(outs[2], "Mixed.Case@domain.example") == 0 && out_lens[3] == 6);
+    email_arena_reset(&arena);
+    CHECK(normalize_emails_batch(inputs + done, lens + done, 5 - done, 0, &arena,
+                                 outs + done, out_lens + done) == 1);
+    CHECK(strcmp(outs[4], "last@one.io") == 0);
+
+    // Same verdicts as is_valid_email_n(); the copy differs only in case
+    char big[MAX_EMAIL_LENGTH + 1];
+    char input[MAX_EMAIL_LENGTH + 16];
+    for (int i = 0; i < 100000 && failures <= 20; i++) {
+        size_t len = random_address(input, sizeof(input) - 1);
+        email_arena_init(&arena, big, sizeof(big));
+        bool ok = email_normalize(input, len, 0, &arena, &r);
+        CHECK_MSG(ok == is_valid_email_n(input, len), "'%s'", input);
+        if (ok) {
+            CHECK_MSG(r.len == len && strncasecmp(r.p, input, len) == 0 && r.p[len] == '\0',
+                      "'%s'", input);
+        }
+    }
+}
+
+/* ---- Internationalized addresses ------------------------------------------ */
+
+// email_check_utf8() of a NUL-terminated address, with the offset
+static email_reason check_utf8(const char* p, size_t* offset) {
+    *offset = 9999;
+    return email_check_utf8(p, strlen(p), offset);
+}
+
+static void test_utf8(void) {
+    size_t offset;
+    char out[MAX_EMAIL_LENGTH + 1];
+
+    // Local parts in any script, IDNA domains, and the other full stops
+    static const char* const valid[] = {
+        "用户@例子.广告", "josé@exämple.de", "Δοκιμή@παράδειγμα.δοκιμή",
+        "иван@пример.рф", "user@bücher.de", "a@例子。广告", "a@ｅｘａｍｐｌｅ．com",
+        "θσερ+tag@ünïcödé.example", "user@xn--bcher-kva.de"
+    };
+    for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+        CHECK_MSG(check_utf8(valid[i], &offset) == EMAIL_VALID, "'%s'", valid[i]);
+        CHECK_MSG(is_valid_email_utf8(valid[i], strlen(valid[i])), "'%s'", valid[i]);
+    }
+    CHECK(!is_valid_email_n("josé@exämple.de", strlen("josé@exämple.de")));
+
+    // RFC 3492 test labels, case-folded and with ASCII labels lowercased
+    CHECK(email_domain_to_ascii("Bücher.DE", strlen("Bücher.DE"), out, sizeof(out)) == 16 &&
+          strcmp(out, "xn--bcher-kva.de") == 0);
+    CHECK(email_domain_to_ascii("例子.广告", strlen("例子.广告"), out, sizeof(out)) > 0 &&
+          strcmp(out, "xn--fsqu00a.xn--4rr70v") == 0);
+    CHECK(email_domain_to_ascii("MÜNCHEN。de", strlen("MÜNCHEN。de"), out, sizeof(out)) > 0 &&
+          strcmp(out, "xn--mnchen-3ya.de") == 0);
+    CHECK(email_domain_to_ascii("пример.рф", strlen("пример.рф"), out, sizeof(out)) > 0 &&
+          strcmp(out, "xn--e1afmkfd.xn--p1ai") == 0);
+    CHECK(email_domain_to_ascii("bücher.de", strlen("bücher.de"), out, 16) == 0);
+    CHECK(email_domain_to_ascii("b\xfc" "cher.de", 8, out, sizeof(out)) == 0);
+
+    // Malformed UTF-8: truncated, overlong, a surrogate, above U+10FFFF
+    CHECK(check_utf8("jos\xc3@a.de", &offset) == EMAIL_BAD_UTF8 && offset == 3);
+    CHECK(check_utf8("\xc0\xaf" "ab@a.de", &offset) == EMAIL_BAD_UTF8 && offset == 0);
+    CHECK(check_utf8("ab@x\xed\xa0\x80.de", &offset) == EMAIL_BAD_UTF8 && offset == 4);
+    CHECK(check_utf8("ab\xf4\x90\x80\x80@a.de", &offset) == EMAIL_BAD_UTF8 && offset == 2);
+    CHECK(check_utf8("ab@a.d\x80", &offset) == EMAIL_BAD_UTF8 && offset == 6);
+
+    // Characters IDNA does not allow, and a label that is too long
+    CHECK(check_utf8("a@ex☃mple.de", &offset) == EMAIL_BAD_IDN && offset == 4);
+    CHECK(check_utf8("a@-über.de", &offset) == EMAIL_BAD_IDN && offset == 2);
+    CHECK(check_utf8("a@\xcc\x81x.de", &offset) == EMAIL_BAD_IDN && offset == 2);
+    CHECK(check_utf8("a@ab--ü.de", &offset) == EMAIL_BAD_IDN && offset == 4);
+    CHECK(check_utf8("a@ü_x.de", &offset) == EMAIL_BAD_DOMAIN_CHAR && offset == 4);
+    char label[MAX_EMAIL_LENGTH + 1] = "a@";
+    for (int i = 0; i < 80; i++) {
+        strcat(label, "ü");
+    }
+    strcat(label, ".de");
+    CHECK(check_utf8(label, &offset) == EMAIL_BAD_IDN && offset == 2);
+
+    // The ASCII rules, with offsets into the input
+    CHECK(check_utf8("jos\xc2\xa0" "e@a.de", &offset) == EMAIL_WHITESPACE && offset == 3);
+    CHECK(check_utf8("josé..x@a.de", &offset) == EMAIL_LOCAL_DOUBLE_DOT && offset == 6);
+    CHECK(check_utf8("a@bücher..de", &offset) == EMAIL_DOMAIN_DOUBLE_DOT && offset == 10);
+    CHECK(check_utf8("josé@bücher", &offset) == EMAIL_DOMAIN_NO_DOT && offset == 6);
+    CHECK(check_utf8("jösé.de", &offset) == EMAIL_MISSING_AT && offset == 9);
+    CHECK(check_utf8("ü@ä@x.de", &offset) == EMAIL_MULTIPLE_AT && offset == 5);
+    CHECK(check_utf8("a@b.cd e", &offset) == EMAIL_WHITESPACE && offset == 6);
+
+    // The A-labels count against MAX_EMAIL_LENGTH
+    char large[MAX_EMAIL_LENGTH + 1];
+    memset(large, 'x', MAX_EMAIL_LENGTH - 16);
+    strcpy(large + MAX_EMAIL_LENGTH - 16, "@例子.广告");
+    CHECK(strlen(large) <= MAX_EMAIL_LENGTH);
+    CHECK(check_utf8(large, &offset) == EMAIL_TOO_LONG && offset < strlen(large));
+
+    // Strict mode looks the A-label of the TLD up
+    CHECK(email_check_utf8_strict("иван@пример.рф", strlen("иван@пример.рф"), &offset) ==
+          EMAIL_VALID);
+    CHECK(is_valid_email_utf8_strict("user@bücher.de", strlen("user@bücher.de")));
+    CHECK(email_check_utf8_strict("a@bc.ü", strlen("a@bc.ü"), &offset) == EMAIL_UNKNOWN_TLD &&
+          offset == 5);
+
+    // Normalization writes the domain as A-labels
+    char buf[128];
+    email_arena arena;
+    email_normalized r;
+    email_arena_init(&arena, buf, sizeof(buf));
+    CHECK(!email_normalize("José@Bücher.DE", strlen("José@Bücher.DE"), 0, &arena, &r) &&
+          r.reason == EMAIL_BAD_LOCAL_CHAR);
+    CHECK(email_normalize(" José@Bücher.DE", strlen(" José@Bücher.DE"),
+                          EMAIL_NORMALIZE_UTF8 | EMAIL_NORMALIZE_LENIENT, &arena, &r));
+    CHECK(strcmp(r.p, "José@xn--bcher-kva.de") == 0 && r.len == strlen(r.p));
+    CHECK(!email_normalize("a@ex☃mple.de", strlen("a@ex☃mple.de"), EMAIL_NORMALIZE_UTF8, &arena,
+                           &r) && r.reason == EMAIL_BAD_IDN && r.offset == 4);
+    CHECK(email_normalize("A@B.CD", 6, EMAIL_NORMALIZE_UTF8, &arena, &r) &&
+          strcmp(r.p, "A@b.cd") == 0);
+
+    // ASCII input takes the ASCII path: same verdicts and reasons. Other
+    // input gets an offset inside it.
+    char input[MAX_EMAIL_LENGTH + 16];
+    for (int i = 0; i < 20000 && failures <= 20; i++) {
+        size_t len = random_address(input, sizeof(input) - 1);
+        size_t ascii_offset = 0, utf8_offset = 0;
+        email_reason reason = email_check_utf8(input, len, &utf8_offset);
+        CHECK_MSG(is_valid_email_utf8(input, len) == (reason == EMAIL_VALID), "'%s'", input);
+        CHECK_MSG(reason == EMAIL_VALID || utf8_offset <= len, "'%s'", input);
+        bool ascii = true;
+        for (size_t k = 0; k < len; k++) {
+            ascii &= (unsigned char)input[k] < 0x80;
+        }
+        if (ascii) {
+            CHECK_MSG(reason == email_check(input, len, &ascii_offset) &&
+                          (reason == EMAIL_VALID || utf8_offset == ascii_offset),
+                      "'%s'", input);
+        }
+    }
+}
+
+/* ---- RFC 5321 mode ---------------------------------------------------------- */
+
+// email_check_rfc() of a NUL-terminated address, with the offset
+static email_reason check_rfc(const char* p, size_t* offset) {
+    *offset = 9999;
+    return email_check_rfc(p, strlen(p), offset);
+}
+
+// True when no domain label of the valid address p starts or ends with '-'
+static bool labels_ok(const char* p, size_t len) {
+    const char* at = memchr(p, '@', len);
+    for (const char* q = at + 1; q < p + len; q++) {
+        if (*q == '-' && (q[-1] == '.' || q[-1] == '@' || q + 1 == p + len || q[1] == '.')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_rfc(void) {
+    size_t offset;
+
+    static const char* const valid[] = {
+        "user@example.com", "a@b", "!#$%&'*+-/=?^_`{|}~@example.org", "a.b.c@x-y.z",
+        "\"john doe\"@example.com", "\"\"@example.com", "\"a\\\"b\\\\c\"@x.org",
+        "\"a@b\"@example.com", "\" \"@x", "user@[192.0.2.1]", "user@[0.0.0.0]",
+        "user@[255.255.255.255]", "user@[IPv6:2001:db8::1]", "user@[ipv6:::1]",
+        "user@[IPv6:::]", "user@[IPv6:1:2:3:4:5:6:7:8]", "user@[IPv6:1:2:3::6]",
+        "user@[IPv6:fe80::abcd:1234]", "user@[IPv6:::ffff:192.0.2.1]",
+        "user@[IPv6:1:2:3:4:5:6:1.2.3.4]", "user@[IPv6:1:2:3:4::1.2.3.4]",
+        "user@[IPv6:1::5:1.2.3.4]", "x@1.2.3.4"
+    };
+    for (size_t i = 0; i < COUNT_OF(valid); i++) {
+        CHECK_MSG(check_rfc(valid[i], &offset) == EMAIL_VALID, "'%s'", valid[i]);
+        CHECK_MSG(is_valid_email_rfc(valid[i], strlen(valid[i])), "'%s'", valid[i]);
+    }
+
+    static const struct {
+        const char* input;
+        email_reason reason;
+        size_t offset;
+    } invalid[] = {
+        {"", EMAIL_TOO_SHORT, 0},
+        {".a@x", EMAIL_LOCAL_LEADING_DOT, 0},
+        {"a..b@x", EMAIL_LOCAL_DOUBLE_DOT, 2},
+        {"a.@x", EMAIL_LOCAL_TRAILING_DOT, 2},
+        {"@x", EMAIL_EMPTY_LOCAL, 0},
+        {"a b@x", EMAIL_WHITESPACE, 1},
+        {"a(b)@x", EMAIL_BAD_LOCAL_CHAR, 1},
+        {"a\"b\"@x", EMAIL_BAD_LOCAL_CHAR, 1},
+        {"\"ab@x", EMAIL_BAD_QUOTED_LOCAL, 5},
+        {"\"a\"b@x", EMAIL_BAD_QUOTED_LOCAL, 3},
+        {"\"a\tb\"@x", EMAIL_BAD_QUOTED_LOCAL, 2},
+        {"\"a\\\x01\"@x", EMAIL_BAD_QUOTED_LOCAL, 3},
+        {"abc", EMAIL_MISSING_AT, 3},
+        {"a@", EMAIL_EMPTY_DOMAIN, 2},
+        {"a@.x", EMAIL_DOMAIN_BAD_START, 2},
+        {"a@-x", EMAIL_DOMAIN_BAD_START, 2},
+        {"a@x-.y", EMAIL_DOMAIN_BAD_END, 4},
+        {"a@x.y-", EMAIL_DOMAIN_BAD_END, 6},
+        {"a@x.", EMAIL_DOMAIN_BAD_END, 4},
+        {"a@x..y", EMAIL_DOMAIN_DOUBLE_DOT, 4},
+        {"a@x_y", EMAIL_BAD_DOMAIN_CHAR, 3},
+        {"a@b@c", EMAIL_MULTIPLE_AT, 3},
+        {"a@b c", EMAIL_WHITESPACE, 3},
+        {"a@[1.2.3]", EMAIL_BAD_ADDRESS_LITERAL, 8},
+        {"a@[1.2.3.256]", EMAIL_BAD_ADDRESS_LITERAL, 11},
+        {"a@[1.2.3.0255]", EMAIL_BAD_ADDRESS_LITERAL, 12},
+        {"a@[1.2.3.4", EMAIL_BAD_ADDRESS_LITERAL, 10},
+        {"a@[1.2.3.4].x", EMAIL_BAD_ADDRESS_LITERAL, 11},
+        {"a@[IPv4:1.2.3.4]", EMAIL_BAD_ADDRESS_LITERAL, 6},
+        {"a@[x:y]", EMAIL_BAD_ADDRESS_LITERAL, 3},
+        {"a@[IPv6:1:2:3:4:5:6:7]", EMAIL_BAD_ADDRESS_LITERAL, 21},
+        {"a@[IPv6:1:2:3:4:5:6:7:8:9]", EMAIL_BAD_ADDRESS_LITERAL, 23},
+        {"a@[IPv6:1::2::3]", EMAIL_BAD_ADDRESS_LITERAL, 13},
+        {"a@[IPv6:1:2:3:4:5::6:7]", EMAIL_BAD_ADDRESS_LITERAL, 20},
+        {"a@[IPv6:12345::]", EMAIL_BAD_ADDRESS_LITERAL, 12},
+        {"a@[IPv6:1:2:3:4:5::1.2.3.4]", EMAIL_BAD_ADDRESS_LITERAL, 20},
+        {"a@[IPv6::ffff:1.2.3.4]", EMAIL_BAD_ADDRESS_LITERAL, 9},
+        {"a@[IPv6:::a1.2.3.4]", EMAIL_BAD_ADDRESS_LITERAL, 12},
+    };
+    for (size_t i = 0; i < COUNT_OF(invalid); i++) {
+        email_reason reason = check_rfc(invalid[i].input, &offset);
+        CHECK_MSG(reason == invalid[i].reason && offset == invalid[i].offset,
+                  "'%s': %s at %zu", invalid[i].input, email_reason_name(reason), offset);
+        CHECK(!is_valid_email_rfc(invalid[i].input, strlen(invalid[i].input)));
+    }
+    CHECK(email_check_rfc(NULL, 0, &offset) == EMAIL_NULL_INPUT);
+    CHECK(email_check_rfc("a@b\0c", 5, &offset) == EMAIL_BAD_DOMAIN_CHAR && offset == 3);
+
+    // The limits of RFC 5321 section 4.5.3.1
+    char buf[MAX_EMAIL_LENGTH + 16];
+    memset(buf, 'a', EMAIL_RFC_MAX_LOCAL);
+    strcpy(buf + EMAIL_RFC_MAX_LOCAL, "@x");
+    CHECK(check_rfc(buf, &offset) == EMAIL_VALID);
+    buf[0] = '"';
+    buf[EMAIL_RFC_MAX_LOCAL - 1] = '"';
+    CHECK(check_rfc(buf, &offset) == EMAIL_VALID);
+    memset(buf, 'a', EMAIL_RFC_MAX_LOCAL + 1);
+    strcpy(buf + EMAIL_RFC_MAX_LOCAL + 1, "@x");
+    CHECK(check_rfc(buf, &offset) == EMAIL_LOCAL_TOO_LONG && offset == EMAIL_RFC_MAX_LOCAL);
+    strcpy(buf, "a@");
+    memset(buf + 2, 'b', EMAIL_RFC_MAX_LABEL);
+    strcpy(buf + 2 + EMAIL_RFC_MAX_LABEL, ".c");
+    CHECK(check_rfc(buf, &offset) == EMAIL_VALID);
+    memset(buf + 2, 'b', EMAIL_RFC_MAX_LABEL + 1);
+    strcpy(buf + 3 + EMAIL_RFC_MAX_LABEL, ".c");
+    CHECK(check_rfc(buf, &offset) == EMAIL_LABEL_TOO_LONG && offset == 2 + EMAIL_RFC_MAX_LABEL);
+    strcpy(buf, "a@");
+    while (strlen(buf) + 8 <= EMAIL_RFC_MAX_LENGTH) {
+        strcat(buf, "bcd.");
+    }
+    while (strlen(buf) < EMAIL_RFC_MAX_LENGTH) {
+        strcat(buf, "e");
+    }
+    CHECK(strlen(buf) == EMAIL_RFC_MAX_LENGTH && check_rfc(buf, &offset) == EMAIL_VALID);
+    strcat(buf, "g");
+    CHECK(check_rfc(buf, &offset) == EMAIL_TOO_LONG && offset == EMAIL_RFC_MAX_LENGTH);
+
+    // Within its limits, RFC mode accepts what the usual rules accept
+    // unless a label starts or ends with '-'
+    for (int i = 0; i < 20000 && failures <= 20; i++) {
+        size_t len = random_address(buf, sizeof(buf) - 1);
+        size_t rfc_offset = 0;
+        email_reason reason = email_check_rfc(buf, len, &rfc_offset);
+        CHECK_MSG(is_valid_email_rfc(buf, len) == (reason == EMAIL_VALID), "'%s'", buf);
+        CHECK_MSG(reason == EMAIL_VALID || rfc_offset <= len, "'%s'", buf);
+        if (is_valid_email_n(buf, len) && len <= EMAIL_RFC_MAX_LENGTH &&
+            (size_t)(strchr(buf, '@') - buf) <= EMAIL_RFC_MAX_LOCAL && labels_ok(buf, len)) {
+            CHECK_MSG(reason == EMAIL_VALID, "'%s': %s", buf, email_reason_name(reason));
+        }
+    }
+}
+
+/* ---- Duplicates ------------------------------------------------------------- */
+
+static void test_dedup(void) {
+    email_dedup* set = email_dedup_create(4, 0);
+    uint64_t first;
+    CHECK(set != NULL);
+    if (set == NULL) {
+        return;
+    }
+
+    CHECK(email_dedup_add(set, "Ann@Example.COM", 15, 7, &first) == EMAIL_DEDUP_NEW && first == 7);
+    CHECK(email_dedup_add(set, "Ann@example.com", 15, 9, &first) == EMAIL_DEDUP_DUPLICATE && first == 7);
+    // Only the domain is case-insensitive
+    CHECK(email_dedup_add(set, "ann@example.com", 15, 10, &first) == EMAIL_DEDUP_NEW && first == 10);
+    // A later add with a lower line number makes that the first one
+    CHECK(email_dedup_add(set, "ann@EXAMPLE.com", 15, 3, &first) == EMAIL_DEDUP_DUPLICATE && first == 3);
+    CHECK(email_dedup_find(set, "ann@example.COM", 15, &first) && first == 3);
+    CHECK(!email_dedup_find(set, "bob@example.com", 15, NULL));
+
+    // Four distinct addresses at most
+    CHECK(email_dedup_add(set, "x", 1, 11, NULL) == EMAIL_DEDUP_NEW);
+    CHECK(email_dedup_add(set, "", 0, 12, NULL) == EMAIL_DEDUP_NEW);
+    CHECK(email_dedup_add(set, "one@too.many", 12, 13, &first) == EMAIL_DEDUP_UNTRACKED && first == 13);
+    CHECK(email_dedup_add(set, "", 0, 14, NULL) == EMAIL_DEDUP_DUPLICATE);
+
+    char long_line[MAX_EMAIL_LENGTH + 1];
+    memset(long_line, 'a', sizeof(long_line));
+    CHECK(email_dedup_add(set, long_line, sizeof(long_line), 15, NULL) == EMAIL_DEDUP_UNTRACKED);
+    CHECK(email_dedup_add(set, NULL, 0, 16, NULL) == EMAIL_DEDUP_UNTRACKED);
+
+    email_dedup_stats st;
+    email_dedup_snapshot(set, &st);
+    CHECK(st.unique == 4 && st.duplicates == 3 && st.untracked == 3);
+    CHECK(st.arena_used > 0 && st.arena_used <= st.arena_size);
+    email_dedup_destroy(set);
+    email_dedup_destroy(NULL);
+
+    // A full arena refuses new addresses but still finds the old ones
+    set = email_dedup_create(0, 64);
+    CHECK(set != NULL);
+    if (set == NULL) {
+        return;
+    }
+    CHECK(email_dedup_add(set, "first@example.com", 17, 1, NULL) == EMAIL_DEDUP_NEW);
+    CHECK(email_dedup_add(set, "second@example.com", 18, 2, NULL) == EMAIL_DEDUP_NEW);
+    CHECK(email_dedup_add(set, "third@example.com", 17, 3, NULL) == EMAIL_DEDUP_UNTRACKED);
+    CHECK(email_dedup_add(set, "first@example.com", 17, 4, NULL) == EMAIL_DEDUP_DUPLICATE);
+    email_dedup_destroy(set);
+
+    // The parallel validator gives the same bitmap with a set, validating
+    // each distinct address once; the samples repeat, so most are duplicates
+    static batch_input in;
+    static email_parallel_stats pst;
+    uint8_t expected[(BATCH_SIZE + 7) / 8];
+    uint8_t bitmap[(BATCH_SIZE + 7) / 8];
+    batch_fill(&in);
+    validate_emails_batch(in.ptrs, in.lens, BATCH_SIZE, expected);
+
+    static const unsigned thread_counts[] = { 1, 4 };
+    for (size_t t = 0; t < COUNT_OF(thread_counts); t++) {
+        set = email_dedup_create(0, 0);
+        CHECK(set != NULL);
+        if (set == NULL) {
+            return;
+        }
+        email_parallel_options opts = { .threads = thread_counts[t], .dedup = set };
+        CHECK(validate_emails_parallel(in.ptrs, in.lens, BATCH_SIZE, bitmap, &opts, &pst)
+              == in.expect_valid);
+        CHECK(memcmp(bitmap, expected, sizeof(bitmap)) == 0);
+
+        email_dedup_snapshot(set, &st);
+        // NULL entries (every 97th) are neither added nor validated
+        CHECK(st.unique <= 8 && st.untracked == 0);
+        CHECK(st.unique + st.duplicates == BATCH_SIZE - (BATCH_SIZE + 96) / 97);
+        CHECK(pst.total.duplicates == st.duplicates);
+
+        // First occurrences are exact once the workers are done
+        for (size_t i = 0; i < BATCH_SIZE; i++) {
+            if (in.ptrs[i] == NULL) {
+                continue;
+            }
+            size_t j = 0;
+            while (in.ptrs[j] == NULL || strcmp(in.ptrs[j], in.ptrs[i]) != 0) {
+                j++;
+            }
+            CHECK_MSG(email_dedup_find(set, in.ptrs[i], in.lens[i], &first) && first == j + 1,
+                      "index %zu", i);
+        }
+        email_dedup_destroy(set);
+    }
+}
+
+/* ---- Address store ---------------------------------------------------------- */
+
+// Every check of test_store() that holds for a built and a mapped store
+static void check_store_lookups(const email_store* store, size_t generated) {
+    char addr[MAX_EMAIL_LENGTH + 1];
+    uint32_t id;
+    size_t len;
+
+    CHECK(email_store_find(store, "Ann@EXAMPLE.com", 15, &id) && id == 0);
+    CHECK(email_store_find(store, "ann@example.com", 15, &id) && id == 2);
+    CHECK(!email_store_find(store, "bob@example.com", 15, &id));
+    CHECK(!email_store_find(store, "nobody", 6, &id) && !email_store_find(store, NULL, 0, &id));
+    CHECK(email_store_get(store, 0, addr, sizeof(addr)) == 15 &&
+          strcmp(addr, "Ann@example.com") == 0);
+    CHECK(email_store_get(store, 0, addr, 15) == 0);
+    CHECK(email_store_get(store, UINT32_MAX - 1, addr, sizeof(addr)) == 0);
+
+    // One dictionary entry per domain, whatever its case
+    uint32_t domain = email_store_domain_of(store, 0);
+    CHECK(domain == email_store_domain_of(store, 2));
+    CHECK(domain != email_store_domain_of(store, 1));
+    const char* text = email_store_domain(store, domain, &len);
+    CHECK(text != NULL && len == 11 && memcmp(text, "example.com", len) == 0);
+    CHECK(email_store_domain(store, UINT32_MAX - 1, &len) == NULL);
+    CHECK(email_store_domain_of(store, UINT32_MAX - 1) == UINT32_MAX);
+
+    // The generated addresses keep their ids
+    for (size_t i = 0; i < generated; i++) {
+        char expect[64];
+        snprintf(expect, sizeof(expect), "user%zu@host%zu.example", i, i % 97);
+        CHECK_MSG(email_store_find(store, expect, strlen(expect), &id) && id == 3 + i &&
+                      email_store_get(store, id, addr, sizeof(addr)) == strlen(expect) &&
+                      strcmp(addr, expect) == 0,
+                  "'%s'", expect);
+        if (failures > 20) {
+            break;
+        }
+    }
+}
+
+static void test_store(void) {
+    email_store* store = email_store_create(0);
+    uint32_t id = 99;
+    CHECK(store != NULL);
+    if (store == NULL) {
+        return;
+    }
+
+    CHECK(email_store_add(store, "Ann@Example.COM", 15, &id) == EMAIL_STORE_ADDED && id == 0);
+    CHECK(email_store_add(store, "Ann@example.com", 15, &id) == EMAIL_STORE_PRESENT && id == 0);
+    CHECK(email_store_add(store, "bob@other.org", 13, &id) == EMAIL_STORE_ADDED && id == 1);
+    // Only the domain is case-insensitive
+    CHECK(email_store_add(store, "ann@example.com", 15, NULL) == EMAIL_STORE_ADDED);
+    CHECK(email_store_add(store, "not an address", 14, &id) == EMAIL_STORE_INVALID);
+    CHECK(email_store_add(store, NULL, 0, &id) == EMAIL_STORE_INVALID);
+    CHECK(email_store_find(store, "bob@OTHER.org", 13, NULL));
+
+    // Enough addresses to grow every table and arena several times
+    enum { GENERATED = 20000 };
+    for (size_t i = 0; i < GENERATED; i++) {
+        char addr[64];
+        int n = snprintf(addr, sizeof(addr), "user%zu@host%zu.example", i, i % 97);
+        CHECK(email_store_add(store, addr, (size_t)n, &id) == EMAIL_STORE_ADDED && id == 3 + i);
+    }
+    check_store_lookups(store, GENERATED);
+
+    email_store_stats st;
+    email_store_snapshot(store, &st);
+    CHECK(st.addresses == 3 + GENERATED && st.domains == 2 + 97);
+    CHECK(st.local_bytes > 0 && st.domain_bytes > 0 && st.memory > st.local_bytes);
+
+    // The saved file maps back with the same contents, read-only
+    char path[] = "/tmp/email_validate_store_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd < 0) {
+        email_store_destroy(store);
+        return;
+    }
+    close(fd);
+    CHECK(email_store_save(store, path) == 0);
+    email_store_destroy(store);
+
+    email_store* mapped = email_store_open(path);
+    CHECK(mapped != NULL);
+    if (mapped != NULL) {
+        check_store_lookups(mapped, GENERATED);
+        email_store_snapshot(mapped, &st);
+        CHECK(st.addresses == 3 + GENERATED && st.domains == 2 + 97);
+        CHECK(email_store_add(mapped, "new@example.com", 15, &id) == EMAIL_STORE_FULL);
+        CHECK(email_store_add(mapped, "ann@example.com", 15, &id) == EMAIL_STORE_FULL);
+        email_store_destroy(mapped);
+    }
+
+    // An empty store round-trips too; other files are refused
+    store = email_store_create(1000);
+    CHECK(store != NULL && email_store_save(store, path) == 0);
+    email_store_destroy(store);
+    mapped = email_store_open(path);
+    CHECK(mapped != NULL && !email_store_find(mapped, "ann@example.com", 15, NULL));
+    email_store_destroy(mapped);
+
+    fd = open(path, O_WRONLY | O_TRUNC);
+    CHECK(fd >= 0 && write(fd, "EMSTORE\0 not a store", 20) == 20);
+    close(fd);
+    CHECK(email_store_open(path) == NULL && errno == EINVAL);
+    unlink(path);
+    CHECK(email_store_open(path) == NULL && errno == ENOENT);
+    email_store_destroy(NULL);
+}
+
+/* ---- Verdict cache ------------------------------------------------------- */
+
+// Puts user<i>@host<i % 31>.example for i in [from, to); odd i are stored as rejected
+static void fill_verdicts(email_verdict_cache* cache, size_t from, size_t to) {
+    for (size_t i = from; i < to; i++) {
+        char addr[64];
+        int n = snprintf(addr, sizeof(addr), "user%zu@host%zu.example", i, i % 31);
+        email_verdict v = { i % 2 ? EMAIL_BAD_LOCAL_CHAR : EMAIL_VALID, -1, 0 };
+        email_verdict_cache_put(cache, 0, addr, (size_t)n, &v);
+    }
+}
+
+static void test_verdict_cache(void) {
+    char path[] = "/tmp/email_validate_verdicts_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd < 0) {
+        return;
+    }
+    close(fd);
+
+    // An empty file is set up with the size asked for, rounded up
+    email_verdict_cache* cache = email_verdict_cache_open(path, 100);
+    CHECK(cache != NULL);
+    if (cache == NULL) {
+        unlink(path);
+        return;
+    }
+    email_verdict_cache_stats st;
+    email_verdict_cache_snapshot(cache, &st);
+    CHECK(st.slots == 128 && st.used == 0);
+
+    email_verdict v = { EMAIL_VALID, -1, 0 };
+    email_verdict got;
+    uint32_t now = (uint32_t)time(NULL);
+    CHECK(!email_verdict_cache_get(cache, 0, "Ann@Example.COM", 15, 0, &got));
+    email_verdict_cache_put(cache, 0, "Ann@Example.COM", 15, &v);
+    CHECK(email_verdict_cache_get(cache, 0, "Ann@example.com", 15, 0, &got));
+    CHECK(got.reason == EMAIL_VALID && got.dns == -1 && got.checked_at >= now);
+    // The local part is compared as is, and every mode has its own entries
+    CHECK(!email_verdict_cache_get(cache, 0, "ann@example.com", 15, 0, &got));
+    CHECK(!email_verdict_cache_get(cache, EMAIL_VERDICT_STRICT, "Ann@example.com", 15, 0, &got));
+    CHECK(!email_verdict_cache_get(cache, 0, NULL, 0, 0, &got));
+    // The domain starts at the last '@', after any in a quoted local part
+    email_verdict_cache_put(cache, EMAIL_VERDICT_RFC, "\"a@B\"@x.com", 11, &v);
+    CHECK(email_verdict_cache_get(cache, EMAIL_VERDICT_RFC, "\"a@B\"@X.COM", 11, 0, &got));
+    CHECK(!email_verdict_cache_get(cache, EMAIL_VERDICT_RFC, "\"a@b\"@x.com", 11, 0, &got));
+
+    // A put replaces the entry; max_age ignores entries checked too long ago
+    v = (email_verdict){ EMAIL_VALID, EMAIL_DNS_NXDOMAIN, now - 1000 };
+    email_verdict_cache_put(cache, 0, "ann@example.com", 15, &v);
+    v.dns = EMAIL_DNS_MX;
+    email_verdict_cache_put(cache, 0, "ann@example.com", 15, &v);
+    CHECK(!email_verdict_cache_get(cache, 0, "ann@example.com", 15, 500, &got));
+    CHECK(email_verdict_cache_get(cache, 0, "ann@example.com", 15, 2000, &got));
+    CHECK(got.dns == EMAIL_DNS_MX && got.checked_at == now - 1000);
+    email_verdict_cache_snapshot(cache, &st);
+    CHECK(st.used == 3 && st.stores == 4 && st.evictions == 0);
+
+    // Far more addresses than slots: full windows give up their oldest entry,
+    // here the ones above, and the last address put is always there
+    fill_verdicts(cache, 0, 1000);
+    email_verdict_cache_snapshot(cache, &st);
+    CHECK(st.used <= st.slots && st.evictions > 0);
+    CHECK(email_verdict_cache_get(cache, 0, "user999@host7.example", 21, 0, &got) &&
+          got.reason == EMAIL_BAD_LOCAL_CHAR);
+    CHECK(!email_verdict_cache_get(cache, 0, "ann@example.com", 15, 0, &got));
+    email_verdict_cache_close(cache);
+
+    // An existing cache keeps its size
+    cache = email_verdict_cache_open(path, 1 << 16);
+    email_verdict_cache_snapshot(cache, &st);
+    CHECK(cache != NULL && st.slots == 128 && st.used > 0);
+    email_verdict_cache_close(cache);
+
+    // Processes that open the same new file fill one table, which the next
+    // process finds complete
+    unlink(path);
+    enum { WORKERS = 3, PER_WORKER = 1000 };
+    pid_t pids[WORKERS];
+    for (int w = 0; w < WORKERS; w++) {
+        pids[w] = fork();
+        if (pids[w] == 0) {
+            email_verdict_cache* mine = email_verdict_cache_open(path, 16384);
+            if (mine == NULL) {
+                _exit(1);
+            }
+            // Half of each range overlaps the next worker's
+            fill_verdicts(mine, (size_t)w * PER_WORKER / 2, (size_t)w * PER_WORKER / 2 + PER_WORKER);
+            email_verdict_cache_close(mine);
+            _exit(0);
+        }
+        CHECK(pids[w] > 0);
+    }
+    for (int w = 0; w < WORKERS; w++) {
+        int status = 0;
+        CHECK(pids[w] > 0 && waitpid(pids[w], &status, 0) == pids[w] &&
+              WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    cache = email_verdict_cache_open(path, 0);
+    CHECK(cache != NULL);
+    size_t total = (WORKERS + 1) * PER_WORKER / 2;
+    for (size_t i = 0; i < total; i++) {
+        char addr[64];
+        int n = snprintf(addr, sizeof(addr), "user%zu@host%zu.example", i, i % 31);
+        CHECK(email_verdict_cache_get(cache, 0, addr, (size_t)n, 0, &got) &&
+              got.reason == (i % 2 ? EMAIL_BAD_LOCAL_CHAR : EMAIL_VALID));
+    }
+    email_verdict_cache_snapshot(cache, &st);
+    CHECK(st.slots == 16384 && st.used == total && st.hits == total && st.misses == 0);
+    email_verdict_cache_close(cache);
+
+    // A stream records the verdicts of its lines, and the next one reuses them
+    unlink(path);
+    char input[] = "/tmp/email_validate_verdict_input_XXXXXX";
+    fd = mkstemp(input);
+    CHECK(fd >= 0 && write(fd, "a@b.cd\nnot-an-address\na@b.cd\n", 29) == 29);
+    close(fd);
+    for (int run = 0; run < 2; run++) {
+        email_stream_options opts = { .verdicts = email_verdict_cache_open(path, 64) };
+        email_stream_stats stream;
+        CHECK(opts.verdicts != NULL);
+        CHECK(validate_email_file_ex(input, &opts, NULL, NULL, &stream) == 0);
+        CHECK(stream.valid == 2 && stream.invalid == 1);
+        email_verdict_cache_snapshot(opts.verdicts, &st);
+        CHECK(st.hits == (run == 0 ? 1 : 3) && st.used == 2);
+        CHECK(email_verdict_cache_get(opts.verdicts, 0, "not-an-address", 14, 0, &got) &&
+              got.reason == EMAIL_MISSING_AT);
+        email_verdict_cache_close(opts.verdicts);
+    }
+    unlink(input);
+
+    fd = open(path, O_WRONLY | O_TRUNC);
+    CHECK(fd >= 0 && write(fd, "EMVERDCT not a verdict cache", 28) == 28);
+    close(fd);
+    CHECK(email_verdict_cache_open(path, 0) == NULL && errno == EINVAL);
+    unlink(path);
+    email_verdict_cache_close(NULL);
+}
+
+/* ---- Bloom filter -------------------------------------------------------- */
+
+static void test_bloom(void) {
+    enum { MEMBERS = 20000, STRANGERS = 200000 };
+    email_bloom* bloom = email_bloom_create(MEMBERS, 16);
+    CHECK(bloom != NULL);
+    if (bloom == NULL) {
+        return;
+    }
+    char addr[64];
+    for (size_t i = 0; i < MEMBERS; i++) {
+        int n = snprintf(addr, sizeof(addr), "blocked%zu@spam%zu.example", i, i % 113);
+        CHECK(email_bloom_add(bloom, addr, (size_t)n));
+    }
+    CHECK(!email_bloom_add(bloom, NULL, 0));
+    CHECK(email_bloom_maybe_contains(bloom, "blocked7@SPAM7.example", 22));
+    CHECK(!email_bloom_maybe_contains(bloom, NULL, 0));
+
+    email_bloom_stats st;
+    email_bloom_snapshot(bloom, &st);
+    CHECK(st.blocks == (MEMBERS * 16 + 511) / 512 && st.addresses == MEMBERS);
+
+    // No false negatives, and close to the false positive rate of 16 bits each
+    size_t positives = 0;
+    for (size_t i = 0; i < STRANGERS; i++) {
+        int n = snprintf(addr, sizeof(addr), "someone%zu@mail%zu.example", i, i % 113);
+        positives += email_bloom_maybe_contains(bloom, addr, (size_t)n);
+    }
+    CHECK(positives < STRANGERS / 500);
+
+    // The stage after the batch validator only probes the valid addresses
+    const char* ptrs[] = { "blocked1@spam1.example", "not valid", "ok@fine.example",
+                           "blocked2@spam2.example", NULL };
+    size_t lens[5];
+    for (size_t i = 0; i < 5; i++) {
+        lens[i] = ptrs[i] != NULL ? strlen(ptrs[i]) : 0;
+    }
+    uint8_t valid[1];
+    uint8_t maybe[1];
+    CHECK(validate_emails_batch(ptrs, lens, 5, valid) == 3);
+    size_t hits = email_bloom_screen_batch(bloom, ptrs, lens, 5, valid, maybe);
+    CHECK(hits >= 2 && (maybe[0] & 0x09) == 0x09 && (maybe[0] & 0x12) == 0);
+    CHECK(email_bloom_screen_batch(bloom, ptrs, lens, 5, NULL, maybe) >= 2);
+
+    // The saved file maps back read-only with the same answers
+    char path[] = "/tmp/email_validate_bloom_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+    CHECK(email_bloom_save(bloom, path) == 0);
+    email_bloom_destroy(bloom);
+
+    email_bloom* mapped = email_bloom_open(path);
+    CHECK(mapped != NULL);
+    if (mapped != NULL) {
+        for (size_t i = 0; i < MEMBERS; i += 7) {
+            int n = snprintf(addr, sizeof(addr), "blocked%zu@spam%zu.example", i, i % 113);
+            CHECK(email_bloom_maybe_contains(mapped, addr, (size_t)n));
+        }
+        CHECK(!email_bloom_add(mapped, "new@example.com", 15));
+        email_bloom_snapshot(mapped, &st);
+        CHECK(st.addresses == MEMBERS && st.blocks == (MEMBERS * 16 + 511) / 512);
+        email_bloom_destroy(mapped);
+    }
+
+    fd = open(path, O_WRONLY | O_TRUNC);
+    CHECK(fd >= 0 && write(fd, "EMBLOOM\0 not a filter", 21) == 21);
+    close(fd);
+    CHECK(email_bloom_open(path) == NULL && errno == EINVAL);
+    unlink(path);
+    email_bloom_destroy(NULL);
+}
+
+/* ---- Classification ------------------------------------------------------ */
+
+static void test_classify(void) {
+    email_classifier* c = email_classifier_create();
+    CHECK(c != NULL);
+    if (c == NULL) {
+        return;
+    }
+    // Nothing is listed yet
+    CHECK(email_classify(c, "admin@mailinator.com", 20) == 0);
+
+    static const char domains[] =
+        "# disposable\n"
+        "mailinator.com\n"
+        "  Temp-Mail.ORG  \r\n"
+        "\n"
+        "deep.sub.example.net.\n"
+        "mailinator.com\n";
+    CHECK(email_classifier_load_list(c, EMAIL_CLASS_DISPOSABLE, domains, sizeof(domains) - 1) == 0);
+    CHECK(email_classifier_load_list(c, EMAIL_CLASS_ROLE, "admin\nNoReply\n", 14) == 0);
+    CHECK(email_classifier_add(c, EMAIL_CLASS_ROLE, "postmaster", 10) == 0);
+
+    email_classifier_stats st;
+    email_classifier_snapshot(c, &st);
+    CHECK(st.domains == 3 && st.roles == 3 && st.memory > 0);
+
+    // Listed domains and everything under them, in any case
+    CHECK(email_classify(c, "ann@mailinator.com", 18) == EMAIL_CLASS_DISPOSABLE);
+    CHECK(email_classify(c, "ann@x.y.MAILINATOR.com", 22) == EMAIL_CLASS_DISPOSABLE);
+    CHECK(email_classify(c, "ann@temp-mail.org", 17) == EMAIL_CLASS_DISPOSABLE);
+    CHECK(email_classify(c, "\"a@x.com\"@mailinator.com", 24) == EMAIL_CLASS_DISPOSABLE);
+    CHECK(email_classify(c, "ann@a.deep.sub.example.net", 26) == EMAIL_CLASS_DISPOSABLE);
+    // ... but not their parents, siblings or look-alikes
+    CHECK(email_classify(c, "ann@sub.example.net", 19) == 0);
+    CHECK(email_classify(c, "ann@notmailinator.com", 21) == 0);
+    CHECK(email_classify(c, "ann@mailinator.com.evil.org", 27) == 0);
+    CHECK(email_classify(c, "ann@com", 7) == 0);
+
+    // Roles match case-insensitively and up to a subaddress
+    CHECK(email_classify(c, "Admin@example.com", 17) == EMAIL_CLASS_ROLE);
+    CHECK(email_classify(c, "noreply+bounce@example.com", 26) == EMAIL_CLASS_ROLE);
+    CHECK(email_classify(c, "administrator@example.com", 25) == 0);
+    CHECK(email_classify(c, "postmaster@mailinator.com", 25) ==
+          (EMAIL_CLASS_ROLE | EMAIL_CLASS_DISPOSABLE));
+    CHECK(email_classify(c, "no-at-sign", 10) == 0);
+    CHECK(email_classify(c, NULL, 0) == 0);
+
+    unsigned flags = 99;
+    size_t offset;
+    CHECK(email_check_classified(c, "admin@x.mailinator.com", 22, &offset, &flags) == EMAIL_VALID);
+    CHECK(flags == (EMAIL_CLASS_ROLE | EMAIL_CLASS_DISPOSABLE));
+    CHECK(email_check_classified(c, "admin@@mailinator.com", 21, &offset, &flags) ==
+              EMAIL_MULTIPLE_AT && flags == 0);
+
+    // Listing a parent domain covers what was listed under it
+    CHECK(email_classifier_add(c, EMAIL_CLASS_DISPOSABLE, "example.net", 11) == 0);
+    CHECK(email_classify(c, "ann@sub.example.net", 19) == EMAIL_CLASS_DISPOSABLE);
+
+    CHECK(email_classifier_add(c, EMAIL_CLASS_DISPOSABLE, "bad domain.com", 14) != 0 && errno == EINVAL);
+    CHECK(email_classifier_add(c, EMAIL_CLASS_DISPOSABLE, "a..b", 4) != 0 && errno == EINVAL);
+    CHECK(email_classifier_add(c, EMAIL_CLASS_ROLE, "a@b", 3) != 0 && errno == EINVAL);
+    CHECK(email_classifier_add(c, 7, "admin", 5) != 0 && errno == EINVAL);
+
+    // The stage after the batch validator flags only valid addresses
+    const char* ptrs[] = { "admin@example.com", "admin@", "ann@mailinator.com", "ann@ok.org" };
+    size_t lens[4];
+    for (size_t i = 0; i < 4; i++) {
+        lens[i] = strlen(ptrs[i]);
+    }
+    uint8_t valid[1];
+    uint8_t out[4];
+    CHECK(validate_emails_batch(ptrs, lens, 4, valid) == 3);
+    CHECK(email_classify_batch(c, ptrs, lens, 4, valid, out) == 2);
+    CHECK(out[0] == EMAIL_CLASS_ROLE && out[1] == 0 && out[2] == EMAIL_CLASS_DISPOSABLE &&
+          out[3] == 0);
+
+    // Large lists grow every table
+    for (size_t i = 0; i < 20000; i++) {
+        char entry[64];
+        int n = snprintf(entry, sizeof(entry), "throwaway%zu.example", i);
+        CHECK(email_classifier_add(c, EMAIL_CLASS_DISPOSABLE, entry, (size_t)n) == 0);
+        n = snprintf(entry, sizeof(entry), "role%zu", i);
+        CHECK(email_classifier_add(c, EMAIL_CLASS_ROLE, entry, (size_t)n) == 0);
+    }
+    CHECK(email_classify(c, "role19999@throwaway7.example", 28) ==
+          (EMAIL_CLASS_ROLE | EMAIL_CLASS_DISPOSABLE));
+    CHECK(email_classify(c, "role20000@throwaway20000.example", 32) == 0);
+    CHECK(email_classifier_load_file(c, EMAIL_CLASS_ROLE, "/nonexistent/roles.txt") != 0);
+    email_classifier_destroy(c);
+    email_classifier_destroy(NULL);
+}
+
+/* ---- Streaming ----------------------------------------------------------- */
+
+typedef struct {
+    uint64_t calls;
+    char lines[8][64];
+    bool valid[8];
+    uint64_t stop_after;   // return 7 from this line on, 0 = never
+    uint64_t duplicates;
+    uint64_t first_lines[8];
+} stream_record;
+
+static int record_line(const char* line, size_t len, uint64_t line_no,
+                       bool valid, void* ctx) {
+    stream_record* r = ctx;
+    if (r->calls < 8 && len < 64) {
+        memcpy(r->lines[r->calls], line, len);
+        r->lines[r->calls][len] = '\0';
+        r->valid[r->calls] = valid;
+    }
+    r->calls++;
+    CHECK(line_no == r->calls);
+    return r->stop_after != 0 && line_no >= r->stop_after ? 7 : 0;
+}
+
+static int record_duplicate(const char* line, size_t len, uint64_t line_no,
+                            uint64_t first_line, bool valid, void* ctx) {
+    stream_record* r = ctx;
+    (void)line;
+    (void)len;
+    (void)valid;
+    CHECK(first_line < line_no);
+    if (r->duplicates < 8) {
+        r->first_lines[r->duplicates] = first_line;
+    }
+    r->duplicates++;
+    return 0;
+}
+
+static const char STREAM_INPUT[] =
+    "a@b.cd\n"
+    "bad\r\n"
+    "john.doe@example.com\r\n"
+    "\n"
+    "last@x.org";  // no final newline
+
+static void check_stream_result(const stream_record* r, const email_stream_stats* st) {
+    CHECK(r->calls == 5);
+    CHECK(strcmp(r->lines[0], "a@b.cd") == 0 && r->valid[0]);
+    CHECK(strcmp(r->lines[1], "bad") == 0 && !r->valid[1]);
+    CHECK(strcmp(r->lines[2], "john.doe@example.com") == 0 && r->valid[2]);
+    CHECK(strcmp(r->lines[3], "") == 0 && !r->valid[3]);
+    CHECK(strcmp(r->lines[4], "last@x.org") == 0 && r->valid[4]);
+    CHECK(st->lines == 5 && st->valid == 3 && st->invalid == 2);
+    CHECK(st->bytes == 6 + 3 + 20 + 0 + 10);
+}
+
+static void test_stream(void) {
+    char path[] = "/tmp/email_validate_test_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd < 0) {
+        return;
+    }
+    CHECK(write(fd, STREAM_INPUT, sizeof(STREAM_INPUT) - 1) == (ssize_t)(sizeof(STREAM_INPUT) - 1));
+    close(fd);
+
+    // Regular file: memory-mapped
+    stream_record r;
+    email_stream_stats st;
+    memset(&r, 0, sizeof(r));
+    CHECK(validate_email_file(path, record_line, &r, &st) == 0);
+    check_stream_result(&r, &st);
+
+    // A callback can stop the scan
+    memset(&r, 0, sizeof(r));
+    r.stop_after = 2;
+    CHECK(validate_email_file(path, record_line, &r, &st) == 7);
+    CHECK(r.calls == 2);
+    unlink(path);
+
+    // Pipe: read in blocks
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    CHECK(write(fds[1], STREAM_INPUT, sizeof(STREAM_INPUT) - 1) == (ssize_t)(sizeof(STREAM_INPUT) - 1));
+    close(fds[1]);
+    memset(&r, 0, sizeof(r));
+    CHECK(validate_email_stream_fd(fds[0], record_line, &r, &st) == 0);
+    close(fds[0]);
+    check_stream_result(&r, &st);
+
+    // Strict mode rejects the unknown TLD of the last line
+    static const char strict_input[] = "a@b.com\nc@d.zz\n";
+    CHECK(pipe(fds) == 0);
+    CHECK(write(fds[1], strict_input, sizeof(strict_input) - 1) == (ssize_t)(sizeof(strict_input) - 1));
+    close(fds[1]);
+    email_stream_options strict = { .strict = true };
+    memset(&r, 0, sizeof(r));
+    CHECK(validate_email_stream_fd_ex(fds[0], &strict, record_line, &r, &st) == 0);
+    close(fds[0]);
+    CHECK(st.lines == 2 && st.valid == 1 && r.valid[0] && !r.valid[1]);
+
+    // The same with cached domain verdicts: the TLD lookup still happens
+    static const char cached_input[] = "a@b.com\nc@d.zz\ne@b.com\nf@d.zz\n";
+    CHECK(pipe(fds) == 0);
+    CHECK(write(fds[1], cached_input, sizeof(cached_input) - 1) == (ssize_t)(sizeof(cached_input) - 1));
+    close(fds[1]);
+    strict.domain_cache = true;
+    memset(&r, 0, sizeof(r));
+    CHECK(validate_email_stream_fd_ex(fds[0], &strict, record_line, &r, &st) == 0);
+    close(fds[0]);
+    CHECK(st.lines == 4 && st.valid == 2 && r.valid[0] && !r.valid[1] && r.valid[2] && !r.valid[3]);
+
+    // UTF-8 mode takes internationalized addresses, and ignores the cache
+    static const char utf8_input[] = "josé@bücher.de\nbad\xc3@x.de\na@b.com\n";
+    CHECK(pipe(fds) == 0);
+    CHECK(write(fds[1], utf8_input, sizeof(utf8_input) - 1) == (ssize_t)(sizeof(utf8_input) - 1));
+    close(fds[1]);
+    email_stream_options utf8 = { .utf8 = true, .domain_cache = true };
+    memset(&r, 0, sizeof(r));
+    CHECK(validate_email_stream_fd_ex(fds[0], &utf8, record_line, &r, &st) == 0);
+    close(fds[0]);
+    CHECK(st.lines == 3 && st.valid == 2 && r.valid[0] && !r.valid[1] && r.valid[2]);
+
+    // RFC mode wins over strict
+    static const char rfc_input[] = "\"a b\"@[192.0.2.1]\na@b.zzzz\na@b-.com\n";
+    CHECK(pipe(fds) == 0);
+    CHECK(write(fds[1], rfc_input, sizeof(rfc_input) - 1) == (ssize_t)(sizeof(rfc_input) - 1));
+    close(fds[1]);
+    email_stream_options rfc = { .rfc = true, .strict = true, .domain_cache = true };
+    memset(&r, 0, sizeof(r));
+    CHECK(validate_email_stream_fd_ex(fds[0], &rfc, record_line, &r, &st) == 0);
+    close(fds[0]);
+    CHECK(st.lines == 3 && st.valid == 2 && r.valid[0] && r.valid[1] && !r.valid[2]);
+
+    // Duplicate lines go to on_duplicate with the line they repeat
+    static const char dup_input[] = "a@b.com\nA@B.COM\nbad\na@B.com\r\nbad\n";
+    CHECK(pipe(fds) == 0);
+    CHECK(write(fds[1], dup_input, sizeof(dup_input) - 1) == (ssize_t)(sizeof(dup_input) - 1));
+    close(fds[1]);
+    email_dedup* set = email_dedup_create(0, 0);
+    CHECK(set != NULL);
+    email_stream_options dedup = { .dedup = set, .on_duplicate = record_duplicate };
+    memset(&r, 0, sizeof(r));
+    CHECK(validate_email_stream_fd_ex(fds[0], &dedup, record_line, &r, &st) == 0);
+    close(fds[0]);
+    CHECK(st.lines == 5 && st.unique == 3 && st.duplicates == 2);
+    CHECK(st.valid == 3 && st.invalid == 2);
+    CHECK(r.calls == 3 && strcmp(r.lines[1], "A@B.COM") == 0);
+    CHECK(r.duplicates == 2 && r.first_lines[0] == 1 && r.first_lines[1] == 3);
+    email_dedup_destroy(set);
+
+    // In RFC mode the domain starts at the last '@': a quoted local part
+    // keeps its case even when it holds an '@' of its own
+    static const char quoted_input[] = "\"a@B\"@x.com\n\"a@b\"@x.com\n\"a@b\"@X.COM\n";
+    CHECK(pipe(fds) == 0);
+    CHECK(write(fds[1], quoted_input, sizeof(quoted_input) - 1) == (ssize_t)(sizeof(quoted_input) - 1));
+    close(fds[1]);
+    set = email_dedup_create(0, 0);
+    CHECK(set != NULL);
+    dedup.dedup = set;
+    dedup.rfc = true;
+    memset(&r, 0, sizeof(r));
+    CHECK(validate_email_stream_fd_ex(fds[0], &dedup, record_line, &r, &st) == 0);
+    close(fds[0]);
+    CHECK(st.lines == 3 && st.valid == 3 && st.unique == 2 && st.duplicates == 1);
+    CHECK(r.duplicates == 1 && r.first_lines[0] == 2);
+    email_dedup_destroy(set);
+
+    // A pipe with lines of megabytes: only the head of each is buffered,
+    // and each one is still a single invalid line
+    CHECK(pipe(fds) == 0);
+    pid_t writer = fork();
+    CHECK(writer >= 0);
+    if (writer == 0) {
+        close(fds[0]);
+        static char filler[1 << 16];
+        memset(filler, 'x', sizeof(filler));
+        bool ok = true;
+        for (int i = 0; i < 48; i++) {        // 3 MiB, then a line end
+            ok &= write(fds[1], filler, sizeof(filler)) == (ssize_t)sizeof(filler);
+        }
+        ok &= write(fds[1], "\r\na@b.com\n", 11) == 11;
+        for (int i = 0; i < 32; i++) {        // 2 MiB with no line end
+            ok &= write(fds[1], filler, sizeof(filler)) == (ssize_t)sizeof(filler);
+        }
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    memset(&r, 0, sizeof(r));
+    CHECK(validate_email_stream_fd(fds[0], record_line, &r, &st) == 0);
+    close(fds[0]);
+    int status;
+    CHECK(waitpid(writer, &status, 0) == writer && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(r.calls == 3 && !r.valid[0] && r.valid[1] && !r.valid[2]);
+    CHECK(strcmp(r.lines[1], "a@b.com") == 0);
+    CHECK(st.lines == 3 && st.valid == 1 && st.bytes == 2 * (MAX_EMAIL_LENGTH + 2) + 7);
+
+    CHECK(validate_email_file("/nonexistent/email_validate_test", NULL, NULL, NULL) == -1);
+}
+
+/* ---- Pipeline ------------------------------------------------------------- */
+
+typedef struct {
+    uint64_t next_line;     // the first_line the next batch should have
+    uint64_t lines;
+    uint64_t valid;
+    uint64_t mismatches;    // lines whose valid bit or flag is wrong
+    uint64_t long_lines;
+    uint64_t stop_at;       // return 9 from the batch holding this line, 0 = never
+} pipe_record;
+
+static int pipe_enrich(email_pipe_batch* batch, void* ctx) {
+    (void)ctx;
+    for (size_t i = 0; i < batch->count; i++) {
+        CHECK(batch->flags[i] == 0);
+        batch->flags[i] = (uint8_t)(batch->first_line + i);
+    }
+    return 0;
+}
+
+static int pipe_write(email_pipe_batch* batch, void* ctx) {
+    pipe_record* r = ctx;
+    CHECK(batch->first_line == r->next_line);
+    for (size_t i = 0; i < batch->count; i++) {
+        bool valid = (batch->valid[i / 8] >> (i % 8)) & 1;
+        if (valid != is_valid_email_n(batch->lines[i], batch->lens[i]) ||
+            batch->flags[i] != (uint8_t)(batch->first_line + i) ||
+            memchr(batch->lines[i], '\r', batch->lens[i]) != NULL) {
+            r->mismatches++;
+        }
+        r->long_lines += batch->lens[i] > MAX_EMAIL_LENGTH;
+        CHECK(batch->lens[i] <= MAX_EMAIL_LENGTH + 2);
+        r->valid += valid;
+    }
+    r->next_line += batch->count;
+    r->lines += batch->count;
+    if (r->stop_at != 0 && r->next_line > r->stop_at) {
+        return 9;
+    }
+    return 0;
+}
+
+static void test_pipeline(void) {
+    char path[] = "/tmp/email_validate_test_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd < 0) {
+        return;
+    }
+    // 3000 lines in small blocks: CRLF endings, blank lines, lines far
+    // longer than a block (reaching the callbacks cut short), and no
+    // newline at the end
+    char line[5000];
+    for (int i = 1; i <= 3000; i++) {
+        int len;
+        if (i == 1234 || i == 3000) {
+            memset(line, 'a', 4000);
+            len = 4000;
+        } else if (i % 97 == 0) {
+            len = 0;
+        } else {
+            len = snprintf(line, sizeof(line), i % 3 == 0 ? "user%d@@example.com" : "user%d@example.com", i);
+        }
+        const char* end = i == 3000 ? "" : i % 5 == 0 ? "\r\n" : "\n";
+        CHECK(write(fd, line, (size_t)len) == len);
+        CHECK(write(fd, end, strlen(end)) == (ssize_t)strlen(end));
+    }
+
+    for (unsigned validators = 1; validators <= 3; validators += 2) {
+        CHECK(lseek(fd, 0, SEEK_SET) == 0);
+        pipe_record r = { .next_line = 1 };
+        email_pipeline_options opts = {
+            .validators = validators, .batch_size = 7, .block_size = 1024, .blocks = 2,
+            .queue_depth = 2, .domain_cache = true,
+            .enrich = pipe_enrich, .write = pipe_write, .write_ctx = &r,
+        };
+        email_pipeline* p = email_pipeline_start(fd, &opts);
+        CHECK(p != NULL);
+        if (p == NULL) {
+            continue;
+        }
+        email_pipeline_stats st;
+        CHECK(email_pipeline_wait(p, &st) == 0);
+        CHECK(r.lines == 3000 && r.mismatches == 0 && r.long_lines == 2);
+        CHECK(st.valid == r.valid && st.invalid == 3000 - r.valid);
+        CHECK(st.valid == 3000 - 1000 - 30 + 10 - 1);   // @@, blank and long lines fail
+        CHECK(st.stage[EMAIL_PIPE_VALIDATE].threads == validators);
+        CHECK(st.stage[EMAIL_PIPE_VALIDATE].lines == 3000);
+        CHECK(st.stage[EMAIL_PIPE_SPLIT].batches == st.stage[EMAIL_PIPE_WRITE].batches);
+        CHECK(st.stage[EMAIL_PIPE_READ].bytes == (uint64_t)lseek(fd, 0, SEEK_END));
+        CHECK(st.stage[EMAIL_PIPE_READ].batches > 1);
+        for (int stage = 0; stage < EMAIL_PIPE_STAGE_COUNT; stage++) {
+            CHECK(st.stage[stage].queue_depth == 0);
+            CHECK(st.stage[stage].queue_peak <= st.stage[stage].queue_capacity);
+        }
+        CHECK(st.stage[EMAIL_PIPE_WRITE].queue_capacity == 2);
+        CHECK(st.stage[EMAIL_PIPE_ENRICH].queue_capacity == 2 * validators);
+    }
+
+    // A callback stops the pipeline with its own value
+    CHECK(lseek(fd, 0, SEEK_SET) == 0);
+    pipe_record r = { .next_line = 1, .stop_at = 100 };
+    email_pipeline_options opts = { .batch_size = 16, .block_size = 512, .write = pipe_write,
+                                    .write_ctx = &r };
+    email_pipeline* p = email_pipeline_start(fd, &opts);
+    CHECK(p != NULL && email_pipeline_wait(p, NULL) == 9);
+    CHECK(r.lines >= 100 && r.lines < 3000);
+    close(fd);
+    unlink(path);
+
+    // A read error comes back as -1 with the read's errno
+    p = email_pipeline_start(-1, NULL);
+    CHECK(p != NULL);
+    errno = 0;
+    CHECK(p != NULL && email_pipeline_wait(p, NULL) == -1 && errno == EBADF);
+
+    CHECK(strcmp(email_pipeline_stage_name(EMAIL_PIPE_VALIDATE), "validate") == 0);
+    opts = (email_pipeline_options){ .validators = 1000 };
+    CHECK(email_pipeline_start(0, &opts) == NULL && errno == EINVAL);
+}
+
+/* ---- Arrow columns --------------------------------------------------------- */
+
+static bool arrow_bit(const struct ArrowArray* column, int64_t i) {
+    const uint8_t* bits = column->buffers[1];
+    return (bits[i >> 3] >> (i & 7)) & 1;
+}
+
+static bool arrow_null(const struct ArrowArray* column, int64_t i) {
+    const uint8_t* validity = column->buffers[0];
+    return validity != NULL && !((validity[i >> 3] >> (i & 7)) & 1);
+}
+
+static void noop_release(struct ArrowArray* array) {
+    array->release = NULL;
+}
+
+static void noop_release_schema(struct ArrowSchema* schema) {
+    schema->release = NULL;
+}
+
+// The rows of the test column, row 0 sliced off and row 4 null
+static const char ARROW_DATA[] = "skipped" "a@b.com" "bad" "user@foo.zz" "NULL" "x@y.c" "first.last@example.org";
+static const int32_t ARROW_OFFSETS[] = { 0, 7, 14, 17, 28, 32, 37, 59 };
+static const uint8_t ARROW_VALIDITY[] = { 0xEF };   // row 4 null
+
+static void test_arrow(void) {
+    const void* buffers[3] = { ARROW_VALIDITY, ARROW_OFFSETS, ARROW_DATA };
+    struct ArrowArray column = { .length = 6, .null_count = 1, .offset = 1, .n_buffers = 3,
+                                 .buffers = buffers, .release = noop_release };
+    struct ArrowSchema schema = { .format = "u", .release = noop_release_schema };
+
+    struct ArrowArray out;
+    struct ArrowSchema out_schema;
+    CHECK(email_arrow_validate(&schema, &column, &(email_arrow_options){.reasons = true},
+                               &out, &out_schema) == 0);
+    CHECK(out.length == 6 && out.n_children == 2);
+    CHECK(strcmp(out_schema.format, "+s") == 0 && out_schema.n_children == 2);
+    CHECK(strcmp(out_schema.children[0]->name, "valid") == 0);
+    CHECK(strcmp(out_schema.children[0]->format, "b") == 0);
+    CHECK(strcmp(out_schema.children[1]->name, "reason") == 0);
+    CHECK(strcmp(out_schema.children[1]->format, "c") == 0);
+
+    const struct ArrowArray* valid = out.children[0];
+    const struct ArrowArray* reason = out.children[1];
+    const int8_t* reasons = reason->buffers[1];
+    CHECK(valid->length == 6 && valid->null_count == 1 && reason->null_count == 1);
+    CHECK(arrow_bit(valid, 0) && !arrow_bit(valid, 1) && arrow_bit(valid, 2));
+    CHECK(!arrow_bit(valid, 3) && !arrow_bit(valid, 4) && arrow_bit(valid, 5));
+    CHECK(!arrow_null(valid, 0) && arrow_null(valid, 3) && arrow_null(reason, 3));
+    CHECK(reasons[0] == EMAIL_VALID && reasons[1] == EMAIL_TOO_SHORT && reasons[2] == EMAIL_VALID);
+    CHECK(reasons[4] == EMAIL_TLD_TOO_SHORT && reasons[5] == EMAIL_VALID);
+    CHECK(((uintptr_t)valid->buffers[1] % 64) == 0);
+    out.release(&out);
+    out_schema.release(&out_schema);
+    CHECK(out.release == NULL && out_schema.release == NULL);
+
+    // Large offsets, strict mode, no schema wanted
+    static const int64_t large_offsets[] = { 0, 7, 14, 17, 28, 32, 37, 59 };
+    const void* large_buffers[3] = { NULL, large_offsets, ARROW_DATA };
+    struct ArrowArray large = { .length = 7, .n_buffers = 3, .buffers = large_buffers,
+                                .release = noop_release };
+    CHECK(email_arrow_validate(&(struct ArrowSchema){.format = "U"}, &large,
+                               &(email_arrow_options){.strict = true}, &out, NULL) == 0);
+    CHECK(out.n_children == 1 && out.children[0]->null_count == 0);
+    CHECK(out.children[0]->buffers[0] == NULL);
+    CHECK(!arrow_bit(out.children[0], 0) && arrow_bit(out.children[0], 1));
+    CHECK(!arrow_bit(out.children[0], 3) && arrow_bit(out.children[0], 6));   // .zz, .org
+    out.release(&out);
+
+    // A record batch: the column is picked by index
+    struct ArrowArray id_column = { .length = 7, .n_buffers = 2,
+                                    .buffers = (const void*[]){ NULL, ARROW_OFFSETS },
+                                    .release = noop_release };
+    struct ArrowArray* children[2] = { &id_column, &column };
+    struct ArrowSchema id_schema = { .format = "i" };
+    struct ArrowSchema* child_schemas[2] = { &id_schema, &schema };
+    column.offset = 0;
+    column.length = 7;
+    column.null_count = 0;
+    struct ArrowArray batch = { .length = 2, .offset = 1, .n_buffers = 1,
+                                .buffers = (const void*[]){ NULL }, .n_children = 2,
+                                .children = children, .release = noop_release };
+    struct ArrowSchema batch_schema = { .format = "+s", .n_children = 2, .children = child_schemas };
+    CHECK(email_arrow_validate(&batch_schema, &batch, &(email_arrow_options){.column = 1},
+                               &out, NULL) == 0);
+    CHECK(out.length == 2 && arrow_bit(out.children[0], 0) && !arrow_bit(out.children[0], 1));
+    out.release(&out);
+
+    CHECK(email_arrow_validate(&batch_schema, &batch, &(email_arrow_options){.column = 0},
+                               &out, NULL) == ENOTSUP);
+    CHECK(email_arrow_validate(&batch_schema, &batch, &(email_arrow_options){.column = 2},
+                               &out, NULL) == EINVAL);
+}
+
+// A stream of three record batches over the test column
+typedef struct {
+    struct ArrowSchema schema;
+    struct ArrowSchema* schema_children[1];
+    struct ArrowSchema column_schema;
+    struct ArrowArray column;
+    struct ArrowArray* children[1];
+    const void* buffers[1];
+    const void* column_buffers[3];
+    int next;
+    int released;
+} arrow_source;
+
+static int source_schema(struct ArrowArrayStream* stream, struct ArrowSchema* out) {
+    arrow_source* src = stream->private_data;
+    *out = src->schema;
+    out->release = noop_release_schema;
+    return 0;
+}
+
+static int source_next(struct ArrowArrayStream* stream, struct ArrowArray* out) {
+    arrow_source* src = stream->private_data;
+    if (src->next == 3) {
+        out->release = NULL;
+        return 0;
+    }
+    // Batch k is rows 1 + 2k and 2 + 2k of the column
+    *out = (struct ArrowArray){ .length = 2, .offset = 1 + 2 * src->next, .n_buffers = 1,
+                                .buffers = src->buffers, .n_children = 1,
+                                .children = src->children, .release = noop_release };
+    src->next++;
+    return 0;
+}
+
+static void source_release(struct ArrowArrayStream* stream) {
+    arrow_source* src = stream->private_data;
+    src->released++;
+    stream->release = NULL;
+}
+
+static void test_arrow_stream(void) {
+    static arrow_source src;
+    src.column_schema = (struct ArrowSchema){ .format = "u" };
+    src.schema_children[0] = &src.column_schema;
+    src.schema = (struct ArrowSchema){ .format = "+s", .n_children = 1, .children = src.schema_children };
+    src.column_buffers[0] = ARROW_VALIDITY;
+    src.column_buffers[1] = ARROW_OFFSETS;
+    src.column_buffers[2] = ARROW_DATA;
+    src.column = (struct ArrowArray){ .length = 7, .null_count = 1, .n_buffers = 3,
+                                      .buffers = src.column_buffers, .release = noop_release };
+    src.children[0] = &src.column;
+
+    struct ArrowArrayStream in = { .get_schema = source_schema, .get_next = source_next,
+                                   .release = source_release, .private_data = &src };
+    struct ArrowArrayStream out;
+    CHECK(email_arrow_validate_stream(&in, &(email_arrow_options){.reasons = true}, &out) == 0);
+    CHECK(in.release == NULL);
+
+    struct ArrowSchema schema;
+    CHECK(out.get_schema(&out, &schema) == 0 && schema.n_children == 2);
+    schema.release(&schema);
+
+    static const bool expect_valid[] = { true, false, true, false, false, true };
+    static const bool expect_null[] = { false, false, false, true, false, false };
+    int rows = 0;
+    struct ArrowArray batch;
+    while (out.get_next(&out, &batch) == 0 && batch.release != NULL) {
+        for (int64_t i = 0; i < batch.length; i++, rows++) {
+            CHECK(arrow_bit(batch.children[0], i) == expect_valid[rows]);
+            CHECK(arrow_null(batch.children[0], i) == expect_null[rows]);
+        }
+        batch.release(&batch);
+    }
+    CHECK(rows == 6 && out.get_last_error(&out) == NULL);
+    out.release(&out);
+    CHECK(src.released == 1);
+}
+
+/*
+ * Sends parts to the server one write each, closes the sending side and
+ * collects every reply until the server closes the connection
+ */
+static size_t server_exchange(const struct sockaddr* addr, socklen_t addr_len,
+                              const char* const* parts, size_t count, char* out, size_t cap) {
+    int fd = socket(addr->sa_family, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, addr, addr_len) != 0) {
+        CHECK(!"cannot connect to the server");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+    for (size_t i = 0; i < count; i++) {
+        size_t len = strlen(parts[i]);
+        CHECK(write(fd, parts[i], len) == (ssize_t)len);
+    }
+    shutdown(fd, SHUT_WR);
+
+    size_t used = 0;
+    ssize_t n;
+    while (used + 1 < cap && (n = read(fd, out + used, cap - 1 - used)) > 0) {
+        used += (size_t)n;
+    }
+    out[used] = '\0';
+    close(fd);
+    return used;
+}
+
+static void test_server(void) {
+    email_server* server = email_server_start(&(email_server_options){
+        .listen = "127.0.0.1:0", .reactors = 2, .domain_cache = true});
+    CHECK(server != NULL);
+    if (server == NULL) {
+        return;
+    }
+    CHECK(email_server_port(server) != 0);
+
+    struct sockaddr_in in;
+    memset(&in, 0, sizeof(in));
+    in.sin_family = AF_INET;
+    in.sin_port = htons((uint16_t)email_server_port(server));
+    in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // Pipelined, split mid-line, CRLF, a line longer than any buffer and
+    // a last line without a newline
+    static char huge[100000];
+    memset(huge, 'a', sizeof(huge) - 2);
+    huge[sizeof(huge) - 2] = '\n';
+    const char* parts[] = {"a@b.com\nbad\r\nx@y.c\nuser@exa", "mple.org\n", huge, "ok@ok.io"};
+    char reply[256];
+    server_exchange((struct sockaddr*)&in, sizeof(in), parts, COUNT_OF(parts), reply, sizeof(reply));
+    CHECK(strcmp(reply, "OK\nERR TOO_SHORT 3\nERR TLD_TOO_SHORT 4\nOK\nERR TOO_LONG 256\nOK\n") == 0);
+
+    // Many connections at once are spread over the reactors
+    for (int k = 0; k < 8; k++) {
+        const char* one[] = {"first.last@example.com\n"};
+        server_exchange((struct sockaddr*)&in, sizeof(in), one, 1, reply, sizeof(reply));
+        CHECK(strcmp(reply, "OK\n") == 0);
+    }
+
+    email_server_stats stats;
+    email_server_snapshot(server, &stats);
+    CHECK(stats.reactors == 2);
+    CHECK(stats.connections == 9);
+    CHECK(stats.requests == 14 && stats.valid == 11 && stats.invalid == 3);
+
+    // A Prometheus scrape
+    static char page[65536];
+    const char* scrape[] = {"GET /metrics HTTP/1.0\r\nHost: localhost\r\n\r\n"};
+    server_exchange((struct sockaddr*)&in, sizeof(in), scrape, 1, page, sizeof(page));
+    CHECK(strncmp(page, "HTTP/1.0 200 OK\r\n", 17) == 0);
+    const char* body = strstr(page, "\r\n\r\n");
+    CHECK(body != NULL && strstr(page, "Content-Type: text/plain; version=0.0.4\r\n") != NULL);
+    if (body != NULL) {
+        char length[64];
+        snprintf(length, sizeof(length), "Content-Length: %zu\r\n", strlen(body + 4));
+        CHECK(strstr(page, length) != NULL);
+    }
+    CHECK(strstr(page, "email_server_requests_total{verdict=\"valid\"} 11\n") != NULL);
+    CHECK(strstr(page, "email_server_connections_total 10\n") != NULL);
+    email_metrics m;
+    CHECK((strstr(page, "email_validation_latency_seconds_count{path=\"server\"}") != NULL) ==
+          email_metrics_snapshot(&m));
+    email_server_stop(server);
+
+    // RFC mode: a line too long to buffer has the offset of the RFC limit
+    server = email_server_start(&(email_server_options){.listen = "127.0.0.1:0", .rfc = true});
+    CHECK(server != NULL);
+    if (server == NULL) {
+        return;
+    }
+    in.sin_port = htons((uint16_t)email_server_port(server));
+    const char* rfc_parts[] = {huge, "\"a b\"@[192.0.2.1]\n"};
+    server_exchange((struct sockaddr*)&in, sizeof(in), rfc_parts, COUNT_OF(rfc_parts), reply,
+                    sizeof(reply));
+    CHECK(strcmp(reply, "ERR TOO_LONG 254\nOK\n") == 0);
+    email_server_stop(server);
+
+    // Unix socket, strict mode
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/email_validate_test_%d.sock", (int)getpid());
+    char listen[80];
+    snprintf(listen, sizeof(listen), "unix:%s", path);
+    server = email_server_start(&(email_server_options){.listen = listen, .strict = true});
+    CHECK(server != NULL);
+    if (server == NULL) {
+        return;
+    }
+    CHECK(email_server_port(server) == 0);
+
+    struct sockaddr_un un;
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    strcpy(un.sun_path, path);
+    const char* strict_parts[] = {"user@example.com\nuser@example.zz\n"};
+    server_exchange((struct sockaddr*)&un, sizeof(un), strict_parts, 1, reply, sizeof(reply));
+    size_t offset;
+    CHECK(email_check_strict("user@example.zz", 15, &offset) == EMAIL_UNKNOWN_TLD);
+    char expect[64];
+    snprintf(expect, sizeof(expect), "OK\nERR UNKNOWN_TLD %zu\n", offset);
+    CHECK(strcmp(reply, expect) == 0);
+    email_server_stop(server);
+    CHECK(access(path, F_OK) != 0);
+
+    CHECK(email_server_start(&(email_server_options){.listen = "no-port"}) == NULL && errno == EINVAL);
+}
+
+/* ---- Batch mode ------------------------------------------------------------ */
+
+#ifdef EMAIL_VALIDATE_CLI
+
+// Runs "email-validate --batch" with mode ("--rfc", or NULL) on input fed
+// through a pipe, the first pause bytes of it before the rest after a
+// short wait (0: all at once); returns what it printed, NUL-terminated, to
+// be freed by the caller
+static char* cli_batch(const char* mode, const char* input, size_t len, size_t pause) {
+    int in[2], out[2];
+    if (pipe(in) != 0) {
+        return NULL;
+    }
+    if (pipe(out) != 0) {
+        close(in[0]);
+        close(in[1]);
+        return NULL;
+    }
+
+    pid_t cli = fork();
+    if (cli == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        execl(EMAIL_VALIDATE_CLI, EMAIL_VALIDATE_CLI, "--batch", "--quiet", mode, (char*)NULL);
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+
+    pid_t writer = fork();
+    if (writer == 0) {
+        close(out[0]);
+        bool ok = true;
+        for (size_t done = 0; ok && done < len;) {
+            if (done == pause) {
+                nanosleep(&(struct timespec){ .tv_nsec = 50 * 1000 * 1000 }, NULL);
+            }
+            size_t end = done < pause ? pause : len;
+            ssize_t n = write(in[1], input + done, end - done);
+            ok = n > 0;
+            done += ok ? (size_t)n : 0;
+        }
+        _exit(ok ? 0 : 1);
+    }
+    close(in[1]);
+
+    size_t used = 0, cap = 1 << 16;
+    char* answers = malloc(cap + 1);
+    for (;;) {
+        if (answers != NULL && cap - used < 4096) {
+            char* grown = realloc(answers, 2 * cap + 1);
+            if (grown == NULL) {
+                free(answers);
+            }
+            answers = grown;
+            cap *= 2;
+        }
+        ssize_t n = answers != NULL ? read(out[0], answers + used, cap - used) : 0;
+        if (n <= 0) {
+            break;
+        }
+        used += (size_t)n;
+    }
+    close(out[0]);
+
+    int status;
+    CHECK(cli > 0 && waitpid(cli, &status, 0) == cli && WIFEXITED(status) &&
+          WEXITSTATUS(status) == 0);
+    CHECK(writer > 0 && waitpid(writer, &status, 0) == writer && WIFEXITED(status) &&
+          WEXITSTATUS(status) == 0);
+    if (answers != NULL) {
+        answers[used] = '\0';
+    }
+    return answers;
+}
+
+// Checks that the output is count repeats of answer, followed by rest
+static bool batch_answers(const char* output, const char* answer, size_t count,
+                          const char* rest) {
+    size_t n = strlen(answer);
+    for (size_t i = 0; i < count; i++, output += n) {
+        if (strncmp(output, answer, n) != 0) {
+            return false;
+        }
+    }
+    return strcmp(output, rest) == 0;
+}
+
+static void test_batch_mode(void) {
+    // CRLF endings, a reason with its offset, and a last line with no '\n'
+    static const char short_input[] = "a@b.co\r\nbad\na@b.co";
+    char* output = cli_batch(NULL, short_input, sizeof(short_input) - 1, 0);
+    CHECK(output != NULL && strcmp(output, "OK\nERR TOO_SHORT 3\nOK\n") == 0);
+    free(output);
+
+    // Seven-byte lines straddle the end of the 64 KiB input ring every
+    // time around it
+    size_t lines = 40000;
+    char* input = malloc(lines * 7 + 300000);
+    CHECK(input != NULL);
+    if (input == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < lines; i++) {
+        memcpy(input + i * 7, "a@b.co\n", 7);
+    }
+    output = cli_batch(NULL, input, lines * 7, 0);
+    CHECK(output != NULL && batch_answers(output, "OK\n", lines, ""));
+    free(output);
+
+    // A whole line far too long arriving in one read, wrapped around the
+    // end of the ring: 65336 bytes of short lines go first
+    size_t len = 9332 * 7;
+    memcpy(input + len, "abcd@efg.co\n", 12);
+    len += 12;
+    size_t pause = len;
+    memset(input + len, 'x', 1200);
+    len += 1200;
+    memcpy(input + len, "\na@b.co\n", 8);
+    len += 8;
+    output = cli_batch(NULL, input, len, pause);
+    CHECK(output != NULL && batch_answers(output, "OK\n", 9333, "ERR TOO_LONG 256\nOK\n"));
+    free(output);
+
+    // Lines longer than the ring are dropped as they arrive and answered
+    // once, when they end or at the end of the input
+    len = 0;
+    memset(input, 'x', 200000);
+    len += 200000;
+    memcpy(input + len, "\r\na@b.co\n", 9);
+    len += 9;
+    memset(input + len, 'x', 80000);
+    len += 80000;
+    output = cli_batch(NULL, input, len, 0);
+    CHECK(output != NULL && strcmp(output, "ERR TOO_LONG 256\nOK\nERR TOO_LONG 256\n") == 0);
+    free(output);
+
+    // The same with no line end, split across reads: what arrives after
+    // the head was dropped is still part of the over-long line
+    memset(input, 'a', 300);
+    memcpy(input + 300, "b@example.com", 13);
+    output = cli_batch(NULL, input, 313, 300);
+    CHECK(output != NULL && strcmp(output, "ERR TOO_LONG 256\n") == 0);
+    free(output);
+
+    // In RFC mode every line too long has the offset of the RFC limit,
+    // whether it was kept, dropped whole or dropped as it arrived
+    memset(input, 'a', 100000);
+    memcpy(input + 255, "\n", 1);
+    memcpy(input + 556, "\n", 1);
+    output = cli_batch("--rfc", input, 100000, 0);
+    CHECK(output != NULL && batch_answers(output, "ERR TOO_LONG 254\n", 3, ""));
+    free(output);
+    free(input);
+}
+
+#endif
+
+int main(void) {
+    test_rules();
+    test_length_limits();
+    test_not_terminated();
+    test_reject_profile();
+    test_metrics();
+    test_engines_agree();
+    test_tld_lookup();
+    test_tld_reload();
+    test_batch();
+    test_parallel();
+    test_domain_cache();
+    test_normalize();
+    test_utf8();
+    test_rfc();
+    test_dedup();
+    test_store();
+    test_verdict_cache();
+    test_bloom();
+    test_classify();
+    test_stream();
+    test_pipeline();
+    test_arrow();
+    test_arrow_stream();
+    test_server();
+#ifdef EMAIL_VALIDATE_CLI
+    test_batch_mode();
+#endif
+
+    if (failures != 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
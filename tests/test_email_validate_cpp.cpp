@@ -0,0 +1,159 @@
+/*
+ * Tests for the C++ policy validators (email_validate.hpp)
+ *
+ * Same conventions as test_email_validate.c: failed CHECK()s are printed
+ * and make the program exit non-zero.
+ */
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "email_validate.hpp"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n",          \
+                         __FILE__, __LINE__, #cond);                    \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+// Short addresses for internal mail, with a 3+ character TLD and no '_'
+struct strict_policy : email::default_policy {
+    static constexpr std::size_t max_length = 64;
+    static constexpr std::size_t min_tld_length = 3;
+    static constexpr bool allow_underscore = false;
+};
+
+// The TLD rule reduced to "has a '.'"
+struct any_tld_policy : email::default_policy {
+    static constexpr std::size_t min_tld_length = 1;
+};
+
+static void test_policies() {
+    CHECK(email::validate("john.doe@example.com"));
+    CHECK(email::validate("first_last+tag@sub-domain.example.co.uk"));
+    CHECK(!email::validate("john@example.c"));
+    CHECK(!email::validate(std::string_view()));
+
+    CHECK(!email::validate<email::no_plus_policy>("first+tag@example.com"));
+    CHECK(email::validate<email::no_plus_policy>("first_last@example.com"));
+    CHECK(!email::validate<email::no_plus_policy>("first@exa+mple.com"));
+
+    CHECK(email::validate<strict_policy>("ops@example.org"));
+    CHECK(!email::validate<strict_policy>("ops@example.io"));
+    CHECK(!email::validate<strict_policy>("first_last@example.org"));
+    CHECK(email::validate<strict_policy>("first+tag@example.org"));
+    CHECK(!email::validate<strict_policy>(std::string(60, 'a') + "@example.org"));
+    CHECK(email::validate<strict_policy>(std::string(52, 'a') + "@example.org"));
+
+    CHECK(email::validate<any_tld_policy>("a@b.c"));
+    CHECK(!email::validate<any_tld_policy>("a@b.c."));
+    CHECK(!email::validate<any_tld_policy>("a@bcde"));
+}
+
+/* ---- Compile-time validation ----------------------------------------------- */
+
+static_assert(email::valid("noreply@example.com"));
+static_assert(email::valid("first_last+tag@sub-domain.example.co.uk"));
+static_assert(!email::valid("noreply@example"));
+static_assert(!email::valid(".noreply@example.com"));
+static_assert(!email::valid("no reply@example.com"));
+static_assert(!email::validate<email::no_plus_policy>("noreply+bounce@example.com"));
+
+// A constant table whose verdicts are computed by the compiler
+struct sender {
+    const char* address;
+    bool valid;
+};
+
+constexpr sender make_sender(const char* address) {
+    return { address, email::valid(address) };
+}
+
+constexpr std::array<sender, 3> SENDERS = {{
+    make_sender("noreply@example.com"),
+    make_sender("billing@example.org"),
+    make_sender("alerts@localhost"),
+}};
+static_assert(SENDERS[0].valid && SENDERS[1].valid && !SENDERS[2].valid);
+
+static void test_constexpr_matches_runtime() {
+    for (const sender& s : SENDERS) {
+        CHECK(s.valid == is_valid_email(s.address));
+    }
+    // The same function evaluated at run time
+    std::string_view runtime_input = "noreply@example.com";
+    CHECK(email::valid(runtime_input));
+}
+
+/* ---- The default policy against the C validator --------------------------- */
+
+static std::uint64_t rng = 0x13198A2E03707344ull;
+
+static std::uint64_t next_random() {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static std::string random_address() {
+    static const char interesting[] = "@.-_+ \t\x80\xff\"!aZ9";
+    std::size_t len = next_random() % 24;
+    if (next_random() % 64 == 0) {
+        len = MAX_EMAIL_LENGTH - 8 + next_random() % 16;
+    }
+    std::string s(len, 'a');
+    for (std::size_t i = 0; i < len; i++) {
+        std::uint64_t r = next_random();
+        s[i] = r % 4 == 0 ? interesting[(r >> 8) % (sizeof(interesting) - 1)]
+                          : "abcxyz0189"[(r >> 8) % 10];
+    }
+    if (len > 6 && next_random() % 2) {
+        s[len / 3] = '@';
+        s[len - 3] = '.';
+    }
+    return s;
+}
+
+static void test_matches_c_validator() {
+    std::size_t valid = 0;
+
+    for (int i = 0; i < 300000 && failures < 20; i++) {
+        std::string s = random_address();
+        bool expect = is_valid_email_n(s.data(), s.size());
+        valid += expect;
+
+        if (email::validate(s) != expect || email::valid(s) != expect) {
+            std::fprintf(stderr, "default policy disagrees on '%s'\n", s.c_str());
+            failures++;
+        }
+        // Without '+' exactly the addresses containing one are lost
+        bool no_plus = expect && s.find('+') == std::string::npos;
+        if (email::validate<email::no_plus_policy>(s) != no_plus) {
+            std::fprintf(stderr, "no_plus policy wrong on '%s'\n", s.c_str());
+            failures++;
+        }
+    }
+    CHECK(valid > 1000);
+}
+
+int main() {
+    test_policies();
+    test_constexpr_matches_runtime();
+    test_matches_c_validator();
+
+    if (failures != 0) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("all tests passed\n");
+    return 0;
+}